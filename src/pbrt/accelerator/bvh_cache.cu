@@ -0,0 +1,245 @@
+#include <pbrt/accelerator/bvh_cache.h>
+#include <pbrt/gpu/gpu_memory_allocator.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/thread_pool.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+struct CacheFileHeader {
+    char magic[8];
+    uint64_t key;
+    uint32_t num_primitives;
+    uint32_t num_morton_primitives;
+    uint32_t num_build_nodes;
+    uint32_t morton_primitive_size;
+    uint32_t build_node_size;
+    // sizes differ between float and double builds
+};
+
+constexpr char CACHE_FILE_MAGIC[8] = {'H', 'L', 'B', 'V', 'H', 0, 0, 2};
+
+bool is_valid_tree(const HLBVH::MortonPrimitive *morton_primitives, uint num_morton_primitives,
+                   uint num_primitives, const HLBVH::BVHBuildNode *build_nodes,
+                   uint num_build_nodes) {
+    // every index traversal follows stays in range, and no node is reached twice (no cycle)
+    for (uint idx = 0; idx < num_morton_primitives; ++idx) {
+        if (morton_primitives[idx].primitive_idx >= num_primitives) {
+            return false;
+        }
+    }
+
+    std::vector<bool> visited(num_build_nodes, false);
+    std::vector<uint> nodes_to_visit = {0};
+    while (!nodes_to_visit.empty()) {
+        const uint node_idx = nodes_to_visit.back();
+        nodes_to_visit.pop_back();
+
+        if (visited[node_idx]) {
+            return false;
+        }
+        visited[node_idx] = true;
+
+        const auto &node = build_nodes[node_idx];
+        if (node.is_leaf()) {
+            if (node.first_primitive_idx > num_morton_primitives ||
+                node.num_primitives > num_morton_primitives - node.first_primitive_idx) {
+                return false;
+            }
+            continue;
+        }
+
+        if (node.axis >= 3 || node.left_child_idx == 0 ||
+            node.left_child_idx >= num_build_nodes - 1) {
+            return false;
+        }
+
+        nodes_to_visit.push_back(node.left_child_idx);
+        nodes_to_visit.push_back(node.left_child_idx + 1);
+    }
+
+    return true;
+}
+} // namespace
+
+static Bounds3f get_octant(const Bounds3f &bounds, const uint octant) {
+    const auto center = bounds.centroid();
+    return Bounds3f(Point3f(octant & 1 ? center.x : bounds.p_min.x,
+                            octant & 2 ? center.y : bounds.p_min.y,
+                            octant & 4 ? center.z : bounds.p_min.z),
+                    Point3f(octant & 1 ? bounds.p_max.x : center.x,
+                            octant & 2 ? bounds.p_max.y : center.y,
+                            octant & 4 ? bounds.p_max.z : center.z));
+}
+
+uint64_t BVHCache::hash_geometry(const std::vector<const Primitive *> &gpu_primitives,
+                                 const HLBVH::BuildOptions &options) {
+    // spatial splits clip primitives: 2 triangles with the same bounds (such as a flipped
+    // diagonal) clip differently, so the bounds of each one clipped to every octant of its own
+    // bounds are hashed as well
+    const uint num_clipped_bounds =
+        options.bottom_split_method == HLBVH::BuildOptions::SplitMethod::sbvh ? 8 : 0;
+    const uint stride = 1 + num_clipped_bounds;
+
+    std::vector<Bounds3f> primitive_bounds(gpu_primitives.size() * stride);
+
+    ThreadPool thread_pool;
+    thread_pool.parallel_for(0, gpu_primitives.size(), [&](const uint start, const uint end) {
+        for (uint idx = start; idx < end; ++idx) {
+            const auto bounds = gpu_primitives[idx]->bounds();
+            primitive_bounds[idx * stride] = bounds;
+
+            for (uint octant = 0; octant < num_clipped_bounds; ++octant) {
+                primitive_bounds[idx * stride + 1 + octant] =
+                    gpu_primitives[idx]->clip_bounds(get_octant(bounds, octant));
+            }
+        }
+    });
+
+    // options deciding the layout of build nodes, wide nodes are rebuilt after loading
+    const uint64_t options_hash =
+        pbrt::hash(options.bottom_split_method, options.max_primitives_in_leaf,
+                   options.traversal_cost, options.restructure_passes,
+                   options.max_duplicated_references);
+
+    return HIDDEN::MurmurHash64A((const unsigned char *)primitive_bounds.data(),
+                                 sizeof(Bounds3f) * primitive_bounds.size(), options_hash);
+}
+
+std::string BVHCache::get_file_path(uint64_t key) const {
+    char filename[32];
+    snprintf(filename, sizeof(filename), "hlbvh-%016llx.bin", (unsigned long long)key);
+
+    return (std::filesystem::path(directory) / filename).string();
+}
+
+std::optional<BVHCache::Entry> BVHCache::load(uint64_t key, uint num_primitives,
+                                              GPUMemoryAllocator &allocator) {
+    if (force_rebuild) {
+        num_misses += 1;
+        return {};
+    }
+
+    const auto file_path = get_file_path(key);
+    const int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        num_misses += 1;
+        return {};
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < sizeof(CacheFileHeader)) {
+        close(fd);
+        num_misses += 1;
+        return {};
+    }
+
+    const size_t file_size = file_stat.st_size;
+    const auto mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        num_misses += 1;
+        return {};
+    }
+
+    const auto header = static_cast<const CacheFileHeader *>(mapped);
+    const size_t morton_primitives_size =
+        sizeof(HLBVH::MortonPrimitive) * header->num_morton_primitives;
+    const size_t build_nodes_size = sizeof(HLBVH::BVHBuildNode) * header->num_build_nodes;
+
+    const bool valid =
+        std::memcmp(header->magic, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC)) == 0 &&
+        header->key == key && header->num_primitives == num_primitives &&
+        header->num_morton_primitives >= num_primitives && header->num_build_nodes > 0 &&
+        header->morton_primitive_size == sizeof(HLBVH::MortonPrimitive) &&
+        header->build_node_size == sizeof(HLBVH::BVHBuildNode) &&
+        file_size == sizeof(CacheFileHeader) + morton_primitives_size + build_nodes_size;
+
+    if (!valid) {
+        printf("BVH cache: ignore stale or corrupted `%s`\n", file_path.c_str());
+        munmap(mapped, file_size);
+        num_misses += 1;
+        return {};
+    }
+
+    // the mapping is host memory: copy it into buffers the device can read
+    const auto payload = static_cast<const uint8_t *>(mapped) + sizeof(CacheFileHeader);
+
+    Entry entry;
+    entry.num_morton_primitives = header->num_morton_primitives;
+    entry.morton_primitives =
+        allocator.allocate<HLBVH::MortonPrimitive>(entry.num_morton_primitives);
+    entry.num_build_nodes = header->num_build_nodes;
+    entry.build_nodes = allocator.allocate<HLBVH::BVHBuildNode>(entry.num_build_nodes);
+
+    CHECK_CUDA_ERROR(cudaMemcpy(entry.morton_primitives, payload, morton_primitives_size,
+                                cudaMemcpyHostToDevice));
+    CHECK_CUDA_ERROR(cudaMemcpy(entry.build_nodes, payload + morton_primitives_size,
+                                build_nodes_size, cudaMemcpyHostToDevice));
+
+    munmap(mapped, file_size);
+
+    if (!is_valid_tree(entry.morton_primitives, entry.num_morton_primitives, num_primitives,
+                       entry.build_nodes, entry.num_build_nodes)) {
+        // the sizes matched but the content didn't: don't hand traversal a broken tree
+        printf("BVH cache: ignore corrupted `%s`\n", file_path.c_str());
+        num_misses += 1;
+        return {};
+    }
+
+    num_hits += 1;
+
+    return entry;
+}
+
+void BVHCache::save(uint64_t key, uint num_primitives,
+                    const HLBVH::MortonPrimitive *morton_primitives, uint num_morton_primitives,
+                    const HLBVH::BVHBuildNode *build_nodes, uint num_build_nodes) const {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    CacheFileHeader header;
+    std::memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+    header.key = key;
+    header.num_primitives = num_primitives;
+    header.num_morton_primitives = num_morton_primitives;
+    header.num_build_nodes = num_build_nodes;
+    header.morton_primitive_size = sizeof(HLBVH::MortonPrimitive);
+    header.build_node_size = sizeof(HLBVH::BVHBuildNode);
+
+    // write then rename so a concurrent run never maps a half-written file
+    const auto file_path = get_file_path(key);
+    const auto temporary_path = file_path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary_path, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(morton_primitives),
+                   sizeof(HLBVH::MortonPrimitive) * num_morton_primitives);
+        file.write(reinterpret_cast<const char *>(build_nodes),
+                   sizeof(HLBVH::BVHBuildNode) * num_build_nodes);
+
+        if (!file) {
+            printf("BVH cache: failed to write `%s`\n", temporary_path.c_str());
+            std::filesystem::remove(temporary_path, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temporary_path, file_path, error);
+    if (error) {
+        printf("BVH cache: failed to write `%s`\n", file_path.c_str());
+        std::filesystem::remove(temporary_path, error);
+        return;
+    }
+
+    printf("BVH cache: saved `%s`\n", file_path.c_str());
+}
+
+void BVHCache::report() const {
+    printf("BVH cache: %u hit, %u miss%s (%s)\n", num_hits, num_misses,
+           force_rebuild ? ", rebuild forced" : "", directory.c_str());
+}
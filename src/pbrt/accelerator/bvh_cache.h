@@ -0,0 +1,45 @@
+#pragma once
+
+#include <pbrt/accelerator/hlbvh.h>
+#include <optional>
+#include <string>
+
+class GPUMemoryAllocator;
+
+class BVHCache {
+  public:
+    struct Entry {
+        HLBVH::MortonPrimitive *morton_primitives;
+        uint num_morton_primitives;
+        // more than the primitives when spatial splits duplicated references
+
+        HLBVH::BVHBuildNode *build_nodes;
+        uint num_build_nodes;
+    };
+
+    BVHCache(const std::string &_directory, bool _force_rebuild)
+        : directory(_directory), force_rebuild(_force_rebuild) {}
+
+    static uint64_t hash_geometry(const std::vector<const Primitive *> &gpu_primitives,
+                                  const HLBVH::BuildOptions &options);
+    // the BVH depends on nothing but primitive bounds (in order) and the build options,
+    // and with spatial splits on how primitives clip
+
+    std::optional<Entry> load(uint64_t key, uint num_primitives, GPUMemoryAllocator &allocator);
+    // allocates morton primitives and build nodes on a hit
+
+    void save(uint64_t key, uint num_primitives, const HLBVH::MortonPrimitive *morton_primitives,
+              uint num_morton_primitives, const HLBVH::BVHBuildNode *build_nodes,
+              uint num_build_nodes) const;
+
+    void report() const;
+
+  private:
+    std::string get_file_path(uint64_t key) const;
+
+    std::string directory;
+    bool force_rebuild;
+
+    uint num_hits = 0;
+    uint num_misses = 0;
+};
@@ -1,14 +1,19 @@
-#include <chrono>
+#include <pbrt/accelerator/bvh_cache.h>
 #include <pbrt/accelerator/hlbvh.h>
+#include <pbrt/accelerator/sbvh_builder.h>
+#include <pbrt/accelerator/triangle_blocks.h>
+#include <pbrt/accelerator/wide_bvh.h>
 #include <pbrt/gpu/gpu_memory_allocator.h>
+#include <pbrt/util/phase_timer.h>
 #include <pbrt/util/stack.h>
 #include <pbrt/util/thread_pool.h>
+#include <numeric>
 
-constexpr uint TREELET_MORTON_BITS_PER_DIMENSION = 10;
-constexpr uint BIT_LENGTH_OF_TREELET_MASK = 21;
-constexpr uint MASK_OFFSET_BIT = TREELET_MORTON_BITS_PER_DIMENSION * 3 - BIT_LENGTH_OF_TREELET_MASK;
+constexpr uint MAX_TREELET_BITS_PER_DIMENSION = 14;
+// only the filled treelets are kept: the grid may be much larger than the primitive count
 
-constexpr uint MAX_TREELET_NUM = 1 << BIT_LENGTH_OF_TREELET_MASK;
+constexpr uint TRAVERSAL_STACK_SIZE = 128;
+// stack traversal pushes 2 children and pops 1 per level: enough for 127 levels
 /*
  total treelets:        ->    splits for each dimension:
  2 ^ 12 = 4096                2 ^ 4  = 16
@@ -20,134 +25,523 @@ constexpr uint MAX_TREELET_NUM = 1 << BIT_LENGTH_OF_TREELET_MASK;
  2 ^ 30 = 1073741824          2 ^ 10 = 1024
 */
 
-constexpr uint32_t TREELET_MASK = (MAX_TREELET_NUM - 1) << MASK_OFFSET_BIT;
+struct TreeletGrid {
+    uint morton_bits_per_dimension;
+    // 10 (30-bit morton codes) or 21 (63-bit morton codes)
 
-constexpr uint MAX_PRIMITIVES_NUM_IN_LEAF = 1;
+    uint treelet_bits_per_dimension;
+    // treelets are the cells of a 2^n * 2^n * 2^n grid over the centroids
 
-[[maybe_unused]] static void _validate_treelet_num() {
-    static_assert(BIT_LENGTH_OF_TREELET_MASK > 0 && BIT_LENGTH_OF_TREELET_MASK < 32);
-    static_assert(BIT_LENGTH_OF_TREELET_MASK % 3 == 0);
-}
+    PBRT_CPU_GPU
+    uint64_t num_treelets() const {
+        return uint64_t(1) << (3 * treelet_bits_per_dimension);
+    }
+
+    PBRT_CPU_GPU
+    uint64_t treelet_idx(const uint64_t morton_code) const {
+        // treelet index is the leading bits of the morton code
+        return morton_code >> (3 * (morton_bits_per_dimension - treelet_bits_per_dimension));
+    }
+};
+
+static TreeletGrid choose_treelet_grid(const uint num_primitives) {
+    // primitives mostly lie on surfaces, which cross about (2^n)^2 cells of the grid:
+    // a grid of sqrt(N) / 2 cells per side leaves a few primitives in each filled treelet
+    uint log2_num_primitives = 0;
+    while ((uint64_t(1) << (log2_num_primitives + 1)) <= num_primitives) {
+        log2_num_primitives += 1;
+    }
+
+    const uint treelet_bits_per_dimension =
+        clamp<int>(int(log2_num_primitives + 1) / 2 - 1, 1, MAX_TREELET_BITS_PER_DIMENSION);
 
-constexpr int MORTON_SCALE = 1 << TREELET_MORTON_BITS_PER_DIMENSION;
+    return TreeletGrid{
+        .morton_bits_per_dimension = treelet_bits_per_dimension <= 10 ? 10u : 21u,
+        .treelet_bits_per_dimension = treelet_bits_per_dimension,
+    };
+}
 
 constexpr uint NUM_BUCKETS = 24;
 
+constexpr uint NUM_BOTTOM_BUCKETS = 12;
+// bottom levels are split per thread on device: fewer buckets to keep them in registers
+
+constexpr uint MAX_TREELET_LEAVES = 7;
+// restructured treelets: all 2^7 subsets of their leaves are searched for the best topology
+
 PBRT_CPU_GPU
-uint morton_code_to_treelet_idx(const uint morton_code) {
-    const auto masked_morton_code = morton_code & TREELET_MASK;
+static bool should_expand(const HLBVH::BVHBuildNode &node, const HLBVH::BuildOptions &options) {
+    if (!node.is_leaf()) {
+        return false;
+    }
 
-    return masked_morton_code >>
-           (3 * TREELET_MORTON_BITS_PER_DIMENSION - BIT_LENGTH_OF_TREELET_MASK);
+    // with SAH a small leaf is only kept when splitting it doesn't pay off
+    const uint max_primitives_to_keep =
+        options.bottom_split_method != HLBVH::BuildOptions::SplitMethod::middle
+            ? 1
+            : options.max_primitives_in_leaf;
+
+    return node.num_primitives > max_primitives_to_keep;
 }
 
-template <typename T>
-__global__ void init_array(T *array, const T val, const uint length) {
-    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
-    if (worker_idx >= length) {
+PBRT_CPU_GPU
+static void init_morton_primitive(HLBVH::MortonPrimitive *morton_primitives,
+                                  const Primitive **primitives, const uint idx) {
+    morton_primitives[idx].primitive_idx = idx;
+
+    const auto _bounds = primitives[idx]->bounds();
+
+    morton_primitives[idx].bounds = _bounds;
+    morton_primitives[idx].centroid = _bounds.centroid();
+}
+
+PBRT_CPU_GPU
+static void compute_morton_code(HLBVH::MortonPrimitive *morton_primitives,
+                                const Bounds3f &bounds_of_centroids, const TreeletGrid &grid,
+                                const uint idx) {
+    // compute morton code for each primitive
+    auto centroid_offset = bounds_of_centroids.offset(morton_primitives[idx].centroid);
+
+    auto scaled_offset = centroid_offset * FloatType(1 << grid.morton_bits_per_dimension);
+    if (grid.morton_bits_per_dimension == 10) {
+        morton_primitives[idx].morton_code = encode_morton3(
+            uint32_t(scaled_offset.x), uint32_t(scaled_offset.y), uint32_t(scaled_offset.z));
         return;
     }
 
-    array[worker_idx] = val;
+    morton_primitives[idx].morton_code = encode_morton3(
+        uint64_t(scaled_offset.x), uint64_t(scaled_offset.y), uint64_t(scaled_offset.z));
 }
 
-__global__ void sort_morton_primitives(HLBVH::MortonPrimitive *out,
-                                       const HLBVH::MortonPrimitive *in, uint *counter,
-                                       const uint *offset, const uint num_primitives) {
-    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
-    if (worker_idx >= num_primitives) {
+PBRT_CPU_GPU
+static void refit_morton_primitive(HLBVH::MortonPrimitive *morton_primitives,
+                                   const Primitive **primitives, const uint idx) {
+    const auto _bounds = primitives[morton_primitives[idx].primitive_idx]->bounds();
+
+    morton_primitives[idx].bounds = _bounds;
+    morton_primitives[idx].centroid = _bounds.centroid();
+}
+
+PBRT_CPU_GPU
+static void refit_build_node(HLBVH::BVHBuildNode *build_nodes,
+                             const HLBVH::MortonPrimitive *morton_primitives, const uint idx) {
+    auto &node = build_nodes[idx];
+
+    if (!node.is_leaf()) {
+        node.bounds = build_nodes[node.left_child_idx].bounds +
+                      build_nodes[node.left_child_idx + 1].bounds;
+        return;
+    }
+
+    Bounds3f bounds;
+    for (uint morton_idx = node.first_primitive_idx;
+         morton_idx < node.first_primitive_idx + node.num_primitives; ++morton_idx) {
+        bounds += morton_primitives[morton_idx].bounds;
+    }
+    node.bounds = bounds;
+}
+
+static void report_treelets(const HLBVH::Treelet *treelets, const uint num_treelets,
+                            const TreeletGrid &grid) {
+    uint max_primitive_num_in_a_treelet = 0;
+    for (uint idx = 0; idx < num_treelets; ++idx) {
+        max_primitive_num_in_a_treelet =
+            std::max(max_primitive_num_in_a_treelet, treelets[idx].n_primitives);
+    }
+
+    printf("HLBVH: %u/%llu (%.2f%) treelets filled (max primitives in a treelet: %u, "
+           "%u-bit morton codes)\n",
+           num_treelets, (unsigned long long)grid.num_treelets(),
+           double(num_treelets) / grid.num_treelets() * 100, max_primitive_num_in_a_treelet,
+           grid.morton_bits_per_dimension * 3);
+}
+
+static Bounds3f cube_bounds_of_centroids(const Bounds3f &bounds_of_primitives_centroids) {
+    auto max_dim = bounds_of_primitives_centroids.max_dimension();
+    auto radius = (bounds_of_primitives_centroids.p_max[max_dim] -
+                   bounds_of_primitives_centroids.p_min[max_dim]) /
+                  2;
+    auto adjusted_p_min = bounds_of_primitives_centroids.p_min;
+    auto adjusted_p_max = bounds_of_primitives_centroids.p_max;
+    for (uint dim = 0; dim < 3; ++dim) {
+        if (dim == max_dim) {
+            continue;
+        }
+        auto center = bounds_of_primitives_centroids.centroid()[dim];
+        adjusted_p_min[dim] = center - radius;
+        adjusted_p_max[dim] = center + radius;
+    }
+
+    // after adjusting bounds, all treelets grids are of the same size
+    return Bounds3f(adjusted_p_min, adjusted_p_max);
+}
+
+constexpr uint RADIX_BITS = 8;
+constexpr uint RADIX_SIZE = 1 << RADIX_BITS;
+
+constexpr uint DEVICE_TILE_SIZE = 256;
+// elements handled by one thread in device sorting and scanning
+
+PBRT_CPU_GPU
+static uint radix_digit(const HLBVH::MortonPrimitive &morton_primitive, const uint shift) {
+    return (morton_primitive.morton_code >> shift) & (RADIX_SIZE - 1);
+}
+
+PBRT_CPU_GPU
+static void count_radix_digits(uint *digit_offsets, const HLBVH::MortonPrimitive *morton_primitives,
+                               const uint num_primitives, const uint tile_size,
+                               const uint num_tiles, const uint shift, const uint tile_idx) {
+    // digit_offsets is digit-major: [digit * num_tiles + tile_idx]
+    // so that its exclusive scan is where each tile writes each digit
+    for (uint digit = 0; digit < RADIX_SIZE; ++digit) {
+        digit_offsets[digit * num_tiles + tile_idx] = 0;
+    }
+
+    const uint end = std::min(tile_size * (tile_idx + 1), num_primitives);
+    for (uint idx = tile_size * tile_idx; idx < end; ++idx) {
+        digit_offsets[radix_digit(morton_primitives[idx], shift) * num_tiles + tile_idx] += 1;
+    }
+}
+
+PBRT_CPU_GPU
+static void scatter_radix_digits(HLBVH::MortonPrimitive *out, const HLBVH::MortonPrimitive *in,
+                                 uint *digit_offsets, const uint num_primitives,
+                                 const uint tile_size, const uint num_tiles, const uint shift,
+                                 const uint tile_idx) {
+    // a tile writes its primitives in order: every pass is stable
+    const uint end = std::min(tile_size * (tile_idx + 1), num_primitives);
+    for (uint idx = tile_size * tile_idx; idx < end; ++idx) {
+        const uint digit = radix_digit(in[idx], shift);
+        out[digit_offsets[digit * num_tiles + tile_idx]++] = in[idx];
+    }
+}
+
+PBRT_CPU_GPU
+static uint sum_tile(const uint *values, const uint length, const uint tile_size,
+                     const uint tile_idx) {
+    uint sum = 0;
+    const uint end = std::min(tile_size * (tile_idx + 1), length);
+    for (uint idx = tile_size * tile_idx; idx < end; ++idx) {
+        sum += values[idx];
+    }
+
+    return sum;
+}
+
+PBRT_CPU_GPU
+static void exclusive_scan_tile(uint *values, const uint length, const uint tile_size,
+                                const uint tile_idx, uint offset) {
+    const uint end = std::min(tile_size * (tile_idx + 1), length);
+    for (uint idx = tile_size * tile_idx; idx < end; ++idx) {
+        const uint value = values[idx];
+        values[idx] = offset;
+        offset += value;
+    }
+}
+
+PBRT_CPU_GPU
+static bool starts_treelet(const HLBVH::MortonPrimitive *morton_primitives,
+                           const TreeletGrid &grid, const uint idx) {
+    // after sorting, primitives of the same treelet are contiguous:
+    // a treelet starts wherever the treelet index changes
+    return idx == 0 || grid.treelet_idx(morton_primitives[idx].morton_code) !=
+                           grid.treelet_idx(morton_primitives[idx - 1].morton_code);
+}
+
+PBRT_CPU_GPU
+static void scatter_treelet_start(HLBVH::Treelet *treelets, const uint *treelet_offsets,
+                                  const HLBVH::MortonPrimitive *morton_primitives,
+                                  const TreeletGrid &grid, const uint idx) {
+    if (!starts_treelet(morton_primitives, grid, idx)) {
         return;
     }
 
-    const auto primitive = &in[worker_idx];
-    const uint treelet_idx = morton_code_to_treelet_idx(primitive->morton_code);
+    treelets[treelet_offsets[idx]].first_primitive_offset = idx;
+}
+
+PBRT_CPU_GPU
+static void finish_treelet(HLBVH::Treelet *treelets, const uint num_treelets,
+                           const HLBVH::MortonPrimitive *morton_primitives,
+                           const uint num_primitives, const uint idx) {
+    auto &treelet = treelets[idx];
+
+    const uint end =
+        idx + 1 < num_treelets ? treelets[idx + 1].first_primitive_offset : num_primitives;
+    treelet.n_primitives = end - treelet.first_primitive_offset;
+
+    Bounds3f bounds;
+    for (uint morton_idx = treelet.first_primitive_offset; morton_idx < end; ++morton_idx) {
+        bounds += morton_primitives[morton_idx].bounds;
+    }
+    treelet.bounds = bounds;
+}
+
+__global__ void count_radix_digits_for_tiles(uint *digit_offsets,
+                                             const HLBVH::MortonPrimitive *morton_primitives,
+                                             const uint num_primitives, const uint num_tiles,
+                                             const uint shift) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= num_tiles) {
+        return;
+    }
 
-    const uint sorted_idx = atomicAdd(&counter[treelet_idx], 1) + offset[treelet_idx];
-    out[sorted_idx] = *primitive;
+    count_radix_digits(digit_offsets, morton_primitives, num_primitives, DEVICE_TILE_SIZE,
+                       num_tiles, shift, worker_idx);
 }
 
-__global__ void count_primitives_for_treelets(uint *counter,
-                                              const HLBVH::MortonPrimitive *morton_primitives,
-                                              const uint num_primitives) {
+__global__ void scatter_radix_digits_for_tiles(HLBVH::MortonPrimitive *out,
+                                               const HLBVH::MortonPrimitive *in,
+                                               uint *digit_offsets, const uint num_primitives,
+                                               const uint num_tiles, const uint shift) {
     const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
-    if (worker_idx >= num_primitives) {
+    if (worker_idx >= num_tiles) {
         return;
     }
 
-    const uint morton_code = morton_primitives[worker_idx].morton_code;
-    const uint treelet_idx = morton_code_to_treelet_idx(morton_code);
-    atomicAdd(&counter[treelet_idx], 1);
+    scatter_radix_digits(out, in, digit_offsets, num_primitives, DEVICE_TILE_SIZE, num_tiles,
+                         shift, worker_idx);
 }
 
-__global__ void compute_treelet_bounds(HLBVH::Treelet *treelets,
-                                       const HLBVH::MortonPrimitive *morton_primitives) {
+__global__ void sum_tiles(uint *tile_sums, const uint *values, const uint length,
+                          const uint num_tiles) {
     const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
-    if (worker_idx >= MAX_TREELET_NUM) {
+    if (worker_idx >= num_tiles) {
         return;
     }
 
-    const uint start = treelets[worker_idx].first_primitive_offset;
-    const uint end =
-        treelets[worker_idx].first_primitive_offset + treelets[worker_idx].n_primitives;
+    tile_sums[worker_idx] = sum_tile(values, length, DEVICE_TILE_SIZE, worker_idx);
+}
 
-    Bounds3f bounds;
-    for (uint primitive_idx = start; primitive_idx < end; ++primitive_idx) {
-        bounds += morton_primitives[primitive_idx].bounds;
+__global__ void exclusive_scan_tiles(uint *values, const uint *tile_offsets, const uint length,
+                                     const uint num_tiles) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= num_tiles) {
+        return;
     }
 
-    treelets[worker_idx].bounds = bounds;
+    exclusive_scan_tile(values, length, DEVICE_TILE_SIZE, worker_idx,
+                        tile_offsets == nullptr ? 0 : tile_offsets[worker_idx]);
 }
 
-__global__ void hlbvh_init_morton_primitives(HLBVH::MortonPrimitive *morton_primitives,
-                                             const Primitive **primitives, uint num_primitives) {
+__global__ void flag_treelet_starts(uint *treelet_offsets,
+                                    const HLBVH::MortonPrimitive *morton_primitives,
+                                    const uint num_primitives, const TreeletGrid grid) {
     const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
     if (worker_idx >= num_primitives) {
         return;
     }
 
-    morton_primitives[worker_idx].primitive_idx = worker_idx;
+    treelet_offsets[worker_idx] = starts_treelet(morton_primitives, grid, worker_idx);
+}
 
-    const auto _bounds = primitives[worker_idx]->bounds();
+__global__ void scatter_treelet_starts(HLBVH::Treelet *treelets, const uint *treelet_offsets,
+                                       const HLBVH::MortonPrimitive *morton_primitives,
+                                       const uint num_primitives, const TreeletGrid grid) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= num_primitives) {
+        return;
+    }
 
-    morton_primitives[worker_idx].bounds = _bounds;
-    morton_primitives[worker_idx].centroid = _bounds.centroid();
+    scatter_treelet_start(treelets, treelet_offsets, morton_primitives, grid, worker_idx);
 }
 
-__global__ void hlbvh_init_treelets(HLBVH::Treelet *treelets) {
+__global__ void finish_treelets(HLBVH::Treelet *treelets, const uint num_treelets,
+                                const HLBVH::MortonPrimitive *morton_primitives,
+                                const uint num_primitives) {
     const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= num_treelets) {
+        return;
+    }
+
+    finish_treelet(treelets, num_treelets, morton_primitives, num_primitives, worker_idx);
+}
+
+static void exclusive_scan_on_device(uint *values, const uint length,
+                                     GPUMemoryAllocator &allocator) {
+    // scan each tile's sum recursively, then every tile from its own offset
+    constexpr uint threads = 1024;
+
+    const uint num_tiles = divide_and_ceil(length, DEVICE_TILE_SIZE);
+    const uint blocks = divide_and_ceil(num_tiles, threads);
+
+    uint *tile_offsets = nullptr;
+    if (num_tiles > 1) {
+        tile_offsets = allocator.allocate<uint>(num_tiles);
+
+        sum_tiles<<<blocks, threads>>>(tile_offsets, values, length, num_tiles);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+
+        exclusive_scan_on_device(tile_offsets, num_tiles, allocator);
+    }
+
+    exclusive_scan_tiles<<<blocks, threads>>>(values, tile_offsets, length, num_tiles);
+    CHECK_CUDA_ERROR(cudaGetLastError());
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+}
+
+static void exclusive_scan_on_host(uint *values, const uint length, ThreadPool &thread_pool) {
+    const uint num_tiles = std::max<uint>(1, std::min(length, thread_pool.num_threads()));
+    const uint tile_size = divide_and_ceil(length, num_tiles);
+
+    std::vector<uint> tile_offsets(num_tiles);
+    thread_pool.parallel_for(0, num_tiles, [&](const uint start, const uint end) {
+        for (uint tile_idx = start; tile_idx < end; ++tile_idx) {
+            tile_offsets[tile_idx] = sum_tile(values, length, tile_size, tile_idx);
+        }
+    });
+
+    exclusive_scan_tile(tile_offsets.data(), num_tiles, num_tiles, 0, 0);
+
+    thread_pool.parallel_for(0, num_tiles, [&](const uint start, const uint end) {
+        for (uint tile_idx = start; tile_idx < end; ++tile_idx) {
+            exclusive_scan_tile(values, length, tile_size, tile_idx, tile_offsets[tile_idx]);
+        }
+    });
+}
+
+static uint num_radix_passes(const TreeletGrid &grid) {
+    return divide_and_ceil(grid.morton_bits_per_dimension * 3, RADIX_BITS);
+}
+
+static void radix_sort_morton_primitives_on_device(HLBVH::MortonPrimitive *morton_primitives,
+                                                   const uint num_primitives,
+                                                   const TreeletGrid &grid,
+                                                   GPUMemoryAllocator &allocator) {
+    // LSD radix sort on the full morton code, RADIX_BITS per pass
+    // (a stable sort: primitives of the same morton code stay in primitive order)
+    constexpr uint threads = 1024;
+
+    const uint num_tiles = divide_and_ceil(num_primitives, DEVICE_TILE_SIZE);
+    const uint blocks = divide_and_ceil(num_tiles, threads);
+
+    auto digit_offsets = allocator.allocate<uint>(RADIX_SIZE * num_tiles);
+    auto buffer = allocator.allocate<HLBVH::MortonPrimitive>(num_primitives);
+
+    HLBVH::MortonPrimitive *src = morton_primitives;
+    HLBVH::MortonPrimitive *dst = buffer;
+
+    for (uint pass = 0; pass < num_radix_passes(grid); ++pass) {
+        count_radix_digits_for_tiles<<<blocks, threads>>>(digit_offsets, src, num_primitives,
+                                                          num_tiles, pass * RADIX_BITS);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+
+        exclusive_scan_on_device(digit_offsets, RADIX_SIZE * num_tiles, allocator);
+
+        scatter_radix_digits_for_tiles<<<blocks, threads>>>(dst, src, digit_offsets,
+                                                            num_primitives, num_tiles,
+                                                            pass * RADIX_BITS);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+
+        std::swap(src, dst);
+    }
+
+    if (src != morton_primitives) {
+        CHECK_CUDA_ERROR(cudaMemcpy(morton_primitives, src,
+                                    sizeof(HLBVH::MortonPrimitive) * num_primitives,
+                                    cudaMemcpyDeviceToDevice));
+    }
+}
+
+static void radix_sort_morton_primitives_on_host(HLBVH::MortonPrimitive *morton_primitives,
+                                                 const uint num_primitives,
+                                                 const TreeletGrid &grid,
+                                                 ThreadPool &thread_pool) {
+    // the same passes as radix_sort_morton_primitives_on_device() with a tile per thread
+    const uint num_tiles = std::max<uint>(1, std::min(num_primitives, thread_pool.num_threads()));
+    const uint tile_size = divide_and_ceil(num_primitives, num_tiles);
+
+    std::vector<uint> digit_offsets(RADIX_SIZE * num_tiles);
+    std::vector<HLBVH::MortonPrimitive> buffer(num_primitives);
+
+    HLBVH::MortonPrimitive *src = morton_primitives;
+    HLBVH::MortonPrimitive *dst = buffer.data();
+
+    for (uint pass = 0; pass < num_radix_passes(grid); ++pass) {
+        thread_pool.parallel_for(0, num_tiles, [&](const uint start, const uint end) {
+            for (uint tile_idx = start; tile_idx < end; ++tile_idx) {
+                count_radix_digits(digit_offsets.data(), src, num_primitives, tile_size,
+                                   num_tiles, pass * RADIX_BITS, tile_idx);
+            }
+        });
+
+        exclusive_scan_on_host(digit_offsets.data(), digit_offsets.size(), thread_pool);
+
+        thread_pool.parallel_for(0, num_tiles, [&](const uint start, const uint end) {
+            for (uint tile_idx = start; tile_idx < end; ++tile_idx) {
+                scatter_radix_digits(dst, src, digit_offsets.data(), num_primitives, tile_size,
+                                     num_tiles, pass * RADIX_BITS, tile_idx);
+            }
+        });
+
+        std::swap(src, dst);
+    }
 
-    if (worker_idx >= MAX_TREELET_NUM) {
+    if (src != morton_primitives) {
+        std::copy(src, src + num_primitives, morton_primitives);
+    }
+}
+
+__global__ void hlbvh_init_morton_primitives(HLBVH::MortonPrimitive *morton_primitives,
+                                             const Primitive **primitives, uint num_primitives) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= num_primitives) {
         return;
     }
 
-    treelets[worker_idx].first_primitive_offset = std::numeric_limits<uint>::max();
-    treelets[worker_idx].n_primitives = 0;
+    init_morton_primitive(morton_primitives, primitives, worker_idx);
 }
 
 __global__ void hlbvh_compute_morton_code(HLBVH::MortonPrimitive *morton_primitives,
                                           uint num_total_primitives,
-                                          const Bounds3f bounds_of_centroids) {
+                                          const Bounds3f bounds_of_centroids,
+                                          const TreeletGrid grid) {
     const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
     if (worker_idx >= num_total_primitives) {
         return;
     }
 
-    // compute morton code for each primitive
-    auto centroid_offset = bounds_of_centroids.offset(morton_primitives[worker_idx].centroid);
-
-    auto scaled_offset = centroid_offset * MORTON_SCALE;
-    morton_primitives[worker_idx].morton_code = encode_morton3(
-        uint32_t(scaled_offset.x), uint32_t(scaled_offset.y), uint32_t(scaled_offset.z));
+    compute_morton_code(morton_primitives, bounds_of_centroids, grid, worker_idx);
 }
 
 __global__ void hlbvh_build_bottom_bvh(const HLBVH::BottomBVHArgs *bvh_args_array,
                                        uint array_length, HLBVH *bvh) {
-    bvh->build_bottom_bvh(bvh_args_array, array_length);
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= array_length) {
+        return;
+    }
+
+    bvh->build_bottom_bvh(bvh_args_array[worker_idx]);
+}
+
+__global__ void hlbvh_refit_morton_primitives(HLBVH::MortonPrimitive *morton_primitives,
+                                              const Primitive **primitives,
+                                              uint num_primitives) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= num_primitives) {
+        return;
+    }
+
+    refit_morton_primitive(morton_primitives, primitives, worker_idx);
+}
+
+__global__ void hlbvh_refit_build_nodes(HLBVH::BVHBuildNode *build_nodes,
+                                        const HLBVH::MortonPrimitive *morton_primitives,
+                                        const uint start, const uint end) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= end - start) {
+        return;
+    }
+
+    refit_build_node(build_nodes, morton_primitives, worker_idx + start);
 }
 
 __global__ void init_bvh_args(HLBVH::BottomBVHArgs *bvh_args_array,
                               const HLBVH::BVHBuildNode *bvh_build_nodes, uint *shared_offset,
-                              const uint start, const uint end) {
+                              const uint start, const uint end,
+                              const HLBVH::BuildOptions options) {
     const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
     const uint total_jobs = end - start;
     if (worker_idx >= total_jobs) {
@@ -157,7 +551,7 @@ __global__ void init_bvh_args(HLBVH::BottomBVHArgs *bvh_args_array,
     const uint build_node_idx = worker_idx + start;
     const auto &node = bvh_build_nodes[build_node_idx];
 
-    if (!node.is_leaf() || node.num_primitives <= MAX_PRIMITIVES_NUM_IN_LEAF) {
+    if (!should_expand(node, options)) {
         bvh_args_array[worker_idx].expand_leaf = false;
         return;
     }
@@ -168,10 +562,11 @@ __global__ void init_bvh_args(HLBVH::BottomBVHArgs *bvh_args_array,
     // 2 pointers: one for left and another right child
 }
 
-const HLBVH *HLBVH::create(const std::vector<const Primitive *> &gpu_primitives,
-                           GPUMemoryAllocator &allocator) {
+HLBVH *HLBVH::create(const std::vector<const Primitive *> &gpu_primitives,
+                     const BuildOptions &options, GPUMemoryAllocator &allocator,
+                     BVHCache *cache) {
     auto bvh = allocator.allocate<HLBVH>();
-    bvh->build_bvh(gpu_primitives, allocator);
+    bvh->build_bvh(gpu_primitives, options, allocator, cache);
 
     return bvh;
 }
@@ -182,15 +577,20 @@ bool HLBVH::fast_intersect(const Ray &ray, FloatType t_max) const {
         return false;
     }
 
-    auto d = ray.d;
-    auto inv_dir = Vector3f(1.0 / d.x, 1.0 / d.y, 1.0 / d.z);
-    int dir_is_neg[3] = {
-        int(inv_dir.x < 0.0),
-        int(inv_dir.y < 0.0),
-        int(inv_dir.z < 0.0),
-    };
+    const RayPrecomputation ray_precomputation(ray);
+
+    if (wide_bvh != nullptr) {
+        return wide_bvh->fast_intersect(ray, ray_precomputation, t_max);
+    }
+
+    if (parent_links != nullptr) {
+        return fast_intersect_stackless(ray, ray_precomputation, t_max);
+    }
 
-    Stack<uint, 128> nodes_to_visit;
+    const auto &inv_dir = ray_precomputation.inv_dir;
+    const auto &dir_is_neg = ray_precomputation.dir_is_neg;
+
+    Stack<uint, TRAVERSAL_STACK_SIZE> nodes_to_visit;
     nodes_to_visit.push(0);
     while (true) {
         if (nodes_to_visit.empty()) {
@@ -204,14 +604,8 @@ bool HLBVH::fast_intersect(const Ray &ray, FloatType t_max) const {
         }
 
         if (node.is_leaf()) {
-            for (uint morton_idx = node.first_primitive_idx;
-                 morton_idx < node.first_primitive_idx + node.num_primitives; morton_idx++) {
-                const uint primitive_idx = morton_primitives[morton_idx].primitive_idx;
-                auto const primitive = primitives[primitive_idx];
-
-                if (primitive->fast_intersect(ray, t_max)) {
-                    return true;
-                }
+            if (fast_intersect_leaf(node, ray, ray_precomputation, t_max)) {
+                return true;
             }
             continue;
         }
@@ -230,22 +624,37 @@ bool HLBVH::fast_intersect(const Ray &ray, FloatType t_max) const {
 
 PBRT_CPU_GPU
 pbrt::optional<ShapeIntersection> HLBVH::intersect(const Ray &ray, FloatType t_max) const {
+    const auto hit = intersect_hit(ray, t_max);
+    if (!hit) {
+        return {};
+    }
+
+    return Primitive::compute_surface_interaction(hit.value(), ray);
+}
+
+PBRT_CPU_GPU
+pbrt::optional<PrimitiveHit> HLBVH::intersect_hit(const Ray &ray, FloatType t_max) const {
     if (build_nodes == nullptr) {
         return {};
     }
 
-    pbrt::optional<ShapeIntersection> best_intersection = {};
+    const RayPrecomputation ray_precomputation(ray);
+
+    if (wide_bvh != nullptr) {
+        return wide_bvh->intersect_hit(ray, ray_precomputation, t_max);
+    }
+
+    if (parent_links != nullptr) {
+        return intersect_hit_stackless(ray, ray_precomputation, t_max);
+    }
+
+    pbrt::optional<PrimitiveHit> best_hit = {};
     auto best_t = t_max;
 
-    auto d = ray.d;
-    auto inv_dir = Vector3f(1.0 / d.x, 1.0 / d.y, 1.0 / d.z);
-    int dir_is_neg[3] = {
-        int(inv_dir.x < 0.0),
-        int(inv_dir.y < 0.0),
-        int(inv_dir.z < 0.0),
-    };
+    const auto &inv_dir = ray_precomputation.inv_dir;
+    const auto &dir_is_neg = ray_precomputation.dir_is_neg;
 
-    Stack<uint, 128> nodes_to_visit;
+    Stack<uint, TRAVERSAL_STACK_SIZE> nodes_to_visit;
     nodes_to_visit.push(0);
 
     while (true) {
@@ -260,19 +669,7 @@ pbrt::optional<ShapeIntersection> HLBVH::intersect(const Ray &ray, FloatType t_m
         }
 
         if (node.is_leaf()) {
-            for (uint morton_idx = node.first_primitive_idx;
-                 morton_idx < node.first_primitive_idx + node.num_primitives; morton_idx++) {
-                const uint primitive_idx = morton_primitives[morton_idx].primitive_idx;
-                auto const primitive = primitives[primitive_idx];
-
-                auto intersection = primitive->intersect(ray, best_t);
-                if (!intersection) {
-                    continue;
-                }
-
-                best_t = intersection->t_hit;
-                best_intersection = intersection;
-            }
+            intersect_leaf(node, ray, ray_precomputation, best_t, best_hit);
             continue;
         }
 
@@ -285,41 +682,456 @@ pbrt::optional<ShapeIntersection> HLBVH::intersect(const Ray &ray, FloatType t_m
         }
     }
 
-    return best_intersection;
+    return best_hit;
 };
 
-PBRT_GPU
-void HLBVH::build_bottom_bvh(const BottomBVHArgs *bvh_args_array, uint array_length) {
-    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
-    if (worker_idx >= array_length) {
-        return;
+PBRT_CPU_GPU
+bool HLBVH::fast_intersect_leaf(const BVHBuildNode &node, const Ray &ray,
+                                const RayPrecomputation &ray_precomputation,
+                                const FloatType t_max) const {
+    if (triangle_blocks != nullptr) {
+        return triangle_blocks->fast_intersect_leaf(ray, ray_precomputation, t_max,
+                                                    node.first_primitive_idx, node.num_primitives);
     }
 
-    const auto &args = bvh_args_array[worker_idx];
+    for (uint morton_idx = node.first_primitive_idx;
+         morton_idx < node.first_primitive_idx + node.num_primitives; morton_idx++) {
+        const uint primitive_idx = morton_primitives[morton_idx].primitive_idx;
+        auto const primitive = primitives[primitive_idx];
 
-    if (!args.expand_leaf) {
-        return;
+        if (primitive->fast_intersect(ray, ray_precomputation, t_max)) {
+            return true;
+        }
     }
 
-    const auto &node = build_nodes[args.build_node_idx];
-    uint left_child_idx = args.left_child_idx + 0;
-    uint right_child_idx = args.left_child_idx + 1;
+    return false;
+}
+
+PBRT_CPU_GPU
+void HLBVH::intersect_leaf(const BVHBuildNode &node, const Ray &ray,
+                           const RayPrecomputation &ray_precomputation, FloatType &best_t,
+                           pbrt::optional<PrimitiveHit> &best_hit) const {
+    if (triangle_blocks != nullptr) {
+        triangle_blocks->intersect_leaf(ray, ray_precomputation, node.first_primitive_idx,
+                                        node.num_primitives, best_t, best_hit);
+        return;
+    }
 
-    Bounds3f bounds_of_centroid;
     for (uint morton_idx = node.first_primitive_idx;
          morton_idx < node.first_primitive_idx + node.num_primitives; morton_idx++) {
-        bounds_of_centroid += morton_primitives[morton_idx].centroid;
+        const uint primitive_idx = morton_primitives[morton_idx].primitive_idx;
+        auto const primitive = primitives[primitive_idx];
+
+        auto hit = primitive->intersect_hit(ray, ray_precomputation, best_t);
+        if (!hit) {
+            continue;
+        }
+
+        best_t = hit->shape_hit.t_hit;
+        best_hit = hit;
     }
+}
 
-    auto split_dimension = bounds_of_centroid.max_dimension();
-    auto split_val = bounds_of_centroid.centroid()[split_dimension];
+struct RayPacketInterval {
+    // interval arithmetic over the origins and inverse directions of a packet:
+    // a box culled here is missed by every ray in it
+
+    Point3f o_min;
+    Point3f o_max;
+    Vector3f inv_dir_min;
+    Vector3f inv_dir_max;
+    int dir_is_neg[3];
+
+    PBRT_CPU_GPU
+    RayPacketInterval(const Ray *rays, const RayPrecomputation *ray_precomputations,
+                      const uint num_rays)
+        : o_min(rays[0].o), o_max(rays[0].o), inv_dir_min(ray_precomputations[0].inv_dir),
+          inv_dir_max(ray_precomputations[0].inv_dir) {
+        for (uint axis = 0; axis < 3; ++axis) {
+            dir_is_neg[axis] = ray_precomputations[0].dir_is_neg[axis];
+        }
 
-    uint mid_idx = partition_morton_primitives(node.first_primitive_idx,
-                                               node.first_primitive_idx + node.num_primitives,
-                                               split_dimension, split_val);
+        for (uint idx = 1; idx < num_rays; ++idx) {
+            for (uint axis = 0; axis < 3; ++axis) {
+                o_min[axis] = std::min(o_min[axis], rays[idx].o[axis]);
+                o_max[axis] = std::max(o_max[axis], rays[idx].o[axis]);
+                inv_dir_min[axis] =
+                    std::min(inv_dir_min[axis], ray_precomputations[idx].inv_dir[axis]);
+                inv_dir_max[axis] =
+                    std::max(inv_dir_max[axis], ray_precomputations[idx].inv_dir[axis]);
+            }
+        }
+    }
 
-    if (DEBUG_MODE) {
-        bool kill_thread = false;
+    PBRT_CPU_GPU
+    bool may_intersect(const Bounds3f &bounds, const FloatType t_max) const {
+        // slab distances are products of 2 intervals: their extremes are at the corners,
+        // computed with the same roundings as Bounds3::fast_intersect() of each ray
+        FloatType t_near = 0;
+        FloatType t_far = t_max;
+
+        for (uint axis = 0; axis < 3; ++axis) {
+            const auto near_plane = bounds[dir_is_neg[axis]][axis];
+            const auto far_plane = bounds[1 - dir_is_neg[axis]][axis];
+
+            const FloatType near_distances[4] = {
+                (near_plane - o_min[axis]) * inv_dir_min[axis],
+                (near_plane - o_min[axis]) * inv_dir_max[axis],
+                (near_plane - o_max[axis]) * inv_dir_min[axis],
+                (near_plane - o_max[axis]) * inv_dir_max[axis],
+            };
+            const FloatType far_distances[4] = {
+                (far_plane - o_min[axis]) * inv_dir_min[axis],
+                (far_plane - o_min[axis]) * inv_dir_max[axis],
+                (far_plane - o_max[axis]) * inv_dir_min[axis],
+                (far_plane - o_max[axis]) * inv_dir_max[axis],
+            };
+
+            FloatType axis_near = near_distances[0];
+            FloatType axis_far = far_distances[0];
+            for (uint corner = 1; corner < 4; ++corner) {
+                axis_near = std::min(axis_near, near_distances[corner]);
+                axis_far = std::max(axis_far, far_distances[corner]);
+            }
+
+            t_near = std::max(t_near, axis_near);
+            t_far = std::min(t_far, axis_far * FloatType(1.0 + 2.0 * gamma(3)));
+        }
+
+        return t_near <= t_far;
+    }
+};
+
+PBRT_CPU_GPU
+void HLBVH::intersect_packet(const Ray *rays, const uint num_rays, const FloatType t_max,
+                             pbrt::optional<ShapeIntersection> *intersections) const {
+    if (num_rays > MAX_PACKET_SIZE) {
+        printf("\n%s(): too many rays in a packet: %u (limit: %u)\n", __func__, num_rays,
+               MAX_PACKET_SIZE);
+        REPORT_FATAL_ERROR();
+    }
+
+    if (build_nodes == nullptr || num_rays == 0) {
+        for (uint idx = 0; idx < num_rays; ++idx) {
+            intersections[idx] = {};
+        }
+        return;
+    }
+
+    RayPrecomputation ray_precomputations[MAX_PACKET_SIZE];
+    FloatType best_t[MAX_PACKET_SIZE];
+    pbrt::optional<PrimitiveHit> best_hits[MAX_PACKET_SIZE];
+
+    bool coherent = true;
+    for (uint idx = 0; idx < num_rays; ++idx) {
+        ray_precomputations[idx] = RayPrecomputation(rays[idx]);
+        best_t[idx] = t_max;
+
+        for (uint axis = 0; axis < 3; ++axis) {
+            coherent = coherent &&
+                       ray_precomputations[idx].dir_is_neg[axis] ==
+                           ray_precomputations[0].dir_is_neg[axis] &&
+                       isfinite(ray_precomputations[idx].inv_dir[axis]);
+        }
+    }
+
+    if (!coherent || parent_links != nullptr) {
+        // rays of different octants visit children in different orders,
+        // and rays parallel to a slab leave infinities in the intervals
+        // and trees with parent links may be too deep for the packet stack
+        for (uint idx = 0; idx < num_rays; ++idx) {
+            intersections[idx] = intersect(rays[idx], t_max);
+        }
+        return;
+    }
+
+    const RayPacketInterval packet_interval(rays, ray_precomputations, num_rays);
+    const auto &dir_is_neg = packet_interval.dir_is_neg;
+
+    struct PacketNode {
+        uint node_idx;
+        uint first_active_ray;
+        // rays before it missed an ancestor of the node
+    };
+
+    Stack<PacketNode, TRAVERSAL_STACK_SIZE> nodes_to_visit;
+    nodes_to_visit.push(PacketNode{.node_idx = 0, .first_active_ray = 0});
+
+    while (!nodes_to_visit.empty()) {
+        const auto packet_node = nodes_to_visit.pop();
+        const auto node = build_nodes[packet_node.node_idx];
+
+        FloatType packet_t_max = 0;
+        for (uint idx = packet_node.first_active_ray; idx < num_rays; ++idx) {
+            packet_t_max = std::max(packet_t_max, best_t[idx]);
+        }
+
+        if (!packet_interval.may_intersect(node.bounds, packet_t_max)) {
+            continue;
+        }
+
+        // the first ray hitting the node: every ray after it is tested again at the children
+        uint first_active_ray = packet_node.first_active_ray;
+        while (first_active_ray < num_rays &&
+               !node.bounds.fast_intersect(rays[first_active_ray], best_t[first_active_ray],
+                                           ray_precomputations[first_active_ray].inv_dir,
+                                           ray_precomputations[first_active_ray].dir_is_neg)) {
+            first_active_ray += 1;
+        }
+
+        if (first_active_ray >= num_rays) {
+            continue;
+        }
+
+        if (!node.is_leaf()) {
+            const uint near_child = node.left_child_idx + dir_is_neg[node.axis];
+            const uint far_child = node.left_child_idx + 1 - dir_is_neg[node.axis];
+
+            nodes_to_visit.push(
+                PacketNode{.node_idx = far_child, .first_active_ray = first_active_ray});
+            nodes_to_visit.push(
+                PacketNode{.node_idx = near_child, .first_active_ray = first_active_ray});
+            continue;
+        }
+
+        for (uint idx = first_active_ray; idx < num_rays; ++idx) {
+            if (idx == first_active_ray ||
+                node.bounds.fast_intersect(rays[idx], best_t[idx],
+                                           ray_precomputations[idx].inv_dir,
+                                           ray_precomputations[idx].dir_is_neg)) {
+                intersect_leaf(node, rays[idx], ray_precomputations[idx], best_t[idx],
+                               best_hits[idx]);
+            }
+        }
+    }
+
+    for (uint idx = 0; idx < num_rays; ++idx) {
+        intersections[idx] = best_hits[idx] ? Primitive::compute_surface_interaction(
+                                                  best_hits[idx].value(), rays[idx])
+                                            : pbrt::optional<ShapeIntersection>{};
+    }
+}
+
+PBRT_CPU_GPU
+void HLBVH::fast_intersect_packet(const Ray *rays, const FloatType *t_max, const uint num_rays,
+                                  bool *occluded) const {
+    if (num_rays > MAX_PACKET_SIZE) {
+        printf("\n%s(): too many rays in a packet: %u (limit: %u)\n", __func__, num_rays,
+               MAX_PACKET_SIZE);
+        REPORT_FATAL_ERROR();
+    }
+
+    if (build_nodes == nullptr || num_rays == 0) {
+        for (uint idx = 0; idx < num_rays; ++idx) {
+            occluded[idx] = false;
+        }
+        return;
+    }
+
+    RayPrecomputation ray_precomputations[MAX_PACKET_SIZE];
+
+    bool coherent = true;
+    for (uint idx = 0; idx < num_rays; ++idx) {
+        ray_precomputations[idx] = RayPrecomputation(rays[idx]);
+        occluded[idx] = false;
+
+        for (uint axis = 0; axis < 3; ++axis) {
+            coherent = coherent &&
+                       ray_precomputations[idx].dir_is_neg[axis] ==
+                           ray_precomputations[0].dir_is_neg[axis] &&
+                       isfinite(ray_precomputations[idx].inv_dir[axis]);
+        }
+    }
+
+    if (!coherent || parent_links != nullptr) {
+        // same fallback as intersect_packet()
+        for (uint idx = 0; idx < num_rays; ++idx) {
+            occluded[idx] = fast_intersect(rays[idx], t_max[idx]);
+        }
+        return;
+    }
+
+    const RayPacketInterval packet_interval(rays, ray_precomputations, num_rays);
+    const auto &dir_is_neg = packet_interval.dir_is_neg;
+
+    struct PacketNode {
+        uint node_idx;
+        uint first_active_ray;
+        // rays before it missed an ancestor of the node or are occluded already
+    };
+
+    Stack<PacketNode, TRAVERSAL_STACK_SIZE> nodes_to_visit;
+    nodes_to_visit.push(PacketNode{.node_idx = 0, .first_active_ray = 0});
+
+    uint num_unoccluded = num_rays;
+    while (!nodes_to_visit.empty() && num_unoccluded > 0) {
+        const auto packet_node = nodes_to_visit.pop();
+        const auto node = build_nodes[packet_node.node_idx];
+
+        FloatType packet_t_max = 0;
+        for (uint idx = packet_node.first_active_ray; idx < num_rays; ++idx) {
+            packet_t_max = occluded[idx] ? packet_t_max : std::max(packet_t_max, t_max[idx]);
+        }
+
+        if (!packet_interval.may_intersect(node.bounds, packet_t_max)) {
+            continue;
+        }
+
+        // the first unoccluded ray hitting the node
+        uint first_active_ray = packet_node.first_active_ray;
+        while (first_active_ray < num_rays &&
+               (occluded[first_active_ray] ||
+                !node.bounds.fast_intersect(rays[first_active_ray], t_max[first_active_ray],
+                                            ray_precomputations[first_active_ray].inv_dir,
+                                            ray_precomputations[first_active_ray].dir_is_neg))) {
+            first_active_ray += 1;
+        }
+
+        if (first_active_ray >= num_rays) {
+            continue;
+        }
+
+        if (!node.is_leaf()) {
+            const uint near_child = node.left_child_idx + dir_is_neg[node.axis];
+            const uint far_child = node.left_child_idx + 1 - dir_is_neg[node.axis];
+
+            nodes_to_visit.push(
+                PacketNode{.node_idx = far_child, .first_active_ray = first_active_ray});
+            nodes_to_visit.push(
+                PacketNode{.node_idx = near_child, .first_active_ray = first_active_ray});
+            continue;
+        }
+
+        for (uint idx = first_active_ray; idx < num_rays; ++idx) {
+            if (occluded[idx]) {
+                continue;
+            }
+
+            if (idx == first_active_ray ||
+                node.bounds.fast_intersect(rays[idx], t_max[idx],
+                                           ray_precomputations[idx].inv_dir,
+                                           ray_precomputations[idx].dir_is_neg)) {
+                occluded[idx] = fast_intersect_leaf(node, rays[idx], ray_precomputations[idx],
+                                                    t_max[idx]);
+                num_unoccluded -= occluded[idx];
+            }
+        }
+    }
+}
+
+PBRT_CPU_GPU
+uint HLBVH::next_node_stackless(uint node_idx, const int dir_is_neg[3]) const {
+    // the near child of a node is visited first (the right one when the ray goes negative along
+    // the split axis): climb until leaving a near child, its far sibling is the next node
+    while (node_idx != 0) {
+        const uint link = parent_links[node_idx];
+        const bool is_right_child = link & 1;
+        const uint8_t parent_axis = (link >> 1) & 3;
+
+        if (is_right_child == bool(dir_is_neg[parent_axis])) {
+            return is_right_child ? node_idx - 1 : node_idx + 1;
+        }
+
+        node_idx = link >> 3;
+    }
+
+    // back at the root: the traversal is done
+    return 0;
+}
+
+PBRT_CPU_GPU
+bool HLBVH::fast_intersect_stackless(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                                     FloatType t_max) const {
+    const auto &inv_dir = ray_precomputation.inv_dir;
+    const auto &dir_is_neg = ray_precomputation.dir_is_neg;
+
+    uint current_node_idx = 0;
+    do {
+        const auto node = build_nodes[current_node_idx];
+        if (node.bounds.fast_intersect(ray, t_max, inv_dir, dir_is_neg)) {
+            if (!node.is_leaf()) {
+                current_node_idx = node.left_child_idx + dir_is_neg[node.axis];
+                continue;
+            }
+
+            if (fast_intersect_leaf(node, ray, ray_precomputation, t_max)) {
+                return true;
+            }
+        }
+
+        current_node_idx = next_node_stackless(current_node_idx, dir_is_neg);
+    } while (current_node_idx != 0);
+
+    return false;
+}
+
+PBRT_CPU_GPU
+pbrt::optional<PrimitiveHit>
+HLBVH::intersect_hit_stackless(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                               FloatType t_max) const {
+    pbrt::optional<PrimitiveHit> best_hit = {};
+    auto best_t = t_max;
+
+    const auto &inv_dir = ray_precomputation.inv_dir;
+    const auto &dir_is_neg = ray_precomputation.dir_is_neg;
+
+    uint current_node_idx = 0;
+    do {
+        const auto node = build_nodes[current_node_idx];
+        if (node.bounds.fast_intersect(ray, best_t, inv_dir, dir_is_neg)) {
+            if (!node.is_leaf()) {
+                current_node_idx = node.left_child_idx + dir_is_neg[node.axis];
+                continue;
+            }
+
+            intersect_leaf(node, ray, ray_precomputation, best_t, best_hit);
+        }
+
+        current_node_idx = next_node_stackless(current_node_idx, dir_is_neg);
+    } while (current_node_idx != 0);
+
+    return best_hit;
+}
+
+PBRT_CPU_GPU
+void HLBVH::build_bottom_bvh(const BottomBVHArgs &args) {
+    if (!args.expand_leaf) {
+        return;
+    }
+
+    const auto &node = build_nodes[args.build_node_idx];
+    uint left_child_idx = args.left_child_idx + 0;
+    uint right_child_idx = args.left_child_idx + 1;
+
+    Bounds3f bounds_of_centroid;
+    for (uint morton_idx = node.first_primitive_idx;
+         morton_idx < node.first_primitive_idx + node.num_primitives; morton_idx++) {
+        bounds_of_centroid += morton_primitives[morton_idx].centroid;
+    }
+
+    uint8_t split_dimension = bounds_of_centroid.max_dimension();
+    auto split_val = bounds_of_centroid.centroid()[split_dimension];
+
+    if (build_options.bottom_split_method != BuildOptions::SplitMethod::middle) {
+        // subtrees of an SBVH rebuilt after refit() split by SAH without duplication
+        const auto sah_split = find_sah_split(node, bounds_of_centroid, split_dimension);
+        if (!sah_split.has_value()) {
+            // keeping the leaf is cheaper than any split
+            build_nodes[left_child_idx].num_primitives = 0;
+            build_nodes[right_child_idx].num_primitives = 0;
+
+            return;
+        }
+
+        split_val = sah_split.value();
+    }
+
+    uint mid_idx = partition_morton_primitives(node.first_primitive_idx,
+                                               node.first_primitive_idx + node.num_primitives,
+                                               split_dimension, split_val);
+
+    if (DEBUG_MODE) {
+        bool kill_thread = false;
 
         if (mid_idx < node.first_primitive_idx ||
             mid_idx > node.first_primitive_idx + node.num_primitives) {
@@ -328,299 +1140,1040 @@ void HLBVH::build_bottom_bvh(const BottomBVHArgs *bvh_args_array, uint array_len
             kill_thread = true;
         }
 
-        for (uint morton_idx = node.first_primitive_idx; morton_idx < mid_idx; morton_idx++) {
-            if (morton_primitives[morton_idx].centroid[split_dimension] >= split_val) {
-                printf("ERROR in partitioning (1st half) at node[%u], idx: %u\n",
-                       args.build_node_idx, morton_idx);
-                kill_thread = true;
-            }
+        for (uint morton_idx = node.first_primitive_idx; morton_idx < mid_idx; morton_idx++) {
+            if (morton_primitives[morton_idx].centroid[split_dimension] >= split_val) {
+                printf("ERROR in partitioning (1st half) at node[%u], idx: %u\n",
+                       args.build_node_idx, morton_idx);
+                kill_thread = true;
+            }
+        }
+
+        for (uint morton_idx = mid_idx; morton_idx < node.first_primitive_idx + node.num_primitives;
+             morton_idx++) {
+            if (morton_primitives[morton_idx].centroid[split_dimension] < split_val) {
+                printf("ERROR in partitioning (2nd half) at node[%u], idx: %u\n",
+                       args.build_node_idx, morton_idx);
+                kill_thread = true;
+            }
+        }
+
+        if (kill_thread) {
+            REPORT_FATAL_ERROR();
+        }
+    }
+
+    if (mid_idx == node.first_primitive_idx ||
+        mid_idx == node.first_primitive_idx + node.num_primitives) {
+        // all primitives' centroids grouped either left or right half
+        // there is no need to separate them
+
+        build_nodes[left_child_idx].num_primitives = 0;
+        build_nodes[right_child_idx].num_primitives = 0;
+
+        return;
+    }
+
+    Bounds3f left_bounds;
+    for (uint morton_idx = node.first_primitive_idx; morton_idx < mid_idx; morton_idx++) {
+        left_bounds += morton_primitives[morton_idx].bounds;
+    }
+
+    Bounds3f right_bounds;
+    for (uint morton_idx = mid_idx; morton_idx < node.first_primitive_idx + node.num_primitives;
+         morton_idx++) {
+        right_bounds += morton_primitives[morton_idx].bounds;
+    }
+
+    build_nodes[left_child_idx].init_leaf(node.first_primitive_idx,
+                                          mid_idx - node.first_primitive_idx, left_bounds);
+    build_nodes[right_child_idx].init_leaf(
+        mid_idx, node.num_primitives - (mid_idx - node.first_primitive_idx), right_bounds);
+
+    build_nodes[args.build_node_idx].init_interior(split_dimension, left_child_idx,
+                                                   left_bounds + right_bounds);
+}
+
+void HLBVH::build_bvh(const std::vector<const Primitive *> &gpu_primitives,
+                      const BuildOptions &options, GPUMemoryAllocator &allocator,
+                      BVHCache *cache) {
+    primitives = nullptr;
+    morton_primitives = nullptr;
+    num_morton_primitives = 0;
+    build_nodes = nullptr;
+    num_build_nodes = 0;
+    reference_surface_areas = nullptr;
+    reference_surface_areas_capacity = 0;
+    reference_sah_cost = 0;
+    parent_links = nullptr;
+    triangle_blocks = nullptr;
+    wide_bvh = nullptr;
+
+    uint num_total_primitives = gpu_primitives.size();
+    if (num_total_primitives == 0) {
+        return;
+    }
+
+    printf("\ntotal primitives: %u\n", num_total_primitives);
+
+    auto gpu_primitives_array = allocator.allocate<const Primitive *>(num_total_primitives);
+
+    CHECK_CUDA_ERROR(cudaMemcpy(gpu_primitives_array, gpu_primitives.data(),
+                                sizeof(Primitive *) * num_total_primitives,
+                                cudaMemcpyHostToDevice));
+
+    primitives = gpu_primitives_array;
+    build_options = options;
+
+    uint64_t cache_key = 0;
+    std::optional<BVHCache::Entry> cached_bvh;
+    if (cache != nullptr) {
+        PhaseTimer timer;
+        cache_key = BVHCache::hash_geometry(gpu_primitives, options);
+        timer.record("hashing");
+
+        cached_bvh = cache->load(cache_key, num_total_primitives, allocator);
+        timer.record("loading");
+
+        if (cached_bvh.has_value()) {
+            timer.report("BVH loading (cache hit)");
+        }
+    }
+
+    if (cached_bvh.has_value()) {
+        morton_primitives = cached_bvh->morton_primitives;
+        num_morton_primitives = cached_bvh->num_morton_primitives;
+        build_nodes = cached_bvh->build_nodes;
+        num_build_nodes = cached_bvh->num_build_nodes;
+    } else {
+        if (options.bottom_split_method == BuildOptions::SplitMethod::sbvh) {
+            build_bvh_with_spatial_splits(num_total_primitives, allocator);
+        } else {
+            morton_primitives = allocator.allocate<MortonPrimitive>(num_total_primitives);
+            num_morton_primitives = num_total_primitives;
+
+            if (options.build_on_host) {
+                build_bvh_on_host(num_total_primitives, allocator);
+            } else {
+                build_bvh_on_device(num_total_primitives, allocator);
+            }
+        }
+
+        if (options.restructure_passes > 0) {
+            restructure_treelets(allocator);
+        }
+
+        if (cache != nullptr) {
+            cache->save(cache_key, num_total_primitives, morton_primitives,
+                        num_morton_primitives, build_nodes, num_build_nodes);
+        }
+    }
+
+    report_sah_cost();
+
+    build_traversal_structures(allocator);
+}
+
+void HLBVH::build_traversal_structures(GPUMemoryAllocator &allocator) {
+    // all derive from the final binary tree: rebuilt whenever its topology changes
+    parent_links = nullptr;
+    triangle_blocks = nullptr;
+    wide_bvh = nullptr;
+
+    if (build_options.triangle_block_width > 0) {
+        triangle_blocks =
+            TriangleBlocks::create(build_nodes, num_build_nodes, morton_primitives,
+                                   num_morton_primitives, primitives,
+                                   build_options.triangle_block_width, allocator);
+    }
+
+    // nullptr when the wide tree may overflow its traversal stack
+    build_wide_bvh(allocator);
+    if (wide_bvh != nullptr) {
+        return;
+    }
+
+    const uint max_depth = compute_max_depth();
+
+    if (max_depth >= TRAVERSAL_STACK_SIZE) {
+        printf("HLBVH: %u levels are too deep for the traversal stack, switch to stackless "
+               "traversal\n",
+               max_depth);
+    } else if (!build_options.stackless_traversal) {
+        return;
+    }
+
+    build_parent_links(allocator);
+}
+
+void HLBVH::build_wide_bvh(GPUMemoryAllocator &allocator) {
+    if (build_options.wide_bvh_width == 0 && !build_options.quantized_nodes) {
+        return;
+    }
+
+    // quantized nodes are always wide: 4-wide unless asked otherwise
+    const uint width = build_options.wide_bvh_width > 0 ? build_options.wide_bvh_width : 4;
+    wide_bvh = WideBVH::create(build_nodes, morton_primitives, primitives, triangle_blocks, width,
+                               build_options.quantized_nodes, allocator);
+}
+
+void HLBVH::build_parent_links(GPUMemoryAllocator &allocator) {
+    if (num_build_nodes >= (1u << 29)) {
+        printf("\n%s(): too many nodes for parent links: %u\n", __func__, num_build_nodes);
+        REPORT_FATAL_ERROR();
+    }
+
+    auto links = allocator.allocate<uint>(num_build_nodes);
+    links[0] = 0;
+    for (uint idx = 0; idx < num_build_nodes; ++idx) {
+        const auto &node = build_nodes[idx];
+        if (node.is_leaf()) {
+            continue;
+        }
+
+        links[node.left_child_idx] = (idx << 3) | (uint(node.axis) << 1);
+        links[node.left_child_idx + 1] = (idx << 3) | (uint(node.axis) << 1) | 1;
+    }
+
+    parent_links = links;
+
+    printf("HLBVH: stackless traversal (%.2f MB of parent links)\n",
+           double(sizeof(uint) * num_build_nodes) / (1024 * 1024));
+}
+
+uint HLBVH::compute_max_depth() const {
+    // compacted nodes are laid out breadth first: parents come before their children
+    std::vector<uint> depths(num_build_nodes, 0);
+
+    uint max_depth = 0;
+    for (uint idx = 0; idx < num_build_nodes; ++idx) {
+        const auto &node = build_nodes[idx];
+        max_depth = std::max(max_depth, depths[idx]);
+
+        if (!node.is_leaf()) {
+            depths[node.left_child_idx] = depths[idx] + 1;
+            depths[node.left_child_idx + 1] = depths[idx] + 1;
+        }
+    }
+
+    return max_depth;
+}
+
+void HLBVH::refit(GPUMemoryAllocator &allocator) {
+    if (build_nodes == nullptr) {
+        return;
+    }
+
+    PhaseTimer timer;
+
+    if (reference_surface_areas == nullptr) {
+        // the first refit compares against the bounds the BVH was built with
+        record_reference_surface_areas(allocator);
+    }
+
+    // compacted nodes are laid out breadth first: each level is a contiguous range
+    // after its parent level, so levels are refit from the deepest one up
+    std::vector<std::pair<uint, uint>> levels;
+    uint num_total_primitives = 0;
+    for (uint start = 0, end = 1; start < end;) {
+        levels.emplace_back(start, end);
+
+        uint num_children = 0;
+        for (uint idx = start; idx < end; ++idx) {
+            if (build_nodes[idx].is_leaf()) {
+                num_total_primitives += build_nodes[idx].num_primitives;
+            } else {
+                num_children += 2;
+            }
+        }
+
+        start = end;
+        end += num_children;
+    }
+
+    if (build_options.build_on_host) {
+        ThreadPool thread_pool;
+        thread_pool.parallel_for(0, num_total_primitives, [&](const uint start, const uint end) {
+            for (uint idx = start; idx < end; ++idx) {
+                refit_morton_primitive(morton_primitives, primitives, idx);
+            }
+        });
+
+        for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+            thread_pool.parallel_for(level->first, level->second,
+                                     [&](const uint start, const uint end) {
+                                         for (uint idx = start; idx < end; ++idx) {
+                                             refit_build_node(build_nodes, morton_primitives,
+                                                              idx);
+                                         }
+                                     });
+        }
+    } else {
+        constexpr uint threads = 1024;
+
+        hlbvh_refit_morton_primitives<<<divide_and_ceil(num_total_primitives, threads),
+                                        threads>>>(morton_primitives, primitives,
+                                                   num_total_primitives);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+
+        for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+            const uint blocks = divide_and_ceil(level->second - level->first, threads);
+            hlbvh_refit_build_nodes<<<blocks, threads>>>(build_nodes, morton_primitives,
+                                                         level->first, level->second);
+            CHECK_CUDA_ERROR(cudaGetLastError());
+        }
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    }
+    timer.record("refitting");
+
+    bool rebuilt = false;
+    const auto sah_cost = compute_sah_cost();
+    if (sah_cost > reference_sah_cost * (1 + build_options.max_refit_sah_growth)) {
+        printf("HLBVH: SAH cost grew from %.2f to %.2f after refitting\n", reference_sah_cost,
+               sah_cost);
+
+        rebuild_degraded_subtrees(num_total_primitives, allocator);
+        record_reference_surface_areas(allocator);
+        rebuilt = true;
+        timer.record("rebuilding");
+    }
+
+    if (!rebuilt && triangle_blocks != nullptr &&
+        !triangle_blocks->refit(build_nodes, num_build_nodes)) {
+        printf("HLBVH: triangles turned degenerate or back, rebuild the triangle blocks\n");
+        rebuilt = true;
+    }
+
+    if (rebuilt) {
+        // parent links, wide nodes and triangle blocks all follow the topology
+        build_traversal_structures(allocator);
+        timer.record("traversal structures");
+    } else if (wide_bvh != nullptr) {
+        wide_bvh->refit(build_nodes);
+        timer.record("wide nodes");
+    }
+
+    timer.report("BVH refitting");
+}
+
+void HLBVH::build_bvh_on_device(const uint num_total_primitives, GPUMemoryAllocator &allocator) {
+    PhaseTimer timer;
+
+    GPUMemoryAllocator local_allocator;
+
+    const auto grid = choose_treelet_grid(num_total_primitives);
+
+    constexpr uint threads = 1024;
+    {
+        const uint blocks = divide_and_ceil(num_total_primitives, threads);
+        hlbvh_init_morton_primitives<<<blocks, threads>>>(morton_primitives, primitives,
+                                                          num_total_primitives);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    }
+
+    Bounds3f bounds_of_primitives_centroids;
+    for (uint idx = 0; idx < num_total_primitives; idx++) {
+        bounds_of_primitives_centroids += morton_primitives[idx].centroid;
+    }
+    bounds_of_primitives_centroids = cube_bounds_of_centroids(bounds_of_primitives_centroids);
+
+    {
+        const uint blocks = divide_and_ceil(num_total_primitives, threads);
+        hlbvh_compute_morton_code<<<blocks, threads>>>(morton_primitives, num_total_primitives,
+                                                       bounds_of_primitives_centroids, grid);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    }
+    timer.record("morton codes");
+
+    radix_sort_morton_primitives_on_device(morton_primitives, num_total_primitives, grid,
+                                           local_allocator);
+    timer.record("sorting");
+
+    auto treelet_offsets = local_allocator.allocate<uint>(num_total_primitives);
+    {
+        const uint blocks = divide_and_ceil(num_total_primitives, threads);
+        flag_treelet_starts<<<blocks, threads>>>(treelet_offsets, morton_primitives,
+                                                 num_total_primitives, grid);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    }
+
+    const uint last_flag = treelet_offsets[num_total_primitives - 1];
+    exclusive_scan_on_device(treelet_offsets, num_total_primitives, local_allocator);
+    const uint num_dense_treelets = treelet_offsets[num_total_primitives - 1] + last_flag;
+
+    auto dense_treelets = local_allocator.allocate<Treelet>(num_dense_treelets);
+    {
+        const uint blocks = divide_and_ceil(num_total_primitives, threads);
+        scatter_treelet_starts<<<blocks, threads>>>(dense_treelets, treelet_offsets,
+                                                    morton_primitives, num_total_primitives, grid);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    }
+    {
+        const uint blocks = divide_and_ceil(num_dense_treelets, threads);
+        finish_treelets<<<blocks, threads>>>(dense_treelets, num_dense_treelets, morton_primitives,
+                                             num_total_primitives);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    }
+
+    report_treelets(dense_treelets, num_dense_treelets, grid);
+    timer.record("treelets");
+
+    // a full binary tree over N primitives has 2N - 1 nodes, and every leaf that fails to split
+    // (at most N / 2 of them as they hold 2+ primitives) leaves 2 unused slots behind
+    const uint max_build_node_length = 3 * num_total_primitives;
+
+    build_nodes = local_allocator.allocate<BVHBuildNode>(max_build_node_length);
+    // over-allocated: released once the used nodes are compacted
+
+    ThreadPool thread_pool;
+    const uint top_bvh_node_num =
+        build_top_bvh_for_treelets(dense_treelets, num_dense_treelets, thread_pool);
+    timer.record("top BVH");
+
+    uint start = 0;
+    uint end = top_bvh_node_num;
+
+    auto shared_offset = local_allocator.allocate<uint>();
+    *shared_offset = end;
+
+    uint depth = 0;
+
+    uint last_allocated_size = (end - start) * 4;
+    auto bvh_args_array = local_allocator.allocate<BottomBVHArgs>(last_allocated_size);
+
+    while (end > start) {
+        const uint array_length = end - start;
+
+        if (array_length > last_allocated_size) {
+            // to avoid unnecessarily repeated memory allocation
+            uint current_size = array_length * 2;
+            bvh_args_array = local_allocator.allocate<BottomBVHArgs>(current_size);
+            last_allocated_size = current_size;
+        }
+
+        {
+            uint blocks = divide_and_ceil(array_length, threads);
+            init_bvh_args<<<blocks, threads>>>(bvh_args_array, build_nodes, shared_offset, start,
+                                               end, build_options);
+            CHECK_CUDA_ERROR(cudaGetLastError());
+            CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+        }
+
+        if (DEBUG_MODE) {
+            printf("HLBVH: building bottom BVH: depth %u, node number: %u\n", depth, array_length);
+        }
+
+        depth += 1;
+        start = end;
+        end = *shared_offset;
+
+        uint blocks = divide_and_ceil(array_length, threads);
+
+        hlbvh_build_bottom_bvh<<<blocks, threads>>>(bvh_args_array, array_length, this);
+        CHECK_CUDA_ERROR(cudaGetLastError());
+        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    }
+    timer.record("bottom BVH");
+
+    printf("HLBVH: bottom BVH nodes: %u, max depth: %u, max primitives in a leaf: %u (%s)\n",
+           end - top_bvh_node_num, depth, build_options.max_primitives_in_leaf,
+           build_options.bottom_split_method == BuildOptions::SplitMethod::sah ? "SAH" : "middle");
+    printf("HLBVH: total nodes: %u/%u\n", end, max_build_node_length);
+
+    compact_build_nodes(allocator);
+    timer.record("compacting");
+
+    timer.report("BVH constructing");
+}
+
+void HLBVH::build_bvh_on_host(const uint num_total_primitives, GPUMemoryAllocator &allocator) {
+    // the same phases as build_bvh_on_device() with the kernels replaced by ThreadPool jobs:
+    // only host code touches the (managed) memory here
+    PhaseTimer timer;
+    ThreadPool thread_pool;
+
+    const auto grid = choose_treelet_grid(num_total_primitives);
+
+    std::mutex mtx;
+    Bounds3f bounds_of_primitives_centroids;
+    thread_pool.parallel_for(0, num_total_primitives, [&](const uint start, const uint end) {
+        Bounds3f local_bounds;
+        for (uint idx = start; idx < end; ++idx) {
+            init_morton_primitive(morton_primitives, primitives, idx);
+            local_bounds += morton_primitives[idx].centroid;
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        bounds_of_primitives_centroids += local_bounds;
+    });
+    bounds_of_primitives_centroids = cube_bounds_of_centroids(bounds_of_primitives_centroids);
+
+    thread_pool.parallel_for(0, num_total_primitives, [&](const uint start, const uint end) {
+        for (uint idx = start; idx < end; ++idx) {
+            compute_morton_code(morton_primitives, bounds_of_primitives_centroids, grid, idx);
+        }
+    });
+    timer.record("morton codes");
+
+    radix_sort_morton_primitives_on_host(morton_primitives, num_total_primitives, grid,
+                                         thread_pool);
+    timer.record("sorting");
+
+    std::vector<uint> treelet_offsets(num_total_primitives);
+    thread_pool.parallel_for(0, num_total_primitives, [&](const uint start, const uint end) {
+        for (uint idx = start; idx < end; ++idx) {
+            treelet_offsets[idx] = starts_treelet(morton_primitives, grid, idx);
+        }
+    });
+
+    const uint last_flag = treelet_offsets.back();
+    exclusive_scan_on_host(treelet_offsets.data(), num_total_primitives, thread_pool);
+
+    std::vector<Treelet> dense_treelets(treelet_offsets.back() + last_flag);
+    thread_pool.parallel_for(0, num_total_primitives, [&](const uint start, const uint end) {
+        for (uint idx = start; idx < end; ++idx) {
+            scatter_treelet_start(dense_treelets.data(), treelet_offsets.data(), morton_primitives,
+                                  grid, idx);
+        }
+    });
+
+    thread_pool.parallel_for(0, dense_treelets.size(), [&](const uint start, const uint end) {
+        for (uint idx = start; idx < end; ++idx) {
+            finish_treelet(dense_treelets.data(), dense_treelets.size(), morton_primitives,
+                           num_total_primitives, idx);
+        }
+    });
+
+    report_treelets(dense_treelets.data(), dense_treelets.size(), grid);
+    timer.record("treelets");
+
+    const uint max_build_node_length = 3 * num_total_primitives;
+
+    // over-allocated in plain host memory: only the compacted nodes go to managed memory
+    std::vector<BVHBuildNode> host_build_nodes(max_build_node_length);
+    build_nodes = host_build_nodes.data();
+
+    const uint top_bvh_node_num =
+        build_top_bvh_for_treelets(dense_treelets.data(), dense_treelets.size(), thread_pool);
+    timer.record("top BVH");
+
+    std::vector<uint> top_bvh_nodes(top_bvh_node_num);
+    std::iota(top_bvh_nodes.begin(), top_bvh_nodes.end(), 0);
+
+    uint depth = 0;
+    const uint end =
+        build_bottom_bvh_on_host(std::move(top_bvh_nodes), top_bvh_node_num, thread_pool, depth);
+    timer.record("bottom BVH");
+
+    printf("HLBVH: bottom BVH nodes: %u, max depth: %u, max primitives in a leaf: %u (%s)\n",
+           end - top_bvh_node_num, depth, build_options.max_primitives_in_leaf,
+           build_options.bottom_split_method == BuildOptions::SplitMethod::sah ? "SAH" : "middle");
+    printf("HLBVH: total nodes: %u/%u\n", end, max_build_node_length);
+
+    compact_build_nodes(allocator);
+    timer.record("compacting");
+
+    timer.report("BVH constructing (host)");
+}
+
+void HLBVH::build_bvh_with_spatial_splits(const uint num_total_primitives,
+                                          GPUMemoryAllocator &allocator) {
+    PhaseTimer timer;
+    ThreadPool thread_pool;
+
+    SBVHBuilder builder(primitives, num_total_primitives, build_options);
+    builder.build(thread_pool);
+    timer.record("SBVH");
+
+    num_morton_primitives = builder.references.size();
+    morton_primitives = allocator.allocate<MortonPrimitive>(num_morton_primitives);
+    CHECK_CUDA_ERROR(cudaMemcpy(morton_primitives, builder.references.data(),
+                                sizeof(MortonPrimitive) * num_morton_primitives,
+                                cudaMemcpyHostToDevice));
+
+    printf("HLBVH: spatial splits: %u, references: %u (%.2f%% duplicated)\n",
+           builder.num_spatial_splits(), num_morton_primitives,
+           double(num_morton_primitives - num_total_primitives) / num_total_primitives * 100);
+
+    // compacting copies the nodes out of the host vector
+    build_nodes = builder.build_nodes.data();
+    compact_build_nodes(allocator);
+    timer.record("compacting");
+
+    timer.report("BVH constructing (SBVH)");
+}
+
+uint HLBVH::build_bottom_bvh_on_host(std::vector<uint> nodes, uint offset,
+                                     ThreadPool &thread_pool, uint &depth) {
+    std::vector<BottomBVHArgs> bvh_args_array;
+    while (!nodes.empty()) {
+        // children are handed out in node order (rather than by atomicAdd as on device)
+        // so the host build is deterministic
+        std::vector<uint> children;
+
+        bvh_args_array.resize(nodes.size());
+        for (uint idx = 0; idx < nodes.size(); ++idx) {
+            const auto &node = build_nodes[nodes[idx]];
+            auto &args = bvh_args_array[idx];
+
+            if (!should_expand(node, build_options)) {
+                args.expand_leaf = false;
+                continue;
+            }
+
+            args.expand_leaf = true;
+            args.build_node_idx = nodes[idx];
+            args.left_child_idx = offset;
+
+            children.push_back(offset);
+            children.push_back(offset + 1);
+            offset += 2;
+        }
+
+        if (DEBUG_MODE) {
+            printf("HLBVH: building bottom BVH: depth %u, node number: %zu\n", depth,
+                   nodes.size());
         }
 
-        for (uint morton_idx = mid_idx; morton_idx < node.first_primitive_idx + node.num_primitives;
-             morton_idx++) {
-            if (morton_primitives[morton_idx].centroid[split_dimension] < split_val) {
-                printf("ERROR in partitioning (2nd half) at node[%u], idx: %u\n",
-                       args.build_node_idx, morton_idx);
-                kill_thread = true;
+        depth += 1;
+
+        thread_pool.parallel_for(0, bvh_args_array.size(), [&](const uint first, const uint last) {
+            for (uint idx = first; idx < last; ++idx) {
+                build_bottom_bvh(bvh_args_array[idx]);
             }
-        }
+        });
 
-        if (kill_thread) {
-            REPORT_FATAL_ERROR();
-        }
+        nodes = std::move(children);
     }
 
-    if (mid_idx == node.first_primitive_idx ||
-        mid_idx == node.first_primitive_idx + node.num_primitives) {
-        // all primitives' centroids grouped either left or right half
-        // there is no need to separate them
-
-        build_nodes[left_child_idx].num_primitives = 0;
-        build_nodes[right_child_idx].num_primitives = 0;
+    return offset;
+}
 
-        return;
+HLBVH::BuildOptions::SplitMethod
+HLBVH::BuildOptions::parse_split_method(const std::string &split_method) {
+    if (split_method == "sah") {
+        return SplitMethod::sah;
     }
 
-    Bounds3f left_bounds;
-    for (uint morton_idx = node.first_primitive_idx; morton_idx < mid_idx; morton_idx++) {
-        left_bounds += morton_primitives[morton_idx].bounds;
+    if (split_method == "middle" || split_method == "hlbvh") {
+        return SplitMethod::middle;
     }
 
-    Bounds3f right_bounds;
-    for (uint morton_idx = mid_idx; morton_idx < node.first_primitive_idx + node.num_primitives;
-         morton_idx++) {
-        right_bounds += morton_primitives[morton_idx].bounds;
+    if (split_method == "sbvh") {
+        return SplitMethod::sbvh;
     }
 
-    build_nodes[left_child_idx].init_leaf(node.first_primitive_idx,
-                                          mid_idx - node.first_primitive_idx, left_bounds);
-    build_nodes[right_child_idx].init_leaf(
-        mid_idx, node.num_primitives - (mid_idx - node.first_primitive_idx), right_bounds);
+    if (split_method == "equalcounts") {
+        // pbrt-v4 method not implemented here: the closest one is splitting at the middle
+        printf("%s(): BVH split method `equalcounts` not implemented, fall back to `middle`\n",
+               __func__);
+        return SplitMethod::middle;
+    }
 
-    build_nodes[args.build_node_idx].init_interior(split_dimension, left_child_idx,
-                                                   left_bounds + right_bounds);
+    printf("%s(): unknown BVH split method `%s` (expected sah, middle, hlbvh, equalcounts or "
+           "sbvh), fall back to `sah`\n",
+           __func__, split_method.c_str());
+    return SplitMethod::sah;
 }
 
-void HLBVH::build_bvh(const std::vector<const Primitive *> &gpu_primitives,
-                      GPUMemoryAllocator &allocator) {
-    auto start_sorting = std::chrono::system_clock::now();
+void HLBVH::compact_build_nodes(GPUMemoryAllocator &allocator) {
+    // keep only the nodes reachable from the root, laid out breadth first:
+    // children of leaves that failed to split are dropped, siblings stay adjacent
+    std::vector<BVHBuildNode> compacted_nodes = {build_nodes[0]};
+    for (uint idx = 0; idx < compacted_nodes.size(); ++idx) {
+        if (compacted_nodes[idx].is_leaf()) {
+            continue;
+        }
 
-    primitives = nullptr;
-    morton_primitives = nullptr;
-    build_nodes = nullptr;
+        const uint left_child_idx = compacted_nodes[idx].left_child_idx;
+        compacted_nodes[idx].left_child_idx = compacted_nodes.size();
 
-    uint num_total_primitives = gpu_primitives.size();
-    if (num_total_primitives == 0) {
-        return;
+        compacted_nodes.push_back(build_nodes[left_child_idx]);
+        compacted_nodes.push_back(build_nodes[left_child_idx + 1]);
     }
 
-    printf("\ntotal primitives: %u\n", num_total_primitives);
-
-    GPUMemoryAllocator local_allocator;
+    num_build_nodes = compacted_nodes.size();
+    build_nodes = allocator.allocate<BVHBuildNode>(num_build_nodes);
+    CHECK_CUDA_ERROR(cudaMemcpy(build_nodes, compacted_nodes.data(),
+                                sizeof(BVHBuildNode) * compacted_nodes.size(),
+                                cudaMemcpyHostToDevice));
 
-    auto sparse_treelets = local_allocator.allocate<Treelet>(MAX_TREELET_NUM);
+    printf("HLBVH: %zu nodes after compacting (%.2f MB)\n", compacted_nodes.size(),
+           double(sizeof(BVHBuildNode) * compacted_nodes.size()) / (1024 * 1024));
+}
 
-    auto gpu_morton_primitives = allocator.allocate<MortonPrimitive>(num_total_primitives);
-    auto gpu_primitives_array = allocator.allocate<const Primitive *>(num_total_primitives);
+FloatType HLBVH::compute_sah_cost() const {
+    const FloatType root_surface_area = build_nodes[0].bounds.surface_area();
+    if (root_surface_area <= 0) {
+        return 0;
+    }
 
-    CHECK_CUDA_ERROR(cudaMemcpy(gpu_primitives_array, gpu_primitives.data(),
-                                sizeof(Primitive *) * num_total_primitives,
-                                cudaMemcpyHostToDevice));
+    // every compacted node is reachable from the root
+    FloatType sah_cost = 0;
+    for (uint idx = 0; idx < num_build_nodes; ++idx) {
+        const auto &node = build_nodes[idx];
+        sah_cost += node.bounds.surface_area() / root_surface_area *
+                    (node.is_leaf() ? node.num_primitives : build_options.traversal_cost);
+    }
 
-    this->init(gpu_primitives_array, gpu_morton_primitives);
+    return sah_cost;
+}
 
-    constexpr uint threads = 1024;
-    {
-        const uint blocks = divide_and_ceil(num_total_primitives, threads);
-        hlbvh_init_morton_primitives<<<blocks, threads>>>(morton_primitives, primitives,
-                                                          num_total_primitives);
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+void HLBVH::record_reference_surface_areas(GPUMemoryAllocator &allocator) {
+    if (num_build_nodes > reference_surface_areas_capacity) {
+        // only a rebuild that grows the tree needs a larger buffer
+        reference_surface_areas = allocator.allocate<FloatType>(num_build_nodes);
+        reference_surface_areas_capacity = num_build_nodes;
     }
 
-    {
-        const uint blocks = divide_and_ceil(MAX_TREELET_NUM, threads);
-        hlbvh_init_treelets<<<blocks, threads>>>(sparse_treelets);
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    for (uint idx = 0; idx < num_build_nodes; ++idx) {
+        reference_surface_areas[idx] = build_nodes[idx].bounds.surface_area();
     }
 
-    Bounds3f bounds_of_primitives_centroids;
-    for (uint idx = 0; idx < num_total_primitives; idx++) {
-        bounds_of_primitives_centroids += gpu_morton_primitives[idx].bounds.centroid();
-    }
-    auto max_dim = bounds_of_primitives_centroids.max_dimension();
-    auto radius = (bounds_of_primitives_centroids.p_max[max_dim] -
-                   bounds_of_primitives_centroids.p_min[max_dim]) /
-                  2;
-    auto adjusted_p_min = bounds_of_primitives_centroids.p_min;
-    auto adjusted_p_max = bounds_of_primitives_centroids.p_max;
-    for (uint dim = 0; dim < 3; ++dim) {
-        if (dim == max_dim) {
+    reference_sah_cost = compute_sah_cost();
+}
+
+void HLBVH::rebuild_degraded_subtrees(const uint num_total_primitives,
+                                      GPUMemoryAllocator &allocator) {
+    const auto is_degraded = [&](const uint node_idx) {
+        const auto &node = build_nodes[node_idx];
+        if (node.is_leaf() && node.num_primitives <= 1) {
+            return false;
+        }
+
+        return node.bounds.surface_area() >
+               reference_surface_areas[node_idx] * (1 + build_options.max_refit_sah_growth);
+    };
+
+    // copy the tree breadth first as compact_build_nodes() does, but collapse every topmost
+    // degraded subtree into one leaf over its primitives (made contiguous in morton order)
+    // these leaves are then split again by the bottom builder
+    std::vector<BVHBuildNode> nodes = {build_nodes[0]};
+    std::vector<uint> old_node_indices = {0};
+    std::vector<MortonPrimitive> reordered_primitives;
+    reordered_primitives.reserve(num_total_primitives);
+
+    std::vector<uint> collapsed_leaves;
+    uint num_collapsed_primitives = 0;
+
+    for (uint idx = 0; idx < nodes.size(); ++idx) {
+        const uint old_node_idx = old_node_indices[idx];
+        const uint first_primitive_idx = reordered_primitives.size();
+
+        if (!nodes[idx].is_leaf() && !is_degraded(old_node_idx)) {
+            const uint left_child_idx = nodes[idx].left_child_idx;
+            nodes[idx].left_child_idx = nodes.size();
+
+            nodes.push_back(build_nodes[left_child_idx]);
+            nodes.push_back(build_nodes[left_child_idx + 1]);
+            old_node_indices.push_back(left_child_idx);
+            old_node_indices.push_back(left_child_idx + 1);
             continue;
         }
-        auto center = bounds_of_primitives_centroids.centroid()[dim];
-        adjusted_p_min[dim] = center - radius;
-        adjusted_p_max[dim] = center + radius;
-    }
-    bounds_of_primitives_centroids = Bounds3f(adjusted_p_min, adjusted_p_max);
-    // after adjusting bounds, all treelets grids are of the same size
 
-    {
-        const uint blocks = divide_and_ceil(num_total_primitives, threads);
-        hlbvh_compute_morton_code<<<blocks, threads>>>(morton_primitives, num_total_primitives,
-                                                       bounds_of_primitives_centroids);
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
-    }
+        std::vector<uint> nodes_to_visit = {old_node_idx};
+        while (!nodes_to_visit.empty()) {
+            const auto &node = build_nodes[nodes_to_visit.back()];
+            nodes_to_visit.pop_back();
 
-    auto primitives_counter = local_allocator.allocate<uint>(MAX_TREELET_NUM);
-    auto primitives_indices_offset = local_allocator.allocate<uint>(MAX_TREELET_NUM);
+            if (node.is_leaf()) {
+                reordered_primitives.insert(
+                    reordered_primitives.end(), morton_primitives + node.first_primitive_idx,
+                    morton_primitives + node.first_primitive_idx + node.num_primitives);
+                continue;
+            }
 
-    {
-        const uint blocks = divide_and_ceil(MAX_TREELET_NUM, threads);
+            nodes_to_visit.push_back(node.left_child_idx + 1);
+            nodes_to_visit.push_back(node.left_child_idx);
+        }
 
-        init_array<<<blocks, threads>>>(primitives_counter, uint(0), MAX_TREELET_NUM);
-        init_array<<<blocks, threads>>>(primitives_indices_offset, uint(0), MAX_TREELET_NUM);
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+        const uint num_primitives = reordered_primitives.size() - first_primitive_idx;
+        nodes[idx].init_leaf(first_primitive_idx, num_primitives, nodes[idx].bounds);
+
+        if (is_degraded(old_node_idx)) {
+            collapsed_leaves.push_back(idx);
+            num_collapsed_primitives += num_primitives;
+        }
     }
 
-    {
-        const uint blocks = divide_and_ceil(num_total_primitives, threads);
-        count_primitives_for_treelets<<<blocks, threads>>>(primitives_counter, morton_primitives,
-                                                           num_total_primitives);
+    printf("HLBVH: rebuilding %zu degraded subtrees (%u primitives)\n", collapsed_leaves.size(),
+           num_collapsed_primitives);
 
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
-    }
-    for (uint idx = 1; idx < MAX_TREELET_NUM; ++idx) {
-        primitives_indices_offset[idx] =
-            primitives_indices_offset[idx - 1] + primitives_counter[idx - 1];
+    if (collapsed_leaves.empty()) {
+        return;
     }
 
-    {
-        const uint blocks = divide_and_ceil(MAX_TREELET_NUM, threads);
+    ThreadPool thread_pool;
+    GPUMemoryAllocator local_allocator;
 
-        init_array<<<blocks, threads>>>(primitives_counter, uint(0), MAX_TREELET_NUM);
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
-    }
+    const uint max_build_node_length = nodes.size() + 3 * num_collapsed_primitives;
+    build_nodes = local_allocator.allocate<BVHBuildNode>(max_build_node_length);
 
-    auto buffer_morton_primitives = local_allocator.allocate<MortonPrimitive>(num_total_primitives);
-    {
-        const uint blocks = divide_and_ceil(num_total_primitives, threads);
-        sort_morton_primitives<<<blocks, threads>>>(buffer_morton_primitives, morton_primitives,
-                                                    primitives_counter, primitives_indices_offset,
-                                                    num_total_primitives);
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
-    }
+    CHECK_CUDA_ERROR(cudaMemcpy(build_nodes, nodes.data(), sizeof(BVHBuildNode) * nodes.size(),
+                                cudaMemcpyHostToDevice));
+    CHECK_CUDA_ERROR(cudaMemcpy(morton_primitives, reordered_primitives.data(),
+                                sizeof(MortonPrimitive) * reordered_primitives.size(),
+                                cudaMemcpyHostToDevice));
 
-    CHECK_CUDA_ERROR(cudaMemcpy(morton_primitives, buffer_morton_primitives,
-                                sizeof(MortonPrimitive) * num_total_primitives,
-                                cudaMemcpyDeviceToDevice));
+    uint depth = 0;
+    build_bottom_bvh_on_host(std::move(collapsed_leaves), nodes.size(), thread_pool, depth);
 
-    for (uint treelet_idx = 0; treelet_idx < MAX_TREELET_NUM; ++treelet_idx) {
-        sparse_treelets[treelet_idx].first_primitive_offset =
-            primitives_indices_offset[treelet_idx];
-        sparse_treelets[treelet_idx].n_primitives = primitives_counter[treelet_idx];
-        // bounds is not computed so far
-    }
-    {
-        // compute bounds
-        const uint blocks = divide_and_ceil(MAX_TREELET_NUM, threads);
-        compute_treelet_bounds<<<blocks, threads>>>(sparse_treelets, morton_primitives);
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
-    }
+    compact_build_nodes(allocator);
+}
 
-    std::vector<uint> dense_treelet_indices;
-    {
-        uint max_primitive_num_in_a_treelet = 0;
-        uint verify_counter = 0;
-        for (uint idx = 0; idx < MAX_TREELET_NUM; idx++) {
-            uint current_treelet_primitives_num = sparse_treelets[idx].n_primitives;
-            if (current_treelet_primitives_num <= 0) {
-                continue;
+void HLBVH::restructure_treelets(GPUMemoryAllocator &allocator) {
+    // treelet restructuring (Karras and Aila 2013) without collapsing subtrees into leaves:
+    // every interior node, bottom up, is the root of a treelet whose topology is replaced
+    // with the one of minimal SAH cost over the same treelet leaves
+    PhaseTimer timer;
+    ThreadPool thread_pool;
+
+    const FloatType sah_cost_before = compute_sah_cost();
+
+    // unnormalized SAH cost of the subtree below each node
+    std::vector<FloatType> node_costs(num_build_nodes);
+
+    for (uint pass = 0; pass < build_options.restructure_passes; ++pass) {
+        // split the tree into subtrees handled by separate jobs, the nodes above them
+        // (in breadth-first order) are restructured afterwards from the bottom up
+        std::vector<uint> top_nodes;
+        std::vector<uint> subtree_roots = {0};
+        while (subtree_roots.size() < thread_pool.num_threads() * 4) {
+            std::vector<uint> next_subtree_roots;
+            for (const auto node_idx : subtree_roots) {
+                const auto &node = build_nodes[node_idx];
+                if (node.is_leaf()) {
+                    next_subtree_roots.push_back(node_idx);
+                    continue;
+                }
+
+                top_nodes.push_back(node_idx);
+                next_subtree_roots.push_back(node.left_child_idx);
+                next_subtree_roots.push_back(node.left_child_idx + 1);
+            }
+
+            if (next_subtree_roots.size() == subtree_roots.size()) {
+                break;
             }
+            subtree_roots = std::move(next_subtree_roots);
+        }
 
-            verify_counter += current_treelet_primitives_num;
+        thread_pool.parallel_for(0, subtree_roots.size(), [&](const uint start, const uint end) {
+            for (uint idx = start; idx < end; ++idx) {
+                // reversed preorder visits every node after its descendants
+                std::vector<uint> preorder;
+                std::vector<uint> nodes_to_visit = {subtree_roots[idx]};
+                while (!nodes_to_visit.empty()) {
+                    const uint node_idx = nodes_to_visit.back();
+                    nodes_to_visit.pop_back();
+                    preorder.push_back(node_idx);
+
+                    const auto &node = build_nodes[node_idx];
+                    if (!node.is_leaf()) {
+                        nodes_to_visit.push_back(node.left_child_idx);
+                        nodes_to_visit.push_back(node.left_child_idx + 1);
+                    }
+                }
+
+                for (auto node_idx = preorder.rbegin(); node_idx != preorder.rend(); ++node_idx) {
+                    restructure_treelet(*node_idx, node_costs);
+                }
+            }
+        });
 
-            max_primitive_num_in_a_treelet =
-                std::max(max_primitive_num_in_a_treelet, current_treelet_primitives_num);
-            dense_treelet_indices.push_back(idx);
+        for (auto node_idx = top_nodes.rbegin(); node_idx != top_nodes.rend(); ++node_idx) {
+            restructure_treelet(*node_idx, node_costs);
         }
+    }
+    timer.record("restructuring");
 
-        if (verify_counter != num_total_primitives) {
-            REPORT_FATAL_ERROR();
+    // slots were reused out of order: restore the breadth-first layout
+    compact_build_nodes(allocator);
+    timer.record("compacting");
+
+    printf("HLBVH: treelet restructuring (%u passes): SAH cost %.2f -> %.2f\n",
+           build_options.restructure_passes, sah_cost_before, compute_sah_cost());
+    timer.report("BVH restructuring");
+}
+
+void HLBVH::restructure_treelet(const uint root_idx, std::vector<FloatType> &node_costs) {
+    const auto &root = build_nodes[root_idx];
+
+    if (root.is_leaf()) {
+        node_costs[root_idx] = root.bounds.surface_area() * root.num_primitives;
+        return;
+    }
+
+    // grow the treelet by opening its largest interior leaf
+    uint num_leaves = 2;
+    uint treelet_leaves[MAX_TREELET_LEAVES] = {root.left_child_idx, root.left_child_idx + 1};
+
+    uint num_pairs = 1;
+    uint sibling_pairs[MAX_TREELET_LEAVES - 1] = {root.left_child_idx};
+    // slots of the treelet's nodes below the root, reused for the new topology
+
+    while (num_leaves < MAX_TREELET_LEAVES) {
+        int largest_idx = -1;
+        FloatType largest_area = -1;
+        for (uint idx = 0; idx < num_leaves; ++idx) {
+            const auto &node = build_nodes[treelet_leaves[idx]];
+            if (!node.is_leaf() && node.bounds.surface_area() > largest_area) {
+                largest_idx = idx;
+                largest_area = node.bounds.surface_area();
+            }
+        }
+
+        if (largest_idx < 0) {
+            break;
         }
 
-        printf("HLBVH: %zu/%d (%.2f%) treelets filled (max primitives in a treelet: %d)\n",
-               dense_treelet_indices.size(), MAX_TREELET_NUM,
-               double(dense_treelet_indices.size()) / MAX_TREELET_NUM * 100,
-               max_primitive_num_in_a_treelet);
+        const uint left_child_idx = build_nodes[treelet_leaves[largest_idx]].left_child_idx;
+        treelet_leaves[largest_idx] = left_child_idx;
+        treelet_leaves[num_leaves] = left_child_idx + 1;
+        sibling_pairs[num_pairs] = left_child_idx;
+
+        num_leaves += 1;
+        num_pairs += 1;
     }
 
-    auto dense_treelets = local_allocator.allocate<Treelet>(dense_treelet_indices.size());
-    for (uint idx = 0; idx < dense_treelet_indices.size(); idx++) {
-        uint sparse_idx = dense_treelet_indices[idx];
-        CHECK_CUDA_ERROR(cudaMemcpy(&dense_treelets[idx], &sparse_treelets[sparse_idx],
-                                    sizeof(Treelet), cudaMemcpyDeviceToDevice));
+    // optimal cost of every subset of treelet leaves by dynamic programming
+    const uint num_subsets = 1 << num_leaves;
+    const uint full_set = num_subsets - 1;
+
+    Bounds3f subset_bounds[1 << MAX_TREELET_LEAVES];
+    FloatType subset_costs[1 << MAX_TREELET_LEAVES];
+    uint best_partitions[1 << MAX_TREELET_LEAVES];
+
+    BVHBuildNode leaf_nodes[MAX_TREELET_LEAVES];
+    FloatType leaf_costs[MAX_TREELET_LEAVES];
+    for (uint idx = 0; idx < num_leaves; ++idx) {
+        leaf_nodes[idx] = build_nodes[treelet_leaves[idx]];
+        leaf_costs[idx] = node_costs[treelet_leaves[idx]];
     }
 
-    uint max_build_node_length =
-        (2 * dense_treelet_indices.size() + 1) + (2 * num_total_primitives + 1);
+    for (uint subset = 1; subset < num_subsets; ++subset) {
+        const uint lowest_bit = subset & (~subset + 1);
+        if (subset == lowest_bit) {
+            const uint leaf_idx = __builtin_ctz(subset);
+            subset_bounds[subset] = leaf_nodes[leaf_idx].bounds;
+            subset_costs[subset] = leaf_costs[leaf_idx];
+            continue;
+        }
 
-    build_nodes = allocator.allocate<BVHBuildNode>(max_build_node_length);
+        subset_bounds[subset] = subset_bounds[lowest_bit] + subset_bounds[subset ^ lowest_bit];
 
-    auto start_top_bvh = std::chrono::system_clock::now();
+        // only partitions keeping the lowest leaf on the left: each split is tried once
+        FloatType best_cost = Infinity;
+        for (uint partition = (subset - 1) & subset; partition > 0;
+             partition = (partition - 1) & subset) {
+            if ((partition & lowest_bit) == 0) {
+                continue;
+            }
 
-    ThreadPool thread_pool;
-    const uint top_bvh_node_num =
-        build_top_bvh_for_treelets(dense_treelets, dense_treelet_indices.size(), thread_pool);
+            const FloatType cost = subset_costs[partition] + subset_costs[subset ^ partition];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_partitions[subset] = partition;
+            }
+        }
 
-    auto start_bottom_bvh = std::chrono::system_clock::now();
+        subset_costs[subset] =
+            build_options.traversal_cost * subset_bounds[subset].surface_area() + best_cost;
+    }
 
-    uint start = 0;
-    uint end = top_bvh_node_num;
+    const FloatType current_cost = build_options.traversal_cost * root.bounds.surface_area() +
+                                   node_costs[root.left_child_idx] +
+                                   node_costs[root.left_child_idx + 1];
 
-    auto shared_offset = local_allocator.allocate<uint>();
-    *shared_offset = end;
+    if (subset_costs[full_set] >= current_cost * (1 - 1e-5)) {
+        node_costs[root_idx] = current_cost;
+        return;
+    }
 
-    uint depth = 0;
+    // rewrite the treelet top-down with the best partitions,
+    // treelet leaves (with the subtrees below them) move to new slots as they are
+    uint num_used_pairs = 0;
 
-    uint last_allocated_size = (end - start) * 4;
-    auto bvh_args_array = local_allocator.allocate<BottomBVHArgs>(last_allocated_size);
+    std::pair<uint, uint> subsets_to_emit[2 * MAX_TREELET_LEAVES];
+    uint num_subsets_to_emit = 0;
+    subsets_to_emit[num_subsets_to_emit++] = {full_set, root_idx};
 
-    while (end > start) {
-        const uint array_length = end - start;
+    while (num_subsets_to_emit > 0) {
+        const auto [subset, node_idx] = subsets_to_emit[--num_subsets_to_emit];
 
-        if (array_length > last_allocated_size) {
-            // to avoid unnecessarily repeated memory allocation
-            uint current_size = array_length * 2;
-            bvh_args_array = local_allocator.allocate<BottomBVHArgs>(current_size);
-            last_allocated_size = current_size;
+        if ((subset & (subset - 1)) == 0) {
+            const uint leaf_idx = __builtin_ctz(subset);
+            build_nodes[node_idx] = leaf_nodes[leaf_idx];
+            node_costs[node_idx] = leaf_costs[leaf_idx];
+            continue;
         }
 
-        {
-            uint blocks = divide_and_ceil(array_length, threads);
-            init_bvh_args<<<blocks, threads>>>(bvh_args_array, build_nodes, shared_offset, start,
-                                               end);
-            CHECK_CUDA_ERROR(cudaGetLastError());
-            CHECK_CUDA_ERROR(cudaDeviceSynchronize());
-        }
+        uint left_subset = best_partitions[subset];
+        uint right_subset = subset ^ left_subset;
 
-        if (DEBUG_MODE) {
-            printf("HLBVH: building bottom BVH: depth %u, node number: %u\n", depth, array_length);
+        // traversal expects the left child to be the lower one along the split axis
+        const Bounds3f bounds_of_centroids(subset_bounds[left_subset].centroid(),
+                                           subset_bounds[right_subset].centroid());
+        const uint8_t axis = bounds_of_centroids.max_dimension();
+        if (subset_bounds[left_subset].centroid()[axis] >
+            subset_bounds[right_subset].centroid()[axis]) {
+            std::swap(left_subset, right_subset);
         }
 
-        depth += 1;
-        start = end;
-        end = *shared_offset;
+        const uint left_child_idx = sibling_pairs[num_used_pairs++];
+        build_nodes[node_idx].init_interior(axis, left_child_idx, subset_bounds[subset]);
+        node_costs[node_idx] = subset_costs[subset];
 
-        uint blocks = divide_and_ceil(array_length, threads);
+        subsets_to_emit[num_subsets_to_emit++] = {left_subset, left_child_idx};
+        subsets_to_emit[num_subsets_to_emit++] = {right_subset, left_child_idx + 1};
+    }
+}
 
-        hlbvh_build_bottom_bvh<<<blocks, threads>>>(bvh_args_array, array_length, this);
-        CHECK_CUDA_ERROR(cudaGetLastError());
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+void HLBVH::report_sah_cost() const {
+    if (build_nodes == nullptr) {
+        return;
     }
 
-    printf("HLBVH: bottom BVH nodes: %u, max depth: %u, max primitives in a leaf: %u\n",
-           end - top_bvh_node_num, depth, MAX_PRIMITIVES_NUM_IN_LEAF);
-    printf("HLBVH: total nodes: %u/%u\n", end, max_build_node_length);
+    const FloatType root_surface_area = build_nodes[0].bounds.surface_area();
+    if (root_surface_area <= 0) {
+        return;
+    }
+
+    FloatType sah_cost = 0;
+    uint num_leaves = 0;
+    uint num_leaf_primitives = 0;
+    uint max_depth = 0;
 
-    const std::chrono::duration<FloatType> duration_sorting{start_top_bvh - start_sorting};
+    // zombie children left by failed splits are never reached from the root
+    std::vector<std::pair<uint, uint>> nodes_to_visit = {{0, 0}};
+    while (!nodes_to_visit.empty()) {
+        const auto [node_idx, depth] = nodes_to_visit.back();
+        nodes_to_visit.pop_back();
 
-    const std::chrono::duration<FloatType> duration_top_bvh{start_bottom_bvh - start_sorting};
+        const auto &node = build_nodes[node_idx];
+        const FloatType probability = node.bounds.surface_area() / root_surface_area;
+        max_depth = std::max(max_depth, depth);
+
+        if (node.is_leaf()) {
+            sah_cost += probability * node.num_primitives;
+            num_leaves += 1;
+            num_leaf_primitives += node.num_primitives;
+            continue;
+        }
 
-    const std::chrono::duration<FloatType> duration_bottom_bvh{std::chrono::system_clock::now() -
-                                                               start_bottom_bvh};
+        sah_cost += probability * build_options.traversal_cost;
+        nodes_to_visit.emplace_back(node.left_child_idx, depth + 1);
+        nodes_to_visit.emplace_back(node.left_child_idx + 1, depth + 1);
+    }
 
-    printf("BVH constructing took %.2f seconds "
-           "(sorting: %.2f, top SAH-BVH building: %.2f, bottom BVH building: %.2f)\n",
-           (duration_sorting + duration_top_bvh + duration_bottom_bvh).count(),
-           duration_sorting.count(), duration_top_bvh.count(), duration_bottom_bvh.count());
+    printf("HLBVH: SAH cost: %.2f (traversal cost: %.3f, leaves: %u, average primitives in a "
+           "leaf: %.2f, max depth: %u)\n",
+           sah_cost, build_options.traversal_cost, num_leaves,
+           double(num_leaf_primitives) / num_leaves, max_depth);
 }
 
 uint HLBVH::build_top_bvh_for_treelets(const Treelet *treelets, const uint num_dense_treelets,
@@ -725,9 +2278,10 @@ void HLBVH::build_upper_sah(uint build_node_idx, std::vector<uint> treelet_indic
             count_right += buckets[right].count;
         }
 
-        sah_cost[split_idx] = 0.125 + (count_left * bounds_left.surface_area() +
-                                       count_right * bounds_right.surface_area()) /
-                                          total_surface_area;
+        sah_cost[split_idx] = build_options.traversal_cost +
+                              (count_left * bounds_left.surface_area() +
+                               count_right * bounds_right.surface_area()) /
+                                  total_surface_area;
     }
 
     // Find bucket to split at that minimizes SAH metric
@@ -825,7 +2379,91 @@ void HLBVH::build_upper_sah(uint build_node_idx, std::vector<uint> treelet_indic
     }
 }
 
-PBRT_GPU
+PBRT_CPU_GPU
+pbrt::optional<FloatType> HLBVH::find_sah_split(const BVHBuildNode &node,
+                                                const Bounds3f &bounds_of_centroid,
+                                                uint8_t &split_dimension) const {
+    // buckets along all 3 axes: split_dimension is set to the cheapest one
+    int min_cost_split = -1;
+    FloatType min_cost = Infinity;
+
+    for (uint8_t dimension = 0; dimension < 3; ++dimension) {
+        const auto base_val = bounds_of_centroid.p_min[dimension];
+        const auto span = bounds_of_centroid.p_max[dimension] - base_val;
+        if (span <= 0) {
+            // all centroids coincide along this axis: no split could separate them
+            continue;
+        }
+
+        uint counts[NUM_BOTTOM_BUCKETS] = {0};
+        Bounds3f bucket_bounds[NUM_BOTTOM_BUCKETS];
+        for (uint morton_idx = node.first_primitive_idx;
+             morton_idx < node.first_primitive_idx + node.num_primitives; morton_idx++) {
+            const auto &morton_primitive = morton_primitives[morton_idx];
+
+            uint bucket_idx =
+                NUM_BOTTOM_BUCKETS * ((morton_primitive.centroid[dimension] - base_val) / span);
+            if (bucket_idx >= NUM_BOTTOM_BUCKETS) {
+                bucket_idx = NUM_BOTTOM_BUCKETS - 1;
+            }
+
+            counts[bucket_idx] += 1;
+            bucket_bounds[bucket_idx] += morton_primitive.bounds;
+        }
+
+        // sweep from the right for the cost of the right half, then from the left for the rest
+        FloatType costs[NUM_BOTTOM_BUCKETS - 1];
+        {
+            Bounds3f bounds_right;
+            uint count_right = 0;
+            for (uint split_idx = NUM_BOTTOM_BUCKETS - 1; split_idx > 0; --split_idx) {
+                bounds_right += bucket_bounds[split_idx];
+                count_right += counts[split_idx];
+                costs[split_idx - 1] =
+                    count_right > 0 ? count_right * bounds_right.surface_area() : 0;
+            }
+        }
+
+        Bounds3f bounds_left;
+        uint count_left = 0;
+        for (uint split_idx = 0; split_idx < NUM_BOTTOM_BUCKETS - 1; ++split_idx) {
+            bounds_left += bucket_bounds[split_idx];
+            count_left += counts[split_idx];
+
+            if (count_left == 0 || count_left == node.num_primitives) {
+                // one side is empty
+                continue;
+            }
+
+            const auto cost = costs[split_idx] + count_left * bounds_left.surface_area();
+            if (cost < min_cost) {
+                min_cost = cost;
+                min_cost_split = split_idx;
+                split_dimension = dimension;
+            }
+        }
+    }
+
+    if (min_cost_split < 0) {
+        return {};
+    }
+
+    const auto surface_area = node.bounds.surface_area();
+    if (node.num_primitives <= build_options.max_primitives_in_leaf && surface_area > 0) {
+        const FloatType leaf_cost = node.num_primitives;
+        const FloatType split_cost = build_options.traversal_cost + min_cost / surface_area;
+
+        if (leaf_cost <= split_cost) {
+            return {};
+        }
+    }
+
+    const auto base_val = bounds_of_centroid.p_min[split_dimension];
+    const auto span = bounds_of_centroid.p_max[split_dimension] - base_val;
+    return base_val + span * FloatType(min_cost_split + 1) / NUM_BOTTOM_BUCKETS;
+}
+
+PBRT_CPU_GPU
 uint HLBVH::partition_morton_primitives(const uint start, const uint end,
                                         const uint8_t split_dimension, const FloatType split_val) {
     // taken and modified from
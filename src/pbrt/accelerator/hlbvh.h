@@ -4,16 +4,20 @@
 #include <pbrt/base/shape.h>
 #include <pbrt/euclidean_space/bounds3.h>
 #include <atomic>
+#include <string>
 #include <vector>
 
+class BVHCache;
 class GPUMemoryAllocator;
 class ThreadPool;
+class TriangleBlocks;
+class WideBVH;
 
 class HLBVH {
   public:
     struct MortonPrimitive {
         uint primitive_idx;
-        uint32_t morton_code;
+        uint64_t morton_code;
         Bounds3f bounds;
         Point3f centroid;
     };
@@ -73,8 +77,54 @@ class HLBVH {
         }
     };
 
-    static const HLBVH *create(const std::vector<const Primitive *> &gpu_primitives,
-                               GPUMemoryAllocator &allocator);
+    struct BuildOptions {
+        enum class SplitMethod {
+            middle,
+            sah,
+            sbvh,
+            // full SAH build on host with spatial splits instead of treelets
+        };
+
+        bool build_on_host = false;
+        // run every construction phase with the host ThreadPool instead of CUDA kernels
+
+        SplitMethod bottom_split_method = SplitMethod::sah;
+        // how leaves within a treelet are split (the top levels always use SAH):
+        // SAH by default as in pbrt-v4, middle splits build faster but trace slower
+
+        FloatType max_duplicated_references = 0.25;
+        // references spatial splits may add, relative to the number of primitives
+
+        uint max_primitives_in_leaf = 1;
+
+        FloatType traversal_cost = 0.125;
+        // cost of visiting an interior node relative to intersecting one primitive
+
+        uint wide_bvh_width = 0;
+        // collapse the binary tree into 4- or 8-wide nodes for traversal, 0 to keep it binary
+
+        bool quantized_nodes = false;
+        // store child bounds of wide nodes in 8 bits relative to their parent
+
+        uint triangle_block_width = 0;
+        // copy leaf triangles into SoA blocks of 4 or 8 to test them together, 0 to disable
+
+        bool stackless_traversal = false;
+        // follow parent links instead of keeping a traversal stack for every ray
+        // (always the case once the tree is too deep for the stack)
+
+        uint restructure_passes = 0;
+        // rounds of treelet restructuring over the finished tree to lower its SAH cost
+
+        FloatType max_refit_sah_growth = 0.25;
+        // refit() rebuilds degraded subtrees once the SAH cost grows by more than this ratio
+
+        static SplitMethod parse_split_method(const std::string &split_method);
+    };
+
+    static HLBVH *create(const std::vector<const Primitive *> &gpu_primitives,
+                         const BuildOptions &options, GPUMemoryAllocator &allocator,
+                         BVHCache *cache = nullptr);
 
     PBRT_CPU_GPU
     Bounds3f bounds() const {
@@ -91,32 +141,124 @@ class HLBVH {
     PBRT_CPU_GPU
     pbrt::optional<ShapeIntersection> intersect(const Ray &ray, FloatType t_max) const;
 
-    PBRT_GPU
-    void build_bottom_bvh(const BottomBVHArgs *bvh_args_array, uint array_length);
+    PBRT_CPU_GPU
+    pbrt::optional<PrimitiveHit> intersect_hit(const Ray &ray, FloatType t_max) const;
+    // only the closest hit gets its SurfaceInteraction built, by intersect()
 
-  private:
-    void init(const Primitive **_primitives, MortonPrimitive *gpu_morton_primitives) {
-        primitives = _primitives;
-        morton_primitives = gpu_morton_primitives;
-        build_nodes = nullptr;
-    }
+    static constexpr uint MAX_PACKET_SIZE = 16;
+
+    PBRT_CPU_GPU
+    void intersect_packet(const Ray *rays, uint num_rays, FloatType t_max,
+                          pbrt::optional<ShapeIntersection> *intersections) const;
+    // coherent rays (such as camera rays of a 4x4 pixel tile) share one traversal of the
+    // binary nodes, which are culled for the whole packet at once
+
+    PBRT_CPU_GPU
+    void fast_intersect_packet(const Ray *rays, const FloatType *t_max, uint num_rays,
+                               bool *occluded) const;
+    // any-hit version of intersect_packet() with a t_max per ray, for shadow rays:
+    // a ray leaves the packet traversal once it hits anything
 
+    PBRT_CPU_GPU
+    void build_bottom_bvh(const BottomBVHArgs &args);
+
+    void refit(GPUMemoryAllocator &allocator);
+    // update bounds after primitives moved while keeping the topology
+
+  private:
     void build_bvh(const std::vector<const Primitive *> &gpu_primitives,
-                   GPUMemoryAllocator &allocator);
+                   const BuildOptions &options, GPUMemoryAllocator &allocator, BVHCache *cache);
+
+    void build_bvh_on_device(uint num_total_primitives, GPUMemoryAllocator &allocator);
+
+    void build_bvh_on_host(uint num_total_primitives, GPUMemoryAllocator &allocator);
+
+    void build_bvh_with_spatial_splits(uint num_total_primitives, GPUMemoryAllocator &allocator);
+
+    uint build_bottom_bvh_on_host(std::vector<uint> nodes, uint offset, ThreadPool &thread_pool,
+                                  uint &depth);
+
+    void build_traversal_structures(GPUMemoryAllocator &allocator);
+
+    void build_wide_bvh(GPUMemoryAllocator &allocator);
+
+    void build_parent_links(GPUMemoryAllocator &allocator);
+
+    uint compute_max_depth() const;
+
+    PBRT_CPU_GPU
+    bool fast_intersect_leaf(const BVHBuildNode &node, const Ray &ray,
+                             const RayPrecomputation &ray_precomputation, FloatType t_max) const;
+
+    PBRT_CPU_GPU
+    void intersect_leaf(const BVHBuildNode &node, const Ray &ray,
+                        const RayPrecomputation &ray_precomputation, FloatType &best_t,
+                        pbrt::optional<PrimitiveHit> &best_hit) const;
+
+    PBRT_CPU_GPU
+    uint next_node_stackless(uint node_idx, const int dir_is_neg[3]) const;
+
+    PBRT_CPU_GPU
+    bool fast_intersect_stackless(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                                  FloatType t_max) const;
+
+    PBRT_CPU_GPU
+    pbrt::optional<PrimitiveHit>
+    intersect_hit_stackless(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                            FloatType t_max) const;
 
     uint build_top_bvh_for_treelets(const Treelet *treelets, uint num_dense_treelets,
                                     ThreadPool &thread_pool);
 
+    void compact_build_nodes(GPUMemoryAllocator &allocator);
+
+    void report_sah_cost() const;
+
+    FloatType compute_sah_cost() const;
+
+    void record_reference_surface_areas(GPUMemoryAllocator &allocator);
+
+    void restructure_treelets(GPUMemoryAllocator &allocator);
+
+    void restructure_treelet(uint root_idx, std::vector<FloatType> &node_costs);
+
+    void rebuild_degraded_subtrees(uint num_total_primitives, GPUMemoryAllocator &allocator);
+
     void build_upper_sah(uint build_node_idx, std::vector<uint> treelet_indices,
                          const Treelet *treelets, std::atomic_int &node_count,
                          ThreadPool &thread_pool, bool spawn);
 
-    PBRT_GPU
+    PBRT_CPU_GPU
+    pbrt::optional<FloatType> find_sah_split(const BVHBuildNode &node,
+                                             const Bounds3f &bounds_of_centroid,
+                                             uint8_t &split_dimension) const;
+
+    PBRT_CPU_GPU
     uint partition_morton_primitives(uint start, uint end, uint8_t split_dimension,
                                      FloatType split_val);
 
+    BuildOptions build_options;
+
     const Primitive **primitives;
 
     MortonPrimitive *morton_primitives;
+    uint num_morton_primitives;
+    // references into primitives, a primitive appears more than once after spatial splits
+
     BVHBuildNode *build_nodes;
+    uint num_build_nodes;
+
+    FloatType *reference_surface_areas;
+    uint reference_surface_areas_capacity;
+    FloatType reference_sah_cost;
+    // node areas and SAH cost refit() compares against
+
+    const uint *parent_links;
+    // for every node: parent index << 3 | parent split axis << 1 | is right child
+    // nullptr unless traversal is stackless
+
+    TriangleBlocks *triangle_blocks;
+
+    WideBVH *wide_bvh;
+    // both are refit in place as long as the binary tree keeps its topology
 };
@@ -0,0 +1,416 @@
+#include <pbrt/accelerator/sbvh_builder.h>
+#include <pbrt/util/thread_pool.h>
+#include <mutex>
+
+constexpr uint NUM_OBJECT_BINS = 32;
+constexpr uint NUM_SPATIAL_BINS = 32;
+
+constexpr uint MAX_SAH_LEAF_SIZE = 16;
+// a node larger than this is split even when SAH prefers a leaf
+
+constexpr uint MAX_DEPTH = 64;
+
+constexpr FloatType MIN_OVERLAP_RATIO = 1e-5;
+// relative to the scene surface area (alpha in the paper)
+
+static bool is_valid(const Bounds3f &bounds) {
+    // unlike Bounds3f::is_empty(), flat bounds (of axis-aligned triangles) are valid
+    return bounds.p_min.x <= bounds.p_max.x && bounds.p_min.y <= bounds.p_max.y &&
+           bounds.p_min.z <= bounds.p_max.z;
+}
+
+static uint bin_of(const FloatType val, const FloatType base, const FloatType span,
+                   const uint num_bins) {
+    const int bin_idx = (val - base) / span * num_bins;
+    return std::clamp<int>(bin_idx, 0, num_bins - 1);
+}
+
+SBVHBuilder::SBVHBuilder(const Primitive **_primitives, const uint _num_primitives,
+                         const HLBVH::BuildOptions &_options)
+    : primitives(_primitives), num_primitives(_num_primitives), options(_options),
+      min_overlap_area(0), remaining_duplicates(0), node_count(0), reference_count(0),
+      spatial_split_count(0) {}
+
+void SBVHBuilder::build(ThreadPool &thread_pool) {
+    const int64_t max_duplicates = num_primitives * options.max_duplicated_references;
+    remaining_duplicates = max_duplicates;
+
+    references.resize(num_primitives + max_duplicates);
+    build_nodes.resize(2 * references.size());
+    // every leaf holds at least one reference
+
+    std::vector<Reference> root_references(num_primitives);
+
+    std::mutex mtx;
+    Bounds3f scene_bounds;
+    thread_pool.parallel_for(0, num_primitives, [&](const uint start, const uint end) {
+        Bounds3f local_bounds;
+        for (uint idx = start; idx < end; ++idx) {
+            const auto bounds = primitives[idx]->bounds();
+
+            root_references[idx].primitive_idx = idx;
+            root_references[idx].morton_code = 0;
+            root_references[idx].bounds = bounds;
+            root_references[idx].centroid = bounds.centroid();
+
+            local_bounds += bounds;
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        scene_bounds += local_bounds;
+    });
+
+    min_overlap_area = scene_bounds.surface_area() * MIN_OVERLAP_RATIO;
+    node_count = 1;
+    reference_count = 0;
+    spatial_split_count = 0;
+
+    thread_pool.submit([this, _root_references = std::move(root_references), scene_bounds,
+                        &thread_pool] {
+        build_node(0, _root_references, scene_bounds, 0, thread_pool, true);
+    });
+    thread_pool.sync();
+
+    build_nodes.resize(node_count.load());
+    references.resize(reference_count.load());
+}
+
+SBVHBuilder::Split SBVHBuilder::find_object_split(const std::vector<Reference> &node_references,
+                                                  const Bounds3f &bounds_of_centroids,
+                                                  const FloatType node_area,
+                                                  Bounds3f &left_bounds,
+                                                  Bounds3f &right_bounds) const {
+    Split best_split;
+
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        const auto base = bounds_of_centroids.p_min[axis];
+        const auto span = bounds_of_centroids.p_max[axis] - base;
+        if (span <= 0) {
+            continue;
+        }
+
+        uint counts[NUM_OBJECT_BINS] = {0};
+        Bounds3f bins[NUM_OBJECT_BINS];
+        for (const auto &reference : node_references) {
+            const uint bin_idx = bin_of(reference.centroid[axis], base, span, NUM_OBJECT_BINS);
+            counts[bin_idx] += 1;
+            bins[bin_idx] += reference.bounds;
+        }
+
+        // sweep from the right first so the left sweep can evaluate each plane
+        Bounds3f right_sweep[NUM_OBJECT_BINS];
+        right_sweep[NUM_OBJECT_BINS - 1] = bins[NUM_OBJECT_BINS - 1];
+        for (int bin_idx = NUM_OBJECT_BINS - 2; bin_idx >= 0; --bin_idx) {
+            right_sweep[bin_idx] = right_sweep[bin_idx + 1] + bins[bin_idx];
+        }
+
+        Bounds3f left_sweep;
+        uint count_left = 0;
+        for (uint split_idx = 0; split_idx < NUM_OBJECT_BINS - 1; ++split_idx) {
+            left_sweep += bins[split_idx];
+            count_left += counts[split_idx];
+
+            const uint count_right = node_references.size() - count_left;
+            if (count_left == 0 || count_right == 0) {
+                continue;
+            }
+
+            const FloatType cost =
+                options.traversal_cost +
+                (count_left * left_sweep.surface_area() +
+                 count_right * right_sweep[split_idx + 1].surface_area()) /
+                    node_area;
+
+            if (cost < best_split.cost) {
+                best_split.cost = cost;
+                best_split.axis = axis;
+                best_split.position = base + span * (split_idx + 1) / NUM_OBJECT_BINS;
+                best_split.spatial = false;
+
+                left_bounds = left_sweep;
+                right_bounds = right_sweep[split_idx + 1];
+            }
+        }
+    }
+
+    return best_split;
+}
+
+SBVHBuilder::Split SBVHBuilder::find_spatial_split(const std::vector<Reference> &node_references,
+                                                   const Bounds3f &node_bounds,
+                                                   const FloatType node_area) const {
+    Split best_split;
+
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        const auto base = node_bounds.p_min[axis];
+        const auto span = node_bounds.p_max[axis] - base;
+        if (span <= 0) {
+            continue;
+        }
+
+        const auto bin_boundary = [&](const uint boundary_idx) {
+            return base + span * boundary_idx / NUM_SPATIAL_BINS;
+        };
+
+        // a reference enters at its first bin and exits at its last one,
+        // bins in between receive the clipped bounds of the part inside them
+        uint entries[NUM_SPATIAL_BINS] = {0};
+        uint exits[NUM_SPATIAL_BINS] = {0};
+        Bounds3f bins[NUM_SPATIAL_BINS];
+
+        for (const auto &reference : node_references) {
+            const uint first_bin = bin_of(reference.bounds.p_min[axis], base, span, NUM_SPATIAL_BINS);
+            const uint last_bin = bin_of(reference.bounds.p_max[axis], base, span, NUM_SPATIAL_BINS);
+
+            entries[first_bin] += 1;
+            exits[last_bin] += 1;
+
+            if (first_bin == last_bin) {
+                bins[first_bin] += reference.bounds;
+                continue;
+            }
+
+            for (uint bin_idx = first_bin; bin_idx <= last_bin; ++bin_idx) {
+                auto slab = reference.bounds;
+                slab.p_min[axis] = std::max(slab.p_min[axis], bin_boundary(bin_idx));
+                slab.p_max[axis] = std::min(slab.p_max[axis], bin_boundary(bin_idx + 1));
+
+                const auto clipped_bounds = primitives[reference.primitive_idx]->clip_bounds(slab);
+                if (is_valid(clipped_bounds)) {
+                    bins[bin_idx] += clipped_bounds;
+                }
+            }
+        }
+
+        Bounds3f right_sweep[NUM_SPATIAL_BINS];
+        uint right_counts[NUM_SPATIAL_BINS];
+        right_sweep[NUM_SPATIAL_BINS - 1] = bins[NUM_SPATIAL_BINS - 1];
+        right_counts[NUM_SPATIAL_BINS - 1] = exits[NUM_SPATIAL_BINS - 1];
+        for (int bin_idx = NUM_SPATIAL_BINS - 2; bin_idx >= 0; --bin_idx) {
+            right_sweep[bin_idx] = right_sweep[bin_idx + 1] + bins[bin_idx];
+            right_counts[bin_idx] = right_counts[bin_idx + 1] + exits[bin_idx];
+        }
+
+        Bounds3f left_sweep;
+        uint count_left = 0;
+        for (uint split_idx = 0; split_idx < NUM_SPATIAL_BINS - 1; ++split_idx) {
+            left_sweep += bins[split_idx];
+            count_left += entries[split_idx];
+
+            const uint count_right = right_counts[split_idx + 1];
+            if (count_left == 0 || count_right == 0) {
+                continue;
+            }
+
+            const FloatType cost =
+                options.traversal_cost +
+                (count_left * left_sweep.surface_area() +
+                 count_right * right_sweep[split_idx + 1].surface_area()) /
+                    node_area;
+
+            if (cost < best_split.cost) {
+                best_split.cost = cost;
+                best_split.axis = axis;
+                best_split.position = bin_boundary(split_idx + 1);
+                best_split.spatial = true;
+            }
+        }
+    }
+
+    return best_split;
+}
+
+void SBVHBuilder::split_reference(const Reference &reference, const uint8_t axis,
+                                  const FloatType position, Reference &left,
+                                  Reference &right) const {
+    const auto primitive = primitives[reference.primitive_idx];
+
+    auto left_box = reference.bounds;
+    left_box.p_max[axis] = position;
+
+    auto right_box = reference.bounds;
+    right_box.p_min[axis] = position;
+
+    left = reference;
+    left.bounds = primitive->clip_bounds(left_box);
+    left.centroid = left.bounds.centroid();
+
+    right = reference;
+    right.bounds = primitive->clip_bounds(right_box);
+    right.centroid = right.bounds.centroid();
+}
+
+void SBVHBuilder::make_leaf(const uint build_node_idx,
+                            const std::vector<Reference> &node_references,
+                            const Bounds3f &node_bounds) {
+    const uint first_reference_idx = reference_count.fetch_add(node_references.size());
+    std::copy(node_references.begin(), node_references.end(),
+              references.begin() + first_reference_idx);
+
+    build_nodes[build_node_idx].init_leaf(first_reference_idx, node_references.size(),
+                                          node_bounds);
+}
+
+void SBVHBuilder::build_node(const uint build_node_idx, std::vector<Reference> node_references,
+                             const Bounds3f &node_bounds, const uint depth,
+                             ThreadPool &thread_pool, const bool spawn) {
+    const uint num_references = node_references.size();
+    if (num_references <= std::max<uint>(options.max_primitives_in_leaf, 1) ||
+        depth >= MAX_DEPTH) {
+        make_leaf(build_node_idx, node_references, node_bounds);
+        return;
+    }
+
+    Bounds3f bounds_of_centroids;
+    for (const auto &reference : node_references) {
+        bounds_of_centroids += reference.centroid;
+    }
+
+    const FloatType node_area = node_bounds.surface_area();
+
+    Bounds3f object_left_bounds;
+    Bounds3f object_right_bounds;
+    const auto object_split = find_object_split(node_references, bounds_of_centroids, node_area,
+                                                object_left_bounds, object_right_bounds);
+
+    auto split = object_split;
+    uint num_duplicates = 0;
+
+    const bool children_overlap =
+        object_split.cost == Infinity ||
+        (is_valid(object_left_bounds.intersection(object_right_bounds)) &&
+         object_left_bounds.intersection(object_right_bounds).surface_area() > min_overlap_area);
+
+    if (children_overlap && remaining_duplicates.load() > 0) {
+        const auto spatial_split = find_spatial_split(node_references, node_bounds, node_area);
+
+        if (spatial_split.cost < object_split.cost) {
+            for (const auto &reference : node_references) {
+                if (reference.bounds.p_min[spatial_split.axis] < spatial_split.position &&
+                    reference.bounds.p_max[spatial_split.axis] > spatial_split.position) {
+                    num_duplicates += 1;
+                }
+            }
+
+            // claim the duplicated references from the budget, or fall back to object split
+            if (remaining_duplicates.fetch_sub(num_duplicates) >= num_duplicates) {
+                split = spatial_split;
+            } else {
+                remaining_duplicates.fetch_add(num_duplicates);
+                num_duplicates = 0;
+            }
+        }
+    }
+
+    if (split.cost == Infinity ||
+        (split.cost >= num_references && num_references <= MAX_SAH_LEAF_SIZE)) {
+        make_leaf(build_node_idx, node_references, node_bounds);
+        return;
+    }
+
+    std::vector<Reference> left_references;
+    std::vector<Reference> right_references;
+    left_references.reserve(num_references);
+    right_references.reserve(num_references);
+
+    for (const auto &reference : node_references) {
+        if (!split.spatial) {
+            (reference.centroid[split.axis] < split.position ? left_references : right_references)
+                .push_back(reference);
+            continue;
+        }
+
+        if (reference.bounds.p_max[split.axis] <= split.position) {
+            left_references.push_back(reference);
+            continue;
+        }
+
+        if (reference.bounds.p_min[split.axis] >= split.position) {
+            right_references.push_back(reference);
+            continue;
+        }
+
+        Reference left;
+        Reference right;
+        split_reference(reference, split.axis, split.position, left, right);
+
+        if (is_valid(left.bounds)) {
+            left_references.push_back(left);
+        }
+        if (is_valid(right.bounds)) {
+            right_references.push_back(right);
+        }
+    }
+
+    if (left_references.empty() || right_references.empty()) {
+        // binning and partitioning disagreed on float rounding: split at the median
+        remaining_duplicates.fetch_add(num_duplicates);
+        if (num_references <= MAX_SAH_LEAF_SIZE) {
+            make_leaf(build_node_idx, node_references, node_bounds);
+            return;
+        }
+
+        split.axis = bounds_of_centroids.max_dimension();
+        split.spatial = false;
+
+        const auto axis = split.axis;
+        std::nth_element(node_references.begin(), node_references.begin() + num_references / 2,
+                         node_references.end(), [axis](const Reference &a, const Reference &b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
+
+        left_references.assign(node_references.begin(),
+                               node_references.begin() + num_references / 2);
+        right_references.assign(node_references.begin() + num_references / 2,
+                                node_references.end());
+    }
+
+    if (split.spatial) {
+        spatial_split_count.fetch_add(1);
+    }
+
+    node_references.clear();
+    node_references.shrink_to_fit();
+
+    Bounds3f left_bounds;
+    for (const auto &reference : left_references) {
+        left_bounds += reference.bounds;
+    }
+
+    Bounds3f right_bounds;
+    for (const auto &reference : right_references) {
+        right_bounds += reference.bounds;
+    }
+
+    const uint left_build_node_idx = node_count.fetch_add(2);
+    const uint right_build_node_idx = left_build_node_idx + 1;
+
+    build_nodes[build_node_idx].init_interior(split.axis, left_build_node_idx,
+                                              left_bounds + right_bounds);
+
+    constexpr uint MIN_SIZE_TO_SPAWN = 1024;
+    // don't bother to send jobs into queue when the size is too small
+
+    if (spawn && left_references.size() >= MIN_SIZE_TO_SPAWN) {
+        thread_pool.submit([this, left_build_node_idx, _left_references = std::move(left_references),
+                            left_bounds, depth, &thread_pool] {
+            build_node(left_build_node_idx, _left_references, left_bounds, depth + 1, thread_pool,
+                       true);
+        });
+    } else {
+        build_node(left_build_node_idx, std::move(left_references), left_bounds, depth + 1,
+                   thread_pool, spawn);
+    }
+
+    if (spawn && right_references.size() >= MIN_SIZE_TO_SPAWN) {
+        thread_pool.submit([this, right_build_node_idx,
+                            _right_references = std::move(right_references), right_bounds, depth,
+                            &thread_pool] {
+            build_node(right_build_node_idx, _right_references, right_bounds, depth + 1,
+                       thread_pool, true);
+        });
+    } else {
+        build_node(right_build_node_idx, std::move(right_references), right_bounds, depth + 1,
+                   thread_pool, spawn);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <pbrt/accelerator/hlbvh.h>
+#include <atomic>
+#include <vector>
+
+class ThreadPool;
+
+class SBVHBuilder {
+    // spatial split BVH (Stich et al. 2009): binned SAH over object splits and spatial splits,
+    // a spatial split clips the references straddling it into both children
+  public:
+    SBVHBuilder(const Primitive **_primitives, uint _num_primitives,
+                const HLBVH::BuildOptions &_options);
+
+    void build(ThreadPool &thread_pool);
+
+    std::vector<HLBVH::MortonPrimitive> references;
+    // grouped by leaf: a primitive appears once for every leaf it was clipped into
+    // (morton_code is unused)
+
+    std::vector<HLBVH::BVHBuildNode> build_nodes;
+
+    uint num_spatial_splits() const {
+        return spatial_split_count.load();
+    }
+
+  private:
+    using Reference = HLBVH::MortonPrimitive;
+
+    struct Split {
+        FloatType cost = Infinity;
+        uint8_t axis = 0;
+        FloatType position = 0;
+        bool spatial = false;
+    };
+
+    Split find_object_split(const std::vector<Reference> &node_references,
+                            const Bounds3f &bounds_of_centroids, FloatType node_area,
+                            Bounds3f &left_bounds, Bounds3f &right_bounds) const;
+
+    Split find_spatial_split(const std::vector<Reference> &node_references,
+                             const Bounds3f &node_bounds, FloatType node_area) const;
+
+    void split_reference(const Reference &reference, uint8_t axis, FloatType position,
+                         Reference &left, Reference &right) const;
+
+    void build_node(uint build_node_idx, std::vector<Reference> node_references,
+                    const Bounds3f &node_bounds, uint depth, ThreadPool &thread_pool,
+                    bool spawn);
+
+    void make_leaf(uint build_node_idx, const std::vector<Reference> &node_references,
+                   const Bounds3f &node_bounds);
+
+    const Primitive **primitives;
+    uint num_primitives;
+    HLBVH::BuildOptions options;
+
+    FloatType min_overlap_area;
+    // spatial splits are only tried where object split children overlap more than this
+
+    std::atomic<int64_t> remaining_duplicates;
+    std::atomic<uint> node_count;
+    std::atomic<uint> reference_count;
+    std::atomic<uint> spatial_split_count;
+};
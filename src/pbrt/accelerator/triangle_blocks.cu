@@ -0,0 +1,287 @@
+#include <pbrt/accelerator/triangle_blocks.h>
+#include <pbrt/base/primitive.h>
+#include <pbrt/gpu/gpu_memory_allocator.h>
+#include <pbrt/shapes/triangle.h>
+#include <algorithm>
+
+
+TriangleBlocks *TriangleBlocks::create(const HLBVH::BVHBuildNode *build_nodes,
+                                       const uint num_build_nodes,
+                                       HLBVH::MortonPrimitive *morton_primitives,
+                                       const uint num_morton_primitives,
+                                       const Primitive **primitives, const uint width,
+                                       GPUMemoryAllocator &allocator) {
+    if (width != 4 && width != 8) {
+        printf("\n%s(): illegal triangle block width: %u (expect 4 or 8)\n", __func__, width);
+        REPORT_FATAL_ERROR();
+    }
+
+    auto triangle_blocks = allocator.allocate<TriangleBlocks>();
+    triangle_blocks->width = width;
+    triangle_blocks->morton_primitives = morton_primitives;
+    triangle_blocks->primitives = primitives;
+
+    auto leaves = allocator.allocate<LeafTriangles>(num_morton_primitives);
+
+    std::vector<uint> lane_morton_indices;
+    uint num_triangles = 0;
+
+    for (uint node_idx = 0; node_idx < num_build_nodes; ++node_idx) {
+        const auto &node = build_nodes[node_idx];
+        if (!node.is_leaf()) {
+            continue;
+        }
+
+        const auto is_triangle = [&](const HLBVH::MortonPrimitive &morton_primitive) {
+            return primitives[morton_primitive.primitive_idx]->get_triangle().has_value();
+        };
+
+        const auto first = morton_primitives + node.first_primitive_idx;
+        const auto last_triangle =
+            std::stable_partition(first, first + node.num_primitives, is_triangle);
+
+        auto &leaf = leaves[node.first_primitive_idx];
+        leaf.num_triangles = last_triangle - first;
+        leaf.first_block_idx = lane_morton_indices.size() / width;
+
+        triangle_blocks->append_lanes(node.first_primitive_idx, leaf.num_triangles,
+                                      lane_morton_indices);
+
+        leaf.num_blocks = lane_morton_indices.size() / width - leaf.first_block_idx;
+        num_triangles += leaf.num_triangles;
+    }
+
+    triangle_blocks->leaves = leaves;
+
+    const uint num_blocks = lane_morton_indices.size() / width;
+    triangle_blocks->num_blocks = num_blocks;
+
+    if (width == 4) {
+        triangle_blocks->blocks = allocator.allocate<TriangleBlock<4>>(num_blocks);
+        triangle_blocks->fill_blocks<4>(lane_morton_indices);
+    } else {
+        triangle_blocks->blocks = allocator.allocate<TriangleBlock<8>>(num_blocks);
+        triangle_blocks->fill_blocks<8>(lane_morton_indices);
+    }
+
+    printf("HLBVH: %u triangles in %u blocks of %u (%.2f%% lanes used, %.2f MB)\n", num_triangles,
+           num_blocks, width, double(num_triangles) / std::max<uint>(num_blocks * width, 1) * 100,
+           double((width == 4 ? sizeof(TriangleBlock<4>) : sizeof(TriangleBlock<8>)) *
+                  num_blocks) /
+               (1024 * 1024));
+
+    return triangle_blocks;
+}
+
+bool TriangleBlocks::refit(const HLBVH::BVHBuildNode *build_nodes, const uint num_build_nodes) {
+    std::vector<uint> lane_morton_indices;
+    for (uint node_idx = 0; node_idx < num_build_nodes; ++node_idx) {
+        const auto &node = build_nodes[node_idx];
+        if (!node.is_leaf()) {
+            continue;
+        }
+
+        const auto &leaf = leaves[node.first_primitive_idx];
+        if (leaf.first_block_idx != lane_morton_indices.size() / width) {
+            return false;
+        }
+
+        // leaves are still partitioned: only triangles turned (non-)degenerate move lanes
+        append_lanes(node.first_primitive_idx, leaf.num_triangles, lane_morton_indices);
+
+        if (leaf.num_blocks != lane_morton_indices.size() / width - leaf.first_block_idx) {
+            return false;
+        }
+    }
+
+    if (lane_morton_indices.size() != num_blocks * width) {
+        return false;
+    }
+
+    if (width == 4) {
+        if (!same_lanes<4>(lane_morton_indices)) {
+            return false;
+        }
+        fill_blocks<4>(lane_morton_indices);
+    } else {
+        if (!same_lanes<8>(lane_morton_indices)) {
+            return false;
+        }
+        fill_blocks<8>(lane_morton_indices);
+    }
+
+    return true;
+}
+
+void TriangleBlocks::append_lanes(const uint first_morton_idx, const uint num_triangles,
+                                  std::vector<uint> &lane_morton_indices) const {
+    for (uint morton_idx = first_morton_idx; morton_idx < first_morton_idx + num_triangles;
+         ++morton_idx) {
+        Point3f p[3];
+        primitives[morton_primitives[morton_idx].primitive_idx]->get_triangle()->get_points(p);
+
+        // never hit by Triangle::intersect() either
+        if ((p[2] - p[0]).cross(p[1] - p[0]).squared_length() == 0.0) {
+            continue;
+        }
+
+        lane_morton_indices.push_back(morton_idx);
+    }
+
+    // pad the last block with its first triangle
+    const uint last_block_start = lane_morton_indices.size() / width * width;
+    while (lane_morton_indices.size() % width != 0) {
+        lane_morton_indices.push_back(lane_morton_indices[last_block_start]);
+    }
+}
+
+template <uint WIDTH>
+bool TriangleBlocks::same_lanes(const std::vector<uint> &lane_morton_indices) const {
+    const auto _blocks = static_cast<const TriangleBlock<WIDTH> *>(blocks);
+
+    for (uint idx = 0; idx < lane_morton_indices.size(); ++idx) {
+        if (_blocks[idx / WIDTH].morton_idx[idx % WIDTH] != lane_morton_indices[idx]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <uint WIDTH>
+void TriangleBlocks::fill_blocks(const std::vector<uint> &lane_morton_indices) {
+    auto _blocks = static_cast<TriangleBlock<WIDTH> *>(blocks);
+
+    for (uint idx = 0; idx < lane_morton_indices.size(); ++idx) {
+        auto &block = _blocks[idx / WIDTH];
+        const uint lane = idx % WIDTH;
+        const uint morton_idx = lane_morton_indices[idx];
+
+        Point3f p[3];
+        primitives[morton_primitives[morton_idx].primitive_idx]->get_triangle()->get_points(p);
+
+        for (uint vertex = 0; vertex < 3; ++vertex) {
+            for (uint axis = 0; axis < 3; ++axis) {
+                block.p[vertex][axis][lane] = p[vertex][axis];
+            }
+        }
+        block.morton_idx[lane] = morton_idx;
+    }
+}
+
+template <uint WIDTH>
+PBRT_CPU_GPU bool TriangleBlocks::fast_intersect_blocks(const Ray &ray,
+                                                        const RayPrecomputation &ray_precomputation,
+                                                        FloatType t_max,
+                                                        const LeafTriangles &leaf) const {
+    const auto _blocks = static_cast<const TriangleBlock<WIDTH> *>(blocks);
+
+    FloatType t_hit[WIDTH];
+    FloatType b[3][WIDTH];
+    const uint end_block_idx = leaf.first_block_idx + leaf.num_blocks;
+    for (uint block_idx = leaf.first_block_idx; block_idx < end_block_idx; ++block_idx) {
+        if (Triangle::intersect_triangles<WIDTH>(ray, ray_precomputation, t_max,
+                                                 _blocks[block_idx].p, t_hit, b)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template <uint WIDTH>
+PBRT_CPU_GPU void TriangleBlocks::intersect_blocks(const Ray &ray,
+                                                   const RayPrecomputation &ray_precomputation,
+                                                   const LeafTriangles &leaf, FloatType &best_t,
+                                                   pbrt::optional<PrimitiveHit> &best_hit) const {
+    const auto _blocks = static_cast<const TriangleBlock<WIDTH> *>(blocks);
+
+    FloatType t_hit[WIDTH];
+    FloatType b[3][WIDTH];
+    const uint end_block_idx = leaf.first_block_idx + leaf.num_blocks;
+    for (uint block_idx = leaf.first_block_idx; block_idx < end_block_idx; ++block_idx) {
+        const auto &block = _blocks[block_idx];
+
+        const uint hit_mask = Triangle::intersect_triangles<WIDTH>(ray, ray_precomputation, best_t,
+                                                                   block.p, t_hit, b);
+        if (hit_mask == 0) {
+            continue;
+        }
+
+        // min-reduce over the lanes: the ones missed are at infinity
+        uint closest_lane = 0;
+        for (uint lane = 1; lane < WIDTH; ++lane) {
+            closest_lane = t_hit[lane] <= t_hit[closest_lane] ? lane : closest_lane;
+        }
+
+        if (t_hit[closest_lane] > best_t) {
+            continue;
+        }
+        best_t = t_hit[closest_lane];
+
+        // the same record Triangle::intersect_hit() gives for this triangle
+        const uint primitive_idx = morton_primitives[block.morton_idx[closest_lane]].primitive_idx;
+        best_hit = PrimitiveHit{
+            .primitive = primitives[primitive_idx],
+            .render_from_primitive = nullptr,
+            .shape_hit =
+                ShapeHit{
+                    .t_hit = t_hit[closest_lane],
+                    .coordinates = Point3f(b[0][closest_lane], b[1][closest_lane],
+                                           b[2][closest_lane]),
+                    .phi = 0,
+                },
+        };
+    }
+}
+
+PBRT_CPU_GPU
+bool TriangleBlocks::fast_intersect_leaf(const Ray &ray,
+                                         const RayPrecomputation &ray_precomputation,
+                                         FloatType t_max, const uint first_morton_idx,
+                                         const uint num_primitives) const {
+    const auto &leaf = leaves[first_morton_idx];
+
+    const bool hit = width == 4 ? fast_intersect_blocks<4>(ray, ray_precomputation, t_max, leaf)
+                                : fast_intersect_blocks<8>(ray, ray_precomputation, t_max, leaf);
+    if (hit) {
+        return true;
+    }
+
+    for (uint morton_idx = first_morton_idx + leaf.num_triangles;
+         morton_idx < first_morton_idx + num_primitives; ++morton_idx) {
+        const uint primitive_idx = morton_primitives[morton_idx].primitive_idx;
+        if (primitives[primitive_idx]->fast_intersect(ray, ray_precomputation, t_max)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+PBRT_CPU_GPU
+void TriangleBlocks::intersect_leaf(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                                    const uint first_morton_idx, const uint num_primitives,
+                                    FloatType &best_t,
+                                    pbrt::optional<PrimitiveHit> &best_hit) const {
+    const auto &leaf = leaves[first_morton_idx];
+
+    if (width == 4) {
+        intersect_blocks<4>(ray, ray_precomputation, leaf, best_t, best_hit);
+    } else {
+        intersect_blocks<8>(ray, ray_precomputation, leaf, best_t, best_hit);
+    }
+
+    for (uint morton_idx = first_morton_idx + leaf.num_triangles;
+         morton_idx < first_morton_idx + num_primitives; ++morton_idx) {
+        const uint primitive_idx = morton_primitives[morton_idx].primitive_idx;
+
+        auto hit = primitives[primitive_idx]->intersect_hit(ray, ray_precomputation, best_t);
+        if (!hit) {
+            continue;
+        }
+
+        best_t = hit->shape_hit.t_hit;
+        best_hit = hit;
+    }
+}
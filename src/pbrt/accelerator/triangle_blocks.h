@@ -0,0 +1,80 @@
+#pragma once
+
+#include <pbrt/accelerator/hlbvh.h>
+
+class GPUMemoryAllocator;
+
+template <uint WIDTH>
+struct alignas(32) TriangleBlock {
+    static constexpr uint width = WIDTH;
+
+    FloatType p[3][3][WIDTH];
+    // vertex positions in SoA layout: p[vertex][axis][lane]
+    // unused lanes repeat the first triangle so they never report another hit
+
+    uint morton_idx[WIDTH];
+};
+
+class TriangleBlocks {
+    // triangles of every leaf copied next to each other in leaf order, so testing them reads
+    // neither Primitive, Shape, Triangle nor TriangleMesh: only the closest hit goes through
+    // its Primitive to build the interaction
+  public:
+    static TriangleBlocks *create(const HLBVH::BVHBuildNode *build_nodes, uint num_build_nodes,
+                                  HLBVH::MortonPrimitive *morton_primitives,
+                                  uint num_morton_primitives, const Primitive **primitives,
+                                  uint width, GPUMemoryAllocator &allocator);
+    // reorders the morton primitives of every leaf so its triangles come first
+
+    bool refit(const HLBVH::BVHBuildNode *build_nodes, uint num_build_nodes);
+    // copies moved vertices into the existing blocks: false (blocks untouched) when a
+    // triangle turned degenerate or back so the lanes no longer match, create() again then
+
+    PBRT_CPU_GPU
+    bool fast_intersect_leaf(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                             FloatType t_max, uint first_morton_idx, uint num_primitives) const;
+
+    PBRT_CPU_GPU
+    void intersect_leaf(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                        uint first_morton_idx, uint num_primitives, FloatType &best_t,
+                        pbrt::optional<PrimitiveHit> &best_hit) const;
+    // replaces best_hit with any closer hit in the leaf
+
+  private:
+    struct LeafTriangles {
+        uint first_block_idx;
+        uint num_blocks;
+        uint num_triangles;
+        // the first num_triangles morton primitives of the leaf, degenerate ones in no block
+    };
+
+    void append_lanes(uint first_morton_idx, uint num_triangles,
+                      std::vector<uint> &lane_morton_indices) const;
+    // the non-degenerate triangles of a leaf, padded to whole blocks
+
+    template <uint WIDTH>
+    bool same_lanes(const std::vector<uint> &lane_morton_indices) const;
+
+    template <uint WIDTH>
+    void fill_blocks(const std::vector<uint> &lane_morton_indices);
+
+    template <uint WIDTH>
+    PBRT_CPU_GPU bool fast_intersect_blocks(const Ray &ray,
+                                            const RayPrecomputation &ray_precomputation,
+                                            FloatType t_max, const LeafTriangles &leaf) const;
+
+    template <uint WIDTH>
+    PBRT_CPU_GPU void intersect_blocks(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                                       const LeafTriangles &leaf, FloatType &best_t,
+                                       pbrt::optional<PrimitiveHit> &best_hit) const;
+
+    uint width;
+    uint num_blocks;
+    void *blocks;
+
+    const LeafTriangles *leaves;
+    // indexed by the first morton primitive of a leaf
+
+    const HLBVH::MortonPrimitive *morton_primitives;
+    const Primitive **primitives;
+};
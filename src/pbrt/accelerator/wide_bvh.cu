@@ -0,0 +1,651 @@
+#include <pbrt/accelerator/triangle_blocks.h>
+#include <pbrt/accelerator/wide_bvh.h>
+#include <pbrt/gpu/gpu_memory_allocator.h>
+#include <pbrt/util/stack.h>
+#include <tuple>
+
+#if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+#include <immintrin.h>
+#endif
+
+struct WideBVHRay {
+    float o[3];
+    float inv_dir[3];
+    int dir_is_neg[3];
+
+    PBRT_CPU_GPU
+    WideBVHRay(const Ray &ray, const RayPrecomputation &ray_precomputation) {
+        for (uint axis = 0; axis < 3; ++axis) {
+            o[axis] = ray.o[axis];
+            inv_dir[axis] = ray_precomputation.inv_dir[axis];
+            dir_is_neg[axis] = ray_precomputation.dir_is_neg[axis];
+        }
+    }
+};
+
+struct WideBVHStackEntry {
+    uint child_idx;
+    uint num_primitives;
+    float t_entry;
+};
+
+
+static float round_down_to_float(const FloatType val) {
+    float result = val;
+    if (result > val) {
+        result = std::nextafter(result, -std::numeric_limits<float>::infinity());
+    }
+
+    return result;
+}
+
+static float round_up_to_float(const FloatType val) {
+    float result = val;
+    if (result < val) {
+        result = std::nextafter(result, std::numeric_limits<float>::infinity());
+    }
+
+    return result;
+}
+
+template <uint WIDTH>
+PBRT_CPU_GPU static uint intersect_children(const WideBVHNode<WIDTH> &node, const WideBVHRay &ray,
+                                            const float t_max, float t_entry[WIDTH]) {
+    // returns a bit mask of the children hit, t_entry is filled for all of them
+    // a NaN from (plane - o) * inv_dir (origin on a plane parallel to the ray) ignores that slab,
+    // as Bounds3::fast_intersect() does
+    const float robust_factor = 1.0 + 2.0 * gamma(3);
+
+#if defined(__SSE2__) && !defined(__CUDA_ARCH__)
+    uint hit_mask = 0;
+
+#if defined(__AVX__)
+    if constexpr (WIDTH % 8 == 0) {
+        for (uint base = 0; base < WIDTH; base += 8) {
+            __m256 t_near = _mm256_setzero_ps();
+            __m256 t_far = _mm256_set1_ps(t_max);
+
+            for (uint axis = 0; axis < 3; ++axis) {
+                const float *near_planes =
+                    ray.dir_is_neg[axis] ? node.bounds_max[axis] : node.bounds_min[axis];
+                const float *far_planes =
+                    ray.dir_is_neg[axis] ? node.bounds_min[axis] : node.bounds_max[axis];
+
+                const __m256 o = _mm256_set1_ps(ray.o[axis]);
+                const __m256 inv_dir = _mm256_set1_ps(ray.inv_dir[axis]);
+
+                const __m256 t0 =
+                    _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_planes + base), o), inv_dir);
+                const __m256 t1 = _mm256_mul_ps(
+                    _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_planes + base), o), inv_dir),
+                    _mm256_set1_ps(robust_factor));
+
+                // max/min return the 2nd operand when either is NaN
+                t_near = _mm256_max_ps(t0, t_near);
+                t_far = _mm256_min_ps(t1, t_far);
+            }
+
+            _mm256_storeu_ps(t_entry + base, t_near);
+            hit_mask |= uint(_mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ))) << base;
+        }
+
+        return hit_mask;
+    }
+#endif
+
+    for (uint base = 0; base < WIDTH; base += 4) {
+        __m128 t_near = _mm_setzero_ps();
+        __m128 t_far = _mm_set1_ps(t_max);
+
+        for (uint axis = 0; axis < 3; ++axis) {
+            const float *near_planes =
+                ray.dir_is_neg[axis] ? node.bounds_max[axis] : node.bounds_min[axis];
+            const float *far_planes =
+                ray.dir_is_neg[axis] ? node.bounds_min[axis] : node.bounds_max[axis];
+
+            const __m128 o = _mm_set1_ps(ray.o[axis]);
+            const __m128 inv_dir = _mm_set1_ps(ray.inv_dir[axis]);
+
+            const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_planes + base), o), inv_dir);
+            const __m128 t1 =
+                _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_planes + base), o), inv_dir),
+                           _mm_set1_ps(robust_factor));
+
+            // max/min return the 2nd operand when either is NaN
+            t_near = _mm_max_ps(t0, t_near);
+            t_far = _mm_min_ps(t1, t_far);
+        }
+
+        _mm_storeu_ps(t_entry + base, t_near);
+        hit_mask |= uint(_mm_movemask_ps(_mm_cmple_ps(t_near, t_far))) << base;
+    }
+
+    return hit_mask;
+#else
+    uint hit_mask = 0;
+    for (uint child = 0; child < WIDTH; ++child) {
+        float t_near = 0;
+        float t_far = t_max;
+
+        for (uint axis = 0; axis < 3; ++axis) {
+            const float near_plane = ray.dir_is_neg[axis] ? node.bounds_max[axis][child]
+                                                          : node.bounds_min[axis][child];
+            const float far_plane = ray.dir_is_neg[axis] ? node.bounds_min[axis][child]
+                                                         : node.bounds_max[axis][child];
+
+            const float t0 = (near_plane - ray.o[axis]) * ray.inv_dir[axis];
+            const float t1 = (far_plane - ray.o[axis]) * ray.inv_dir[axis] * robust_factor;
+
+            // comparisons with NaN are false: the slab is skipped
+            t_near = t0 > t_near ? t0 : t_near;
+            t_far = t1 < t_far ? t1 : t_far;
+        }
+
+        t_entry[child] = t_near;
+        if (t_near <= t_far) {
+            hit_mask |= 1u << child;
+        }
+    }
+
+    return hit_mask;
+#endif
+}
+
+template <uint WIDTH>
+PBRT_CPU_GPU static uint intersect_children(const QuantizedWideBVHNode<WIDTH> &node,
+                                            const WideBVHRay &ray, const float t_max,
+                                            float t_entry[WIDTH]) {
+    WideBVHNode<WIDTH> decoded_node;
+    uint used_slots = 0;
+
+    for (uint axis = 0; axis < 3; ++axis) {
+        const float scale = ldexpf(1.0f, node.exponent[axis]);
+        for (uint child = 0; child < WIDTH; ++child) {
+            decoded_node.bounds_min[axis][child] =
+                node.origin[axis] + float(node.q_min[axis][child]) * scale;
+            decoded_node.bounds_max[axis][child] =
+                node.origin[axis] + float(node.q_max[axis][child]) * scale;
+        }
+    }
+
+    for (uint child = 0; child < WIDTH; ++child) {
+        // an unused slot may decode to a flat box when the scale is tiny:
+        // recognize it by pointing to the root, which can't be anyone's child
+        if (node.child_idx[child] != 0 || node.num_primitives[child] != 0) {
+            used_slots |= 1u << child;
+        }
+    }
+
+    return intersect_children(decoded_node, ray, t_max, t_entry) & used_slots;
+}
+
+template <uint WIDTH>
+static void set_child_bounds(WideBVHNode<WIDTH> &node, const uint slot, const Bounds3f &bounds) {
+    for (uint axis = 0; axis < 3; ++axis) {
+        // float bounds must still enclose the full-precision ones
+        node.bounds_min[axis][slot] = round_down_to_float(bounds.p_min[axis]);
+        node.bounds_max[axis][slot] = round_up_to_float(bounds.p_max[axis]);
+    }
+}
+
+template <uint WIDTH>
+static void set_unused_slot(WideBVHNode<WIDTH> &node, const uint slot) {
+    for (uint axis = 0; axis < 3; ++axis) {
+        node.bounds_min[axis][slot] = std::numeric_limits<float>::infinity();
+        node.bounds_max[axis][slot] = -std::numeric_limits<float>::infinity();
+    }
+    node.child_idx[slot] = 0;
+    node.num_primitives[slot] = 0;
+}
+
+template <uint WIDTH>
+static bool quantize_node(QuantizedWideBVHNode<WIDTH> &quantized_node,
+                          const WideBVHNode<WIDTH> &node) {
+    for (uint axis = 0; axis < 3; ++axis) {
+        float lower = std::numeric_limits<float>::infinity();
+        float upper = -std::numeric_limits<float>::infinity();
+        for (uint child = 0; child < WIDTH; ++child) {
+            if (node.bounds_min[axis][child] > node.bounds_max[axis][child]) {
+                // unused slot
+                continue;
+            }
+
+            lower = std::min(lower, node.bounds_min[axis][child]);
+            upper = std::max(upper, node.bounds_max[axis][child]);
+        }
+
+        // the smallest power of 2 that spans [lower, upper] in 255 steps
+        int exponent = upper > lower ? int(std::ceil(std::log2((upper - lower) / 255))) : -126;
+        exponent = clamp(exponent, -126, 127);
+        while (exponent < 127 && lower + 255.0f * std::ldexp(1.0f, exponent) < upper) {
+            exponent += 1;
+        }
+        const float scale = std::ldexp(1.0f, exponent);
+
+        quantized_node.origin[axis] = lower;
+        quantized_node.exponent[axis] = exponent;
+
+        for (uint child = 0; child < WIDTH; ++child) {
+            if (node.bounds_min[axis][child] > node.bounds_max[axis][child]) {
+                quantized_node.q_min[axis][child] = 255;
+                quantized_node.q_max[axis][child] = 0;
+                continue;
+            }
+
+            // decode exactly as intersect_children() does, and widen until the box is covered
+            int q_min = clamp(int(std::floor((node.bounds_min[axis][child] - lower) / scale)), 0,
+                              255);
+            while (q_min > 0 && lower + float(q_min) * scale > node.bounds_min[axis][child]) {
+                q_min -= 1;
+            }
+
+            int q_max =
+                clamp(int(std::ceil((node.bounds_max[axis][child] - lower) / scale)), 0, 255);
+            while (q_max < 255 && lower + float(q_max) * scale < node.bounds_max[axis][child]) {
+                q_max += 1;
+            }
+
+            quantized_node.q_min[axis][child] = q_min;
+            quantized_node.q_max[axis][child] = q_max;
+        }
+    }
+
+    for (uint child = 0; child < WIDTH; ++child) {
+        if (node.num_primitives[child] > std::numeric_limits<uint16_t>::max()) {
+            return false;
+        }
+
+        quantized_node.child_idx[child] = node.child_idx[child];
+        quantized_node.num_primitives[child] = node.num_primitives[child];
+    }
+
+    return true;
+}
+
+template <typename Node, size_t CAPACITY>
+PBRT_CPU_GPU static void push_children_by_distance(Stack<WideBVHStackEntry, CAPACITY> &stack,
+                                                   const Node &node, uint hit_mask,
+                                                   const float t_entry[Node::width]) {
+    constexpr uint WIDTH = Node::width;
+
+    // sort the children hit from far to near (insertion sort over at most WIDTH entries)
+    // so the nearest one is popped first
+    WideBVHStackEntry hits[WIDTH];
+    uint num_hits = 0;
+
+    while (hit_mask != 0) {
+        uint child = 0;
+        while ((hit_mask & (1u << child)) == 0) {
+            child += 1;
+        }
+        hit_mask &= ~(1u << child);
+
+        const WideBVHStackEntry entry = {
+            .child_idx = node.child_idx[child],
+            .num_primitives = node.num_primitives[child],
+            .t_entry = t_entry[child],
+        };
+
+        uint idx = num_hits;
+        while (idx > 0 && hits[idx - 1].t_entry < entry.t_entry) {
+            hits[idx] = hits[idx - 1];
+            idx -= 1;
+        }
+        hits[idx] = entry;
+        num_hits += 1;
+    }
+
+    for (uint idx = 0; idx < num_hits; ++idx) {
+        stack.push(hits[idx]);
+    }
+}
+
+WideBVH *WideBVH::create(const HLBVH::BVHBuildNode *build_nodes,
+                         const HLBVH::MortonPrimitive *morton_primitives,
+                         const Primitive **primitives, const TriangleBlocks *triangle_blocks,
+                         const uint width, const bool quantized, GPUMemoryAllocator &allocator) {
+    auto wide_bvh = allocator.allocate<WideBVH>();
+
+    wide_bvh->width = width;
+    wide_bvh->quantized = quantized;
+    wide_bvh->num_nodes = 0;
+    wide_bvh->nodes = nullptr;
+    wide_bvh->build_node_indices = nullptr;
+    wide_bvh->morton_primitives = morton_primitives;
+    wide_bvh->primitives = primitives;
+    wide_bvh->triangle_blocks = triangle_blocks;
+
+    bool collapsed = false;
+    switch (width) {
+    case 4: {
+        collapsed = wide_bvh->collapse<4>(build_nodes, allocator);
+        break;
+    }
+    case 8: {
+        collapsed = wide_bvh->collapse<8>(build_nodes, allocator);
+        break;
+    }
+    default: {
+        printf("\n%s(): illegal BVH width: %u (only 4 and 8 are supported)\n", __func__, width);
+        REPORT_FATAL_ERROR();
+    }
+    }
+
+    return collapsed ? wide_bvh : nullptr;
+}
+
+template <uint WIDTH>
+bool WideBVH::collapse(const HLBVH::BVHBuildNode *build_nodes, GPUMemoryAllocator &allocator) {
+    std::vector<WideBVHNode<WIDTH>> wide_nodes(1);
+    std::vector<std::tuple<uint, uint, uint>> nodes_to_collapse;
+    // (binary node, wide node, entries left on the traversal stack when the node is popped)
+
+    if (build_nodes[0].is_leaf()) {
+        // a tree of a single leaf: put it under a wide root
+        nodes_to_collapse.emplace_back(std::numeric_limits<uint>::max(), 0, 0);
+    } else {
+        nodes_to_collapse.emplace_back(0, 0, 0);
+    }
+
+    std::vector<uint> slot_build_nodes;
+    // binary node under every slot of every wide node, for refit()
+
+    uint num_binary_nodes = 0;
+    uint max_stack_size = 1;
+    while (!nodes_to_collapse.empty()) {
+        const auto [binary_idx, wide_idx, stack_size] = nodes_to_collapse.back();
+        nodes_to_collapse.pop_back();
+
+        std::vector<uint> children;
+        if (binary_idx == std::numeric_limits<uint>::max()) {
+            children.push_back(0);
+        } else {
+            num_binary_nodes += 1;
+            children.push_back(build_nodes[binary_idx].left_child_idx);
+            children.push_back(build_nodes[binary_idx].left_child_idx + 1);
+        }
+
+        // pull up the grandchildren of the largest interior child until the node is full
+        while (children.size() < WIDTH) {
+            int largest_interior = -1;
+            FloatType largest_area = -1;
+            for (uint idx = 0; idx < children.size(); ++idx) {
+                const auto &child = build_nodes[children[idx]];
+                if (!child.is_leaf() && child.bounds.surface_area() > largest_area) {
+                    largest_area = child.bounds.surface_area();
+                    largest_interior = idx;
+                }
+            }
+
+            if (largest_interior < 0) {
+                break;
+            }
+
+            num_binary_nodes += 1;
+            const uint left_child_idx = build_nodes[children[largest_interior]].left_child_idx;
+            children[largest_interior] = left_child_idx;
+            children.push_back(left_child_idx + 1);
+        }
+
+        // in any order, every child hit is pushed and all but the one popped next stay below it
+        max_stack_size = std::max<uint>(max_stack_size, stack_size + children.size());
+
+        slot_build_nodes.resize(wide_nodes.size() * WIDTH, UNUSED_SLOT);
+
+        WideBVHNode<WIDTH> wide_node;
+        for (uint slot = 0; slot < WIDTH; ++slot) {
+            if (slot >= children.size()) {
+                set_unused_slot(wide_node, slot);
+                continue;
+            }
+
+            slot_build_nodes[wide_idx * WIDTH + slot] = children[slot];
+
+            const auto &child = build_nodes[children[slot]];
+            set_child_bounds(wide_node, slot, child.bounds);
+
+            if (child.is_leaf()) {
+                wide_node.child_idx[slot] = child.first_primitive_idx;
+                wide_node.num_primitives[slot] = child.num_primitives;
+                continue;
+            }
+
+            wide_node.child_idx[slot] = wide_nodes.size();
+            wide_node.num_primitives[slot] = 0;
+
+            nodes_to_collapse.emplace_back(children[slot], wide_nodes.size(),
+                                           stack_size + children.size() - 1);
+            wide_nodes.emplace_back();
+        }
+
+        wide_nodes[wide_idx] = wide_node;
+    }
+
+    if (max_stack_size > STACK_CAPACITY) {
+        printf("WideBVH: traversal may need %u stack entries (more than %u), keep the tree "
+               "binary\n",
+               max_stack_size, STACK_CAPACITY);
+        return false;
+    }
+
+    num_nodes = wide_nodes.size();
+
+    auto gpu_slot_build_nodes = allocator.allocate<uint>(slot_build_nodes.size());
+    std::copy(slot_build_nodes.begin(), slot_build_nodes.end(), gpu_slot_build_nodes);
+    build_node_indices = gpu_slot_build_nodes;
+
+    if (quantized) {
+        std::vector<QuantizedWideBVHNode<WIDTH>> quantized_nodes(num_nodes);
+        for (uint idx = 0; idx < num_nodes; ++idx) {
+            if (!quantize_node(quantized_nodes[idx], wide_nodes[idx])) {
+                printf("WideBVH: too many primitives in a leaf to quantize, fall back to "
+                       "full-precision nodes\n");
+                quantized = false;
+                break;
+            }
+        }
+
+        if (quantized) {
+            auto gpu_quantized_nodes = allocator.allocate<QuantizedWideBVHNode<WIDTH>>(num_nodes);
+            CHECK_CUDA_ERROR(cudaMemcpy(gpu_quantized_nodes, quantized_nodes.data(),
+                                        sizeof(QuantizedWideBVHNode<WIDTH>) * num_nodes,
+                                        cudaMemcpyHostToDevice));
+            nodes = gpu_quantized_nodes;
+
+            printf("WideBVH: collapsed %u binary interior nodes into %u quantized %u-wide nodes "
+                   "(%.2f MB), stack of %u entries\n",
+                   num_binary_nodes, num_nodes, WIDTH,
+                   double(sizeof(QuantizedWideBVHNode<WIDTH>) * num_nodes) / (1024 * 1024),
+                   max_stack_size);
+            return true;
+        }
+    }
+
+    auto gpu_wide_nodes = allocator.allocate<WideBVHNode<WIDTH>>(num_nodes);
+    CHECK_CUDA_ERROR(cudaMemcpy(gpu_wide_nodes, wide_nodes.data(),
+                                sizeof(WideBVHNode<WIDTH>) * num_nodes, cudaMemcpyHostToDevice));
+    nodes = gpu_wide_nodes;
+
+    printf("WideBVH: collapsed %u binary interior nodes into %u %u-wide nodes (%.2f MB), "
+           "stack of %u entries\n",
+           num_binary_nodes, num_nodes, WIDTH,
+           double(sizeof(WideBVHNode<WIDTH>) * num_nodes) / (1024 * 1024), max_stack_size);
+    return true;
+}
+
+void WideBVH::refit(const HLBVH::BVHBuildNode *build_nodes) {
+    if (width == 4) {
+        refit<4>(build_nodes);
+    } else {
+        refit<8>(build_nodes);
+    }
+}
+
+template <uint WIDTH>
+void WideBVH::refit(const HLBVH::BVHBuildNode *build_nodes) {
+    // every slot keeps its binary node: only the bounds are copied (and quantized) again
+    for (uint idx = 0; idx < num_nodes; ++idx) {
+        const uint *slots = &build_node_indices[idx * WIDTH];
+
+        if (!quantized) {
+            auto &wide_node = static_cast<WideBVHNode<WIDTH> *>(nodes)[idx];
+            for (uint slot = 0; slot < WIDTH; ++slot) {
+                if (slots[slot] != UNUSED_SLOT) {
+                    set_child_bounds(wide_node, slot, build_nodes[slots[slot]].bounds);
+                }
+            }
+            continue;
+        }
+
+        auto &quantized_node = static_cast<QuantizedWideBVHNode<WIDTH> *>(nodes)[idx];
+
+        WideBVHNode<WIDTH> wide_node;
+        for (uint slot = 0; slot < WIDTH; ++slot) {
+            if (slots[slot] == UNUSED_SLOT) {
+                set_unused_slot(wide_node, slot);
+                continue;
+            }
+
+            set_child_bounds(wide_node, slot, build_nodes[slots[slot]].bounds);
+            wide_node.child_idx[slot] = quantized_node.child_idx[slot];
+            wide_node.num_primitives[slot] = quantized_node.num_primitives[slot];
+        }
+
+        // primitive counts fit: they did when the node was first quantized
+        quantize_node(quantized_node, wide_node);
+    }
+}
+
+PBRT_CPU_GPU
+bool WideBVH::fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                             FloatType t_max) const {
+    switch (width) {
+    case 4: {
+        return quantized ? fast_intersect<QuantizedWideBVHNode<4>>(ray, ray_precomputation, t_max)
+                         : fast_intersect<WideBVHNode<4>>(ray, ray_precomputation, t_max);
+    }
+    case 8: {
+        return quantized ? fast_intersect<QuantizedWideBVHNode<8>>(ray, ray_precomputation, t_max)
+                         : fast_intersect<WideBVHNode<8>>(ray, ray_precomputation, t_max);
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return false;
+}
+
+PBRT_CPU_GPU
+pbrt::optional<PrimitiveHit> WideBVH::intersect_hit(const Ray &ray,
+                                                    const RayPrecomputation &ray_precomputation,
+                                                    FloatType t_max) const {
+    switch (width) {
+    case 4: {
+        return quantized ? intersect_hit<QuantizedWideBVHNode<4>>(ray, ray_precomputation, t_max)
+                         : intersect_hit<WideBVHNode<4>>(ray, ray_precomputation, t_max);
+    }
+    case 8: {
+        return quantized ? intersect_hit<QuantizedWideBVHNode<8>>(ray, ray_precomputation, t_max)
+                         : intersect_hit<WideBVHNode<8>>(ray, ray_precomputation, t_max);
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return {};
+}
+
+template <typename Node>
+PBRT_CPU_GPU bool WideBVH::fast_intersect(const Ray &ray,
+                                          const RayPrecomputation &ray_precomputation,
+                                          FloatType t_max) const {
+    constexpr uint WIDTH = Node::width;
+    const auto wide_nodes = static_cast<const Node *>(nodes);
+    const WideBVHRay wide_ray(ray, ray_precomputation);
+
+    Stack<WideBVHStackEntry, STACK_CAPACITY> nodes_to_visit;
+    nodes_to_visit.push(WideBVHStackEntry{.child_idx = 0, .num_primitives = 0, .t_entry = 0});
+
+    float t_entry[WIDTH];
+    while (!nodes_to_visit.empty()) {
+        const auto entry = nodes_to_visit.pop();
+
+        if (entry.num_primitives > 0) {
+            if (triangle_blocks != nullptr) {
+                if (triangle_blocks->fast_intersect_leaf(ray, ray_precomputation, t_max,
+                                                         entry.child_idx, entry.num_primitives)) {
+                    return true;
+                }
+                continue;
+            }
+
+            for (uint morton_idx = entry.child_idx;
+                 morton_idx < entry.child_idx + entry.num_primitives; morton_idx++) {
+                const uint primitive_idx = morton_primitives[morton_idx].primitive_idx;
+                if (primitives[primitive_idx]->fast_intersect(ray, ray_precomputation, t_max)) {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        const auto &node = wide_nodes[entry.child_idx];
+        const uint hit_mask = intersect_children(node, wide_ray, t_max, t_entry);
+        push_children_by_distance(nodes_to_visit, node, hit_mask, t_entry);
+    }
+
+    return false;
+}
+
+template <typename Node>
+PBRT_CPU_GPU pbrt::optional<PrimitiveHit>
+WideBVH::intersect_hit(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                       FloatType t_max) const {
+    constexpr uint WIDTH = Node::width;
+    const auto wide_nodes = static_cast<const Node *>(nodes);
+    const WideBVHRay wide_ray(ray, ray_precomputation);
+
+    const FloatType robust_factor = 1.0 + 2.0 * gamma(3);
+
+    pbrt::optional<PrimitiveHit> best_hit = {};
+    auto best_t = t_max;
+
+    Stack<WideBVHStackEntry, STACK_CAPACITY> nodes_to_visit;
+    nodes_to_visit.push(WideBVHStackEntry{.child_idx = 0, .num_primitives = 0, .t_entry = 0});
+
+    float t_entry[WIDTH];
+    while (!nodes_to_visit.empty()) {
+        const auto entry = nodes_to_visit.pop();
+        if (entry.t_entry > best_t * robust_factor) {
+            // pushed before a closer hit was found
+            continue;
+        }
+
+        if (entry.num_primitives > 0) {
+            if (triangle_blocks != nullptr) {
+                triangle_blocks->intersect_leaf(ray, ray_precomputation, entry.child_idx,
+                                                entry.num_primitives, best_t, best_hit);
+                continue;
+            }
+
+            for (uint morton_idx = entry.child_idx;
+                 morton_idx < entry.child_idx + entry.num_primitives; morton_idx++) {
+                const uint primitive_idx = morton_primitives[morton_idx].primitive_idx;
+
+                auto hit =
+                    primitives[primitive_idx]->intersect_hit(ray, ray_precomputation, best_t);
+                if (!hit) {
+                    continue;
+                }
+
+                best_t = hit->shape_hit.t_hit;
+                best_hit = hit;
+            }
+            continue;
+        }
+
+        const auto &node = wide_nodes[entry.child_idx];
+        const uint hit_mask = intersect_children(node, wide_ray, best_t, t_entry);
+        push_children_by_distance(nodes_to_visit, node, hit_mask, t_entry);
+    }
+
+    return best_hit;
+}
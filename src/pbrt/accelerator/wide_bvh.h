@@ -0,0 +1,97 @@
+#pragma once
+
+#include <limits>
+#include <pbrt/accelerator/hlbvh.h>
+
+class GPUMemoryAllocator;
+class TriangleBlocks;
+
+template <uint WIDTH>
+struct alignas(32) WideBVHNode {
+    static_assert(WIDTH % 4 == 0, "children are tested 4 (SSE) or 8 (AVX) at a time");
+    static constexpr uint width = WIDTH;
+
+    // child bounds in SoA layout: one SIMD lane per child
+    // unused slots hold empty bounds so they never get hit
+    float bounds_min[3][WIDTH];
+    float bounds_max[3][WIDTH];
+
+    uint child_idx[WIDTH];
+    // first morton primitive for leaf child, otherwise index of the child WideBVHNode
+
+    uint num_primitives[WIDTH];
+    // 0 for interior child
+};
+
+template <uint WIDTH>
+struct alignas(32) QuantizedWideBVHNode {
+    static constexpr uint width = WIDTH;
+
+    // child bounds are origin + q * 2^exponent, rounded outward when quantized
+    // unused slots have q_min > q_max
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t q_min[3][WIDTH];
+    uint8_t q_max[3][WIDTH];
+
+    uint child_idx[WIDTH];
+    uint16_t num_primitives[WIDTH];
+};
+
+static_assert(sizeof(QuantizedWideBVHNode<4>) == 64);
+static_assert(sizeof(QuantizedWideBVHNode<8>) == 128);
+
+class WideBVH {
+  public:
+    static constexpr uint STACK_CAPACITY = 96;
+    // traversal stack entries per ray: create() returns nullptr for a tree that may need more
+
+    static WideBVH *create(const HLBVH::BVHBuildNode *build_nodes,
+                           const HLBVH::MortonPrimitive *morton_primitives,
+                           const Primitive **primitives, const TriangleBlocks *triangle_blocks,
+                           uint width, bool quantized, GPUMemoryAllocator &allocator);
+    // triangle_blocks (optional) is shared with the HLBVH: leaves are the same
+
+    void refit(const HLBVH::BVHBuildNode *build_nodes);
+    // copies the bounds of refit build nodes into the wide nodes, in place:
+    // only valid while the binary tree keeps the topology it was collapsed from
+
+    PBRT_CPU_GPU
+    bool fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                        FloatType t_max) const;
+
+    PBRT_CPU_GPU
+    pbrt::optional<PrimitiveHit> intersect_hit(const Ray &ray,
+                                               const RayPrecomputation &ray_precomputation,
+                                               FloatType t_max) const;
+
+  private:
+    static constexpr uint UNUSED_SLOT = std::numeric_limits<uint>::max();
+
+    template <uint WIDTH>
+    bool collapse(const HLBVH::BVHBuildNode *build_nodes, GPUMemoryAllocator &allocator);
+
+    template <uint WIDTH>
+    void refit(const HLBVH::BVHBuildNode *build_nodes);
+
+    template <typename Node>
+    PBRT_CPU_GPU bool fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                                     FloatType t_max) const;
+
+    template <typename Node>
+    PBRT_CPU_GPU pbrt::optional<PrimitiveHit>
+    intersect_hit(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                  FloatType t_max) const;
+
+    uint width;
+    bool quantized;
+    uint num_nodes;
+    void *nodes;
+
+    const uint *build_node_indices;
+    // WIDTH per wide node: the binary node collapsed into each slot, UNUSED_SLOT for none
+
+    const HLBVH::MortonPrimitive *morton_primitives;
+    const Primitive **primitives;
+    const TriangleBlocks *triangle_blocks;
+};
@@ -1,6 +1,81 @@
 #include <pbrt/accelerator/hlbvh.h>
 #include <pbrt/base/integrator_base.h>
 #include <pbrt/base/interaction.h>
+#include <pbrt/gpu/gpu_memory_allocator.h>
+
+PBRT_CPU_GPU
+static uint direction_octant(const Vector3f &d) {
+    return (d.x < 0 ? 1 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 4 : 0);
+}
+
+__global__ void count_ray_octants(OcclusionBatch *batch) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= batch->num_rays) {
+        return;
+    }
+
+    if (worker_idx % 32 == 0) {
+        batch->hit_mask[worker_idx / 32] = 0;
+    }
+
+    atomicAdd(&batch->octant_offsets[direction_octant(batch->rays[worker_idx].d)], 1);
+}
+
+__global__ void sort_rays_by_octant(OcclusionBatch *batch) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= batch->num_rays) {
+        return;
+    }
+
+    const uint octant = direction_octant(batch->rays[worker_idx].d);
+    batch->sorted_indices[atomicAdd(&batch->octant_offsets[octant], 1)] = worker_idx;
+}
+
+__global__ void trace_occlusion_packets(const IntegratorBase *base, OcclusionBatch *batch) {
+    // one thread per packet: up to MAX_PACKET_SIZE sorted rays of a single octant
+    const uint packet_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (packet_idx >= batch->packet_offsets[8]) {
+        return;
+    }
+
+    uint octant = 0;
+    while (packet_idx >= batch->packet_offsets[octant + 1]) {
+        octant += 1;
+    }
+
+    const uint first_sorted_idx = batch->octant_starts[octant] +
+                                  (packet_idx - batch->packet_offsets[octant]) *
+                                      HLBVH::MAX_PACKET_SIZE;
+    const uint num_rays = std::min<uint>(HLBVH::MAX_PACKET_SIZE,
+                                         batch->octant_starts[octant + 1] - first_sorted_idx);
+
+    Ray rays[HLBVH::MAX_PACKET_SIZE];
+    FloatType t_max[HLBVH::MAX_PACKET_SIZE];
+    for (uint idx = 0; idx < num_rays; ++idx) {
+        const uint ray_idx = batch->sorted_indices[first_sorted_idx + idx];
+        rays[idx] = batch->rays[ray_idx];
+        t_max[idx] = batch->t_max[ray_idx];
+    }
+
+    bool occluded[HLBVH::MAX_PACKET_SIZE];
+    base->bvh->fast_intersect_packet(rays, t_max, num_rays, occluded);
+
+    for (uint idx = 0; idx < num_rays; ++idx) {
+        if (occluded[idx]) {
+            const uint ray_idx = batch->sorted_indices[first_sorted_idx + idx];
+            atomicOr(&batch->hit_mask[ray_idx / 32], 1u << (ray_idx % 32));
+        }
+    }
+}
+
+void OcclusionBatch::init(const uint capacity, GPUMemoryAllocator &allocator) {
+    rays = allocator.allocate<Ray>(capacity);
+    t_max = allocator.allocate<FloatType>(capacity);
+    num_rays = 0;
+
+    hit_mask = allocator.allocate<uint>(divide_and_ceil(capacity, 32u));
+    sorted_indices = allocator.allocate<uint>(capacity);
+}
 
 PBRT_CPU_GPU
 bool IntegratorBase::fast_intersect(const Ray &ray, FloatType t_max) const {
@@ -9,7 +84,54 @@ bool IntegratorBase::fast_intersect(const Ray &ray, FloatType t_max) const {
 
 PBRT_CPU_GPU
 bool IntegratorBase::unoccluded(const Interaction &p0, const Interaction &p1) const {
-    return !fast_intersect(p0.spawn_ray_to(p1), 0.6) && !fast_intersect(p1.spawn_ray_to(p0), 0.6);
+    Ray rays[2];
+    unoccluded_rays(p0, p1, rays);
+
+    return !fast_intersect(rays[0], UNOCCLUDED_T_MAX) &&
+           !fast_intersect(rays[1], UNOCCLUDED_T_MAX);
+}
+
+PBRT_CPU_GPU
+void IntegratorBase::unoccluded_rays(const Interaction &p0, const Interaction &p1, Ray rays[2]) {
+    rays[0] = p0.spawn_ray_to(p1);
+    rays[1] = p1.spawn_ray_to(p0);
+}
+
+void IntegratorBase::fast_intersect_batch(OcclusionBatch *batch) const {
+    if (batch->num_rays == 0) {
+        return;
+    }
+
+    constexpr uint threads = 256;
+    const uint blocks = divide_and_ceil(batch->num_rays, threads);
+
+    for (auto &offset : batch->octant_offsets) {
+        offset = 0;
+    }
+
+    count_ray_octants<<<blocks, threads>>>(batch);
+    CHECK_CUDA_ERROR(cudaGetLastError());
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+
+    batch->octant_starts[0] = 0;
+    batch->packet_offsets[0] = 0;
+    for (uint octant = 0; octant < 8; ++octant) {
+        const uint count = batch->octant_offsets[octant];
+        batch->octant_offsets[octant] = batch->octant_starts[octant];
+
+        batch->octant_starts[octant + 1] = batch->octant_starts[octant] + count;
+        batch->packet_offsets[octant + 1] =
+            batch->packet_offsets[octant] + divide_and_ceil(count, HLBVH::MAX_PACKET_SIZE);
+    }
+
+    sort_rays_by_octant<<<blocks, threads>>>(batch);
+    CHECK_CUDA_ERROR(cudaGetLastError());
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+
+    trace_occlusion_packets<<<divide_and_ceil(batch->packet_offsets[8], threads), threads>>>(
+        this, batch);
+    CHECK_CUDA_ERROR(cudaGetLastError());
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
 }
 
 PBRT_CPU_GPU
@@ -4,6 +4,7 @@
 
 class Camera;
 class Filter;
+class GPUMemoryAllocator;
 class HLBVH;
 class Light;
 class UniformLightSampler;
@@ -14,7 +15,34 @@ struct ShapeIntersection;
 class Ray;
 class Interaction;
 
+struct OcclusionBatch {
+    // shadow rays traced together by IntegratorBase::fast_intersect_batch()
+
+    Ray *rays;
+    FloatType *t_max;
+    uint num_rays;
+
+    uint *hit_mask;
+    // bit (idx % 32) of hit_mask[idx / 32] is set when rays[idx] hits anything before t_max
+
+    uint *sorted_indices;
+    uint octant_offsets[8];
+    uint octant_starts[9];
+    uint packet_offsets[9];
+    // rays are sorted by direction octant, then every MAX_PACKET_SIZE rays of an octant are
+    // traced as one packet by HLBVH::fast_intersect_packet(): a packet never mixes octants
+
+    void init(uint capacity, GPUMemoryAllocator &allocator);
+
+    PBRT_CPU_GPU
+    bool is_occluded(const uint idx) const {
+        return hit_mask[idx / 32] & (1u << (idx % 32));
+    }
+};
+
 struct IntegratorBase {
+    static constexpr FloatType UNOCCLUDED_T_MAX = 0.6;
+
     const HLBVH *bvh;
     const Camera *camera;
     const Filter *filter;
@@ -62,6 +90,12 @@ struct IntegratorBase {
     PBRT_CPU_GPU
     bool unoccluded(const Interaction &p0, const Interaction &p1) const;
 
+    PBRT_CPU_GPU
+    static void unoccluded_rays(const Interaction &p0, const Interaction &p1, Ray rays[2]);
+    // p0 and p1 are unoccluded when neither ray hits anything before UNOCCLUDED_T_MAX
+
+    void fast_intersect_batch(OcclusionBatch *batch) const;
+
     PBRT_CPU_GPU
     pbrt::optional<ShapeIntersection> intersect(const Ray &ray, FloatType t_max) const;
 
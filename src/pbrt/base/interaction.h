@@ -151,3 +151,14 @@ struct QuadricIntersection {
     Point3f p_obj;
     FloatType phi;
 };
+
+struct ShapeHit {
+    // what a shape keeps of a hit to build its SurfaceInteraction later
+    FloatType t_hit;
+
+    Point3f coordinates;
+    // barycentrics b0, b1, b2 for triangles, hit point in object space for quadrics
+
+    FloatType phi;
+    // quadrics only
+};
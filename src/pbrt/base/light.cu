@@ -326,3 +326,34 @@ void Light::preprocess(const Bounds3<FloatType> &scene_bounds) {
 
     REPORT_FATAL_ERROR();
 }
+
+void Light::build_distribution(GPUMemoryAllocator &allocator) {
+    switch (type) {
+    case Type::diffuse_area_light: {
+        // do nothing
+        return;
+    }
+
+    case Type::spot_light: {
+        // do nothing
+        return;
+    }
+
+    case Type::distant_light: {
+        // do nothing
+        return;
+    }
+
+    case Type::image_infinite_light: {
+        static_cast<ImageInfiniteLight *>(ptr)->build_distribution(allocator);
+        return;
+    }
+
+    case Type::uniform_infinite_light: {
+        // do nothing
+        return;
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+}
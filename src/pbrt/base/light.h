@@ -177,6 +177,9 @@ class Light {
 
     void preprocess(const Bounds3<FloatType> &scene_bounds);
 
+    void build_distribution(GPUMemoryAllocator &allocator);
+    // for lights sampled from an image: after LoaderCache::read_images()
+
     Type type;
 
   private:
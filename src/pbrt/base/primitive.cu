@@ -1,7 +1,9 @@
+#include <pbrt/accelerator/hlbvh.h>
 #include <pbrt/base/light.h>
 #include <pbrt/base/primitive.h>
 #include <pbrt/gpu/gpu_memory_allocator.h>
 #include <pbrt/primitives/geometric_primitive.h>
+#include <pbrt/primitives/mesh_primitive.h>
 #include <pbrt/primitives/simple_primitive.h>
 #include <pbrt/primitives/transformed_primitive.h>
 
@@ -41,6 +43,18 @@ static __global__ void init_transformed_primitives(Primitive *primitives,
     primitives[idx].init(&transformed_primitives[idx]);
 }
 
+template <typename MeshShape>
+static __global__ void init_mesh_primitives(Primitive *primitives,
+                                            const MeshPrimitive<MeshShape> *mesh_primitive,
+                                            uint num) {
+    uint idx = threadIdx.x + blockIdx.x * blockDim.x;
+    if (idx >= num) {
+        return;
+    }
+
+    primitives[idx].init(mesh_primitive, idx);
+}
+
 template <typename TypeOfPrimitive>
 static __global__ void init_primitives(Primitive *primitives, TypeOfPrimitive *_primitives,
                                        uint num) {
@@ -95,6 +109,42 @@ const Primitive *Primitive::create_simple_primitives(const Shape *shapes, const
     return primitives;
 }
 
+template <typename MeshShape>
+static const Primitive *build_mesh_primitives(const typename MeshShape::Mesh *mesh, uint num,
+                                              const Material *material,
+                                              const Light *diffuse_area_lights,
+                                              GPUMemoryAllocator &allocator) {
+    constexpr uint threads = 1024;
+    const uint blocks = divide_and_ceil(num, threads);
+
+    auto mesh_primitive = allocator.allocate<MeshPrimitive<MeshShape>>();
+    mesh_primitive->init(mesh, material, diffuse_area_lights);
+
+    auto primitives = allocator.allocate<Primitive>(num);
+
+    init_mesh_primitives<<<blocks, threads>>>(primitives, mesh_primitive, num);
+    CHECK_CUDA_ERROR(cudaGetLastError());
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+
+    return primitives;
+}
+
+const Primitive *Primitive::create_mesh_primitives(const TriangleMesh *mesh,
+                                                   const Material *material,
+                                                   const Light *diffuse_area_lights,
+                                                   GPUMemoryAllocator &allocator) {
+    return build_mesh_primitives<Triangle>(mesh, mesh->triangles_num, material,
+                                           diffuse_area_lights, allocator);
+}
+
+const Primitive *Primitive::create_mesh_primitives(const BilinearPatchMesh *mesh,
+                                                   const Material *material,
+                                                   const Light *diffuse_area_lights,
+                                                   GPUMemoryAllocator &allocator) {
+    return build_mesh_primitives<BilinearPatch>(mesh, mesh->patches_num, material,
+                                                diffuse_area_lights, allocator);
+}
+
 const Primitive *Primitive::create_transformed_primitives(const Primitive *base_primitives,
                                                           const Transform &render_from_primitive,
                                                           uint num, GPUMemoryAllocator &allocator) {
@@ -107,6 +157,8 @@ const Primitive *Primitive::create_transformed_primitives(const Primitive *base_
 
     init_transformed_primitives<<<blocks, threads>>>(primitives, transformed_primitives,
                                                      base_primitives, render_from_primitive, num);
+    CHECK_CUDA_ERROR(cudaGetLastError());
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
 
     return primitives;
 }
@@ -117,6 +169,20 @@ void Primitive::init(const GeometricPrimitive *geometric_primitive) {
     ptr = geometric_primitive;
 }
 
+PBRT_CPU_GPU
+void Primitive::init(const TriangleMeshPrimitive *mesh_primitive, const uint _shape_idx) {
+    type = Type::triangle_mesh;
+    shape_idx = _shape_idx;
+    ptr = mesh_primitive;
+}
+
+PBRT_CPU_GPU
+void Primitive::init(const BilinearPatchMeshPrimitive *mesh_primitive, const uint _shape_idx) {
+    type = Type::bilinear_patch_mesh;
+    shape_idx = _shape_idx;
+    ptr = mesh_primitive;
+}
+
 PBRT_CPU_GPU
 void Primitive::init(const SimplePrimitive *simple_primitive) {
     type = Type::simple;
@@ -129,6 +195,12 @@ void Primitive::init(const TransformedPrimitive *transformed_primitive) {
     ptr = transformed_primitive;
 }
 
+PBRT_CPU_GPU
+void Primitive::init(const HLBVH *bvh) {
+    type = Type::bvh;
+    ptr = bvh;
+}
+
 PBRT_CPU_GPU
 const Material *Primitive::get_material() const {
     switch (type) {
@@ -136,6 +208,14 @@ const Material *Primitive::get_material() const {
         return static_cast<const GeometricPrimitive *>(ptr)->get_material();
     }
 
+    case Type::triangle_mesh: {
+        return static_cast<const TriangleMeshPrimitive *>(ptr)->get_material();
+    }
+
+    case Type::bilinear_patch_mesh: {
+        return static_cast<const BilinearPatchMeshPrimitive *>(ptr)->get_material();
+    }
+
     case Type::simple: {
         return static_cast<const SimplePrimitive *>(ptr)->get_material();
     }
@@ -143,12 +223,53 @@ const Material *Primitive::get_material() const {
     case Type::transformed: {
         return static_cast<const TransformedPrimitive *>(ptr)->get_material();
     }
+
+    case Type::bvh: {
+        return nullptr;
+    }
     }
 
     REPORT_FATAL_ERROR();
     return {};
 }
 
+PBRT_CPU_GPU
+const Shape *Primitive::get_shape() const {
+    switch (type) {
+    case Type::geometric: {
+        return static_cast<const GeometricPrimitive *>(ptr)->get_shape();
+    }
+
+    case Type::simple: {
+        return static_cast<const SimplePrimitive *>(ptr)->get_shape();
+    }
+
+    case Type::triangle_mesh:
+    case Type::bilinear_patch_mesh:
+    case Type::transformed:
+    case Type::bvh: {
+        return nullptr;
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return nullptr;
+}
+
+PBRT_CPU_GPU
+pbrt::optional<Triangle> Primitive::get_triangle() const {
+    if (type == Type::triangle_mesh) {
+        return static_cast<const TriangleMeshPrimitive *>(ptr)->get_shape(shape_idx);
+    }
+
+    const auto shape = get_shape();
+    if (shape == nullptr || shape->get_triangle() == nullptr) {
+        return {};
+    }
+
+    return *shape->get_triangle();
+}
+
 PBRT_CPU_GPU
 Bounds3f Primitive::bounds() const {
     switch (type) {
@@ -156,6 +277,14 @@ Bounds3f Primitive::bounds() const {
         return static_cast<const GeometricPrimitive *>(ptr)->bounds();
     }
 
+    case Type::triangle_mesh: {
+        return static_cast<const TriangleMeshPrimitive *>(ptr)->bounds(shape_idx);
+    }
+
+    case Type::bilinear_patch_mesh: {
+        return static_cast<const BilinearPatchMeshPrimitive *>(ptr)->bounds(shape_idx);
+    }
+
     case Type::simple: {
         return static_cast<const SimplePrimitive *>(ptr)->bounds();
     }
@@ -163,6 +292,10 @@ Bounds3f Primitive::bounds() const {
     case Type::transformed: {
         return static_cast<const TransformedPrimitive *>(ptr)->bounds();
     }
+
+    case Type::bvh: {
+        return static_cast<const HLBVH *>(ptr)->bounds();
+    }
     }
 
     REPORT_FATAL_ERROR();
@@ -170,19 +303,67 @@ Bounds3f Primitive::bounds() const {
 }
 
 PBRT_CPU_GPU
-bool Primitive::fast_intersect(const Ray &ray, FloatType t_max) const {
+Bounds3f Primitive::clip_bounds(const Bounds3f &clip_box) const {
     switch (type) {
     case Type::geometric: {
-        return static_cast<const GeometricPrimitive *>(ptr)->fast_intersect(ray, t_max);
+        return static_cast<const GeometricPrimitive *>(ptr)->clip_bounds(clip_box);
+    }
+
+    case Type::triangle_mesh: {
+        return static_cast<const TriangleMeshPrimitive *>(ptr)->clip_bounds(shape_idx, clip_box);
+    }
+
+    case Type::bilinear_patch_mesh: {
+        return static_cast<const BilinearPatchMeshPrimitive *>(ptr)->clip_bounds(shape_idx,
+                                                                                 clip_box);
     }
 
     case Type::simple: {
-        return static_cast<const SimplePrimitive *>(ptr)->fast_intersect(ray, t_max);
+        return static_cast<const SimplePrimitive *>(ptr)->clip_bounds(clip_box);
+    }
+
+    case Type::transformed:
+    case Type::bvh: {
+        // not clipped through the transform or into the nested BVH
+        return bounds().intersection(clip_box);
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return {};
+}
+
+PBRT_CPU_GPU
+bool Primitive::fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                               FloatType t_max) const {
+    switch (type) {
+    case Type::geometric: {
+        return static_cast<const GeometricPrimitive *>(ptr)->fast_intersect(
+            ray, ray_precomputation, t_max);
+    }
+
+    case Type::triangle_mesh: {
+        return static_cast<const TriangleMeshPrimitive *>(ptr)->fast_intersect(
+            shape_idx, ray, ray_precomputation, t_max);
+    }
+
+    case Type::bilinear_patch_mesh: {
+        return static_cast<const BilinearPatchMeshPrimitive *>(ptr)->fast_intersect(
+            shape_idx, ray, ray_precomputation, t_max);
+    }
+
+    case Type::simple: {
+        return static_cast<const SimplePrimitive *>(ptr)->fast_intersect(ray, ray_precomputation,
+                                                                          t_max);
     }
 
     case Type::transformed: {
         return static_cast<const TransformedPrimitive *>(ptr)->fast_intersect(ray, t_max);
     }
+
+    case Type::bvh: {
+        return static_cast<const HLBVH *>(ptr)->fast_intersect(ray, t_max);
+    }
     }
 
     REPORT_FATAL_ERROR();
@@ -197,6 +378,15 @@ pbrt::optional<ShapeIntersection> Primitive::intersect(const Ray &ray, FloatType
         return static_cast<const GeometricPrimitive *>(ptr)->intersect(ray, t_max);
     }
 
+    case Type::triangle_mesh: {
+        return static_cast<const TriangleMeshPrimitive *>(ptr)->intersect(shape_idx, ray, t_max);
+    }
+
+    case Type::bilinear_patch_mesh: {
+        return static_cast<const BilinearPatchMeshPrimitive *>(ptr)->intersect(shape_idx, ray,
+                                                                               t_max);
+    }
+
     case Type::simple: {
         return static_cast<const SimplePrimitive *>(ptr)->intersect(ray, t_max);
     }
@@ -204,8 +394,116 @@ pbrt::optional<ShapeIntersection> Primitive::intersect(const Ray &ray, FloatType
     case Type::transformed: {
         return static_cast<const TransformedPrimitive *>(ptr)->intersect(ray, t_max);
     }
+
+    case Type::bvh: {
+        return static_cast<const HLBVH *>(ptr)->intersect(ray, t_max);
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return {};
+}
+
+PBRT_CPU_GPU
+pbrt::optional<PrimitiveHit> Primitive::intersect_hit(const Ray &ray,
+                                                      const RayPrecomputation &ray_precomputation,
+                                                      FloatType t_max) const {
+    switch (type) {
+    case Type::geometric: {
+        auto shape_hit = static_cast<const GeometricPrimitive *>(ptr)->intersect_hit(
+            ray, ray_precomputation, t_max);
+        if (!shape_hit) {
+            return {};
+        }
+
+        return PrimitiveHit{this, nullptr, shape_hit.value()};
+    }
+
+    case Type::triangle_mesh: {
+        auto shape_hit = static_cast<const TriangleMeshPrimitive *>(ptr)->intersect_hit(
+            shape_idx, ray, ray_precomputation, t_max);
+        if (!shape_hit) {
+            return {};
+        }
+
+        return PrimitiveHit{this, nullptr, shape_hit.value()};
+    }
+
+    case Type::bilinear_patch_mesh: {
+        auto shape_hit = static_cast<const BilinearPatchMeshPrimitive *>(ptr)->intersect_hit(
+            shape_idx, ray, ray_precomputation, t_max);
+        if (!shape_hit) {
+            return {};
+        }
+
+        return PrimitiveHit{this, nullptr, shape_hit.value()};
+    }
+
+    case Type::simple: {
+        auto shape_hit = static_cast<const SimplePrimitive *>(ptr)->intersect_hit(
+            ray, ray_precomputation, t_max);
+        if (!shape_hit) {
+            return {};
+        }
+
+        return PrimitiveHit{this, nullptr, shape_hit.value()};
+    }
+
+    case Type::transformed: {
+        return static_cast<const TransformedPrimitive *>(ptr)->intersect_hit(ray, t_max);
+    }
+
+    case Type::bvh: {
+        return static_cast<const HLBVH *>(ptr)->intersect_hit(ray, t_max);
+    }
     }
 
     REPORT_FATAL_ERROR();
     return {};
 }
+
+PBRT_CPU_GPU
+ShapeIntersection Primitive::compute_surface_interaction(const PrimitiveHit &hit,
+                                                         const Ray &ray) {
+    if (hit.render_from_primitive != nullptr) {
+        // rebuild the ray the instance was intersected with (its origin doesn't depend on t_max)
+        const auto inverse_ray = hit.render_from_primitive->apply_inverse(ray, nullptr);
+
+        auto si = compute_surface_interaction(
+            PrimitiveHit{hit.primitive, nullptr, hit.shape_hit}, inverse_ray);
+        si.interaction = (*hit.render_from_primitive)(si.interaction);
+
+        return si;
+    }
+
+    const auto primitive = hit.primitive;
+    switch (primitive->type) {
+    case Type::geometric: {
+        return static_cast<const GeometricPrimitive *>(primitive->ptr)
+            ->compute_surface_interaction(hit.shape_hit, ray);
+    }
+
+    case Type::triangle_mesh: {
+        return static_cast<const TriangleMeshPrimitive *>(primitive->ptr)
+            ->compute_surface_interaction(primitive->shape_idx, hit.shape_hit, ray);
+    }
+
+    case Type::bilinear_patch_mesh: {
+        return static_cast<const BilinearPatchMeshPrimitive *>(primitive->ptr)
+            ->compute_surface_interaction(primitive->shape_idx, hit.shape_hit, ray);
+    }
+
+    case Type::simple: {
+        return static_cast<const SimplePrimitive *>(primitive->ptr)
+            ->compute_surface_interaction(hit.shape_hit, ray);
+    }
+
+    case Type::transformed:
+    case Type::bvh: {
+        break;
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return ShapeIntersection(SurfaceInteraction(), NAN);
+}
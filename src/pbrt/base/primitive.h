@@ -5,20 +5,44 @@
 #include <pbrt/euclidean_space/transform.h>
 #include <pbrt/gpu/macro.h>
 
+class BilinearPatch;
+class BilinearPatchMesh;
 class GPUMemoryAllocator;
+class HLBVH;
 class Shape;
 class Material;
+class Primitive;
+class Triangle;
+class TriangleMesh;
 
 class GeometricPrimitive;
 class SimplePrimitive;
 class TransformedPrimitive;
 
+template <typename MeshShape>
+class MeshPrimitive;
+using TriangleMeshPrimitive = MeshPrimitive<Triangle>;
+using BilinearPatchMeshPrimitive = MeshPrimitive<BilinearPatch>;
+
+struct PrimitiveHit {
+    const Primitive *primitive;
+    // the geometric or simple primitive hit
+
+    const Transform *render_from_primitive;
+    // of the instance it was hit through, nullptr if not instanced
+
+    ShapeHit shape_hit;
+};
+
 class Primitive {
   public:
     enum class Type {
         geometric,
+        triangle_mesh,
+        bilinear_patch_mesh,
         simple,
         transformed,
+        bvh,
     };
 
     static const Primitive *create_geometric_primitives(const Shape *shapes,
@@ -29,31 +53,82 @@ class Primitive {
     static const Primitive *create_simple_primitives(const Shape *shapes, const Material *material,
                                                      uint num, GPUMemoryAllocator &allocator);
 
+    static const Primitive *create_mesh_primitives(const TriangleMesh *mesh,
+                                                   const Material *material,
+                                                   const Light *diffuse_area_lights,
+                                                   GPUMemoryAllocator &allocator);
+    // one per triangle of mesh, all sharing a single MeshPrimitive
+    // diffuse_area_lights: one per triangle, nullptr if the mesh isn't emissive
+
+    static const Primitive *create_mesh_primitives(const BilinearPatchMesh *mesh,
+                                                   const Material *material,
+                                                   const Light *diffuse_area_lights,
+                                                   GPUMemoryAllocator &allocator);
+    // one per patch of mesh, the same as above
+
     static const Primitive *create_transformed_primitives(const Primitive *base_primitives,
                                                           const Transform &render_from_primitive,
                                                           uint num, GPUMemoryAllocator &allocator);
 
     PBRT_CPU_GPU void init(const GeometricPrimitive *geometric_primitive);
 
+    PBRT_CPU_GPU
+    void init(const TriangleMeshPrimitive *mesh_primitive, uint _shape_idx);
+
+    PBRT_CPU_GPU
+    void init(const BilinearPatchMeshPrimitive *mesh_primitive, uint _shape_idx);
+
     PBRT_CPU_GPU
     void init(const SimplePrimitive *simple_primitive);
 
     PBRT_CPU_GPU
     void init(const TransformedPrimitive *transformed_primitive);
 
+    PBRT_CPU_GPU
+    void init(const HLBVH *bvh);
+    // a BVH shared by all instances of an object
+
     PBRT_CPU_GPU
     const Material *get_material() const;
+    // nullptr for BVH primitive: it holds primitives of different materials
+
+    PBRT_CPU_GPU
+    const Shape *get_shape() const;
+    // nullptr for mesh, transformed and BVH primitives
+
+    PBRT_CPU_GPU
+    pbrt::optional<Triangle> get_triangle() const;
+    // the triangle of a triangle mesh primitive or of a triangle shape
 
     PBRT_CPU_GPU
     Bounds3f bounds() const;
 
     PBRT_CPU_GPU
-    bool fast_intersect(const Ray &ray, FloatType t_max) const;
+    Bounds3f clip_bounds(const Bounds3f &clip_box) const;
+    // bounds of the part inside clip_box, used by spatial splits
+
+    PBRT_CPU_GPU
+    bool fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                        FloatType t_max) const;
+    // ray_precomputation: of ray, rebuilt by instances for the ray in their own space
 
     PBRT_CPU_GPU
     pbrt::optional<ShapeIntersection> intersect(const Ray &ray, FloatType t_max) const;
 
+    PBRT_CPU_GPU
+    pbrt::optional<PrimitiveHit> intersect_hit(const Ray &ray,
+                                               const RayPrecomputation &ray_precomputation,
+                                               FloatType t_max) const;
+    // the closest hit without its SurfaceInteraction: cheap to drop for a closer one
+
+    PBRT_CPU_GPU
+    static ShapeIntersection compute_surface_interaction(const PrimitiveHit &hit, const Ray &ray);
+    // ray: the one intersect_hit() was called with
+
   private:
     Type type;
+    uint shape_idx;
+    // in the mesh, for mesh primitives only (fills the padding before ptr)
+
     const void *ptr;
 };
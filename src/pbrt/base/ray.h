@@ -50,3 +50,40 @@ class Ray {
         return Ray(pf, pt - pf);
     }
 };
+
+struct RayPrecomputation {
+    // what box and triangle tests derive from the ray direction alone:
+    // built once before traversal instead of for every node and candidate triangle
+
+    Vector3f inv_dir;
+    int dir_is_neg[3];
+
+    uint8_t kx;
+    uint8_t ky;
+    uint8_t kz;
+    // kz: the largest component of the direction, triangles are sheared along it
+
+    FloatType shear_x;
+    FloatType shear_y;
+    FloatType shear_z;
+
+    PBRT_CPU_GPU
+    RayPrecomputation() {}
+
+    PBRT_CPU_GPU
+    explicit RayPrecomputation(const Ray &ray) {
+        const auto d = ray.d;
+        inv_dir = Vector3f(1.0 / d.x, 1.0 / d.y, 1.0 / d.z);
+        for (uint axis = 0; axis < 3; ++axis) {
+            dir_is_neg[axis] = int(inv_dir[axis] < 0.0);
+        }
+
+        kz = d.abs().max_component_index();
+        kx = (kz + 1) % 3;
+        ky = (kz + 2) % 3;
+
+        shear_x = -d[kx] / d[kz];
+        shear_y = -d[ky] / d[kz];
+        shear_z = 1 / d[kz];
+    }
+};
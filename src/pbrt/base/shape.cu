@@ -1,16 +1,115 @@
 #include <pbrt/base/shape.h>
 #include <pbrt/gpu/gpu_memory_allocator.h>
 #include <pbrt/scene/parameter_dictionary.h>
+#include <pbrt/shapes/bilinear_patch.h>
 #include <pbrt/shapes/disk.h>
 #include <pbrt/shapes/loop_subdivide.h>
 #include <pbrt/shapes/sphere.h>
 #include <pbrt/shapes/tri_quad_mesh.h>
 #include <pbrt/shapes/triangle.h>
 
+bool Shape::is_mesh(const std::string &type_of_shape) {
+    return type_of_shape == "plymesh" || type_of_shape == "trianglemesh" ||
+           type_of_shape == "bilinearmesh" || type_of_shape == "loopsubdiv";
+}
+
+TriQuadMesh Shape::read_mesh(const std::string &type_of_shape,
+                             const ParameterDictionary &parameters) {
+    if (type_of_shape == "plymesh") {
+        auto file_path = parameters.root + "/" + parameters.get_one_string("filename");
+        return TriQuadMesh::read_ply(file_path);
+    }
+
+    TriQuadMesh mesh;
+
+    if (type_of_shape == "trianglemesh") {
+        mesh.uv = parameters.get_point2_array("uv");
+        mesh.triIndices = parameters.get_integers("indices");
+        mesh.p = parameters.get_point3_array("P");
+        mesh.n = parameters.get_normal_array("N");
+
+        return mesh;
+    }
+
+    if (type_of_shape == "bilinearmesh") {
+        mesh.uv = parameters.get_point2_array("uv");
+        mesh.quadIndices = parameters.get_integers("indices");
+        mesh.p = parameters.get_point3_array("P");
+        mesh.n = parameters.get_normal_array("N");
+
+        if (mesh.quadIndices.empty() && mesh.p.size() == 4) {
+            // a single patch
+            mesh.quadIndices = {0, 1, 2, 3};
+        }
+
+        return mesh;
+    }
+
+    if (type_of_shape == "loopsubdiv") {
+        auto levels = parameters.get_integer("levels", 3);
+        auto indices = parameters.get_integers("indices");
+        auto points = parameters.get_point3_array("P");
+
+        auto loop_subdivide_data = LoopSubdivide(levels, indices, points);
+
+        mesh.p = std::move(loop_subdivide_data.p_limit);
+        mesh.triIndices = std::move(loop_subdivide_data.vertex_indices);
+        mesh.n = std::move(loop_subdivide_data.normals);
+
+        return mesh;
+    }
+
+    printf("\n%s(): `%s` is not a mesh\n", __func__, type_of_shape.c_str());
+    REPORT_FATAL_ERROR();
+    return mesh;
+}
+
+void MeshStats::report() const {
+    if (compressed_meshes > 0) {
+        printf("compressed meshes: %u, %zu vertices from %.2f MB to %.2f MB (%.2f MB saved)\n",
+               compressed_meshes, compressed_vertices, double(full_vertex_bytes) / (1024 * 1024),
+               double(compressed_vertex_bytes) / (1024 * 1024),
+               double(full_vertex_bytes - compressed_vertex_bytes) / (1024 * 1024));
+    }
+
+    if (patch_meshes > 0) {
+        printf("bilinear patch meshes: %u, %zu patches as %zu primitives (%.2f MB) instead of "
+               "%zu triangles (%.2f MB)\n",
+               patch_meshes, patches, patches, double(patch_bytes) / (1024 * 1024), patches * 2,
+               double(triangle_bytes) / (1024 * 1024));
+    }
+}
+
+Shape::Meshes Shape::create_meshes(const TriQuadMesh &mesh, const Transform &render_from_object,
+                                   bool reverse_orientation, bool compressed, MeshStats *stats,
+                                   GPUMemoryAllocator &allocator, const Meshes *same_topology) {
+    Meshes meshes;
+
+    if (!mesh.triIndices.empty()) {
+        meshes.triangle_mesh = TriangleMesh::build_mesh(
+            render_from_object, reverse_orientation, mesh.p, mesh.triIndices, mesh.n, mesh.uv,
+            compressed, same_topology ? same_topology->triangle_mesh : nullptr, stats, allocator);
+    }
+
+    if (!mesh.quadIndices.empty()) {
+        // quads stay one primitive each instead of being split into 2 triangles
+        meshes.bilinear_patch_mesh = BilinearPatchMesh::build_mesh(
+            render_from_object, reverse_orientation, mesh.p, mesh.quadIndices, mesh.n, mesh.uv,
+            same_topology ? same_topology->bilinear_patch_mesh : nullptr, stats, allocator);
+    }
+
+    return meshes;
+}
+
 std::pair<const Shape *, uint>
 Shape::create(const std::string &type_of_shape, const Transform &render_from_object,
               const Transform &object_from_render, bool reverse_orientation,
               const ParameterDictionary &parameters, GPUMemoryAllocator &allocator) {
+    if (is_mesh(type_of_shape)) {
+        printf("\n%s(): meshes are built by Shape::read_mesh() and create_meshes()\n", __func__);
+        REPORT_FATAL_ERROR();
+    }
+
     auto shape = allocator.allocate<Shape>();
 
     if (type_of_shape == "disk") {
@@ -29,57 +128,18 @@ Shape::create(const std::string &type_of_shape, const Transform &render_from_obj
         return {shape, 1};
     }
 
-    if (type_of_shape == "plymesh") {
-        auto file_path = parameters.root + "/" + parameters.get_one_string("filename");
-        auto ply_mesh = TriQuadMesh::read_ply(file_path);
-
-        const Shape *shapes = nullptr;
-        uint num_shapes = 0;
-
-        if (!ply_mesh.triIndices.empty()) {
-            const auto result = TriangleMesh::build_triangles(
-                render_from_object, reverse_orientation, ply_mesh.p, ply_mesh.triIndices,
-                ply_mesh.n, ply_mesh.uv, allocator);
-            shapes = result.first;
-            num_shapes = result.second;
-        }
-
-        if (!ply_mesh.quadIndices.empty()) {
-            printf("\n%s(): Shape::plymesh.quadIndices not implemented\n", __func__);
-            REPORT_FATAL_ERROR();
-        }
-
-        return {shapes, num_shapes};
-    }
-
-    if (type_of_shape == "trianglemesh") {
-        auto uv = parameters.get_point2_array("uv");
-        auto indices = parameters.get_integers("indices");
-        auto points = parameters.get_point3_array("P");
-        auto normals = parameters.get_normal_array("N");
-
-        return TriangleMesh::build_triangles(render_from_object, reverse_orientation, points,
-                                             indices, normals, uv, allocator);
-    }
-
-    if (type_of_shape == "loopsubdiv") {
-        auto levels = parameters.get_integer("levels", 3);
-        auto indices = parameters.get_integers("indices");
-        auto points = parameters.get_point3_array("P");
-
-        const auto loop_subdivide_data = LoopSubdivide(levels, indices, points);
-
-        return TriangleMesh::build_triangles(
-            render_from_object, reverse_orientation, loop_subdivide_data.p_limit,
-            loop_subdivide_data.vertex_indices, loop_subdivide_data.normals, {}, allocator);
-    }
-
     printf("\nShape `%s` not implemented\n", type_of_shape.c_str());
 
     REPORT_FATAL_ERROR();
     return {nullptr, 0};
 }
 
+PBRT_CPU_GPU
+void Shape::init(const BilinearPatch *bilinear_patch) {
+    type = Type::bilinear_patch;
+    ptr = bilinear_patch;
+}
+
 PBRT_CPU_GPU
 void Shape::init(const Disk *disk) {
     type = Type::disk;
@@ -98,6 +158,11 @@ void Shape::init(const Sphere *sphere) {
     ptr = sphere;
 }
 
+PBRT_CPU_GPU
+const Triangle *Shape::get_triangle() const {
+    return type == Type::triangle ? static_cast<const Triangle *>(ptr) : nullptr;
+}
+
 PBRT_CPU_GPU
 Bounds3f Shape::bounds() const {
     switch (type) {
@@ -112,6 +177,31 @@ Bounds3f Shape::bounds() const {
     case Type::triangle: {
         return static_cast<const Triangle *>(ptr)->bounds();
     }
+
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->bounds();
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return {};
+}
+
+PBRT_CPU_GPU
+Bounds3f Shape::clip_bounds(const Bounds3f &clip_box) const {
+    switch (type) {
+    case Type::disk:
+    case Type::sphere: {
+        return bounds().intersection(clip_box);
+    }
+
+    case Type::triangle: {
+        return static_cast<const Triangle *>(ptr)->clip_bounds(clip_box);
+    }
+
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->clip_bounds(clip_box);
+    }
     }
 
     REPORT_FATAL_ERROR();
@@ -132,6 +222,10 @@ FloatType Shape::area() const {
     case Type::triangle: {
         return static_cast<const Triangle *>(ptr)->area();
     }
+
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->area();
+    }
     }
 
     REPORT_FATAL_ERROR();
@@ -139,14 +233,20 @@ FloatType Shape::area() const {
 }
 
 PBRT_CPU_GPU
-bool Shape::fast_intersect(const Ray &ray, FloatType t_max) const {
+bool Shape::fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                           FloatType t_max) const {
     switch (type) {
     case Type::disk: {
         return static_cast<const Disk *>(ptr)->fast_intersect(ray, t_max);
     }
 
     case Type::triangle: {
-        return static_cast<const Triangle *>(ptr)->fast_intersect(ray, t_max);
+        return static_cast<const Triangle *>(ptr)->fast_intersect(ray, ray_precomputation, t_max);
+    }
+
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->fast_intersect(ray, ray_precomputation,
+                                                                       t_max);
     }
 
     case Type::sphere: {
@@ -169,6 +269,10 @@ pbrt::optional<ShapeIntersection> Shape::intersect(const Ray &ray, FloatType t_m
         return static_cast<const Triangle *>(ptr)->intersect(ray, t_max);
     }
 
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->intersect(ray, t_max);
+    }
+
     case Type::sphere: {
         return static_cast<const Sphere *>(ptr)->intersect(ray, t_max);
     }
@@ -178,6 +282,57 @@ pbrt::optional<ShapeIntersection> Shape::intersect(const Ray &ray, FloatType t_m
     return {};
 }
 
+PBRT_CPU_GPU
+pbrt::optional<ShapeHit> Shape::intersect_hit(const Ray &ray,
+                                              const RayPrecomputation &ray_precomputation,
+                                              FloatType t_max) const {
+    switch (type) {
+    case Type::disk: {
+        return static_cast<const Disk *>(ptr)->intersect_hit(ray, t_max);
+    }
+
+    case Type::triangle: {
+        return static_cast<const Triangle *>(ptr)->intersect_hit(ray, ray_precomputation, t_max);
+    }
+
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->intersect_hit(ray, ray_precomputation,
+                                                                      t_max);
+    }
+
+    case Type::sphere: {
+        return static_cast<const Sphere *>(ptr)->intersect_hit(ray, t_max);
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return {};
+}
+
+PBRT_CPU_GPU
+SurfaceInteraction Shape::compute_surface_interaction(const ShapeHit &hit, const Ray &ray) const {
+    switch (type) {
+    case Type::disk: {
+        return static_cast<const Disk *>(ptr)->compute_surface_interaction(hit, ray);
+    }
+
+    case Type::triangle: {
+        return static_cast<const Triangle *>(ptr)->compute_surface_interaction(hit, ray);
+    }
+
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->compute_surface_interaction(hit, ray);
+    }
+
+    case Type::sphere: {
+        return static_cast<const Sphere *>(ptr)->compute_surface_interaction(hit, ray);
+    }
+    }
+
+    REPORT_FATAL_ERROR();
+    return {};
+}
+
 PBRT_CPU_GPU
 pbrt::optional<ShapeSample> Shape::sample(const ShapeSampleContext &ctx, const Point2f &u) const {
     switch (type) {
@@ -192,6 +347,10 @@ pbrt::optional<ShapeSample> Shape::sample(const ShapeSampleContext &ctx, const P
     case Type::triangle: {
         return static_cast<const Triangle *>(ptr)->sample(ctx, u);
     }
+
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->sample(ctx, u);
+    }
     }
 
     REPORT_FATAL_ERROR();
@@ -212,6 +371,10 @@ FloatType Shape::pdf(const ShapeSampleContext &ctx, const Vector3f &wi) const {
     case Type::triangle: {
         return static_cast<const Triangle *>(ptr)->pdf(ctx, wi);
     }
+
+    case Type::bilinear_patch: {
+        return static_cast<const BilinearPatch *>(ptr)->pdf(ctx, wi);
+    }
     }
 
     REPORT_FATAL_ERROR();
@@ -6,10 +6,14 @@
 #include <pbrt/gpu/macro.h>
 #include <vector>
 
+class BilinearPatch;
+class BilinearPatchMesh;
 class Disk;
 class GPUMemoryAllocator;
 class Sphere;
+struct TriQuadMesh;
 class Triangle;
+class TriangleMesh;
 class Transform;
 class ParameterDictionary;
 
@@ -65,6 +69,23 @@ struct ShapeSampleContext {
     }
 };
 
+struct MeshStats {
+    // what mesh building saved, summed over the scene and reported once
+
+    uint compressed_meshes = 0;
+    size_t compressed_vertices = 0;
+    size_t full_vertex_bytes = 0;
+    size_t compressed_vertex_bytes = 0;
+
+    uint patch_meshes = 0;
+    size_t patches = 0;
+    size_t patch_bytes = 0;
+    size_t triangle_bytes = 0;
+    // per-primitive storage of the patches and of the triangles they would be split into
+
+    void report() const;
+};
+
 struct ShapeSample {
     Interaction interaction;
     FloatType pdf;
@@ -73,6 +94,7 @@ struct ShapeSample {
 class Shape {
   public:
     enum class Type {
+        bilinear_patch,
         disk,
         sphere,
         triangle,
@@ -82,6 +104,33 @@ class Shape {
     create(const std::string &type_of_shape, const Transform &render_from_object,
            const Transform &object_from_render, bool reverse_orientation,
            const ParameterDictionary &parameters, GPUMemoryAllocator &allocator);
+    // shapes other than meshes
+
+    struct Meshes {
+        const TriangleMesh *triangle_mesh = nullptr;
+        const BilinearPatchMesh *bilinear_patch_mesh = nullptr;
+        // nullptr when there are no triangles (quads)
+    };
+
+    static bool is_mesh(const std::string &type_of_shape);
+
+    static TriQuadMesh read_mesh(const std::string &type_of_shape,
+                                 const ParameterDictionary &parameters);
+    // the host side of a mesh: decodes PLY files and subdivides loopsubdiv shapes
+    // touches no device memory, so meshes can be read on several threads at once
+
+    static Meshes create_meshes(const TriQuadMesh &mesh, const Transform &render_from_object,
+                                bool reverse_orientation, bool compressed, MeshStats *stats,
+                                GPUMemoryAllocator &allocator,
+                                const Meshes *same_topology = nullptr);
+    // uploads mesh: its triangles and quads (bilinear patches) as separate meshes
+    // compressed: quantized positions, octahedral normals and half-precision uv
+    // (triangle meshes only)
+    // same_topology: meshes built earlier from the same TriQuadMesh, sharing indices and uv
+    // stats: added to (nullptr: not counted)
+
+    PBRT_CPU_GPU
+    void init(const BilinearPatch *bilinear_patch);
 
     PBRT_CPU_GPU
     void init(const Disk *disk);
@@ -92,18 +141,38 @@ class Shape {
     PBRT_CPU_GPU
     void init(const Triangle *triangle);
 
+    PBRT_CPU_GPU
+    const Triangle *get_triangle() const;
+    // nullptr for other shapes
+
     PBRT_CPU_GPU
     Bounds3f bounds() const;
 
+    PBRT_CPU_GPU
+    Bounds3f clip_bounds(const Bounds3f &clip_box) const;
+    // bounds of the part inside clip_box: exact for triangles, conservative otherwise
+
     PBRT_CPU_GPU
     FloatType area() const;
 
     PBRT_CPU_GPU
-    bool fast_intersect(const Ray &ray, FloatType t_max) const;
+    bool fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                        FloatType t_max) const;
+    // ray_precomputation: of ray, only triangles use it
 
     PBRT_CPU_GPU
     pbrt::optional<ShapeIntersection> intersect(const Ray &ray, FloatType t_max = Infinity) const;
 
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeHit> intersect_hit(const Ray &ray,
+                                           const RayPrecomputation &ray_precomputation,
+                                           FloatType t_max) const;
+    // the closest hit without its SurfaceInteraction
+
+    PBRT_CPU_GPU
+    SurfaceInteraction compute_surface_interaction(const ShapeHit &hit, const Ray &ray) const;
+    // ray: the one intersect_hit() was called with
+
     PBRT_CPU_GPU
     pbrt::optional<ShapeSample> sample(const ShapeSampleContext &ctx, const Point2f &u) const;
 
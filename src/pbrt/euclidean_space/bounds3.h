@@ -81,6 +81,15 @@ class Bounds3 {
         return Point3(NAN, NAN, NAN);
     }
 
+    PBRT_CPU_GPU Bounds3 intersection(const Bounds3 &b) const {
+        // inverted (empty) when they don't overlap
+        Bounds3 result;
+        result.p_min = p_min.max(b.p_min);
+        result.p_max = p_max.min(b.p_max);
+
+        return result;
+    }
+
     PBRT_CPU_GPU Bounds3 operator+(const Bounds3 &b) const {
         return Bounds3(p_min.min(b.p_min), p_max.max(b.p_max));
     }
@@ -120,6 +129,13 @@ class Bounds3 {
         return o;
     }
 
+    PBRT_CPU_GPU
+    Point3f lerp(const Point3f &t) const {
+        // the inverse of offset()
+        return Point3f(pbrt::lerp(t.x, p_min.x, p_max.x), pbrt::lerp(t.y, p_min.y, p_max.y),
+                       pbrt::lerp(t.z, p_min.z, p_max.z));
+    }
+
     PBRT_CPU_GPU uint8_t max_dimension() const {
         auto d = diagonal();
         if (d.x > d.y && d.x > d.z) {
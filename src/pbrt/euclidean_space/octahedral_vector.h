@@ -0,0 +1,65 @@
+#pragma once
+
+#include <pbrt/euclidean_space/normal3f.h>
+#include <pbrt/gpu/macro.h>
+
+class OctahedralVector {
+    // a unit vector in 32 bits: projected onto the octahedron |x| + |y| + |z| = 1,
+    // with the lower half folded over the upper one, and x, y quantized to 16 bits each
+
+  public:
+    OctahedralVector() = default;
+
+    PBRT_CPU_GPU
+    explicit OctahedralVector(const Normal3f &n) {
+        const FloatType l1_norm = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        if (l1_norm == 0) {
+            // a degenerate normal has no direction to keep: store +z rather than NaN
+            x = encode(0);
+            y = encode(0);
+            return;
+        }
+
+        const FloatType vx = n.x / l1_norm;
+        const FloatType vy = n.y / l1_norm;
+
+        if (n.z >= 0) {
+            x = encode(vx);
+            y = encode(vy);
+        } else {
+            x = encode((1 - std::abs(vy)) * sign(vx));
+            y = encode((1 - std::abs(vx)) * sign(vy));
+        }
+    }
+
+    PBRT_CPU_GPU
+    Normal3f to_normal() const {
+        FloatType vx = -1 + 2 * (FloatType(x) / 65535);
+        FloatType vy = -1 + 2 * (FloatType(y) / 65535);
+        const FloatType vz = 1 - (std::abs(vx) + std::abs(vy));
+
+        if (vz < 0) {
+            const FloatType folded_x = vx;
+            vx = (1 - std::abs(vy)) * sign(folded_x);
+            vy = (1 - std::abs(folded_x)) * sign(vy);
+        }
+
+        return Normal3f(Vector3f(vx, vy, vz).normalize());
+    }
+
+  private:
+    uint16_t x;
+    uint16_t y;
+
+    PBRT_CPU_GPU
+    static FloatType sign(FloatType v) {
+        return std::copysign(FloatType(1), v);
+    }
+
+    PBRT_CPU_GPU
+    static uint16_t encode(FloatType f) {
+        return std::round(clamp<FloatType>((f + 1) / 2, 0, 1) * 65535);
+    }
+};
+
+static_assert(sizeof(OctahedralVector) == 4);
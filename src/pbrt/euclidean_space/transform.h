@@ -238,6 +238,10 @@ class Transform {
         return true;
     }
 
+    PBRT_CPU_GPU bool operator==(const Transform &transform) const {
+        return m == transform.m;
+    }
+
     PBRT_CPU_GPU Transform inverse() const {
         return Transform(inv_m, m);
     }
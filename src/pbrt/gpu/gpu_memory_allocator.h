@@ -21,6 +21,15 @@ class GPUMemoryAllocator {
         return data;
     }
 
+    template <typename T>
+    T *copy_to_device(const std::vector<T> &host_data) {
+        auto data = allocate<T>(host_data.size());
+        CHECK_CUDA_ERROR(cudaMemcpy(data, host_data.data(), sizeof(T) * host_data.size(),
+                                    cudaMemcpyHostToDevice));
+
+        return data;
+    }
+
   private:
     std::vector<void *> gpu_dynamic_pointers;
 };
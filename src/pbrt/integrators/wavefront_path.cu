@@ -17,6 +17,13 @@
 
 constexpr uint PATH_POOL_SIZE = 2 * 1024 * 1024;
 
+constexpr uint CAMERA_TILE_SIZE = 4;
+constexpr uint CAMERA_PACKET_SIZE = CAMERA_TILE_SIZE * CAMERA_TILE_SIZE;
+// camera rays of a 4x4 pixel tile are traced as one packet
+static_assert(CAMERA_PACKET_SIZE <= HLBVH::MAX_PACKET_SIZE);
+
+constexpr uint NO_CAMERA_RAY = std::numeric_limits<uint>::max();
+
 struct FrameBuffer {
     uint pixel_idx;
     uint sample_idx;
@@ -262,9 +269,41 @@ __global__ void fill_new_path_queue(WavefrontPathIntegrator::Queues *queues) {
     queues->new_path_queue[worker_idx] = worker_idx;
 }
 
+struct TiledIndex {
+    uint band;
+    uint band_height;
+    uint idx_in_band;
+};
+
+PBRT_CPU_GPU
+static TiledIndex split_tiled_index(const uint idx, const Point2i &resolution) {
+    // pixels are walked in bands of CAMERA_TILE_SIZE rows, column by column inside a band:
+    // CAMERA_PACKET_SIZE consecutive indices make up a tile
+    // (the last band is lower when the height isn't a multiple of CAMERA_TILE_SIZE)
+    const uint band_size = resolution.x * CAMERA_TILE_SIZE;
+    const uint band = idx / band_size;
+
+    return TiledIndex{
+        .band = band,
+        .band_height = std::min<uint>(CAMERA_TILE_SIZE, resolution.y - band * CAMERA_TILE_SIZE),
+        .idx_in_band = idx - band * band_size,
+    };
+}
+
+PBRT_CPU_GPU
+static uint tiled_pixel_index(const uint idx, const Point2i &resolution) {
+    const auto [band, band_height, idx_in_band] = split_tiled_index(idx, resolution);
+
+    const uint x = idx_in_band / band_height;
+    const uint y = band * CAMERA_TILE_SIZE + idx_in_band % band_height;
+
+    return y * resolution.x + x;
+}
+
 __global__ void generate_new_path(const IntegratorBase *base,
                                   WavefrontPathIntegrator::PathState *path_state,
-                                  WavefrontPathIntegrator::Queues *queues) {
+                                  WavefrontPathIntegrator::Queues *queues,
+                                  const bool camera_ray_packets) {
     const uint queue_idx = blockIdx.x * blockDim.x + threadIdx.x;
     if (queue_idx >= queues->new_path_counter) {
         return;
@@ -272,16 +311,22 @@ __global__ void generate_new_path(const IntegratorBase *base,
 
     const uint path_idx = queues->new_path_queue[queue_idx];
 
-    const auto unique_path_id = atomicAdd(&path_state->global_path_counter, 1);
+    // ids follow the queue order (instead of atomicAdd) so that neighbouring camera rays
+    // in the queue come from neighbouring pixels
+    const auto unique_path_id = queues->first_camera_path_id + queue_idx;
     if (unique_path_id >= path_state->total_path_num) {
         path_state->finished[path_idx] = true;
+        queues->camera_ray_queue[queue_idx] = NO_CAMERA_RAY;
         return;
     }
 
     const uint width = path_state->image_resolution.x;
     const uint height = path_state->image_resolution.y;
 
-    const uint pixel_idx = unique_path_id % (width * height);
+    const uint pixel_idx =
+        camera_ray_packets
+            ? tiled_pixel_index(unique_path_id % (width * height), path_state->image_resolution)
+            : unique_path_id % (width * height);
     const uint sample_idx = unique_path_id / (width * height);
 
     auto sampler = &path_state->samplers[path_idx];
@@ -303,10 +348,67 @@ __global__ void generate_new_path(const IntegratorBase *base,
 
     path_state->init_new_path(path_idx);
 
-    uint ray_queue_idx = atomicAdd(&queues->ray_counter, 1);
+    if (camera_ray_packets) {
+        queues->camera_ray_queue[queue_idx] = path_idx;
+        return;
+    }
+
+    const uint ray_queue_idx = atomicAdd(&queues->ray_counter, 1);
     queues->ray_queue[ray_queue_idx] = path_idx;
 }
 
+__global__ void trace_camera_ray_packets(const WavefrontPathIntegrator *integrator,
+                                         WavefrontPathIntegrator::PathState *path_state,
+                                         const WavefrontPathIntegrator::Queues *queues) {
+    // one thread per camera ray: the first ray of each pixel tile traces the tile as a packet
+    const uint queue_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (queue_idx >= queues->camera_ray_counter) {
+        return;
+    }
+
+    // the tile of the path, laid out as in tiled_pixel_index(): tiles of the last band and
+    // of the last columns are smaller when the resolution isn't a multiple of CAMERA_TILE_SIZE
+    const auto resolution = path_state->image_resolution;
+    const uint idx = (queues->first_camera_path_id + queue_idx) % (resolution.x * resolution.y);
+
+    const auto tiled_idx = split_tiled_index(idx, resolution);
+    const uint band_height = tiled_idx.band_height;
+    const uint idx_in_band = tiled_idx.idx_in_band;
+
+    const uint tile_size = CAMERA_TILE_SIZE * band_height;
+    const uint idx_in_tile = idx_in_band % tile_size;
+    if (idx_in_tile != 0 && queue_idx != 0) {
+        return;
+    }
+
+    const uint tile_end =
+        std::min(idx_in_band - idx_in_tile + tile_size, resolution.x * band_height);
+
+    const uint start = queue_idx;
+    const uint end = std::min(queue_idx + (tile_end - idx_in_band), queues->camera_ray_counter);
+
+    Ray rays[CAMERA_PACKET_SIZE];
+    uint path_indices[CAMERA_PACKET_SIZE];
+    uint num_rays = 0;
+    for (uint queue_idx = start; queue_idx < end; ++queue_idx) {
+        const uint path_idx = queues->camera_ray_queue[queue_idx];
+        if (path_idx == NO_CAMERA_RAY) {
+            continue;
+        }
+
+        rays[num_rays] = path_state->camera_rays[path_idx].ray;
+        path_indices[num_rays] = path_idx;
+        num_rays += 1;
+    }
+
+    pbrt::optional<ShapeIntersection> intersections[CAMERA_PACKET_SIZE];
+    integrator->base->bvh->intersect_packet(rays, num_rays, Infinity, intersections);
+
+    for (uint idx = 0; idx < num_rays; ++idx) {
+        path_state->shape_intersections[path_indices[idx]] = intersections[idx];
+    }
+}
+
 __global__ void gpu_evaluate_material(WavefrontPathIntegrator::PathState *path_state,
                                       WavefrontPathIntegrator::Queues *queues,
                                       const Material::Type material_type,
@@ -366,12 +468,40 @@ __global__ void gpu_evaluate_material(WavefrontPathIntegrator::PathState *path_s
     path_state->bsdf[path_idx] =
         isect.get_bsdf(lambda, integrator->base->camera, sampler->get_samples_per_pixel());
 
-    integrator->sample_bsdf(path_idx, path_state);
+    Ray shadow_rays[2];
+    integrator->sample_bsdf(path_idx, path_state, shadow_rays);
+
+    if (path_state->unoccluded_L[path_idx].is_positive()) {
+        const uint shadow_queue_idx = atomicAdd(&queues->shadow_ray_counter, 1);
+        queues->shadow_ray_queue[shadow_queue_idx] = path_idx;
+
+        for (uint idx = 0; idx < 2; ++idx) {
+            queues->shadow_rays.rays[shadow_queue_idx * 2 + idx] = shadow_rays[idx];
+            queues->shadow_rays.t_max[shadow_queue_idx * 2 + idx] =
+                IntegratorBase::UNOCCLUDED_T_MAX;
+        }
+    }
 
     uint ray_queue_idx = atomicAdd(&queues->ray_counter, 1);
     queues->ray_queue[ray_queue_idx] = path_idx;
 }
 
+__global__ void add_unoccluded_radiance(WavefrontPathIntegrator::PathState *path_state,
+                                        const WavefrontPathIntegrator::Queues *queues) {
+    const uint queue_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (queue_idx >= queues->shadow_ray_counter) {
+        return;
+    }
+
+    if (queues->shadow_rays.is_occluded(queue_idx * 2) ||
+        queues->shadow_rays.is_occluded(queue_idx * 2 + 1)) {
+        return;
+    }
+
+    const uint path_idx = queues->shadow_ray_queue[queue_idx];
+    path_state->L[path_idx] += path_state->unoccluded_L[path_idx];
+}
+
 __global__ void ray_cast(const WavefrontPathIntegrator *integrator,
                          WavefrontPathIntegrator::PathState *path_state,
                          WavefrontPathIntegrator::Queues *queues) {
@@ -389,7 +519,8 @@ __global__ void ray_cast(const WavefrontPathIntegrator *integrator,
 }
 
 PBRT_CPU_GPU
-void WavefrontPathIntegrator::sample_bsdf(uint path_idx, PathState *path_state) const {
+void WavefrontPathIntegrator::sample_bsdf(uint path_idx, PathState *path_state,
+                                          Ray shadow_rays[2]) const {
     auto &isect = path_state->shape_intersections[path_idx]->interaction;
     auto &lambda = path_state->lambdas[path_idx];
 
@@ -400,9 +531,11 @@ void WavefrontPathIntegrator::sample_bsdf(uint path_idx, PathState *path_state)
         path_state->bsdf[path_idx].regularize();
     }
 
+    path_state->unoccluded_L[path_idx] = SampledSpectrum(0.0);
     if (pbrt::is_non_specular(path_state->bsdf[path_idx].flags())) {
-        SampledSpectrum Ld = sample_ld(isect, &path_state->bsdf[path_idx], lambda, sampler);
-        path_state->L[path_idx] += path_state->beta[path_idx] * Ld;
+        SampledSpectrum Ld =
+            sample_ld(isect, &path_state->bsdf[path_idx], lambda, sampler, shadow_rays);
+        path_state->unoccluded_L[path_idx] = path_state->beta[path_idx] * Ld;
     }
 
     // Sample BSDF to get new path direction
@@ -474,6 +607,48 @@ void WavefrontPathIntegrator::evaluate_material(const Material::Type material_ty
     CHECK_CUDA_ERROR(cudaDeviceSynchronize());
 }
 
+void WavefrontPathIntegrator::generate_new_paths() {
+    // new paths take the next path ids in queue order
+    // their camera rays join the ray queue, or wait for trace_camera_rays() with packets
+    constexpr uint threads = 256;
+
+    queues.first_camera_path_id = path_state.global_path_counter;
+    generate_new_path<<<divide_and_ceil(queues.new_path_counter, threads), threads>>>(
+        base, &path_state, &queues, camera_ray_packets);
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+
+    path_state.global_path_counter += queues.new_path_counter;
+    queues.camera_ray_counter = camera_ray_packets ? queues.new_path_counter : 0;
+}
+
+void WavefrontPathIntegrator::trace_camera_rays() {
+    if (queues.camera_ray_counter <= 0) {
+        return;
+    }
+
+    constexpr uint threads = 256;
+
+    trace_camera_ray_packets<<<divide_and_ceil(queues.camera_ray_counter, threads), threads>>>(
+        this, &path_state, &queues);
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+}
+
+void WavefrontPathIntegrator::trace_shadow_rays() {
+    // all shadow rays of this round are traced as one batch
+    if (queues.shadow_ray_counter <= 0) {
+        return;
+    }
+
+    queues.shadow_rays.num_rays = queues.shadow_ray_counter * 2;
+    base->fast_intersect_batch(&queues.shadow_rays);
+
+    const uint threads = 256;
+    const auto blocks = divide_and_ceil(queues.shadow_ray_counter, threads);
+
+    add_unoccluded_radiance<<<blocks, threads>>>(&path_state, &queues);
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+}
+
 PBRT_CPU_GPU
 void WavefrontPathIntegrator::PathState::init_new_path(uint path_idx) {
     finished[path_idx] = false;
@@ -499,6 +674,7 @@ void WavefrontPathIntegrator::PathState::create(uint samples_per_pixel, const Po
 
     L = allocator.allocate<SampledSpectrum>(PATH_POOL_SIZE);
     beta = allocator.allocate<SampledSpectrum>(PATH_POOL_SIZE);
+    unoccluded_L = allocator.allocate<SampledSpectrum>(PATH_POOL_SIZE);
     shape_intersections = allocator.allocate<pbrt::optional<ShapeIntersection>>(PATH_POOL_SIZE);
 
     path_length = allocator.allocate<uint>(PATH_POOL_SIZE);
@@ -541,6 +717,7 @@ void WavefrontPathIntegrator::PathState::create(uint samples_per_pixel, const Po
 void WavefrontPathIntegrator::Queues::init(GPUMemoryAllocator &allocator) {
     new_path_queue = allocator.allocate<uint>(PATH_POOL_SIZE);
     ray_queue = allocator.allocate<uint>(PATH_POOL_SIZE);
+    camera_ray_queue = allocator.allocate<uint>(PATH_POOL_SIZE);
     frame_buffer_queue = allocator.allocate<FrameBuffer>(PATH_POOL_SIZE);
 
     coated_conductor_material_queue = allocator.allocate<uint>(PATH_POOL_SIZE);
@@ -548,16 +725,21 @@ void WavefrontPathIntegrator::Queues::init(GPUMemoryAllocator &allocator) {
     conductor_material_queue = allocator.allocate<uint>(PATH_POOL_SIZE);
     dielectric_material_queue = allocator.allocate<uint>(PATH_POOL_SIZE);
     diffuse_material_queue = allocator.allocate<uint>(PATH_POOL_SIZE);
+
+    shadow_ray_queue = allocator.allocate<uint>(PATH_POOL_SIZE);
+    shadow_rays.init(PATH_POOL_SIZE * 2, allocator);
 }
 
 WavefrontPathIntegrator *WavefrontPathIntegrator::create(const ParameterDictionary &parameters,
                                                          const IntegratorBase *base,
                                                          const std::string &sampler_type,
                                                          uint samples_per_pixel,
+                                                         bool camera_ray_packets,
                                                          GPUMemoryAllocator &allocator) {
     auto integrator = allocator.allocate<WavefrontPathIntegrator>();
 
     integrator->samples_per_pixel = samples_per_pixel;
+    integrator->camera_ray_packets = camera_ray_packets;
 
     integrator->base = base;
     integrator->path_state.create(samples_per_pixel, base->camera->get_camerabase()->resolution,
@@ -573,8 +755,8 @@ WavefrontPathIntegrator *WavefrontPathIntegrator::create(const ParameterDictiona
 
 PBRT_CPU_GPU
 SampledSpectrum WavefrontPathIntegrator::sample_ld(const SurfaceInteraction &intr, const BSDF *bsdf,
-                                                   SampledWavelengths &lambda,
-                                                   Sampler *sampler) const {
+                                                   SampledWavelengths &lambda, Sampler *sampler,
+                                                   Ray shadow_rays[2]) const {
     // Initialize _LightSampleContext_ for light sampling
     LightSampleContext ctx(intr);
     // Try to nudge the light sampling position to correct side of the surface
@@ -606,10 +788,13 @@ SampledSpectrum WavefrontPathIntegrator::sample_ld(const SurfaceInteraction &int
     Vector3f wi = ls->wi;
     SampledSpectrum f = bsdf->f(wo, wi) * wi.abs_dot(intr.shading.n.to_vector3());
 
-    if (!f.is_positive() || !base->unoccluded(intr, ls->p_light)) {
+    if (!f.is_positive()) {
         return SampledSpectrum(0);
     }
 
+    // visibility is left to the shadow ray stage
+    IntegratorBase::unoccluded_rays(intr, ls->p_light, shadow_rays);
+
     // Return light's contribution to reflected radiance
     FloatType pdf_light = sampled_light->p * ls->pdf;
     if (pbrt::is_delta_light(light->get_light_type())) {
@@ -644,18 +829,22 @@ void WavefrontPathIntegrator::render(Film *film, const bool preview) {
     queues.new_path_counter = PATH_POOL_SIZE;
 
     queues.ray_counter = 0;
-    generate_new_path<<<divide_and_ceil(queues.new_path_counter, threads), threads>>>(
-        base, &path_state, &queues);
-    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    generate_new_paths();
 
-    while (queues.ray_counter > 0) {
-        ray_cast<<<divide_and_ceil(queues.ray_counter, threads), threads>>>(this, &path_state,
-                                                                            &queues);
-        CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+    while (queues.ray_counter > 0 || queues.camera_ray_counter > 0) {
+        if (queues.ray_counter > 0) {
+            ray_cast<<<divide_and_ceil(queues.ray_counter, threads), threads>>>(
+                this, &path_state, &queues);
+            CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+        }
+
+        // depth-0 rays
+        trace_camera_rays();
 
         // clear all queues before control stage
         queues.new_path_counter = 0;
         queues.ray_counter = 0;
+        queues.camera_ray_counter = 0;
         queues.frame_buffer_counter = 0;
 
         queues.coated_conductor_material_counter = 0;
@@ -663,6 +852,7 @@ void WavefrontPathIntegrator::render(Film *film, const bool preview) {
         queues.conductor_material_counter = 0;
         queues.dielectric_material_counter = 0;
         queues.diffuse_material_counter = 0;
+        queues.shadow_ray_counter = 0;
 
         control_logic<<<divide_and_ceil(PATH_POOL_SIZE, threads), threads>>>(this, &path_state,
                                                                              &queues);
@@ -689,9 +879,7 @@ void WavefrontPathIntegrator::render(Film *film, const bool preview) {
         }
 
         if (queues.new_path_counter > 0) {
-            generate_new_path<<<divide_and_ceil(queues.new_path_counter, threads), threads>>>(
-                base, &path_state, &queues);
-            CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+            generate_new_paths();
         }
 
         for (const auto material_type : {
@@ -703,5 +891,7 @@ void WavefrontPathIntegrator::render(Film *film, const bool preview) {
              }) {
             evaluate_material(material_type);
         }
+
+        trace_shadow_rays();
     }
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <pbrt/base/integrator_base.h>
 #include <pbrt/base/material.h>
 #include <pbrt/euclidean_space/point2.h>
 
@@ -18,7 +19,6 @@ struct CameraSample;
 struct CameraRay;
 struct FrameBuffer;
 struct MISParameter;
-struct IntegratorBase;
 struct ShapeIntersection;
 
 class WavefrontPathIntegrator {
@@ -30,6 +30,9 @@ class WavefrontPathIntegrator {
 
         SampledSpectrum *L;
         SampledSpectrum *beta;
+
+        SampledSpectrum *unoccluded_L;
+        // direct lighting added to L once its shadow rays are traced
         Sampler *samplers;
 
         pbrt::optional<ShapeIntersection> *shape_intersections;
@@ -66,6 +69,11 @@ class WavefrontPathIntegrator {
         uint *ray_queue;
         uint ray_counter;
 
+        uint *camera_ray_queue;
+        uint camera_ray_counter;
+        unsigned long long int first_camera_path_id;
+        // camera_ray_queue[idx] is the path of id (first_camera_path_id + idx)
+
         uint *conductor_material_queue;
         uint conductor_material_counter;
 
@@ -81,13 +89,18 @@ class WavefrontPathIntegrator {
         uint *diffuse_material_queue;
         uint diffuse_material_counter;
 
+        uint *shadow_ray_queue;
+        uint shadow_ray_counter;
+        // shadow_rays[2 * idx] and shadow_rays[2 * idx + 1] belong to shadow_ray_queue[idx]
+        OcclusionBatch shadow_rays;
+
         void init(GPUMemoryAllocator &allocator);
     };
 
     static WavefrontPathIntegrator *create(const ParameterDictionary &parameters,
                                            const IntegratorBase *base,
                                            const std::string &sampler_type, uint samples_per_pixel,
-                                           GPUMemoryAllocator &allocator);
+                                           bool camera_ray_packets, GPUMemoryAllocator &allocator);
 
     void render(Film *film, bool preview);
 
@@ -100,12 +113,23 @@ class WavefrontPathIntegrator {
     bool regularize;
     uint samples_per_pixel;
 
+    bool camera_ray_packets;
+    // trace camera rays of 4x4 pixel tiles as packets instead of one ray per thread
+
     PBRT_CPU_GPU
     SampledSpectrum sample_ld(const SurfaceInteraction &intr, const BSDF *bsdf,
-                              SampledWavelengths &lambda, Sampler *sampler) const;
+                              SampledWavelengths &lambda, Sampler *sampler,
+                              Ray shadow_rays[2]) const;
+    // returns the unshadowed contribution: it counts only when neither shadow ray is occluded
 
     PBRT_CPU_GPU
-    void sample_bsdf(uint path_idx, PathState *path_state) const;
+    void sample_bsdf(uint path_idx, PathState *path_state, Ray shadow_rays[2]) const;
 
     void evaluate_material(const Material::Type material_type);
+
+    void generate_new_paths();
+
+    void trace_camera_rays();
+
+    void trace_shadow_rays();
 };
@@ -1,6 +1,7 @@
 #include <pbrt/euclidean_space/bounds3.h>
 #include <pbrt/euclidean_space/vector3.h>
 #include <pbrt/lights/image_infinite_light.h>
+#include <pbrt/scene/loader_cache.h>
 #include <pbrt/scene/parameter_dictionary.h>
 #include <pbrt/spectra/rgb_illuminant_spectrum.h>
 #include <pbrt/spectrum_util/global_spectra.h>
@@ -42,8 +43,10 @@ void ImageInfiniteLight::init(const Transform &_render_from_light,
     scene_center = Point3f(NAN, NAN, NAN);
 
     auto texture_file = parameters.root + "/" + parameters.get_one_string("filename");
-    image_ptr = GPUImage::create_from_file(texture_file, allocator);
+    image_ptr = parameters.loader_cache->read_image(texture_file, allocator);
+}
 
+void ImageInfiniteLight::build_distribution(GPUMemoryAllocator &allocator) {
     image_resolution = image_ptr->get_resolution();
 
     FloatType max_luminance = 0.0;
@@ -24,6 +24,9 @@ class ImageInfiniteLight : public LightBase {
     void init(const Transform &_render_from_light, const ParameterDictionary &parameters,
               GPUMemoryAllocator &allocator);
 
+    void build_distribution(GPUMemoryAllocator &allocator);
+    // once LoaderCache::read_images() has filled in the image
+
     PBRT_CPU_GPU
     SampledSpectrum le(const Ray &ray, const SampledWavelengths &lambda) const;
 
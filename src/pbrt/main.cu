@@ -122,6 +122,14 @@ void display_system_info() {
 }
 
 int main(int argc, const char **argv) {
+    int device_count = 0;
+    if (cudaGetDeviceCount(&device_count) != cudaSuccess || device_count == 0) {
+        // --host-bvh only moves BVH construction to the host:
+        // loading the scene (and rendering) still goes through the CUDA runtime
+        printf("no CUDA device found: pbrt-minus needs one to load and render a scene\n");
+        return 1;
+    }
+
     size_t stack_size;
     cudaDeviceGetLimit(&stack_size, cudaLimitStackSize);
     size_t new_stack_size = std::max(stack_size, size_t(64 * 1024));
@@ -15,14 +15,26 @@ const Material *GeometricPrimitive::get_material() const {
     return material;
 }
 
+PBRT_CPU_GPU
+const Shape *GeometricPrimitive::get_shape() const {
+    return shape_ptr;
+}
+
 PBRT_CPU_GPU
 Bounds3f GeometricPrimitive::bounds() const {
     return shape_ptr->bounds();
 }
 
 PBRT_CPU_GPU
-bool GeometricPrimitive::fast_intersect(const Ray &ray, FloatType t_max) const {
-    return shape_ptr->fast_intersect(ray, t_max);
+Bounds3f GeometricPrimitive::clip_bounds(const Bounds3f &clip_box) const {
+    return shape_ptr->clip_bounds(clip_box);
+}
+
+PBRT_CPU_GPU
+bool GeometricPrimitive::fast_intersect(const Ray &ray,
+                                        const RayPrecomputation &ray_precomputation,
+                                        FloatType t_max) const {
+    return shape_ptr->fast_intersect(ray, ray_precomputation, t_max);
 }
 
 PBRT_CPU_GPU
@@ -36,3 +48,19 @@ pbrt::optional<ShapeIntersection> GeometricPrimitive::intersect(const Ray &ray,
     si->interaction.set_intersection_properties(material, area_light);
     return si;
 }
+
+PBRT_CPU_GPU
+pbrt::optional<ShapeHit>
+GeometricPrimitive::intersect_hit(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                                  FloatType t_max) const {
+    return shape_ptr->intersect_hit(ray, ray_precomputation, t_max);
+}
+
+PBRT_CPU_GPU
+ShapeIntersection GeometricPrimitive::compute_surface_interaction(const ShapeHit &hit,
+                                                                  const Ray &ray) const {
+    auto interaction = shape_ptr->compute_surface_interaction(hit, ray);
+    interaction.set_intersection_properties(material, area_light);
+
+    return ShapeIntersection(interaction, hit.t_hit);
+}
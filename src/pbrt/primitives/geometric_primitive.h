@@ -16,15 +16,30 @@ class GeometricPrimitive {
     PBRT_CPU_GPU
     const Material *get_material() const;
 
+    PBRT_CPU_GPU
+    const Shape *get_shape() const;
+
     PBRT_CPU_GPU
     Bounds3f bounds() const;
 
     PBRT_CPU_GPU
-    bool fast_intersect(const Ray &ray, FloatType t_max) const;
+    Bounds3f clip_bounds(const Bounds3f &clip_box) const;
+
+    PBRT_CPU_GPU
+    bool fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                        FloatType t_max) const;
 
     PBRT_CPU_GPU
     pbrt::optional<ShapeIntersection> intersect(const Ray &ray, FloatType t_max) const;
 
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeHit> intersect_hit(const Ray &ray,
+                                           const RayPrecomputation &ray_precomputation,
+                                           FloatType t_max) const;
+
+    PBRT_CPU_GPU
+    ShapeIntersection compute_surface_interaction(const ShapeHit &hit, const Ray &ray) const;
+
   private:
     const Shape *shape_ptr;
     const Material *material;
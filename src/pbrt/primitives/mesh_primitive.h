@@ -0,0 +1,96 @@
+#pragma once
+
+#include <pbrt/base/material.h>
+#include <pbrt/shapes/bilinear_patch.h>
+#include <pbrt/shapes/triangle.h>
+
+class Light;
+
+template <typename MeshShape>
+class MeshPrimitive {
+    // a whole mesh (of triangles or bilinear patches) with its material and (optional) area
+    // lights: shapes are addressed by their index in the mesh, with no MeshShape/Shape built
+    // for them
+
+  public:
+    using Mesh = typename MeshShape::Mesh;
+
+    PBRT_CPU_GPU
+    void init(const Mesh *_mesh, const Material *_material, const Light *_area_lights) {
+        mesh = _mesh;
+        material = _material;
+        area_lights = _area_lights;
+    }
+
+    PBRT_CPU_GPU
+    const Material *get_material() const {
+        return material;
+    }
+
+    PBRT_CPU_GPU
+    MeshShape get_shape(const uint shape_idx) const {
+        MeshShape shape;
+        shape.init(shape_idx, mesh);
+
+        return shape;
+    }
+
+    PBRT_CPU_GPU
+    Bounds3f bounds(const uint shape_idx) const {
+        return get_shape(shape_idx).bounds();
+    }
+
+    PBRT_CPU_GPU
+    Bounds3f clip_bounds(const uint shape_idx, const Bounds3f &clip_box) const {
+        return get_shape(shape_idx).clip_bounds(clip_box);
+    }
+
+    PBRT_CPU_GPU
+    bool fast_intersect(const uint shape_idx, const Ray &ray,
+                        const RayPrecomputation &ray_precomputation, FloatType t_max) const {
+        return get_shape(shape_idx).fast_intersect(ray, ray_precomputation, t_max);
+    }
+
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeIntersection> intersect(const uint shape_idx, const Ray &ray,
+                                                FloatType t_max) const {
+        auto si = get_shape(shape_idx).intersect(ray, t_max);
+        if (!si.has_value()) {
+            return {};
+        }
+
+        si->interaction.set_intersection_properties(material, get_area_light(shape_idx));
+        return si;
+    }
+
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeHit> intersect_hit(const uint shape_idx, const Ray &ray,
+                                           const RayPrecomputation &ray_precomputation,
+                                           FloatType t_max) const {
+        return get_shape(shape_idx).intersect_hit(ray, ray_precomputation, t_max);
+    }
+
+    PBRT_CPU_GPU
+    ShapeIntersection compute_surface_interaction(const uint shape_idx, const ShapeHit &hit,
+                                                  const Ray &ray) const {
+        auto interaction = get_shape(shape_idx).compute_surface_interaction(hit, ray);
+        interaction.set_intersection_properties(material, get_area_light(shape_idx));
+
+        return ShapeIntersection(interaction, hit.t_hit);
+    }
+
+  private:
+    const Mesh *mesh;
+    const Material *material;
+
+    const Light *area_lights;
+    // one per shape, nullptr if the mesh isn't emissive
+
+    PBRT_CPU_GPU
+    const Light *get_area_light(const uint shape_idx) const {
+        return area_lights == nullptr ? nullptr : &area_lights[shape_idx];
+    }
+};
+
+using TriangleMeshPrimitive = MeshPrimitive<Triangle>;
+using BilinearPatchMeshPrimitive = MeshPrimitive<BilinearPatch>;
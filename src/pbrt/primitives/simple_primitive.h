@@ -16,14 +16,25 @@ class SimplePrimitive {
         return material;
     }
 
+    PBRT_CPU_GPU
+    const Shape *get_shape() const {
+        return shape;
+    }
+
     PBRT_CPU_GPU
     Bounds3f bounds() const {
         return shape->bounds();
     }
 
     PBRT_CPU_GPU
-    bool fast_intersect(const Ray &ray, FloatType t_max) const {
-        return shape->fast_intersect(ray, t_max);
+    Bounds3f clip_bounds(const Bounds3f &clip_box) const {
+        return shape->clip_bounds(clip_box);
+    }
+
+    PBRT_CPU_GPU
+    bool fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                        FloatType t_max) const {
+        return shape->fast_intersect(ray, ray_precomputation, t_max);
     }
 
     PBRT_CPU_GPU
@@ -37,6 +48,21 @@ class SimplePrimitive {
         return si;
     }
 
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeHit> intersect_hit(const Ray &ray,
+                                           const RayPrecomputation &ray_precomputation,
+                                           FloatType t_max) const {
+        return shape->intersect_hit(ray, ray_precomputation, t_max);
+    }
+
+    PBRT_CPU_GPU
+    ShapeIntersection compute_surface_interaction(const ShapeHit &hit, const Ray &ray) const {
+        auto interaction = shape->compute_surface_interaction(hit, ray);
+        interaction.set_intersection_properties(material, nullptr);
+
+        return ShapeIntersection(interaction, hit.t_hit);
+    }
+
   private:
     const Shape *shape;
     const Material *material;
@@ -14,7 +14,7 @@ Bounds3f TransformedPrimitive::bounds() const {
 PBRT_CPU_GPU
 bool TransformedPrimitive::fast_intersect(const Ray &ray, FloatType t_max) const {
     auto inverse_ray = render_from_pritimive.apply_inverse(ray, &t_max);
-    return primitive->fast_intersect(inverse_ray, t_max);
+    return primitive->fast_intersect(inverse_ray, RayPrecomputation(inverse_ray), t_max);
 }
 
 PBRT_CPU_GPU
@@ -32,3 +32,18 @@ pbrt::optional<ShapeIntersection> TransformedPrimitive::intersect(const Ray &ray
     si->interaction = render_from_pritimive(si->interaction);
     return si;
 }
+
+PBRT_CPU_GPU
+pbrt::optional<PrimitiveHit> TransformedPrimitive::intersect_hit(const Ray &ray,
+                                                                 FloatType t_max) const {
+    auto inverse_ray = render_from_pritimive.apply_inverse(ray, &t_max);
+
+    auto hit = primitive->intersect_hit(inverse_ray, RayPrecomputation(inverse_ray), t_max);
+    if (!hit) {
+        return {};
+    }
+
+    // instances don't nest: the hit primitive is a shape seen through this transform only
+    hit->render_from_primitive = &render_from_pritimive;
+    return hit;
+}
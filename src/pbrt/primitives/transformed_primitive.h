@@ -3,6 +3,7 @@
 #include <pbrt/euclidean_space/transform.h>
 
 class Primitive;
+struct PrimitiveHit;
 
 class TransformedPrimitive {
   public:
@@ -24,6 +25,9 @@ class TransformedPrimitive {
     PBRT_CPU_GPU
     pbrt::optional<ShapeIntersection> intersect(const Ray &ray, FloatType t_max) const;
 
+    PBRT_CPU_GPU
+    pbrt::optional<PrimitiveHit> intersect_hit(const Ray &ray, FloatType t_max) const;
+
   private:
     Transform render_from_pritimive;
     const Primitive *primitive;
@@ -11,6 +11,21 @@ struct CommandLineOption {
     std::string output_file;
     std::optional<int> samples_per_pixel;
     bool preview = false;
+    bool host_bvh = false;
+    std::optional<std::string> bvh_split_method;
+    std::optional<int> bvh_max_primitives_in_leaf;
+    std::optional<double> bvh_traversal_cost;
+    std::optional<int> bvh_width;
+    std::optional<bool> bvh_quantized;
+    std::optional<bool> bvh_stackless;
+    std::optional<int> bvh_triangle_blocks;
+    std::optional<int> bvh_restructure_passes;
+    std::optional<double> bvh_spatial_split_budget;
+    std::optional<std::string> bvh_cache_directory;
+    bool rebuild_bvh = false;
+    bool check_bvh_refit = false;
+    bool compress_meshes = false;
+    bool camera_ray_packets = false;
 
     CommandLineOption(int argc, const char **argv) {
         int idx = 1;
@@ -29,6 +44,96 @@ struct CommandLineOption {
                     continue;
                 }
 
+                if (argument == "--host-bvh") {
+                    host_bvh = true;
+                    idx += 1;
+                    continue;
+                }
+
+                if (argument == "--bvh-split") {
+                    bvh_split_method = argv[idx + 1];
+                    idx += 2;
+                    continue;
+                }
+
+                if (argument == "--bvh-leaf-size") {
+                    bvh_max_primitives_in_leaf = stoi(std::string(argv[idx + 1]));
+                    idx += 2;
+                    continue;
+                }
+
+                if (argument == "--bvh-traversal-cost") {
+                    bvh_traversal_cost = stod(std::string(argv[idx + 1]));
+                    idx += 2;
+                    continue;
+                }
+
+                if (argument == "--bvh-width") {
+                    bvh_width = stoi(std::string(argv[idx + 1]));
+                    idx += 2;
+                    continue;
+                }
+
+                if (argument == "--bvh-quantize") {
+                    bvh_quantized = true;
+                    idx += 1;
+                    continue;
+                }
+
+                if (argument == "--bvh-stackless") {
+                    bvh_stackless = true;
+                    idx += 1;
+                    continue;
+                }
+
+                if (argument == "--bvh-triangle-blocks") {
+                    bvh_triangle_blocks = stoi(std::string(argv[idx + 1]));
+                    idx += 2;
+                    continue;
+                }
+
+                if (argument == "--bvh-restructure") {
+                    bvh_restructure_passes = stoi(std::string(argv[idx + 1]));
+                    idx += 2;
+                    continue;
+                }
+
+                if (argument == "--bvh-spatial-split-budget") {
+                    bvh_spatial_split_budget = stod(std::string(argv[idx + 1]));
+                    idx += 2;
+                    continue;
+                }
+
+                if (argument == "--bvh-cache") {
+                    bvh_cache_directory = argv[idx + 1];
+                    idx += 2;
+                    continue;
+                }
+
+                if (argument == "--rebuild-bvh") {
+                    rebuild_bvh = true;
+                    idx += 1;
+                    continue;
+                }
+
+                if (argument == "--check-bvh-refit") {
+                    check_bvh_refit = true;
+                    idx += 1;
+                    continue;
+                }
+
+                if (argument == "--compress-meshes") {
+                    compress_meshes = true;
+                    idx += 1;
+                    continue;
+                }
+
+                if (argument == "--camera-packets") {
+                    camera_ray_packets = true;
+                    idx += 1;
+                    continue;
+                }
+
                 if (argument == "--integrator") {
                     integrator_name = argv[idx + 1];
                     idx += 2;
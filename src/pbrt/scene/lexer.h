@@ -1,259 +1,282 @@
 #pragma once
 
 #include <pbrt/scene/tokenizer.h>
-#include <fstream>
-#include <iterator>
+#include <fcntl.h>
 #include <optional>
-#include <sstream>
+#include <stdexcept>
 #include <string>
-#include <vector>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-class Lexer {
+struct LexedToken {
+    TokenType type;
 
-  private:
-    bool string_starts_with(const std::string &full_str, const std::string &beginning) {
-        return full_str.rfind(beginning, 0) == 0;
-    }
+    std::string_view text;
+    // a slice of the mapped file, without the quotes of strings and variables
+    // (the object name for ObjectBegin and ObjectInstance)
+};
 
-    bool is_letter(char ch) {
-        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
-    }
+class Lexer {
+    // reads tokens on demand from the memory-mapped file: nothing is copied,
+    // every token is a string_view into the mapping and lives as long as the Lexer
 
-    bool is_digit(char ch) {
-        return ch >= '0' && ch <= '9';
-    }
+  public:
+    int line_number = 1;
 
-    Token parse_identifier(const std::string &identifier) {
-        if (identifier == "WorldBegin") {
-            return Token(TokenType::WorldBegin);
+    explicit Lexer(const std::string &filename) {
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("fail to build Lexer: can't open `" + filename + "`");
         }
 
-        if (identifier == "AttributeBegin") {
-            return Token(TokenType::AttributeBegin);
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("fail to build Lexer: `" + filename + "` is empty");
         }
 
-        if (identifier == "AttributeEnd") {
-            return Token(TokenType::AttributeEnd);
+        mapped_size = file_stat.st_size;
+        mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("fail to build Lexer: can't map `" + filename + "`");
         }
 
-        if (identifier == "ObjectBegin") {
-            skip_space();
-            auto object_name = read_next_quoted_string();
-            return Token(TokenType::ObjectBegin, {object_name});
-        }
+        // read once front to back: let the kernel read ahead and drop pages behind us
+        madvise(mapped, mapped_size, MADV_SEQUENTIAL);
 
-        if (identifier == "ObjectEnd") {
-            return Token(TokenType::ObjectEnd);
+        input = std::string_view(static_cast<const char *>(mapped), mapped_size);
+    }
+
+    ~Lexer() {
+        munmap(mapped, mapped_size);
+    }
+
+    Lexer(const Lexer &) = delete;
+
+    Lexer &operator=(const Lexer &) = delete;
+
+    LexedToken next_token() {
+        skip_space_and_comments();
+
+        if (position - released_size >= RELEASE_CHUNK_SIZE) {
+            release_read_pages();
         }
 
-        if (identifier == "ObjectInstance") {
-            skip_space();
-            auto object_name = read_next_quoted_string();
-            return Token(TokenType::ObjectInstance, {object_name});
+        if (position >= input.size()) {
+            return LexedToken{TokenType::EndOfFile, {}};
         }
 
-        if (identifier == "true" || identifier == "false") {
-            return Token(TokenType::String, identifier);
+        const char ch = input[position];
+        switch (ch) {
+        case '[': {
+            in_bracket = true;
+            position += 1;
+            return LexedToken{TokenType::LeftBracket, input.substr(position - 1, 1)};
         }
 
-        return Token(TokenType::Keyword, identifier);
-    }
+        case ']': {
+            in_bracket = false;
+            position += 1;
+            return LexedToken{TokenType::RightBracket, input.substr(position - 1, 1)};
+        }
 
-  public:
-    std::string input;
-    int position;
-    std::optional<char> current_char;
-    int line_number;
-    bool in_bracket = false;
+        case '"': {
+            const auto text = read_quoted_string();
+            if (!text) {
+                printf("line %d: unterminated string\n", line_number);
+                return LexedToken{TokenType::Illegal, {}};
+            }
 
-    Lexer(const std::string &filename)
-        : position(0), current_char(std::nullopt), line_number(1), in_bracket(false) {
-        std::ifstream file_stream(filename);
-        std::stringstream buffer;
-        buffer << file_stream.rdbuf();
-        input = buffer.str();
+            return LexedToken{is_variable(*text) ? TokenType::Variable : TokenType::String,
+                              *text};
+        }
+        }
 
-        if (input.size() == 0) {
-            throw std::runtime_error("fail to build Lexer");
+        if (is_letter(ch)) {
+            return read_identifier();
         }
-    }
 
-    void read_char() {
-        if (position >= input.size()) {
-            current_char = std::nullopt;
-        } else {
-            current_char = input[position];
+        if (ch == '-' || ch == '+' || ch == '.' || is_digit(ch)) {
+            return LexedToken{TokenType::Number, read_number()};
         }
 
-        position += 1;
+        printf("line %d: illegal char: `%c`\n", line_number, ch);
+
+        return LexedToken{TokenType::Illegal, input.substr(position, 1)};
     }
 
-    std::string read_number() {
-        int last_position = position - 1;
+    std::optional<std::string_view> read_number_list() {
+        // right after a `[`: the text up to the `]` (consumed) if the list holds only numbers,
+        // nothing read otherwise
+        int lines = 0;
+        for (auto idx = position; idx < input.size(); ++idx) {
+            const char ch = input[idx];
 
-        while (true) {
-            if (!current_char) {
-                break;
-            }
+            if (ch == ']') {
+                const auto text = input.substr(position, idx - position);
+                line_number += lines;
+                in_bracket = false;
+                position = idx + 1;
 
-            if (current_char == '-' || current_char == 'e' || current_char == '.' ||
-                is_digit(current_char.value())) {
-                // `e` for scientific notation
-                read_char();
-                continue;
+                return text;
             }
 
-            break;
+            if (ch == '\n') {
+                lines += 1;
+            } else if (!is_number_char(ch) && ch != ' ' && ch != '\t' && ch != '\r') {
+                return {};
+            }
         }
 
-        return input.substr(last_position, position - 1 - last_position);
+        return {};
     }
 
-    std::vector<std::string> read_list() {
-        read_char(); // consume '['
-        std::vector<std::string> values;
-        while (true) {
-            auto token = next_token();
+  private:
+    static constexpr size_t RELEASE_CHUNK_SIZE = 64 * 1024 * 1024;
 
-            if (token.type == TokenType::RightBracket) {
-                break;
-            }
+    void *mapped = nullptr;
+    size_t mapped_size = 0;
+    size_t released_size = 0;
 
-            if (token.type == TokenType::Number || token.type == TokenType::String) {
-                values.push_back(token.values[0]);
-                continue;
-            }
+    std::string_view input;
+    size_t position = 0;
+    bool in_bracket = false;
 
-            std::cout << "\n" << __func__ << "(): error token type: " << token.type << "\n";
-            REPORT_FATAL_ERROR();
-        }
+    void release_read_pages() {
+        // drop what was already read from the resident set: the mapping is read-only and backed
+        // by the file, so a string_view still pointing there is simply paged in again
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        const size_t end = position / page_size * page_size;
 
-        return values;
+        madvise(static_cast<char *>(mapped) + released_size, end - released_size, MADV_DONTNEED);
+        released_size = end;
     }
 
-    std::string read_next_quoted_string() {
-        // you could get String or Variable from this token
+    static bool is_letter(char ch) {
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
+    }
 
-        int last_position = position - 1;
-        read_char(); // consume first quote
+    static bool is_digit(char ch) {
+        return ch >= '0' && ch <= '9';
+    }
 
-        while (current_char != '"') {
-            read_char();
+    static bool is_number_char(char ch) {
+        // `e` for scientific notation
+        return ch == '-' || ch == '+' || ch == 'e' || ch == 'E' || ch == '.' || is_digit(ch);
+    }
+
+    bool is_variable(std::string_view text) const {
+        // e.g. "float fov", but not a string inside a list, or a single word
+        if (in_bracket || text.find(' ') == std::string_view::npos) {
+            return false;
         }
-        read_char(); // consume the last quote
 
-        return input.substr(last_position + 1, position - 2 - (last_position + 1));
-    }
+        constexpr std::string_view variable_definitions[] = {
+            "bool ",   "blackbody ", "float ",  "integer ",  "normal ",  "rgb ",
+            "point2 ", "point3 ",    "string ", "spectrum ", "texture ", "vector3 ",
+        };
 
-    std::string read_identifier() {
-        int last_position = position - 1;
-        while (current_char.has_value() && is_letter(current_char.value())) {
-            read_char();
+        for (const auto type : variable_definitions) {
+            if (text.substr(0, type.size()) == type) {
+                return true;
+            }
         }
 
-        return input.substr(last_position, (position - 1) - last_position);
+        return false;
     }
 
-    void skip_space() {
-        for (;;) {
-            if (!current_char) {
-                return;
-            }
+    void skip_space_and_comments() {
+        while (position < input.size()) {
+            const char ch = input[position];
 
-            if (current_char == ' ' || current_char == '\t' || current_char == '\n' ||
-                current_char == '\r') {
-                if (current_char == '\n') {
-                    line_number += 1;
-                }
-                read_char();
+            if (ch == '#') {
+                const auto end_of_line = input.find('\n', position);
+                position = end_of_line == std::string_view::npos ? input.size() : end_of_line;
                 continue;
             }
 
-            return;
-        }
-    }
-
-    void skip_comment() {
-        for (;;) {
-            read_char();
-            if (current_char == '\n') {
+            if (ch == '\n') {
                 line_number += 1;
+            } else if (ch != ' ' && ch != '\t' && ch != '\r') {
                 return;
             }
+
+            position += 1;
         }
     }
 
-    Token next_token() {
-        skip_space();
-        while (current_char == '#') {
-            skip_comment();
-            skip_space();
+    std::string_view read_number() {
+        const auto start = position;
+        while (position < input.size() && is_number_char(input[position])) {
+            position += 1;
         }
 
-        if (!current_char) {
-            return Token(TokenType::EndOfFile);
-        }
+        return input.substr(start, position - start);
+    }
 
-        switch (current_char.value()) {
-        case '[': {
-            in_bracket = true;
-            auto token = Token(TokenType::List, read_list());
-            read_char();
-            return token;
+    std::optional<std::string_view> read_quoted_string() {
+        const auto start = position + 1;
+        const auto end = input.find('"', start);
+        if (end == std::string_view::npos) {
+            return {};
         }
 
-        case ']': {
-            in_bracket = false;
-            read_char();
-            return Token(TokenType::RightBracket);
+        for (auto idx = start; idx < end; ++idx) {
+            line_number += input[idx] == '\n';
         }
 
-        case '"': {
-            const auto variable_definitions = {
-                "bool ",   "blackbody ", "float ",  "integer ",  "normal ",  "rgb ",
-                "point2 ", "point3 ",    "string ", "spectrum ", "texture ", "vector3 ",
-            };
-
-            auto is_string = true;
-            auto string_without_quote = read_next_quoted_string();
-
-            if (in_bracket || string_without_quote.find(' ') == std::string::npos) {
-                is_string = true;
-            } else {
-                for (const auto type : variable_definitions) {
-                    if (string_starts_with(string_without_quote, type)) {
-                        is_string = false;
-                        break;
-                    }
-                }
-            }
-
-            if (is_string) {
-                return Token(TokenType::String, string_without_quote);
-            }
+        position = end + 1;
+        return input.substr(start, end - start);
+    }
 
-            // otherwise it's a Variable
+    LexedToken read_identifier() {
+        const auto start = position;
+        while (position < input.size() && is_letter(input[position])) {
+            position += 1;
+        }
 
-            std::istringstream iss(string_without_quote);
+        const auto identifier = input.substr(start, position - start);
 
-            std::vector<std::string> split_strings;
-            copy(std::istream_iterator<std::string>(iss), std::istream_iterator<std::string>(),
-                 back_inserter(split_strings));
+        if (identifier == "WorldBegin") {
+            return LexedToken{TokenType::WorldBegin, identifier};
+        }
 
-            return Token(TokenType::Variable, split_strings);
+        if (identifier == "AttributeBegin") {
+            return LexedToken{TokenType::AttributeBegin, identifier};
         }
+
+        if (identifier == "AttributeEnd") {
+            return LexedToken{TokenType::AttributeEnd, identifier};
         }
 
-        if (is_letter(current_char.value())) {
-            return parse_identifier(read_identifier());
+        if (identifier == "ObjectEnd") {
+            return LexedToken{TokenType::ObjectEnd, identifier};
         }
 
-        if (current_char == '-' || current_char == '.' || is_digit(current_char.value())) {
-            return Token(TokenType::Number, read_number());
+        if (identifier == "ObjectBegin" || identifier == "ObjectInstance") {
+            const auto type =
+                identifier == "ObjectBegin" ? TokenType::ObjectBegin : TokenType::ObjectInstance;
+
+            skip_space_and_comments();
+            const auto object_name = position < input.size() && input[position] == '"'
+                                         ? read_quoted_string()
+                                         : std::nullopt;
+            if (!object_name) {
+                printf("line %d: `%s` without an object name\n", line_number,
+                       std::string(identifier).c_str());
+                return LexedToken{TokenType::Illegal, identifier};
+            }
+
+            return LexedToken{type, *object_name};
         }
 
-        printf("line %d: illegal char: `%c`", line_number, current_char.value());
+        if (identifier == "true" || identifier == "false") {
+            return LexedToken{TokenType::String, identifier};
+        }
 
-        return Token(TokenType::Illegal);
+        return LexedToken{TokenType::Keyword, identifier};
     }
 };
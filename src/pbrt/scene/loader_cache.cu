@@ -0,0 +1,184 @@
+#include <pbrt/base/shape.h>
+#include <pbrt/scene/loader_cache.h>
+#include <pbrt/shapes/tri_quad_mesh.h>
+#include <pbrt/gpu/gpu_memory_allocator.h>
+#include <pbrt/spectrum_util/rgb.h>
+#include <pbrt/util/thread_pool.h>
+#include <chrono>
+#include <filesystem>
+
+static FloatType get_seconds_since(const std::chrono::system_clock::time_point &start) {
+    const std::chrono::duration<FloatType> duration{std::chrono::system_clock::now() - start};
+    return duration.count();
+}
+
+static size_t get_topology_size(const TriQuadMesh &mesh) {
+    // what doesn't depend on the transform
+    return sizeof(Point2f) * mesh.uv.size() +
+           sizeof(int) * (mesh.triIndices.size() + mesh.quadIndices.size());
+}
+
+static size_t get_host_size(const TriQuadMesh &mesh) {
+    // what building the mesh uploads (before compression)
+    return sizeof(Point3f) * mesh.p.size() + sizeof(Normal3f) * mesh.n.size() +
+           sizeof(Point2f) * mesh.uv.size() +
+           sizeof(int) * (mesh.faceIndices.size() + mesh.triIndices.size() +
+                          mesh.quadIndices.size());
+}
+
+std::string LoaderCache::get_key(const std::string &filename) {
+    // a file rewritten between 2 references is read again
+    std::error_code error;
+    const auto path = std::filesystem::canonical(filename, error);
+    if (error) {
+        // left to the loader to report
+        return filename;
+    }
+
+    const auto size = std::filesystem::file_size(path, error);
+    const auto modification_time = std::filesystem::last_write_time(path, error);
+
+    return path.string() + "|" + std::to_string(size) + "|" +
+           std::to_string(modification_time.time_since_epoch().count());
+}
+
+std::shared_ptr<const TriQuadMesh> LoaderCache::read_ply(const std::string &filename,
+                                                         ThreadPool *thread_pool) {
+    const auto key = get_key(filename);
+
+    std::shared_ptr<PLYEntry> entry;
+    bool hit = false;
+    {
+        std::lock_guard<std::mutex> lock(ply_mutex);
+        auto &slot = ply_entries[key];
+        hit = slot != nullptr;
+        if (!hit) {
+            slot = std::make_shared<PLYEntry>();
+        }
+        entry = slot;
+    }
+
+    // other threads asking for the same file wait for the first one to read it
+    std::call_once(entry->read, [&] {
+        const auto start = std::chrono::system_clock::now();
+        entry->mesh =
+            std::make_shared<const TriQuadMesh>(TriQuadMesh::read_ply(filename, thread_pool));
+        entry->bytes = get_host_size(*entry->mesh);
+        entry->seconds = get_seconds_since(start);
+    });
+
+    if (hit) {
+        std::lock_guard<std::mutex> lock(ply_mutex);
+        ply_savings.hits += 1;
+        ply_savings.bytes += entry->bytes;
+        ply_savings.seconds += entry->seconds;
+    }
+
+    return entry->mesh;
+}
+
+Shape::Meshes LoaderCache::create_meshes(const std::string &filename, const TriQuadMesh &mesh,
+                                         const Transform &render_from_object,
+                                         bool reverse_orientation, bool compressed,
+                                         MeshStats *stats, GPUMemoryAllocator &allocator) {
+    // vertices are stored in render space: only an identical placement can share them
+    auto &entries = mesh_entries[get_key(filename)];
+    for (const auto &entry : entries) {
+        if (entry.render_from_object == render_from_object &&
+            entry.reverse_orientation == reverse_orientation && entry.compressed == compressed) {
+            mesh_savings.hits += 1;
+            mesh_savings.bytes += entry.bytes;
+            mesh_savings.seconds += entry.seconds;
+
+            return entry.meshes;
+        }
+    }
+
+    // any earlier placement of the file holds the same indices and uv
+    const Shape::Meshes *same_topology = entries.empty() ? nullptr : &entries.front().meshes;
+    if (same_topology) {
+        topology_savings.hits += 1;
+        topology_savings.bytes += get_topology_size(mesh);
+    }
+
+    const auto start = std::chrono::system_clock::now();
+    const auto meshes = Shape::create_meshes(mesh, render_from_object, reverse_orientation,
+                                             compressed, stats, allocator, same_topology);
+
+    entries.push_back(MeshEntry{
+        .render_from_object = render_from_object,
+        .reverse_orientation = reverse_orientation,
+        .compressed = compressed,
+        .meshes = meshes,
+        .bytes = get_host_size(mesh),
+        .seconds = get_seconds_since(start),
+    });
+
+    return meshes;
+}
+
+const GPUImage *LoaderCache::read_image(const std::string &filename,
+                                        GPUMemoryAllocator &allocator) {
+    const auto key = get_key(filename);
+    if (const auto entry = image_entries.find(key); entry != image_entries.end()) {
+        // savings are added up by report(): the file may not be decoded yet
+        entry->second.hits += 1;
+        return entry->second.image;
+    }
+
+    auto &entry = image_entries[key];
+    entry.filename = filename;
+    entry.image = allocator.allocate<GPUImage>();
+    pending_images.push_back(&entry);
+
+    return entry.image;
+}
+
+void LoaderCache::read_images(ThreadPool &thread_pool, GPUMemoryAllocator &allocator) {
+    if (pending_images.empty()) {
+        return;
+    }
+
+    // decoding only touches host memory and each job its own entry: on all cores
+    std::vector<GPUImage::HostPixels> host_pixels(pending_images.size());
+    thread_pool.parallel_execute(0, pending_images.size(), [&](const int idx) {
+        const auto start = std::chrono::system_clock::now();
+        host_pixels[idx] = GPUImage::read_file(pending_images[idx]->filename);
+        pending_images[idx]->seconds = get_seconds_since(start);
+    });
+
+    // the allocator isn't thread-safe: uploads in recording order on the calling thread
+    for (uint idx = 0; idx < pending_images.size(); ++idx) {
+        auto entry = pending_images[idx];
+        entry->image->init(host_pixels[idx], allocator);
+        entry->bytes = sizeof(GPUImage) + sizeof(RGB) * host_pixels[idx].pixels.size();
+
+        // release the host copy as soon as it's on the device
+        host_pixels[idx] = {};
+    }
+
+    pending_images.clear();
+}
+
+void LoaderCache::release_host_meshes() {
+    std::lock_guard<std::mutex> lock(ply_mutex);
+    ply_entries.clear();
+}
+
+void LoaderCache::report() const {
+    // PLY files: decoded host memory, meshes, indices and images: device memory
+    Savings image_savings;
+    for (const auto &[key, entry] : image_entries) {
+        image_savings.hits += entry.hits;
+        image_savings.bytes += entry.hits * entry.bytes;
+        image_savings.seconds += entry.hits * entry.seconds;
+    }
+
+    printf("loader cache: reused %u PLY files (%.2f MB, %.2f s), %u meshes (%.2f MB, %.2f s), "
+           "indices and uv of %u meshes (%.2f MB), %u images (%.2f MB, %.2f s)\n",
+           ply_savings.hits, double(ply_savings.bytes) / (1024 * 1024), ply_savings.seconds,
+           mesh_savings.hits, double(mesh_savings.bytes) / (1024 * 1024), mesh_savings.seconds,
+           topology_savings.hits, double(topology_savings.bytes) / (1024 * 1024),
+           image_savings.hits, double(image_savings.bytes) / (1024 * 1024),
+           image_savings.seconds);
+}
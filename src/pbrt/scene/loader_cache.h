@@ -0,0 +1,90 @@
+#pragma once
+
+#include <pbrt/base/shape.h>
+#include <pbrt/euclidean_space/transform.h>
+#include <pbrt/textures/gpu_image.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class GPUMemoryAllocator;
+class ThreadPool;
+
+class LoaderCache {
+    // files referenced more than once (PLY meshes, image textures) are read and decoded once:
+    // entries are keyed by the canonical path, size and modification time of the file
+
+  public:
+    std::shared_ptr<const TriQuadMesh> read_ply(const std::string &filename,
+                                                ThreadPool *thread_pool);
+    // thread-safe: meshes are read on the thread pool
+    // thread_pool: see BinaryPLYReader::read()
+
+    Shape::Meshes create_meshes(const std::string &filename, const TriQuadMesh &mesh,
+                                const Transform &render_from_object, bool reverse_orientation,
+                                bool compressed, MeshStats *stats,
+                                GPUMemoryAllocator &allocator);
+    // the same file under the same transform shares vertex and index buffers,
+    // under another transform only the index and uv buffers
+
+    const GPUImage *read_image(const std::string &filename, GPUMemoryAllocator &allocator);
+    // every texture and light reading the file shares the same pixels
+    // the image stays empty until read_images(): textures and lights only keep the pointer
+
+    void read_images(ThreadPool &thread_pool, GPUMemoryAllocator &allocator);
+    // decodes the files recorded by read_image() since the last call, one file per job,
+    // then uploads their pixels on the calling thread
+
+    void release_host_meshes();
+    // drops decoded PLY files once a batch of shapes is uploaded:
+    // a file referenced again in a later batch is read again, its device buffers are still shared
+
+    void report() const;
+
+  private:
+    struct Savings {
+        uint hits = 0;
+        size_t bytes = 0;
+        double seconds = 0;
+    };
+
+    struct PLYEntry {
+        std::once_flag read;
+        std::shared_ptr<const TriQuadMesh> mesh;
+        size_t bytes = 0;
+        double seconds = 0;
+    };
+
+    struct MeshEntry {
+        Transform render_from_object;
+        bool reverse_orientation;
+        bool compressed;
+
+        Shape::Meshes meshes;
+        size_t bytes;
+        double seconds;
+    };
+
+    struct ImageEntry {
+        std::string filename;
+        GPUImage *image;
+
+        uint hits = 0;
+        size_t bytes = 0;
+        double seconds = 0;
+    };
+
+    static std::string get_key(const std::string &filename);
+
+    std::mutex ply_mutex;
+    std::map<std::string, std::shared_ptr<PLYEntry>> ply_entries;
+    std::map<std::string, std::vector<MeshEntry>> mesh_entries;
+    std::map<std::string, ImageEntry> image_entries;
+    std::vector<ImageEntry *> pending_images;
+
+    Savings ply_savings;
+    Savings mesh_savings;
+    Savings topology_savings;
+};
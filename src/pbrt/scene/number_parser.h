@@ -0,0 +1,115 @@
+#pragma once
+
+#include <pbrt/gpu/macro.h>
+#include <pbrt/util/thread_pool.h>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class NumberParser {
+    // whitespace-separated numbers parsed with std::from_chars straight into a pre-sized buffer:
+    // the text is cut into chunks at whitespace, each chunk counts its numbers, then parses them
+    // at its offset in the buffer (on the caller's thread pool for long lists)
+
+  public:
+    template <typename T>
+    static std::vector<T> parse(std::string_view text, ThreadPool *thread_pool) {
+        // thread_pool: nullptr to parse on the calling thread
+        if (thread_pool == nullptr || text.size() < PARALLEL_TEXT_SIZE) {
+            std::vector<T> numbers(count_numbers(text));
+            parse_chunk(text, numbers.data());
+
+            return numbers;
+        }
+
+        const uint num_chunks = thread_pool->num_threads() * 4;
+
+        // chunks end on a whitespace so that no number is split between 2 of them
+        std::vector<size_t> boundaries(num_chunks + 1);
+        boundaries[0] = 0;
+        for (uint idx = 1; idx < num_chunks; ++idx) {
+            auto position = std::max(boundaries[idx - 1], text.size() / num_chunks * idx);
+            while (position < text.size() && !is_blank(text[position])) {
+                position += 1;
+            }
+            boundaries[idx] = position;
+        }
+        boundaries[num_chunks] = text.size();
+
+        const auto get_chunk = [&](const uint idx) {
+            return text.substr(boundaries[idx], boundaries[idx + 1] - boundaries[idx]);
+        };
+
+        std::vector<size_t> offsets(num_chunks + 1, 0);
+        thread_pool->parallel_for(0, num_chunks, [&](const uint start, const uint end) {
+            for (uint idx = start; idx < end; ++idx) {
+                offsets[idx + 1] = count_numbers(get_chunk(idx));
+            }
+        });
+
+        for (uint idx = 0; idx < num_chunks; ++idx) {
+            offsets[idx + 1] += offsets[idx];
+        }
+
+        std::vector<T> numbers(offsets[num_chunks]);
+        thread_pool->parallel_for(0, num_chunks, [&](const uint start, const uint end) {
+            for (uint idx = start; idx < end; ++idx) {
+                parse_chunk(get_chunk(idx), numbers.data() + offsets[idx]);
+            }
+        });
+
+        return numbers;
+    }
+
+  private:
+    static constexpr size_t PARALLEL_TEXT_SIZE = 1024 * 1024;
+
+    static bool is_blank(char ch) {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+    }
+
+    static size_t count_numbers(std::string_view text) {
+        size_t count = 0;
+        bool in_number = false;
+        for (const char ch : text) {
+            const bool blank = is_blank(ch);
+            count += !blank && !in_number;
+            in_number = !blank;
+        }
+
+        return count;
+    }
+
+    template <typename T>
+    static void parse_chunk(std::string_view text, T *numbers) {
+        const char *ptr = text.data();
+        const char *end = text.data() + text.size();
+
+        while (true) {
+            while (ptr < end && is_blank(*ptr)) {
+                ptr += 1;
+            }
+
+            if (ptr == end) {
+                return;
+            }
+
+            // from_chars() doesn't take the leading `+` that strtod() does
+            const auto result = std::from_chars(*ptr == '+' ? ptr + 1 : ptr, end, *numbers);
+            if (result.ec != std::errc() || (result.ptr < end && !is_blank(*result.ptr))) {
+                auto number_end = ptr;
+                while (number_end < end && !is_blank(*number_end)) {
+                    number_end += 1;
+                }
+
+                printf("\n%s(): illegal number `%s`\n", __func__,
+                       std::string(ptr, number_end).c_str());
+                REPORT_FATAL_ERROR();
+            }
+
+            ptr = result.ptr;
+            numbers += 1;
+        }
+    }
+};
@@ -28,15 +28,17 @@ std::vector<FloatType> read_spectrum_file(const std::string &filename) {
 
 ParameterDictionary::ParameterDictionary(
     const std::vector<Token> &tokens, const std::string &_root,
-    const GlobalSpectra *_global_spectra, const std::map<std::string, const Spectrum *> &_spectra,
+    const GlobalSpectra *_global_spectra, LoaderCache *_loader_cache,
+    const std::map<std::string, const Spectrum *> &_spectra,
     std::map<std::string, const Material *> _materials,
     const std::map<std::string, const FloatTexture *> &_float_textures,
     const std::map<std::string, const SpectrumTexture *> &_albedo_spectrum_textures,
     const std::map<std::string, const SpectrumTexture *> &_illuminant_spectrum_textures,
     const std::map<std::string, const SpectrumTexture *> &_unbounded_spectrum_textures,
-    GPUMemoryAllocator &allocator)
-    : root(_root), global_spectra(_global_spectra), spectra(_spectra), materials(_materials),
-      float_textures(_float_textures), albedo_spectrum_textures(_albedo_spectrum_textures),
+    ThreadPool *thread_pool, GPUMemoryAllocator &allocator)
+    : root(_root), global_spectra(_global_spectra), loader_cache(_loader_cache), spectra(_spectra),
+      materials(_materials), float_textures(_float_textures),
+      albedo_spectrum_textures(_albedo_spectrum_textures),
       illuminant_spectrum_textures(_illuminant_spectrum_textures),
       unbounded_spectrum_textures(_unbounded_spectrum_textures) {
     // the 1st token is Keyword
@@ -55,10 +57,12 @@ ParameterDictionary::ParameterDictionary(
         auto variable_name = tokens[idx].values[1];
 
         if (variable_type == "blackbody") {
-            auto value_in_str = tokens[idx + 1].values[0];
-            auto variable_value = std::stod(value_in_str);
+            const auto numbers = tokens[idx + 1].to_floats(thread_pool);
+            if (numbers.empty()) {
+                REPORT_FATAL_ERROR();
+            }
 
-            blackbodies[variable_name] = variable_value;
+            blackbodies[variable_name] = numbers[0];
             continue;
         }
 
@@ -80,17 +84,17 @@ ParameterDictionary::ParameterDictionary(
         }
 
         if (variable_type == "float") {
-            floats[variable_name] = tokens[idx + 1].to_floats();
+            floats[variable_name] = tokens[idx + 1].to_floats(thread_pool);
             continue;
         }
 
         if (variable_type == "integer") {
-            integers[variable_name] = tokens[idx + 1].to_integers();
+            integers[variable_name] = tokens[idx + 1].to_integers(thread_pool);
             continue;
         }
 
         if (variable_type == "normal") {
-            auto numbers = tokens[idx + 1].to_floats();
+            auto numbers = tokens[idx + 1].to_floats(thread_pool);
             auto n = std::vector<Normal3f>(numbers.size() / 3);
             for (int k = 0; k < n.size(); k++) {
                 n[k] = Normal3f(numbers[k * 3], numbers[k * 3 + 1], numbers[k * 3 + 2]);
@@ -100,7 +104,7 @@ ParameterDictionary::ParameterDictionary(
         }
 
         if (variable_type == "point2") {
-            auto numbers = tokens[idx + 1].to_floats();
+            auto numbers = tokens[idx + 1].to_floats(thread_pool);
             auto p = std::vector<Point2f>(numbers.size() / 2);
             for (int k = 0; k < p.size(); k++) {
                 p[k] = Point2f(numbers[k * 2], numbers[k * 2 + 1]);
@@ -111,7 +115,7 @@ ParameterDictionary::ParameterDictionary(
         }
 
         if (variable_type == "point3") {
-            auto numbers = tokens[idx + 1].to_floats();
+            auto numbers = tokens[idx + 1].to_floats(thread_pool);
             auto p = std::vector<Point3f>(numbers.size() / 3);
             for (int k = 0; k < p.size(); k++) {
                 p[k] = Point3f(numbers[k * 3], numbers[k * 3 + 1], numbers[k * 3 + 2]);
@@ -122,7 +126,7 @@ ParameterDictionary::ParameterDictionary(
         }
 
         if (variable_type == "rgb") {
-            auto rgb_list = tokens[idx + 1].to_floats();
+            auto rgb_list = tokens[idx + 1].to_floats(thread_pool);
             rgbs[variable_name] = RGB(rgb_list[0], rgb_list[1], rgb_list[2]);
             continue;
         }
@@ -130,10 +134,6 @@ ParameterDictionary::ParameterDictionary(
         if (variable_type == "spectrum") {
             auto spectrum_arg_list = tokens[idx + 1].values;
 
-            if (spectrum_arg_list.empty()) {
-                REPORT_FATAL_ERROR();
-            }
-
             if (spectrum_arg_list.size() == 1) {
                 // the only value could be a path
                 auto spectrum_arg = spectrum_arg_list[0];
@@ -159,9 +159,9 @@ ParameterDictionary::ParameterDictionary(
             }
 
             // build PiecewiseLinearSpectrum from Interleaved data
-            std::vector<FloatType> floats;
-            for (const auto &x : spectrum_arg_list) {
-                floats.push_back(stod(x));
+            const auto floats = tokens[idx + 1].to_floats(thread_pool);
+            if (floats.empty()) {
+                REPORT_FATAL_ERROR();
             }
 
             auto spectrum = Spectrum::create_piecewise_linear_spectrum_from_interleaved(
@@ -182,7 +182,7 @@ ParameterDictionary::ParameterDictionary(
         }
 
         if (variable_type == "vector3") {
-            auto value_list = tokens[idx + 1].to_floats();
+            auto value_list = tokens[idx + 1].to_floats(thread_pool);
             vector3s[variable_name] = Vector3f(value_list[0], value_list[1], value_list[2]);
             continue;
         }
@@ -14,9 +14,11 @@
 class FloatTexture;
 class GlobalSpectra;
 class GPUMemoryAllocator;
+class LoaderCache;
 class Material;
 class Spectrum;
 class SpectrumTexture;
+class ThreadPool;
 class Token;
 
 class ParameterDictionary {
@@ -25,17 +27,21 @@ class ParameterDictionary {
 
     explicit ParameterDictionary(
         const std::vector<Token> &tokens, const std::string &_root,
-        const GlobalSpectra *_global_spectra,
+        const GlobalSpectra *_global_spectra, LoaderCache *_loader_cache,
         const std::map<std::string, const Spectrum *> &_spectra,
         std::map<std::string, const Material *> _materials,
         const std::map<std::string, const FloatTexture *> &_float_textures,
         const std::map<std::string, const SpectrumTexture *> &_albedo_spectrum_textures,
         const std::map<std::string, const SpectrumTexture *> &_illuminant_spectrum_textures,
         const std::map<std::string, const SpectrumTexture *> &_unbounded_spectrum_textures,
-        GPUMemoryAllocator &allocator);
+        ThreadPool *thread_pool, GPUMemoryAllocator &allocator);
+    // thread_pool: parses long number lists (nullptr: on the calling thread)
 
     const GlobalSpectra *global_spectra = nullptr;
 
+    LoaderCache *loader_cache = nullptr;
+    // shared by everything reading image files
+
     bool has_floats(const std::string &key) const {
         return floats.find(key) != floats.end();
     }
@@ -203,6 +209,12 @@ class ParameterDictionary {
     const SpectrumTexture *get_spectrum_texture(const std::string &key, SpectrumType spectrum_type,
                                                 GPUMemoryAllocator &allocator) const;
 
+    size_t get_array_bytes() const {
+        // host memory held by the numeric arrays (such as "P", "indices", "uv" and "N")
+        return sum_vector_bytes(point2s) + sum_vector_bytes(point3s) + sum_vector_bytes(normals) +
+               sum_vector_bytes(integers) + sum_vector_bytes(floats);
+    }
+
     friend std::ostream &operator<<(std::ostream &stream, const ParameterDictionary &parameters) {
         if (!parameters.integers.empty()) {
             stream << "integers:\n";
@@ -321,6 +333,15 @@ class ParameterDictionary {
     std::map<std::string, const SpectrumTexture *> albedo_spectrum_textures;
     std::map<std::string, const SpectrumTexture *> illuminant_spectrum_textures;
 
+    template <typename T>
+    static size_t sum_vector_bytes(const std::map<std::string, std::vector<T>> &kv_map) {
+        size_t bytes = 0;
+        for (const auto &kv : kv_map) {
+            bytes += sizeof(T) * kv.second.size();
+        }
+        return bytes;
+    }
+
     template <typename T>
     void print_dict_of_single_var(std::ostream &stream,
                                   const std::map<std::string, T> kv_map) const {
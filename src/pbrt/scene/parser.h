@@ -3,25 +3,136 @@
 #include <pbrt/scene/lexer.h>
 #include <iostream>
 
-static std::vector<Token> parse_pbrt_into_token(const std::string &filename) {
-    auto lexer = Lexer(filename);
+class Parser {
+    // reads a .pbrt file one statement at a time: a keyword with all its arguments, or a single
+    // WorldBegin, AttributeBegin, AttributeEnd, ObjectBegin, ObjectEnd or ObjectInstance
+    // only the current statement is copied out of the mapped file
 
-    std::vector<Token> tokens;
-    lexer.read_char();
-    while (true) {
-        auto token = lexer.next_token();
+  public:
+    explicit Parser(const std::string &_filename) : filename(_filename), lexer(_filename) {
+        lookahead = read_token();
+    }
+
+    bool next_statement(std::vector<Token> &statement) {
+        // false at the end of the file
+        // statement is cleared first: reusing it keeps its capacity across statements
+
+        statement.clear();
+        if (lookahead.type == TokenType::EndOfFile) {
+            return false;
+        }
+
+        const auto first_token = lookahead;
+        lookahead = read_token();
+        statement.push_back(to_token(first_token));
+
+        if (first_token.type != TokenType::Keyword) {
+            return true;
+        }
+
+        // the arguments run up to the next keyword
+        while (true) {
+            switch (lookahead.type) {
+            case TokenType::Number:
+            case TokenType::String:
+            case TokenType::Variable: {
+                statement.push_back(to_token(lookahead));
+                lookahead = read_token();
+                continue;
+            }
+
+            case TokenType::LeftBracket: {
+                statement.push_back(read_list());
+                continue;
+            }
+
+            default: {
+                return true;
+            }
+            }
+        }
+    }
+
+  private:
+    std::string filename;
+    Lexer lexer;
+    LexedToken lookahead;
+
+    LexedToken read_token() {
+        const auto token = lexer.next_token();
 
         if (token.type == TokenType::Illegal) {
             printf("parsing `%s` fails at line %d\n", filename.c_str(), lexer.line_number);
             REPORT_FATAL_ERROR();
         }
 
-        if (token.type == TokenType::EndOfFile) {
-            break;
+        return token;
+    }
+
+    Token read_list() {
+        // lookahead is the `[`
+        if (const auto number_text = lexer.read_number_list()) {
+            // kept as text for NumberParser: no string per number
+            Token token(TokenType::List);
+            token.number_text = *number_text;
+
+            lookahead = read_token();
+            return token;
         }
 
-        tokens.push_back(token);
+        std::vector<std::string> values;
+        while (true) {
+            const auto token = read_token();
+
+            if (token.type == TokenType::RightBracket) {
+                break;
+            }
+
+            if (token.type == TokenType::Number || token.type == TokenType::String) {
+                values.emplace_back(token.text);
+                continue;
+            }
+
+            std::cout << "\n" << __func__ << "(): error token type: " << token.type << "\n";
+            printf("parsing `%s` fails at line %d\n", filename.c_str(), lexer.line_number);
+            REPORT_FATAL_ERROR();
+        }
+
+        lookahead = read_token();
+        return Token(TokenType::List, std::move(values));
     }
 
-    return tokens;
-}
+    static Token to_token(const LexedToken &token) {
+        switch (token.type) {
+        case TokenType::WorldBegin:
+        case TokenType::AttributeBegin:
+        case TokenType::AttributeEnd:
+        case TokenType::ObjectEnd: {
+            return Token(token.type);
+        }
+
+        case TokenType::Variable: {
+            // e.g. "float fov" -> { float, fov }
+            std::vector<std::string> split_strings;
+            size_t start = 0;
+            while (true) {
+                start = token.text.find_first_not_of(" \t\r\n", start);
+                if (start == std::string_view::npos) {
+                    break;
+                }
+
+                const auto end = std::min(token.text.find_first_of(" \t\r\n", start),
+                                          token.text.size());
+                split_strings.emplace_back(token.text.substr(start, end - start));
+                start = end;
+            }
+
+            return Token(TokenType::Variable, std::move(split_strings));
+        }
+
+        default: {
+            return Token(token.type, std::string(token.text));
+        }
+        }
+    }
+};
@@ -1,3 +1,4 @@
+#include <pbrt/accelerator/bvh_cache.h>
 #include <pbrt/accelerator/hlbvh.h>
 #include <pbrt/base/film.h>
 #include <pbrt/base/filter.h>
@@ -14,27 +15,20 @@
 #include <pbrt/integrators/wavefront_path.h>
 #include <pbrt/light_samplers/power_light_sampler.h>
 #include <pbrt/light_samplers/uniform_light_sampler.h>
+#include <pbrt/primitives/transformed_primitive.h>
 #include <pbrt/scene/scene_builder.h>
+#include <pbrt/shapes/bilinear_patch_mesh.h>
+#include <pbrt/shapes/tri_quad_mesh.h>
+#include <pbrt/shapes/triangle_mesh.h>
 #include <pbrt/spectrum_util/global_spectra.h>
 #include <pbrt/spectrum_util/spectrum_constants_glass.h>
 #include <pbrt/spectrum_util/spectrum_constants_metal.h>
 #include <pbrt/textures/spectrum_constant_texture.h>
 #include <pbrt/util/std_container.h>
+#include <pbrt/util/thread_pool.h>
+#include <random>
 #include <set>
 
-uint next_keyword_position(const std::vector<Token> &tokens, uint start) {
-    for (uint idx = start + 1; idx < tokens.size(); ++idx) {
-        const auto type = tokens[idx].type;
-        if (type == TokenType::Number || type == TokenType::String || type == TokenType::Variable ||
-            type == TokenType::List) {
-            continue;
-        }
-        return idx;
-    }
-
-    return tokens.size();
-}
-
 void add_one_to_map(const std::string &key, std::map<std::string, uint> &counter) {
     if (counter.find(key) == counter.end()) {
         counter[key] = 1;
@@ -85,8 +79,13 @@ std::map<std::string, uint> count_light_type(const std::vector<Light *> &gpu_lig
 std::map<std::string, uint> count_material_type(const std::vector<const Primitive *> &primitives) {
     std::map<std::string, uint> counter;
     for (const auto primitive : primitives) {
+        const auto material = primitive->get_material();
+        if (material == nullptr) {
+            add_one_to_map("(instance)", counter);
+            continue;
+        }
 
-        switch (primitive->get_material()->get_material_type()) {
+        switch (material->get_material_type()) {
         case Material::Type::coated_conductor: {
             add_one_to_map("CoatedConductor", counter);
             break;
@@ -131,6 +130,21 @@ SceneBuilder::SceneBuilder(const CommandLineOption &command_line_option)
       output_filename(command_line_option.output_file),
       samples_per_pixel(command_line_option.samples_per_pixel),
       preview(command_line_option.preview) {
+    bvh_build_options.build_on_host = command_line_option.host_bvh;
+    bvh_split_method = command_line_option.bvh_split_method;
+    bvh_max_primitives_in_leaf = command_line_option.bvh_max_primitives_in_leaf;
+    bvh_traversal_cost = command_line_option.bvh_traversal_cost;
+    bvh_width = command_line_option.bvh_width;
+    bvh_quantized = command_line_option.bvh_quantized;
+    bvh_stackless = command_line_option.bvh_stackless;
+    bvh_triangle_block_width = command_line_option.bvh_triangle_blocks;
+    bvh_restructure_passes = command_line_option.bvh_restructure_passes;
+    bvh_spatial_split_budget = command_line_option.bvh_spatial_split_budget;
+    bvh_cache_directory = command_line_option.bvh_cache_directory;
+    rebuild_bvh = command_line_option.rebuild_bvh;
+    check_bvh_refit = command_line_option.check_bvh_refit;
+    compress_meshes = command_line_option.compress_meshes;
+    camera_ray_packets = command_line_option.camera_ray_packets;
 
     global_spectra = GlobalSpectra::create(RGBtoSpectrumData::Gamut::sRGB, allocator);
 
@@ -174,6 +188,71 @@ SceneBuilder::SceneBuilder(const CommandLineOption &command_line_option)
     graphics_state.material = Material::create_diffuse_material(texture, allocator);
 }
 
+void SceneBuilder::build_bvh_options() {
+    if (bvh_split_method.has_value()) {
+        bvh_build_options.bottom_split_method =
+            HLBVH::BuildOptions::parse_split_method(bvh_split_method.value());
+    }
+
+    if (bvh_max_primitives_in_leaf.has_value()) {
+        if (bvh_max_primitives_in_leaf.value() < 1) {
+            printf("\n%s(): illegal max primitives in a BVH leaf: %d\n", __func__,
+                   bvh_max_primitives_in_leaf.value());
+            REPORT_FATAL_ERROR();
+        }
+        bvh_build_options.max_primitives_in_leaf = bvh_max_primitives_in_leaf.value();
+    }
+
+    if (bvh_traversal_cost.has_value()) {
+        bvh_build_options.traversal_cost = bvh_traversal_cost.value();
+    }
+
+    if (bvh_width.has_value()) {
+        if (bvh_width.value() != 0 && bvh_width.value() != 4 && bvh_width.value() != 8) {
+            printf("\n%s(): illegal BVH width: %d (expect 0, 4 or 8)\n", __func__,
+                   bvh_width.value());
+            REPORT_FATAL_ERROR();
+        }
+        bvh_build_options.wide_bvh_width = bvh_width.value();
+    }
+
+    if (bvh_quantized.has_value()) {
+        bvh_build_options.quantized_nodes = bvh_quantized.value();
+    }
+
+    if (bvh_stackless.has_value()) {
+        bvh_build_options.stackless_traversal = bvh_stackless.value();
+    }
+
+    if (bvh_triangle_block_width.has_value()) {
+        if (bvh_triangle_block_width.value() != 0 && bvh_triangle_block_width.value() != 4 &&
+            bvh_triangle_block_width.value() != 8) {
+            printf("\n%s(): illegal triangle block width: %d (expect 0, 4 or 8)\n", __func__,
+                   bvh_triangle_block_width.value());
+            REPORT_FATAL_ERROR();
+        }
+        bvh_build_options.triangle_block_width = bvh_triangle_block_width.value();
+    }
+
+    if (bvh_restructure_passes.has_value()) {
+        if (bvh_restructure_passes.value() < 0) {
+            printf("\n%s(): illegal BVH restructure passes: %d\n", __func__,
+                   bvh_restructure_passes.value());
+            REPORT_FATAL_ERROR();
+        }
+        bvh_build_options.restructure_passes = bvh_restructure_passes.value();
+    }
+
+    if (bvh_spatial_split_budget.has_value()) {
+        if (bvh_spatial_split_budget.value() < 0) {
+            printf("\n%s(): illegal BVH spatial split budget: %f\n", __func__,
+                   bvh_spatial_split_budget.value());
+            REPORT_FATAL_ERROR();
+        }
+        bvh_build_options.max_duplicated_references = bvh_spatial_split_budget.value();
+    }
+}
+
 void SceneBuilder::build_camera() {
     if (film == nullptr) {
         REPORT_FATAL_ERROR();
@@ -305,7 +384,8 @@ void SceneBuilder::build_integrator() {
 
     if (integrator_name == "path") {
         wavefront_path_integrator = WavefrontPathIntegrator::create(
-            parameters, integrator_base, sampler_type, samples_per_pixel.value(), allocator);
+            parameters, integrator_base, sampler_type, samples_per_pixel.value(),
+            camera_ray_packets, allocator);
         return;
     }
 
@@ -316,6 +396,54 @@ void SceneBuilder::build_integrator() {
 void SceneBuilder::parse_keyword(const std::vector<Token> &tokens) {
     const auto keyword = tokens[0].values[0];
 
+    if (keyword == "Accelerator") {
+        if (tokens[1].values[0] != "bvh") {
+            printf("%s(): accelerator `%s` not implemented, fall back to BVH\n", __func__,
+                   tokens[1].values[0].c_str());
+        }
+
+        // command line options take precedence over the scene file
+        const auto parameters = build_parameter_dictionary(sub_vector(tokens, 2));
+
+        if (!bvh_split_method.has_value()) {
+            bvh_split_method = parameters.get_one_string("splitmethod", "sah");
+        }
+
+        if (!bvh_max_primitives_in_leaf.has_value()) {
+            bvh_max_primitives_in_leaf = parameters.get_integer("maxnodeprims", 1);
+        }
+
+        if (!bvh_traversal_cost.has_value()) {
+            bvh_traversal_cost = parameters.get_float("traversalcost", 0.125);
+        }
+
+        if (!bvh_width.has_value()) {
+            bvh_width = parameters.get_integer("width", 0);
+        }
+
+        if (!bvh_quantized.has_value()) {
+            bvh_quantized = parameters.get_bool("quantize", false);
+        }
+
+        if (!bvh_stackless.has_value()) {
+            bvh_stackless = parameters.get_bool("stackless", false);
+        }
+
+        if (!bvh_triangle_block_width.has_value()) {
+            bvh_triangle_block_width = parameters.get_integer("triangleblocks", 0);
+        }
+
+        if (!bvh_restructure_passes.has_value()) {
+            bvh_restructure_passes = parameters.get_integer("restructurepasses", 0);
+        }
+
+        if (!bvh_spatial_split_budget.has_value()) {
+            bvh_spatial_split_budget = parameters.get_float("spatialsplitbudget", 0.25);
+        }
+
+        return;
+    }
+
     if (keyword == "AreaLightSource") {
         parse_area_light_source(tokens);
         return;
@@ -468,10 +596,8 @@ void SceneBuilder::parse_concat_transform(const std::vector<Token> &tokens) {
         REPORT_FATAL_ERROR();
     }
 
-    std::vector<FloatType> data(16);
-    for (uint idx = 0; idx < tokens[1].values.size(); idx++) {
-        data[idx] = stod(tokens[1].values[idx]);
-    }
+    auto data = tokens[1].to_floats();
+    data.resize(16);
 
     FloatType transform_data[4][4];
     for (uint y = 0; y < 4; y++) {
@@ -486,6 +612,9 @@ void SceneBuilder::parse_concat_transform(const std::vector<Token> &tokens) {
 }
 
 void SceneBuilder::parse_light_source(const std::vector<Token> &tokens) {
+    // keep the lights in the order of the file: after the area lights of shapes parsed before
+    build_pending_shapes();
+
     const auto parameters = build_parameter_dictionary(sub_vector(tokens, 2));
 
     const auto light_source_type = tokens[1].values[0];
@@ -592,42 +721,142 @@ void SceneBuilder::parse_shape(const std::vector<Token> &tokens) {
         REPORT_FATAL_ERROR();
     }
 
-    const auto parameters = build_parameter_dictionary(sub_vector(tokens, 2));
-    auto type_of_shape = tokens[1].values[0];
-    const auto render_from_object = get_render_from_object();
+    if (graphics_state.area_light_entity && active_instance_definition) {
+        printf("\nERROR: area lights not supported with object instancing\n");
+        REPORT_FATAL_ERROR();
+    }
 
-    auto result = Shape::create(type_of_shape, render_from_object, render_from_object.inverse(),
-                                graphics_state.reverse_orientation, parameters, allocator);
-    auto shapes = result.first;
-    auto num_shapes = result.second;
+    pending_shapes.push_back(ShapeEntity{
+        .type_of_shape = tokens[1].values[0],
+        .parameters = build_parameter_dictionary(sub_vector(tokens, 2)),
+        .render_from_object = get_render_from_object(),
+        .reverse_orientation = graphics_state.reverse_orientation,
+        .material = graphics_state.material,
+        .area_light_entity = graphics_state.area_light_entity,
+    });
 
-    if (!graphics_state.area_light_entity) {
-        auto simple_primitives = Primitive::create_simple_primitives(
-            shapes, graphics_state.material, num_shapes, allocator);
+    pending_shape_bytes += pending_shapes.back().parameters.get_array_bytes();
 
-        if (active_instance_definition) {
-            active_instance_definition->instantiated_primitives.push_back(
-                InstantiatedPrimitive(simple_primitives, num_shapes));
-        } else {
-            for (uint idx = 0; idx < num_shapes; ++idx) {
-                gpu_primitives.push_back(&simple_primitives[idx]);
-            }
+    if (pending_shapes.size() >= MAX_PENDING_SHAPES ||
+        pending_shape_bytes >= MAX_PENDING_SHAPE_BYTES) {
+        build_pending_shapes();
+    }
+}
+
+static std::string get_ply_path(const ParameterDictionary &parameters) {
+    return parameters.root + "/" + parameters.get_one_string("filename");
+}
+
+void SceneBuilder::build_pending_shapes() {
+    if (pending_shapes.empty()) {
+        return;
+    }
+
+    // decoding meshes (PLY files, loop subdivision) only touches host memory: on all cores
+    std::vector<uint> mesh_indices;
+    for (uint idx = 0; idx < pending_shapes.size(); ++idx) {
+        if (Shape::is_mesh(pending_shapes[idx].type_of_shape)) {
+            mesh_indices.push_back(idx);
+        }
+    }
+
+    std::vector<std::shared_ptr<const TriQuadMesh>> meshes(pending_shapes.size());
+    const auto read_mesh = [&](const int idx, ThreadPool *ply_thread_pool) {
+        const auto &shape = pending_shapes[mesh_indices[idx]];
+        // a PLY file referenced again within the batch is decoded once
+        meshes[mesh_indices[idx]] =
+            shape.type_of_shape == "plymesh"
+                ? loader_cache.read_ply(get_ply_path(shape.parameters), ply_thread_pool)
+                : std::make_shared<const TriQuadMesh>(
+                      Shape::read_mesh(shape.type_of_shape, shape.parameters));
+    };
+
+    if (mesh_indices.size() > 1) {
+        // one mesh per job, each decoded on its own thread: a job helping with nested jobs
+        // could pick up another reference to the file LoaderCache is decoding (and wait for it)
+        thread_pool.parallel_execute(0, mesh_indices.size(),
+                                     [&](const int idx) { read_mesh(idx, nullptr); });
+    } else if (mesh_indices.size() == 1) {
+        // a single (possibly large) PLY file is decoded on the whole pool instead
+        read_mesh(0, &thread_pool);
+    }
+
+    // uploads, primitives and lights in parsing order: the scene is the same from run to run
+    for (uint idx = 0; idx < pending_shapes.size(); ++idx) {
+        build_shape(pending_shapes[idx], meshes[idx].get());
+
+        // release the host copy as soon as it's on the device
+        meshes[idx] = nullptr;
+    }
+
+    pending_shapes.clear();
+    pending_shape_bytes = 0;
+    loader_cache.release_host_meshes();
+}
+
+void SceneBuilder::build_shape(const ShapeEntity &shape, const TriQuadMesh *host_mesh) {
+    const auto &render_from_object = shape.render_from_object;
+
+    if (Shape::is_mesh(shape.type_of_shape)) {
+        // one MeshPrimitive for the whole mesh instead of a Triangle/BilinearPatch, Shape and
+        // SimplePrimitive/GeometricPrimitive per shape
+        const auto meshes =
+            shape.type_of_shape == "plymesh"
+                ? loader_cache.create_meshes(get_ply_path(shape.parameters), *host_mesh,
+                                             render_from_object, shape.reverse_orientation,
+                                             compress_meshes, &mesh_stats, allocator)
+                : Shape::create_meshes(*host_mesh, render_from_object, shape.reverse_orientation,
+                                       compress_meshes, &mesh_stats, allocator);
+
+        if (const auto mesh = meshes.triangle_mesh) {
+            // area lights sample their own Triangle: only built for emissive meshes
+            const auto diffuse_area_lights =
+                shape.area_light_entity
+                    ? create_mesh_area_lights(TriangleMesh::build_triangles(mesh, allocator),
+                                              render_from_object,
+                                              shape.area_light_entity->parameters)
+                    : nullptr;
+
+            add_primitives(Primitive::create_mesh_primitives(mesh, shape.material,
+                                                             diffuse_area_lights, allocator),
+                           mesh->triangles_num);
+        }
+
+        if (const auto mesh = meshes.bilinear_patch_mesh) {
+            const auto diffuse_area_lights =
+                shape.area_light_entity
+                    ? create_mesh_area_lights(BilinearPatchMesh::build_patches(mesh, allocator),
+                                              render_from_object,
+                                              shape.area_light_entity->parameters)
+                    : nullptr;
+
+            add_primitives(Primitive::create_mesh_primitives(mesh, shape.material,
+                                                             diffuse_area_lights, allocator),
+                           mesh->patches_num);
         }
 
         return;
     }
 
-    if (active_instance_definition) {
-        printf("\nERROR: area lights not supported with object instancing\n");
-        REPORT_FATAL_ERROR();
+    auto result =
+        Shape::create(shape.type_of_shape, render_from_object, render_from_object.inverse(),
+                      shape.reverse_orientation, shape.parameters, allocator);
+    auto shapes = result.first;
+    auto num_shapes = result.second;
+
+    if (!shape.area_light_entity) {
+        add_primitives(
+            Primitive::create_simple_primitives(shapes, shape.material, num_shapes, allocator),
+            num_shapes);
+        return;
     }
 
     auto diffuse_area_lights =
         Light::create_diffuse_area_lights(shapes, num_shapes, render_from_object,
-                                          graphics_state.area_light_entity->parameters, allocator);
+                                          shape.area_light_entity->parameters, allocator);
 
     auto geometric_primitives = Primitive::create_geometric_primitives(
-        shapes, graphics_state.material, diffuse_area_lights, num_shapes, allocator);
+        shapes, shape.material, diffuse_area_lights, num_shapes, allocator);
 
     // otherwise: build AreaDiffuseLight
     for (uint idx = 0; idx < num_shapes; ++idx) {
@@ -639,6 +868,31 @@ void SceneBuilder::parse_shape(const std::vector<Token> &tokens) {
     }
 }
 
+void SceneBuilder::add_primitives(const Primitive *primitives, const uint num) {
+    if (active_instance_definition) {
+        active_instance_definition->instantiated_primitives.push_back(
+            InstantiatedPrimitive(primitives, num));
+        return;
+    }
+
+    for (uint idx = 0; idx < num; ++idx) {
+        gpu_primitives.push_back(&primitives[idx]);
+    }
+}
+
+const Light *SceneBuilder::create_mesh_area_lights(const std::pair<const Shape *, uint> &shapes,
+                                                   const Transform &render_from_object,
+                                                   const ParameterDictionary &light_parameters) {
+    const auto diffuse_area_lights = Light::create_diffuse_area_lights(
+        shapes.first, shapes.second, render_from_object, light_parameters, allocator);
+
+    for (uint idx = 0; idx < shapes.second; ++idx) {
+        gpu_lights.push_back(&diffuse_area_lights[idx]);
+    }
+
+    return diffuse_area_lights;
+}
+
 void SceneBuilder::parse_texture(const std::vector<Token> &tokens) {
     auto texture_name = tokens[1].values[0];
     auto color_type = tokens[2].values[0];
@@ -678,10 +932,8 @@ void SceneBuilder::parse_transform(const std::vector<Token> &tokens) {
         REPORT_FATAL_ERROR();
     }
 
-    std::vector<FloatType> data(16);
-    for (uint idx = 0; idx < tokens[1].values.size(); idx++) {
-        data[idx] = stod(tokens[1].values[idx]);
-    }
+    auto data = tokens[1].to_floats();
+    data.resize(16);
 
     FloatType transform_data[4][4];
     for (uint y = 0; y < 4; y++) {
@@ -704,130 +956,179 @@ void SceneBuilder::parse_translate(const std::vector<Token> &tokens) {
     graphics_state.transform *= Transform::translate(data[0], data[1], data[2]);
 }
 
-void SceneBuilder::parse_tokens(const std::vector<Token> &tokens) {
-    uint token_idx = 0;
-    while (token_idx < tokens.size()) {
-        const Token &first_token = tokens[token_idx];
-        if (first_token.type == TokenType::WorldBegin) {
-            build_filter();
-            build_film();
-            build_camera();
+void SceneBuilder::parse_statement(const std::vector<Token> &statement) {
+    const Token &first_token = statement[0];
+    if (first_token.type == TokenType::WorldBegin) {
+        build_filter();
+        build_film();
+        build_camera();
+        build_bvh_options();
 
-            graphics_state.transform = Transform::identity();
-            named_coordinate_systems["world"] = graphics_state.transform;
+        graphics_state.transform = Transform::identity();
+        named_coordinate_systems["world"] = graphics_state.transform;
 
-            token_idx += 1;
-            continue;
+        return;
+    }
+
+    if (first_token.type == TokenType::AttributeBegin) {
+        pushed_graphics_state.push(graphics_state);
+
+        return;
+    }
+
+    if (first_token.type == TokenType::AttributeEnd) {
+        if (pushed_graphics_state.empty()) {
+            REPORT_FATAL_ERROR();
         }
 
-        if (first_token.type == TokenType::AttributeBegin) {
-            pushed_graphics_state.push(graphics_state);
+        graphics_state = pushed_graphics_state.top();
+        pushed_graphics_state.pop();
 
-            token_idx += 1;
-            continue;
+        return;
+    }
+
+    if (first_token.type == TokenType::ObjectBegin) {
+        // shapes parsed so far belong to the scene, not to this object
+        build_pending_shapes();
+
+        pushed_graphics_state.push(graphics_state);
+
+        if (active_instance_definition) {
+            printf("\nERROR: ObjectBegin called inside of instance definition\n");
+            REPORT_FATAL_ERROR();
         }
 
-        if (first_token.type == TokenType::AttributeEnd) {
-            if (pushed_graphics_state.empty()) {
-                REPORT_FATAL_ERROR();
-            }
+        active_instance_definition = std::make_shared<ActiveInstanceDefinition>();
 
-            graphics_state = pushed_graphics_state.top();
-            pushed_graphics_state.pop();
+        active_instance_definition->name = first_token.values[0];
 
-            token_idx += 1;
-            continue;
+        return;
+    }
+
+    if (first_token.type == TokenType::ObjectEnd) {
+        if (!active_instance_definition) {
+            printf("\nERROR: ObjectEnd called before an instance defined\n");
+            REPORT_FATAL_ERROR();
         }
 
-        if (first_token.type == TokenType::ObjectBegin) {
-            pushed_graphics_state.push(graphics_state);
+        build_pending_shapes();
 
-            if (active_instance_definition) {
-                printf("\nERROR: ObjectBegin called inside of instance definition\n");
-                REPORT_FATAL_ERROR();
+        std::vector<const Primitive *> instance_primitives;
+        for (const auto &instanced_primitives :
+             active_instance_definition->instantiated_primitives) {
+            for (uint p_idx = 0; p_idx < instanced_primitives.num; ++p_idx) {
+                instance_primitives.push_back(&instanced_primitives.primitives[p_idx]);
             }
+        }
 
-            active_instance_definition = std::make_shared<ActiveInstanceDefinition>();
-
-            active_instance_definition->name = first_token.values[0];
+        if (!instance_primitives.empty()) {
+            // one BVH per object, shared by all its instances
+            auto bvh = HLBVH::create(instance_primitives, bvh_build_options, allocator);
 
-            token_idx += 1;
-            continue;
+            auto bvh_primitive = allocator.allocate<Primitive>();
+            bvh_primitive->init(bvh);
+            active_instance_definition->bvh_primitive = bvh_primitive;
         }
 
-        if (first_token.type == TokenType::ObjectEnd) {
-            if (!active_instance_definition) {
-                printf("\nERROR: ObjectEnd called before an instance defined\n");
-                REPORT_FATAL_ERROR();
-            }
+        instance_definition[active_instance_definition->name] = active_instance_definition;
 
-            instance_definition[active_instance_definition->name] = active_instance_definition;
+        active_instance_definition = nullptr;
 
-            active_instance_definition = nullptr;
+        graphics_state = pushed_graphics_state.top();
+        pushed_graphics_state.pop();
 
-            graphics_state = pushed_graphics_state.top();
-            pushed_graphics_state.pop();
+        return;
+    }
 
-            token_idx += 1;
-            continue;
+    if (first_token.type == TokenType::ObjectInstance) {
+        if (active_instance_definition) {
+            printf("\nERROR: ObjectInstance called inside of instance definition\n");
+            REPORT_FATAL_ERROR();
         }
 
-        if (first_token.type == TokenType::ObjectInstance) {
-            const auto object_name = first_token.values[0];
-            if (instance_definition.find(object_name) == instance_definition.end()) {
-                printf("\nERROR: object `%s` not found\n", object_name.c_str());
-                REPORT_FATAL_ERROR();
-            }
-
-            const auto instance = instance_definition.at(object_name);
-
-            auto world_from_render = render_from_world.inverse();
-            auto render_from_instance = get_render_from_object() * world_from_render;
-
-            if (render_from_instance.is_identity()) {
-                for (auto &instanced_primitives : instance->instantiated_primitives) {
-                    for (uint p_idx = 0; p_idx < instanced_primitives.num; ++p_idx) {
-                        gpu_primitives.push_back(&instanced_primitives.primitives[p_idx]);
-                    }
-                }
-            } else {
-                for (auto &instanced_primitives : instance->instantiated_primitives) {
-                    auto transformed_primitives = Primitive::create_transformed_primitives(
-                        instanced_primitives.primitives, render_from_instance,
-                        instanced_primitives.num, allocator);
-
-                    for (uint p_idx = 0; p_idx < instanced_primitives.num; ++p_idx) {
-                        gpu_primitives.push_back(&transformed_primitives[p_idx]);
-                    }
-                }
-            }
+        // keep the instance after the shapes parsed before it
+        build_pending_shapes();
 
-            token_idx += 1;
-            continue;
+        const auto object_name = first_token.values[0];
+        if (instance_definition.find(object_name) == instance_definition.end()) {
+            printf("\nERROR: object `%s` not found\n", object_name.c_str());
+            REPORT_FATAL_ERROR();
         }
 
-        if (first_token.type == TokenType::Keyword) {
-            auto end = next_keyword_position(tokens, token_idx);
-            auto keyword_tokens = sub_vector(tokens, token_idx, end);
+        const auto instance = instance_definition.at(object_name);
 
-            parse_keyword(keyword_tokens);
+        auto world_from_render = render_from_world.inverse();
+        auto render_from_instance = get_render_from_object() * world_from_render;
 
-            token_idx = end;
-            continue;
+        if (instance->bvh_primitive == nullptr) {
+            return;
         }
 
-        std::cout << "\nillegal token: \n" << first_token << "\n";
-        REPORT_FATAL_ERROR();
+        // instances share the object BVH and differ only in their transform
+        if (render_from_instance.is_identity()) {
+            gpu_primitives.push_back(instance->bvh_primitive);
+            return;
+        }
+
+        auto transformed_primitive = allocator.allocate<TransformedPrimitive>();
+        transformed_primitive->init(instance->bvh_primitive, render_from_instance);
+
+        auto primitive = allocator.allocate<Primitive>();
+        primitive->init(transformed_primitive);
+        gpu_primitives.push_back(primitive);
+
+        object_instances.push_back(ObjectInstance{
+            .transformed_primitive = transformed_primitive,
+            .bvh_primitive = instance->bvh_primitive,
+            .render_from_instance = render_from_instance,
+        });
+
+        return;
     }
+
+    if (first_token.type == TokenType::Keyword) {
+        parse_keyword(statement);
+        return;
+    }
+
+    std::cout << "\nillegal token: \n" << first_token << "\n";
+    REPORT_FATAL_ERROR();
 }
 
 void SceneBuilder::parse_file(const std::string &_filename) {
-    const auto all_tokens = parse_pbrt_into_token(_filename);
-    parse_tokens(all_tokens);
+    // the file is only mapped: one statement at a time is held in memory
+    Parser parser(_filename);
+
+    std::vector<Token> statement;
+    while (parser.next_statement(statement)) {
+        parse_statement(statement);
+    }
 }
 
 void SceneBuilder::preprocess() {
-    integrator_base->bvh = HLBVH::create(gpu_primitives, allocator);
+    build_pending_shapes();
+
+    // image textures and lights only recorded their files while parsing
+    loader_cache.read_images(thread_pool, allocator);
+    for (auto light : gpu_lights) {
+        light->build_distribution(allocator);
+    }
+
+    loader_cache.report();
+    mesh_stats.report();
+
+    if (bvh_cache_directory.has_value()) {
+        BVHCache bvh_cache(bvh_cache_directory.value(), rebuild_bvh);
+        scene_bvh = HLBVH::create(gpu_primitives, bvh_build_options, allocator, &bvh_cache);
+        bvh_cache.report();
+    } else {
+        scene_bvh = HLBVH::create(gpu_primitives, bvh_build_options, allocator);
+    }
+
+    if (check_bvh_refit) {
+        verify_bvh_refit();
+    }
+    integrator_base->bvh = scene_bvh;
 
     auto full_scene_bounds = integrator_base->bvh->bounds();
     for (auto light : gpu_lights) {
@@ -869,6 +1170,101 @@ void SceneBuilder::preprocess() {
     printf("\n");
 }
 
+void SceneBuilder::move_object_instances(const std::vector<Transform> &render_from_instances) {
+    if (render_from_instances.size() != object_instances.size()) {
+        printf("\n%s(): %zu transforms for %zu object instances\n", __func__,
+               render_from_instances.size(), object_instances.size());
+        REPORT_FATAL_ERROR();
+    }
+
+    for (uint idx = 0; idx < object_instances.size(); ++idx) {
+        const auto &instance = object_instances[idx];
+        instance.transformed_primitive->init(instance.bvh_primitive, render_from_instances[idx]);
+    }
+
+    if (scene_bvh == nullptr) {
+        // still parsing: the BVH built by preprocess() sees the new transforms
+        return;
+    }
+
+    scene_bvh->refit(allocator);
+
+    const auto full_scene_bounds = scene_bvh->bounds();
+    for (auto light : gpu_lights) {
+        light->preprocess(full_scene_bounds);
+    }
+}
+
+void SceneBuilder::verify_bvh_refit() {
+    if (object_instances.empty()) {
+        printf("BVH refit check: no object instance to move\n\n");
+        return;
+    }
+
+    auto bvh = scene_bvh;
+    const auto scene_bounds = bvh->bounds();
+    const auto step = scene_bounds.diagonal().length() * 0.02;
+
+    std::mt19937 random_engine(0);
+    std::uniform_real_distribution<FloatType> uniform(0, 1);
+
+    std::vector<Transform> moved_transforms;
+    std::vector<Transform> original_transforms;
+    for (const auto &instance : object_instances) {
+        const auto offset = Vector3f(uniform(random_engine) - 0.5, uniform(random_engine) - 0.5,
+                                     uniform(random_engine) - 0.5) *
+                            step;
+        moved_transforms.push_back(Transform::translate(offset.x, offset.y, offset.z) *
+                                   instance.render_from_instance);
+        original_transforms.push_back(instance.render_from_instance);
+    }
+    move_object_instances(moved_transforms);
+
+    GPUMemoryAllocator local_allocator;
+    const auto reference = HLBVH::create(gpu_primitives, bvh_build_options, local_allocator);
+
+    // rays between random points of the scene: hits are compared on the host
+    constexpr uint num_rays = 1 << 14;
+    uint num_hits = 0;
+    uint num_mismatches = 0;
+    for (uint idx = 0; idx < num_rays; ++idx) {
+        const auto origin = scene_bounds.lerp(Point3f(
+            uniform(random_engine), uniform(random_engine), uniform(random_engine)));
+        const auto target = scene_bounds.lerp(Point3f(
+            uniform(random_engine), uniform(random_engine), uniform(random_engine)));
+        const auto distance = (target - origin).length();
+        if (distance == 0) {
+            continue;
+        }
+
+        const Ray ray(origin, (target - origin) / distance);
+
+        const auto hit = bvh->intersect(ray, Infinity);
+        const auto expected_hit = reference->intersect(ray, Infinity);
+        num_hits += expected_hit.has_value();
+
+        if (hit.has_value() != expected_hit.has_value() ||
+            (hit.has_value() && std::abs(hit->t_hit - expected_hit->t_hit) >
+                                    std::max<FloatType>(1, expected_hit->t_hit) * 1e-4)) {
+            num_mismatches += 1;
+            continue;
+        }
+
+        if (bvh->fast_intersect(ray, distance) != reference->fast_intersect(ray, distance)) {
+            num_mismatches += 1;
+        }
+    }
+
+    printf("BVH refit check: %zu instances moved, %u rays (%u hits), %u mismatches\n\n",
+           object_instances.size(), num_rays, num_hits, num_mismatches);
+
+    move_object_instances(original_transforms);
+
+    if (num_mismatches > 0) {
+        REPORT_FATAL_ERROR();
+    }
+}
+
 void SceneBuilder::render() const {
     if (!integrator_base->is_ready()) {
         REPORT_FATAL_ERROR();
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <pbrt/accelerator/hlbvh.h>
 #include <pbrt/base/light.h>
 #include <pbrt/euclidean_space/transform.h>
 #include <pbrt/gpu/gpu_memory_allocator.h>
 #include <pbrt/scene/command_line_option.h>
+#include <pbrt/scene/loader_cache.h>
 #include <pbrt/scene/parameter_dictionary.h>
 #include <pbrt/scene/parser.h>
+#include <pbrt/util/thread_pool.h>
 #include <filesystem>
 #include <map>
 #include <stack>
@@ -17,6 +20,8 @@ class MegakernelIntegrator;
 class MLTPathIntegrator;
 class Primitive;
 class Renderer;
+class TransformedPrimitive;
+struct TriQuadMesh;
 class WavefrontPathIntegrator;
 struct IntegratorBase;
 
@@ -58,6 +63,21 @@ class SceneBuilder {
     std::optional<int> samples_per_pixel;
     std::optional<std::string> integrator_name;
     bool preview = false;
+    HLBVH::BuildOptions bvh_build_options;
+    std::optional<std::string> bvh_split_method;
+    std::optional<int> bvh_max_primitives_in_leaf;
+    std::optional<FloatType> bvh_traversal_cost;
+    std::optional<int> bvh_width;
+    std::optional<bool> bvh_quantized;
+    std::optional<bool> bvh_stackless;
+    std::optional<int> bvh_triangle_block_width;
+    std::optional<int> bvh_restructure_passes;
+    std::optional<FloatType> bvh_spatial_split_budget;
+    std::optional<std::string> bvh_cache_directory;
+    bool rebuild_bvh = false;
+    bool check_bvh_refit = false;
+    bool compress_meshes = false;
+    bool camera_ray_packets = false;
 
     const MegakernelIntegrator *megakernel_integrator = nullptr;
     WavefrontPathIntegrator *wavefront_path_integrator = nullptr;
@@ -72,6 +92,13 @@ class SceneBuilder {
 
     GPUMemoryAllocator allocator;
 
+    LoaderCache loader_cache;
+    MeshStats mesh_stats;
+
+    ThreadPool thread_pool;
+    // for mesh decoding and long number lists: started once rather than for every batch of
+    // pending shapes or every list
+
     std::map<std::string, const Material *> materials;
     std::map<std::string, const Spectrum *> spectra;
 
@@ -91,6 +118,24 @@ class SceneBuilder {
     std::vector<const Primitive *> gpu_primitives;
     std::vector<Light *> gpu_lights;
 
+    struct ShapeEntity {
+        std::string type_of_shape;
+        ParameterDictionary parameters;
+        Transform render_from_object;
+        bool reverse_orientation;
+        const Material *material;
+        std::optional<AreaLightEntity> area_light_entity;
+    };
+
+    static constexpr uint MAX_PENDING_SHAPES = 256;
+    static constexpr size_t MAX_PENDING_SHAPE_BYTES = 64 * 1024 * 1024;
+
+    std::vector<ShapeEntity> pending_shapes;
+    size_t pending_shape_bytes = 0;
+    // recorded by parse_shape(), built in batches by build_pending_shapes()
+    // a batch ends at MAX_PENDING_SHAPES shapes or once their inline arrays (vertices,
+    // indices...) reach MAX_PENDING_SHAPE_BYTES: hundreds of large inline meshes aren't held
+
     GraphicsState graphics_state;
     std::stack<GraphicsState> pushed_graphics_state;
     std::map<std::string, Transform> named_coordinate_systems;
@@ -108,21 +153,36 @@ class SceneBuilder {
         ActiveInstanceDefinition() = default;
         std::string name;
         std::vector<InstantiatedPrimitive> instantiated_primitives;
+        const Primitive *bvh_primitive = nullptr;
     };
 
     std::shared_ptr<ActiveInstanceDefinition> active_instance_definition = nullptr;
 
     std::map<std::string, std::shared_ptr<ActiveInstanceDefinition>> instance_definition;
 
+    struct ObjectInstance {
+        TransformedPrimitive *transformed_primitive;
+        const Primitive *bvh_primitive;
+        Transform render_from_instance;
+    };
+    std::vector<ObjectInstance> object_instances;
+    // the ones placed with a transform, in the order they were parsed
+
+    HLBVH *scene_bvh = nullptr;
+    // the one integrator_base->bvh points to, refit by move_object_instances()
+
   public:
     explicit SceneBuilder(const CommandLineOption &command_line_option);
 
     ParameterDictionary build_parameter_dictionary(const std::vector<Token> &tokens) {
-        return ParameterDictionary(tokens, root, global_spectra, spectra, materials, float_textures,
-                                   albedo_spectrum_textures, illuminant_spectrum_textures,
-                                   unbounded_spectrum_textures, allocator);
+        return ParameterDictionary(tokens, root, global_spectra, &loader_cache, spectra, materials,
+                                   float_textures, albedo_spectrum_textures,
+                                   illuminant_spectrum_textures, unbounded_spectrum_textures,
+                                   &thread_pool, allocator);
     }
 
+    void build_bvh_options();
+
     void build_camera();
 
     void build_filter();
@@ -133,6 +193,26 @@ class SceneBuilder {
 
     void build_integrator();
 
+    void verify_bvh_refit();
+    // moves every object instance, refits the scene BVH and compares its hits against a BVH
+    // built from scratch, then moves the instances back
+
+    void add_primitives(const Primitive *primitives, uint num);
+    // to the active instance definition if there is one, otherwise to the scene
+
+    void build_pending_shapes();
+    // reads the meshes of pending_shapes in parallel, then uploads them and creates their
+    // primitives and lights one by one in the order they were parsed
+    // called whenever the order matters: before objects, instances, lights and the BVH
+
+    void build_shape(const ShapeEntity &shape, const TriQuadMesh *host_mesh);
+    // host_mesh: read by build_pending_shapes() for meshes, nullptr for other shapes
+
+    const Light *create_mesh_area_lights(const std::pair<const Shape *, uint> &shapes,
+                                         const Transform &render_from_object,
+                                         const ParameterDictionary &light_parameters);
+    // one per shape of an emissive mesh
+
     void parse_keyword(const std::vector<Token> &tokens);
 
     void parse_area_light_source(const std::vector<Token> &tokens);
@@ -161,7 +241,7 @@ class SceneBuilder {
 
     void parse_translate(const std::vector<Token> &tokens);
 
-    void parse_tokens(const std::vector<Token> &tokens);
+    void parse_statement(const std::vector<Token> &statement);
 
     Transform get_render_from_object() const {
         return render_from_world * graphics_state.transform;
@@ -171,6 +251,10 @@ class SceneBuilder {
 
     void preprocess();
 
+    void move_object_instances(const std::vector<Transform> &render_from_instances);
+    // between frames: places every object instance anew (one transform each, in parse order),
+    // then refits the scene BVH in place and updates the lights depending on its bounds
+
     void render() const;
 
     static void render_pbrt(const CommandLineOption &command_line_option) {
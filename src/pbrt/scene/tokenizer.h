@@ -1,8 +1,11 @@
 #pragma once
 
+#include <pbrt/scene/number_parser.h>
+
 enum class TokenType {
     Illegal,
     EndOfFile,
+    LeftBracket,
     RightBracket,
 
     WorldBegin,
@@ -30,6 +33,10 @@ static std::ostream &operator<<(std::ostream &stream, const TokenType type) {
         stream << "EOF";
         break;
     }
+    case TokenType::LeftBracket: {
+        stream << "LeftBracket";
+        break;
+    }
     case TokenType::RightBracket: {
         stream << "RightBracket";
         break;
@@ -94,18 +101,23 @@ class Token {
     TokenType type;
     std::vector<std::string> values;
 
+    std::string number_text;
+    // a List of only numbers keeps its text as is, with values left empty:
+    // parsed in bulk by to_floats() and to_integers()
+
     explicit Token(TokenType _type) : type(_type) {}
 
     Token(TokenType _type, const std::string &_value) : type(_type), values({_value}) {}
 
-    Token(TokenType _type, const std::vector<std::string> &_value) : type(_type), values(_value) {}
+    Token(TokenType _type, std::vector<std::string> _values)
+        : type(_type), values(std::move(_values)) {}
 
     bool operator==(const Token &t) const {
         if (type != t.type) {
             return false;
         }
 
-        if (values.size() != t.values.size()) {
+        if (number_text != t.number_text || values.size() != t.values.size()) {
             return false;
         }
 
@@ -130,7 +142,12 @@ class Token {
         return stod(values[0]);
     }
 
-    std::vector<FloatType> to_floats() const {
+    std::vector<FloatType> to_floats(ThreadPool *thread_pool = nullptr) const {
+        // thread_pool: see NumberParser::parse()
+        if (!number_text.empty()) {
+            return NumberParser::parse<FloatType>(number_text, thread_pool);
+        }
+
         std::vector<FloatType> floats(values.size());
         for (int idx = 0; idx < values.size(); idx++) {
             floats[idx] = stod(values[idx]);
@@ -139,7 +156,11 @@ class Token {
         return floats;
     }
 
-    std::vector<int> to_integers() const {
+    std::vector<int> to_integers(ThreadPool *thread_pool = nullptr) const {
+        if (!number_text.empty()) {
+            return NumberParser::parse<int>(number_text, thread_pool);
+        }
+
         std::vector<int> integers(values.size());
         for (int idx = 0; idx < values.size(); idx++) {
             integers[idx] = stoi(values[idx]);
@@ -150,7 +171,9 @@ class Token {
 
     friend std::ostream &operator<<(std::ostream &stream, const Token &token) {
         stream << token.type;
-        if (!token.values.empty()) {
+        if (!token.number_text.empty()) {
+            stream << ": [ " << token.number_text << " ]";
+        } else if (!token.values.empty()) {
             stream << ": { ";
             for (const auto &x : token.values) {
                 stream << x << ", ";
@@ -0,0 +1,393 @@
+#include <pbrt/base/shape.h>
+#include <pbrt/shapes/bilinear_patch.h>
+#include <pbrt/util/sampling.h>
+
+PBRT_CPU_GPU
+bool BilinearPatch::is_rectangle() const {
+    Point3f p[4];
+    get_points(p);
+    const auto &p00 = p[0];
+    const auto &p10 = p[1];
+    const auto &p01 = p[2];
+    const auto &p11 = p[3];
+
+    if (p00.squared_distance(p01) == 0 || p01.squared_distance(p11) == 0 ||
+        p11.squared_distance(p10) == 0 || p10.squared_distance(p00) == 0) {
+        return false;
+    }
+
+    // coplanar vertices
+    const auto n = (p10 - p00).cross(p01 - p00).normalize();
+    if (std::abs((p11 - p00).normalize().dot(n)) > 1e-5) {
+        return false;
+    }
+
+    // with all of them at the same distance from the center
+    const Point3f center = FloatType(0.25) * (p00 + p01 + p10 + p11);
+    const FloatType d2[4] = {
+        p00.squared_distance(center),
+        p01.squared_distance(center),
+        p10.squared_distance(center),
+        p11.squared_distance(center),
+    };
+    for (uint idx = 1; idx < 4; ++idx) {
+        if (std::abs(d2[idx] - d2[0]) / d2[0] > 1e-4) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+PBRT_CPU_GPU
+FloatType BilinearPatch::area() const {
+    Point3f p[4];
+    get_points(p);
+
+    if (is_rectangle()) {
+        return p[0].distance(p[2]) * p[0].distance(p[1]);
+    }
+
+    // approximated with the quadrilaterals of a 3x3 grid
+    constexpr uint GRID_SIZE = 3;
+    Point3f grid[GRID_SIZE + 1][GRID_SIZE + 1];
+    for (uint i = 0; i <= GRID_SIZE; ++i) {
+        const FloatType u = FloatType(i) / GRID_SIZE;
+        for (uint j = 0; j <= GRID_SIZE; ++j) {
+            const FloatType v = FloatType(j) / GRID_SIZE;
+            grid[i][j] = lerp(u, lerp(v, p[0], p[2]), lerp(v, p[1], p[3]));
+        }
+    }
+
+    FloatType area = 0;
+    for (uint i = 0; i < GRID_SIZE; ++i) {
+        for (uint j = 0; j < GRID_SIZE; ++j) {
+            area += 0.5 * (grid[i + 1][j + 1] - grid[i][j])
+                              .cross(grid[i + 1][j] - grid[i][j + 1])
+                              .length();
+        }
+    }
+
+    return area;
+}
+
+PBRT_CPU_GPU
+pbrt::optional<BilinearPatch::BilinearIntersection>
+BilinearPatch::intersect_patch(const Ray &ray, FloatType t_max) const {
+    Point3f p[4];
+    get_points(p);
+    const auto &p00 = p[0];
+    const auto &p10 = p[1];
+    const auto &p01 = p[2];
+    const auto &p11 = p[3];
+
+    // quadratic coefficients for the distance from ray to the u iso-lines
+    const FloatType a = (p10 - p00).cross(p01 - p11).dot(ray.d);
+    const FloatType c = (p00 - ray.o).cross(ray.d).dot(p01 - p00);
+    const FloatType b = (p10 - ray.o).cross(ray.d).dot(p11 - p10) - (a + c);
+
+    FloatType u[2];
+    if (!solve_quadratic(a, b, c, &u[0], &u[1])) {
+        return {};
+    }
+
+    // ensure that t is conservatively greater than zero
+    const FloatType eps =
+        gamma(10) * (ray.o.to_vector3().abs().max_component_value() +
+                     ray.d.abs().max_component_value() +
+                     p00.to_vector3().abs().max_component_value() +
+                     p10.to_vector3().abs().max_component_value() +
+                     p01.to_vector3().abs().max_component_value() +
+                     p11.to_vector3().abs().max_component_value());
+
+    FloatType t = t_max;
+    Point2f uv;
+    for (uint idx = 0; idx < 2; ++idx) {
+        if (u[idx] < 0 || u[idx] > 1 || (idx == 1 && u[1] == u[0])) {
+            continue;
+        }
+
+        // v and t from the u iso-line: determinants as triple products
+        const Point3f uo = lerp(u[idx], p00, p10);
+        const Vector3f ud = lerp(u[idx], p01, p11) - uo;
+        const Vector3f delta_o = uo - ray.o;
+        const Vector3f perp = ray.d.cross(ud);
+        const FloatType p2 = perp.squared_length();
+
+        const FloatType v_scaled = delta_o.dot(ray.d.cross(perp));
+        const FloatType t_scaled = delta_o.dot(ud.cross(perp));
+        if (v_scaled < 0 || v_scaled > p2) {
+            continue;
+        }
+
+        const FloatType t_candidate = t_scaled / p2;
+        if (t_candidate > eps && t_candidate < t) {
+            t = t_candidate;
+            uv = Point2f(u[idx], v_scaled / p2);
+        }
+    }
+
+    if (t >= t_max) {
+        return {};
+    }
+
+    return BilinearIntersection{.uv = uv, .t = t};
+}
+
+PBRT_CPU_GPU
+pbrt::optional<ShapeIntersection> BilinearPatch::intersect(const Ray &ray,
+                                                           FloatType t_max) const {
+    auto hit = intersect_hit(ray, RayPrecomputation(ray), t_max);
+    if (!hit) {
+        return {};
+    }
+
+    return ShapeIntersection(compute_surface_interaction(hit.value(), ray), hit->t_hit);
+}
+
+PBRT_CPU_GPU
+pbrt::optional<ShapeHit> BilinearPatch::intersect_hit(const Ray &ray,
+                                                      const RayPrecomputation &ray_precomputation,
+                                                      FloatType t_max) const {
+    auto patch_intersection = intersect_patch(ray, t_max);
+    if (!patch_intersection) {
+        return {};
+    }
+
+    return ShapeHit{
+        .t_hit = patch_intersection->t,
+        .coordinates = Point3f(patch_intersection->uv.x, patch_intersection->uv.y, 0),
+        .phi = 0,
+    };
+}
+
+PBRT_CPU_GPU
+SurfaceInteraction BilinearPatch::compute_surface_interaction(const ShapeHit &hit,
+                                                              const Ray &ray) const {
+    return interaction_from_intersection(Point2f(hit.coordinates.x, hit.coordinates.y), -ray.d);
+}
+
+PBRT_CPU_GPU
+SurfaceInteraction BilinearPatch::interaction_from_intersection(const Point2f &uv,
+                                                                const Vector3f &wo) const {
+    const int *v = &(mesh->vertex_indices[4 * patch_idx]);
+    Point3f p[4];
+    get_points(p);
+    const auto &p00 = p[0];
+    const auto &p10 = p[1];
+    const auto &p01 = p[2];
+    const auto &p11 = p[3];
+
+    // point and partial derivatives at (u, v)
+    const Point3f p_hit = lerp(uv[0], lerp(uv[1], p00, p01), lerp(uv[1], p10, p11));
+    Vector3f dpdu = lerp(uv[1], p10, p11) - lerp(uv[1], p00, p01);
+    Vector3f dpdv = lerp(uv[0], p01, p11) - lerp(uv[0], p00, p10);
+
+    // texture coordinates (s, t) at (u, v)
+    Point2f st = uv;
+    FloatType duds = 1;
+    FloatType dudt = 0;
+    FloatType dvds = 0;
+    FloatType dvdt = 1;
+    if (mesh->uv) {
+        const Point2f uv00 = mesh->uv[v[0]];
+        const Point2f uv10 = mesh->uv[v[1]];
+        const Point2f uv01 = mesh->uv[v[2]];
+        const Point2f uv11 = mesh->uv[v[3]];
+        st = lerp(uv[0], lerp(uv[1], uv00, uv01), lerp(uv[1], uv10, uv11));
+
+        // partial derivatives of (u, v) with respect to (s, t)
+        const Vector2f dstdu = lerp(uv[1], uv10, uv11) - lerp(uv[1], uv00, uv01);
+        const Vector2f dstdv = lerp(uv[0], uv01, uv11) - lerp(uv[0], uv00, uv10);
+        duds = std::abs(dstdu[0]) < 1e-8 ? 0 : 1 / dstdu[0];
+        dvds = std::abs(dstdv[0]) < 1e-8 ? 0 : 1 / dstdv[0];
+        dudt = std::abs(dstdu[1]) < 1e-8 ? 0 : 1 / dstdu[1];
+        dvdt = std::abs(dstdv[1]) < 1e-8 ? 0 : 1 / dstdv[1];
+
+        // partial derivatives of p with respect to (s, t)
+        const Vector3f dpds = dpdu * duds + dpdv * dvds;
+        Vector3f dpdt = dpdu * dudt + dpdv * dvdt;
+
+        if (dpds.cross(dpdt).squared_length() > 0) {
+            if (dpdu.cross(dpdv).dot(dpds.cross(dpdt)) < 0) {
+                dpdt = -dpdt;
+            }
+
+            dpdu = dpds;
+            dpdv = dpdt;
+        }
+    }
+
+    // dndu and dndv from the fundamental forms (d2p/du2 = d2p/dv2 = 0)
+    const Vector3f d2pduv = (p00 - p01) + (p11 - p10);
+    const FloatType E = dpdu.dot(dpdu);
+    const FloatType F = dpdu.dot(dpdv);
+    const FloatType G = dpdv.dot(dpdv);
+    const Vector3f n = dpdu.cross(dpdv).normalize();
+    const FloatType f = n.dot(d2pduv);
+
+    const FloatType EGF2 = difference_of_products(E, G, F, F);
+    const FloatType inv_EGF2 = EGF2 == 0 ? FloatType(0) : 1 / EGF2;
+    Normal3f dndu = Normal3f((f * F) * inv_EGF2 * dpdu + (-f * E) * inv_EGF2 * dpdv);
+    Normal3f dndv = Normal3f((-f * G) * inv_EGF2 * dpdu + (f * F) * inv_EGF2 * dpdv);
+
+    // account for the (s, t) parameterization
+    const Normal3f dnds = dndu * duds + dndv * dvds;
+    const Normal3f dndt = dndu * dudt + dndv * dvdt;
+    dndu = dnds;
+    dndv = dndt;
+
+    const Point3f p_abs_sum = p00.abs() + p01.abs() + p10.abs() + p11.abs();
+    const Vector3f p_error = gamma(6) * p_abs_sum.to_vector3();
+
+    const bool flip_normal = mesh->reverse_orientation ^ mesh->transform_swaps_handedness;
+    SurfaceInteraction isect(Point3fi(p_hit, p_error), st, wo, dpdu, dpdv, dndu, dndv,
+                             flip_normal);
+
+    if (mesh->n) {
+        const Normal3f n00 = mesh->n[v[0]];
+        const Normal3f n10 = mesh->n[v[1]];
+        const Normal3f n01 = mesh->n[v[2]];
+        const Normal3f n11 = mesh->n[v[3]];
+
+        Normal3f ns = lerp(uv[0], lerp(uv[1], n00, n01), lerp(uv[1], n10, n11));
+        if (ns.squared_length() > 0) {
+            ns = ns.normalize();
+
+            Normal3f shading_dndu = lerp(uv[1], n10, n11) - lerp(uv[1], n00, n01);
+            Normal3f shading_dndv = lerp(uv[0], n01, n11) - lerp(uv[0], n00, n10);
+            const Normal3f shading_dnds = shading_dndu * duds + shading_dndv * dvds;
+            const Normal3f shading_dndt = shading_dndu * dudt + shading_dndv * dvdt;
+
+            const auto r = Transform::rotate_from_to(isect.n.to_vector3().normalize(),
+                                                     ns.to_vector3());
+            isect.set_shading_geometry(ns, r(dpdu), r(dpdv), shading_dnds, shading_dndt, true);
+        }
+    }
+
+    return isect;
+}
+
+PBRT_CPU_GPU
+FloatType BilinearPatch::area_pdf(const Point2f &uv) const {
+    Point3f p[4];
+    get_points(p);
+    const auto &p00 = p[0];
+    const auto &p10 = p[1];
+    const auto &p01 = p[2];
+    const auto &p11 = p[3];
+
+    FloatType pdf = 1;
+    if (!is_rectangle()) {
+        // (u, v) sampled proportionally to the differential area at the corners
+        const FloatType w[4] = {
+            (p10 - p00).cross(p01 - p00).length(),
+            (p10 - p00).cross(p11 - p10).length(),
+            (p01 - p00).cross(p11 - p01).length(),
+            (p11 - p10).cross(p11 - p01).length(),
+        };
+        pdf = bilinear_pdf(uv, w);
+    }
+
+    const Vector3f dpdu = lerp(uv[1], p10, p11) - lerp(uv[1], p00, p01);
+    const Vector3f dpdv = lerp(uv[0], p01, p11) - lerp(uv[0], p00, p10);
+
+    return pdf / dpdu.cross(dpdv).length();
+}
+
+PBRT_CPU_GPU
+FloatType BilinearPatch::pdf(const ShapeSampleContext &ctx, const Vector3f &wi) const {
+    const Ray ray = ctx.spawn_ray(wi);
+    const auto hit = intersect_patch(ray, Infinity);
+    if (!hit) {
+        return 0;
+    }
+
+    const auto isect = interaction_from_intersection(hit->uv, -ray.d);
+
+    // convert the area density of sample(u) to solid angle
+    const FloatType pdf = area_pdf(hit->uv) /
+                          (isect.n.abs_dot(-wi) / ctx.p().squared_distance(isect.p()));
+
+    return is_inf(pdf) ? 0 : pdf;
+}
+
+PBRT_CPU_GPU
+pbrt::optional<ShapeSample> BilinearPatch::sample(Point2f u) const {
+    const int *v = &(mesh->vertex_indices[4 * patch_idx]);
+    Point3f p[4];
+    get_points(p);
+    const auto &p00 = p[0];
+    const auto &p10 = p[1];
+    const auto &p01 = p[2];
+    const auto &p11 = p[3];
+
+    // (u, v) approximately uniform in area: exact for rectangles
+    Point2f uv = u;
+    if (!is_rectangle()) {
+        const FloatType w[4] = {
+            (p10 - p00).cross(p01 - p00).length(),
+            (p10 - p00).cross(p11 - p10).length(),
+            (p01 - p00).cross(p11 - p01).length(),
+            (p11 - p10).cross(p11 - p01).length(),
+        };
+        uv = sample_bilinear(u, w);
+    }
+
+    const Point3f pu0 = lerp(uv[1], p00, p01);
+    const Point3f pu1 = lerp(uv[1], p10, p11);
+    const Point3f p_sample = lerp(uv[0], pu0, pu1);
+    const Vector3f dpdu = pu1 - pu0;
+    const Vector3f dpdv = lerp(uv[0], p01, p11) - lerp(uv[0], p00, p10);
+    if (dpdu.squared_length() == 0 || dpdv.squared_length() == 0) {
+        return {};
+    }
+
+    Point2f st = uv;
+    if (mesh->uv) {
+        const Point2f uv00 = mesh->uv[v[0]];
+        const Point2f uv10 = mesh->uv[v[1]];
+        const Point2f uv01 = mesh->uv[v[2]];
+        const Point2f uv11 = mesh->uv[v[3]];
+        st = lerp(uv[0], lerp(uv[1], uv00, uv01), lerp(uv[1], uv10, uv11));
+    }
+
+    Normal3f n = Normal3f(dpdu.cross(dpdv).normalize());
+    if (mesh->n) {
+        const Normal3f ns = lerp(uv[0], lerp(uv[1], mesh->n[v[0]], mesh->n[v[2]]),
+                                 lerp(uv[1], mesh->n[v[1]], mesh->n[v[3]]));
+        n = n.face_forward(ns);
+    } else if (mesh->reverse_orientation ^ mesh->transform_swaps_handedness) {
+        n = -n;
+    }
+
+    const Point3f p_abs_sum = p00.abs() + p01.abs() + p10.abs() + p11.abs();
+    const Vector3f p_error = gamma(6) * p_abs_sum.to_vector3();
+
+    return ShapeSample{
+        .interaction = Interaction(Point3fi(p_sample, p_error), n, st),
+        .pdf = area_pdf(uv),
+    };
+}
+
+PBRT_CPU_GPU
+pbrt::optional<ShapeSample> BilinearPatch::sample(const ShapeSampleContext &ctx, Point2f u) const {
+    // area sampling, converted to solid angle
+    auto ss = sample(u);
+    if (!ss) {
+        return {};
+    }
+
+    Vector3f wi = ss->interaction.p() - ctx.p();
+    if (wi.squared_length() == 0) {
+        return {};
+    }
+    wi = wi.normalize();
+
+    ss->pdf /= ss->interaction.n.abs_dot(-wi) / ctx.p().squared_distance(ss->interaction.p());
+    if (is_inf(ss->pdf)) {
+        return {};
+    }
+
+    return ss;
+}
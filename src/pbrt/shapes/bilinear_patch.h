@@ -0,0 +1,101 @@
+#pragma once
+
+#include <pbrt/base/interaction.h>
+#include <pbrt/base/ray.h>
+#include <pbrt/euclidean_space/bounds3.h>
+#include <pbrt/shapes/bilinear_patch_mesh.h>
+
+struct ShapeSample;
+struct ShapeSampleContext;
+
+class BilinearPatch {
+  public:
+    using Mesh = BilinearPatchMesh;
+
+    PBRT_CPU_GPU
+    void init(int idx, const BilinearPatchMesh *_mesh) {
+        patch_idx = idx;
+        mesh = _mesh;
+    }
+
+    PBRT_CPU_GPU
+    void get_points(Point3f p[4]) const {
+        // p00, p10, p01, p11
+        const int *v = &(mesh->vertex_indices[4 * patch_idx]);
+        for (uint idx = 0; idx < 4; ++idx) {
+            p[idx] = mesh->p[v[idx]];
+        }
+    }
+
+    PBRT_CPU_GPU
+    Bounds3f bounds() const {
+        Point3f points[4];
+        get_points(points);
+
+        return Bounds3f(points, 4);
+    }
+
+    PBRT_CPU_GPU
+    Bounds3f clip_bounds(const Bounds3f &clip_box) const {
+        // conservative: a curved patch can't be clipped as a polygon
+        return bounds().intersection(clip_box);
+    }
+
+    PBRT_CPU_GPU
+    FloatType area() const;
+
+    PBRT_CPU_GPU
+    bool fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                        FloatType t_max) const {
+        return intersect_patch(ray, t_max).has_value();
+    }
+    // ray_precomputation: unused, the same signature as Triangle
+
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeIntersection> intersect(const Ray &ray, FloatType t_max) const;
+
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeHit> intersect_hit(const Ray &ray,
+                                           const RayPrecomputation &ray_precomputation,
+                                           FloatType t_max) const;
+    // coordinates of the hit: patch (u, v, 0)
+
+    PBRT_CPU_GPU
+    SurfaceInteraction compute_surface_interaction(const ShapeHit &hit, const Ray &ray) const;
+
+    PBRT_CPU_GPU
+    FloatType pdf(const ShapeSampleContext &ctx, const Vector3f &wi) const;
+
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeSample> sample(Point2f u) const;
+
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeSample> sample(const ShapeSampleContext &ctx, Point2f u) const;
+
+  private:
+    struct BilinearIntersection {
+        Point2f uv;
+        FloatType t;
+    };
+
+    int patch_idx;
+    const BilinearPatchMesh *mesh;
+
+    template <typename T>
+    PBRT_CPU_GPU static T lerp(FloatType t, const T &a, const T &b) {
+        return (1 - t) * a + t * b;
+    }
+
+    PBRT_CPU_GPU
+    bool is_rectangle() const;
+
+    PBRT_CPU_GPU
+    FloatType area_pdf(const Point2f &uv) const;
+    // of sample(u) at patch coordinates uv
+
+    PBRT_CPU_GPU
+    pbrt::optional<BilinearIntersection> intersect_patch(const Ray &ray, FloatType t_max) const;
+
+    PBRT_CPU_GPU
+    SurfaceInteraction interaction_from_intersection(const Point2f &uv, const Vector3f &wo) const;
+};
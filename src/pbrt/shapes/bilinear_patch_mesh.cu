@@ -0,0 +1,86 @@
+#include <pbrt/base/primitive.h>
+#include <pbrt/base/shape.h>
+#include <pbrt/gpu/gpu_memory_allocator.h>
+#include <pbrt/shapes/bilinear_patch.h>
+#include <pbrt/shapes/bilinear_patch_mesh.h>
+
+static __global__ void init_bilinear_patches(Shape *shapes, BilinearPatch *patches,
+                                             const BilinearPatchMesh *mesh) {
+    const uint worker_idx = blockIdx.x * blockDim.x + threadIdx.x;
+    if (worker_idx >= mesh->patches_num) {
+        return;
+    }
+
+    patches[worker_idx].init(worker_idx, mesh);
+    shapes[worker_idx].init(&patches[worker_idx]);
+}
+
+const BilinearPatchMesh *BilinearPatchMesh::build_mesh(const Transform &render_from_object,
+                                                       bool reverse_orientation,
+                                                       const std::vector<Point3f> &points,
+                                                       const std::vector<int> &indices,
+                                                       const std::vector<Normal3f> &normals,
+                                                       const std::vector<Point2f> &uv,
+                                                       const BilinearPatchMesh *same_topology,
+                                                       MeshStats *stats,
+                                                       GPUMemoryAllocator &allocator) {
+    if (indices.size() % 4 != 0) {
+        printf("\n%s(): number of vertex indices %zu not a multiple of 4\n", __func__,
+               indices.size());
+        REPORT_FATAL_ERROR();
+    }
+
+    std::vector<Point3f> render_points(points.size());
+    for (size_t idx = 0; idx < points.size(); ++idx) {
+        render_points[idx] = render_from_object(points[idx]);
+    }
+
+    std::vector<Normal3f> render_normals(normals.size());
+    for (size_t idx = 0; idx < normals.size(); ++idx) {
+        const auto n = render_from_object(normals[idx]);
+        render_normals[idx] = reverse_orientation ? -n : n;
+    }
+
+    // indices and uv don't depend on the transform
+    const int *gpu_indices = same_topology != nullptr ? same_topology->vertex_indices
+                                                      : allocator.copy_to_device(indices);
+    const Point2f *gpu_uv = nullptr;
+    if (same_topology != nullptr) {
+        gpu_uv = same_topology->uv;
+    } else if (!uv.empty()) {
+        gpu_uv = allocator.copy_to_device(uv);
+    }
+
+    auto mesh = allocator.allocate<BilinearPatchMesh>();
+    mesh->init(reverse_orientation, render_from_object.swaps_handedness(), gpu_indices,
+               indices.size(), allocator.copy_to_device(render_points),
+               normals.empty() ? nullptr : allocator.copy_to_device(render_normals), gpu_uv);
+
+    if (stats != nullptr) {
+        // the same vertices either way: compare what depends on the number of primitives
+        const uint num_patches = mesh->patches_num;
+        stats->patch_meshes += 1;
+        stats->patches += num_patches;
+        stats->patch_bytes += (sizeof(int) * 4 + sizeof(Primitive)) * num_patches;
+        stats->triangle_bytes += (sizeof(int) * 6 + sizeof(Primitive) * 2) * num_patches;
+    }
+
+    return mesh;
+}
+
+std::pair<const Shape *, uint> BilinearPatchMesh::build_patches(const BilinearPatchMesh *mesh,
+                                                                GPUMemoryAllocator &allocator) {
+    constexpr uint threads = 1024;
+
+    const uint num_patches = mesh->patches_num;
+
+    auto patches = allocator.allocate<BilinearPatch>(num_patches);
+    auto shapes = allocator.allocate<Shape>(num_patches);
+
+    init_bilinear_patches<<<divide_and_ceil(num_patches, threads), threads>>>(shapes, patches,
+                                                                              mesh);
+    CHECK_CUDA_ERROR(cudaGetLastError());
+    CHECK_CUDA_ERROR(cudaDeviceSynchronize());
+
+    return {shapes, num_patches};
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pbrt/euclidean_space/transform.h>
+#include <vector>
+
+class GPUMemoryAllocator;
+class Shape;
+struct MeshStats;
+
+class BilinearPatchMesh {
+  public:
+    uint patches_num = 0;
+
+    const int *vertex_indices;
+    // 4 per patch, in the order p00, p10, p01, p11
+    const Point3f *p;
+    const Normal3f *n;
+    const Point2f *uv;
+
+    bool reverse_orientation;
+    bool transform_swaps_handedness;
+
+    static const BilinearPatchMesh *build_mesh(const Transform &render_from_object,
+                                               bool reverse_orientation,
+                                               const std::vector<Point3f> &points,
+                                               const std::vector<int> &indices,
+                                               const std::vector<Normal3f> &normals,
+                                               const std::vector<Point2f> &uv,
+                                               const BilinearPatchMesh *same_topology,
+                                               MeshStats *stats, GPUMemoryAllocator &allocator);
+    // same_topology and stats: see TriangleMesh::build_mesh()
+
+    static std::pair<const Shape *, uint> build_patches(const BilinearPatchMesh *mesh,
+                                                        GPUMemoryAllocator &allocator);
+    // one BilinearPatch and Shape per patch: only needed by what samples them (area lights)
+
+    PBRT_CPU_GPU
+    void init(bool _reverse_orientation, bool _transform_swaps_handedness,
+              const int *_vertex_indices, uint num_indices, const Point3f *_p, const Normal3f *_n,
+              const Point2f *_uv) {
+        reverse_orientation = _reverse_orientation;
+        transform_swaps_handedness = _transform_swaps_handedness;
+
+        patches_num = num_indices / 4;
+        vertex_indices = _vertex_indices;
+        p = _p;
+        n = _n;
+        uv = _uv;
+    }
+};
@@ -0,0 +1,597 @@
+#include <pbrt/shapes/ply_reader.h>
+#include <pbrt/shapes/tri_quad_mesh.h>
+#include <pbrt/util/thread_pool.h>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+enum class PLYType {
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Float32,
+    Float64,
+};
+
+struct PLYProperty {
+    std::string name;
+    PLYType type;
+
+    bool is_list;
+    PLYType count_type;
+    // for lists: the type of the leading count, type is the type of the values
+};
+
+struct PLYElement {
+    std::string name;
+    size_t count;
+    std::vector<PLYProperty> properties;
+};
+
+struct VertexColumn {
+    size_t offset;
+    PLYType type;
+
+    FloatType *output;
+    size_t output_stride;
+};
+
+constexpr size_t PARALLEL_SIZE = 1024 * 1024;
+// vertices or faces below this are decoded on the calling thread
+
+class MappedFile {
+  public:
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string &filename) {
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+            close(fd);
+            return;
+        }
+
+        void *mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return;
+        }
+
+        // decoded once front to back
+        madvise(mapped, file_stat.st_size, MADV_SEQUENTIAL);
+
+        data = static_cast<const uint8_t *>(mapped);
+        size = file_stat.st_size;
+    }
+
+    ~MappedFile() {
+        if (data != nullptr) {
+            munmap(const_cast<uint8_t *>(data), size);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+};
+
+std::optional<PLYType> parse_type(const std::string &name) {
+    if (name == "char" || name == "int8") {
+        return PLYType::Int8;
+    }
+    if (name == "uchar" || name == "uint8") {
+        return PLYType::UInt8;
+    }
+    if (name == "short" || name == "int16") {
+        return PLYType::Int16;
+    }
+    if (name == "ushort" || name == "uint16") {
+        return PLYType::UInt16;
+    }
+    if (name == "int" || name == "int32") {
+        return PLYType::Int32;
+    }
+    if (name == "uint" || name == "uint32") {
+        return PLYType::UInt32;
+    }
+    if (name == "float" || name == "float32") {
+        return PLYType::Float32;
+    }
+    if (name == "double" || name == "float64") {
+        return PLYType::Float64;
+    }
+
+    return {};
+}
+
+template <typename Function>
+auto dispatch(PLYType type, Function function) {
+    // calls function() with a value of the C++ type matching type
+    switch (type) {
+    case PLYType::Int8: {
+        return function(int8_t{});
+    }
+    case PLYType::UInt8: {
+        return function(uint8_t{});
+    }
+    case PLYType::Int16: {
+        return function(int16_t{});
+    }
+    case PLYType::UInt16: {
+        return function(uint16_t{});
+    }
+    case PLYType::Int32: {
+        return function(int32_t{});
+    }
+    case PLYType::UInt32: {
+        return function(uint32_t{});
+    }
+    case PLYType::Float32: {
+        return function(float{});
+    }
+    default: {
+        return function(double{});
+    }
+    }
+}
+
+size_t type_size(PLYType type) {
+    return dispatch(type, [](auto value) { return sizeof(value); });
+}
+
+template <typename T>
+T load(const uint8_t *ptr) {
+    // records are packed: values aren't aligned
+    T value;
+    memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+
+long long load_integer(PLYType type, const uint8_t *ptr) {
+    return dispatch(type, [ptr](auto value) {
+        return static_cast<long long>(load<decltype(value)>(ptr));
+    });
+}
+
+bool parse_header(std::string_view text, std::vector<PLYElement> &elements,
+                  size_t &data_offset) {
+    // false unless the file is binary little-endian and every property type is known
+    const auto header_end = text.find("end_header");
+    if (text.substr(0, 3) != "ply" || header_end == std::string_view::npos) {
+        return false;
+    }
+
+    const auto line_end = text.find('\n', header_end);
+    if (line_end == std::string_view::npos) {
+        return false;
+    }
+    data_offset = line_end + 1;
+
+    std::istringstream header{std::string(text.substr(0, header_end))};
+    std::string line;
+    bool binary_little_endian = false;
+    while (std::getline(header, line)) {
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+
+        if (keyword == "format") {
+            std::string format;
+            words >> format;
+            binary_little_endian = format == "binary_little_endian";
+            continue;
+        }
+
+        if (keyword == "element") {
+            PLYElement element;
+            words >> element.name >> element.count;
+            if (words.fail()) {
+                return false;
+            }
+
+            elements.push_back(element);
+            continue;
+        }
+
+        if (keyword == "property") {
+            if (elements.empty()) {
+                return false;
+            }
+
+            std::string type_name;
+            words >> type_name;
+
+            PLYProperty property{};
+            if (type_name == "list") {
+                std::string count_type_name;
+                std::string value_type_name;
+                words >> count_type_name >> value_type_name >> property.name;
+
+                const auto count_type = parse_type(count_type_name);
+                const auto value_type = parse_type(value_type_name);
+                if (!count_type || !value_type) {
+                    return false;
+                }
+
+                property.is_list = true;
+                property.count_type = *count_type;
+                property.type = *value_type;
+            } else {
+                words >> property.name;
+
+                const auto type = parse_type(type_name);
+                if (!type) {
+                    return false;
+                }
+
+                property.is_list = false;
+                property.type = *type;
+            }
+
+            if (words.fail()) {
+                return false;
+            }
+
+            elements.back().properties.push_back(property);
+        }
+
+        // "ply", comment and obj_info lines carry nothing to decode
+    }
+
+    return binary_little_endian;
+}
+
+std::optional<size_t> get_record_size(const PLYElement &element) {
+    // nothing if the records have a list
+    size_t size = 0;
+    for (const auto &property : element.properties) {
+        if (property.is_list) {
+            return {};
+        }
+        size += type_size(property.type);
+    }
+
+    return size;
+}
+
+std::optional<VertexColumn> find_column(const PLYElement &element, const std::string &name) {
+    size_t offset = 0;
+    for (const auto &property : element.properties) {
+        if (property.name == name) {
+            return VertexColumn{
+                .offset = offset,
+                .type = property.type,
+                .output = nullptr,
+                .output_stride = 0,
+            };
+        }
+        offset += type_size(property.type);
+    }
+
+    return {};
+}
+
+void run(ThreadPool *thread_pool, size_t count,
+         const std::function<void(size_t, size_t)> &function) {
+    // on the thread pool if there is one
+    if (thread_pool == nullptr) {
+        function(0, count);
+        return;
+    }
+
+    thread_pool->parallel_for(0, count,
+                              [&](const uint start, const uint end) { function(start, end); });
+}
+
+bool read_vertices(const PLYElement &element, const uint8_t *data, TriQuadMesh &mesh,
+                   ThreadPool *thread_pool) {
+    const auto record_size = get_record_size(element);
+    if (!record_size) {
+        return false;
+    }
+
+    std::vector<VertexColumn> columns;
+    const auto add_columns = [&](const std::vector<std::string> &names, FloatType *output) {
+        // all of them or none
+        std::vector<VertexColumn> found;
+        for (uint idx = 0; idx < names.size(); ++idx) {
+            auto column = find_column(element, names[idx]);
+            if (!column) {
+                return false;
+            }
+
+            column->output = output + idx;
+            column->output_stride = names.size();
+            found.push_back(*column);
+        }
+
+        columns.insert(columns.end(), found.begin(), found.end());
+        return true;
+    };
+
+    mesh.p.resize(element.count);
+    if (!add_columns({"x", "y", "z"}, &mesh.p.data()->x)) {
+        // let rply report it
+        return false;
+    }
+
+    mesh.n.resize(element.count);
+    if (!add_columns({"nx", "ny", "nz"}, &mesh.n.data()->x)) {
+        mesh.n.resize(0);
+    }
+
+    // there seem to be lots of different conventions regarding UV coordinate names
+    mesh.uv.resize(element.count);
+    if (!add_columns({"u", "v"}, &mesh.uv.data()->x) &&
+        !add_columns({"s", "t"}, &mesh.uv.data()->x) &&
+        !add_columns({"texture_u", "texture_v"}, &mesh.uv.data()->x) &&
+        !add_columns({"texture_s", "texture_t"}, &mesh.uv.data()->x)) {
+        mesh.uv.resize(0);
+    }
+
+    run(thread_pool, element.count, [&](const size_t start, const size_t end) {
+        // column by column: the type switch is out of the loop
+        for (const auto &column : columns) {
+            dispatch(column.type, [&](auto value) {
+                using T = decltype(value);
+
+                const uint8_t *records = data + column.offset;
+                for (size_t idx = start; idx < end; ++idx) {
+                    column.output[idx * column.output_stride] =
+                        FloatType(load<T>(records + idx * *record_size));
+                }
+            });
+        }
+    });
+
+    return true;
+}
+
+template <uint N, typename T>
+void decode_faces(const uint8_t *first_index, size_t record_size, size_t start, size_t end,
+                  int *output) {
+    // quads are specified as bilinear patches: vertices 0, 1, 3, 2
+    constexpr uint order[4] = {0, 1, N == 4 ? 3 : 2, 2};
+
+    for (size_t face = start; face < end; ++face) {
+        const uint8_t *indices = first_index + face * record_size;
+        for (uint k = 0; k < N; ++k) {
+            output[face * N + k] = int(load<T>(indices + order[k] * sizeof(T)));
+        }
+    }
+}
+
+std::optional<const uint8_t *> read_faces(const PLYElement &element, const uint8_t *data,
+                                          const uint8_t *data_end, TriQuadMesh &mesh,
+                                          ThreadPool *thread_pool) {
+    // the end of the face records, nothing for layouts left to rply
+    const PLYProperty *vertex_indices = nullptr;
+    size_t prefix_size = 0;
+    size_t suffix_size = 0;
+
+    std::optional<size_t> face_index_offset;
+    bool face_index_after_list = false;
+    PLYType face_index_type = PLYType::Int32;
+
+    for (const auto &property : element.properties) {
+        if (property.is_list) {
+            if (property.name != "vertex_indices" || vertex_indices != nullptr) {
+                return {};
+            }
+            vertex_indices = &property;
+            continue;
+        }
+
+        auto &size = vertex_indices == nullptr ? prefix_size : suffix_size;
+        if (property.name == "face_indices") {
+            face_index_offset = size;
+            face_index_after_list = vertex_indices != nullptr;
+            face_index_type = property.type;
+        }
+        size += type_size(property.type);
+    }
+
+    if (vertex_indices == nullptr) {
+        return {};
+    }
+
+    const size_t count_size = type_size(vertex_indices->count_type);
+    const size_t index_size = type_size(vertex_indices->type);
+    const size_t num_faces = element.count;
+
+    const auto get_face_index = [&](const uint8_t *record, long long vertex_count) {
+        const size_t offset =
+            face_index_after_list
+                ? prefix_size + count_size + vertex_count * index_size + *face_index_offset
+                : *face_index_offset;
+        return int(load_integer(face_index_type, record + offset));
+    };
+
+    // fast path: every face has as many vertices as the first one, records have a fixed size
+    const long long first_count = num_faces > 0 && data + prefix_size + count_size <= data_end
+                                      ? load_integer(vertex_indices->count_type, data + prefix_size)
+                                      : 0;
+    if (first_count == 3 || first_count == 4) {
+        const size_t record_size =
+            prefix_size + count_size + first_count * index_size + suffix_size;
+
+        std::atomic<bool> fixed_size = size_t(data_end - data) / record_size >= num_faces;
+        if (fixed_size) {
+            run(thread_pool, num_faces, [&](const size_t start, const size_t end) {
+                for (size_t face = start; face < end && fixed_size; ++face) {
+                    const uint8_t *count = data + face * record_size + prefix_size;
+                    if (load_integer(vertex_indices->count_type, count) != first_count) {
+                        fixed_size = false;
+                    }
+                }
+            });
+        }
+
+        if (fixed_size) {
+            auto &indices = first_count == 3 ? mesh.triIndices : mesh.quadIndices;
+            indices.resize(num_faces * first_count);
+            if (face_index_offset) {
+                mesh.faceIndices.resize(num_faces);
+            }
+
+            const uint8_t *first_index = data + prefix_size + count_size;
+            run(thread_pool, num_faces, [&](const size_t start, const size_t end) {
+                dispatch(vertex_indices->type, [&](auto value) {
+                    using T = decltype(value);
+
+                    if (first_count == 3) {
+                        decode_faces<3, T>(first_index, record_size, start, end, indices.data());
+                    } else {
+                        decode_faces<4, T>(first_index, record_size, start, end, indices.data());
+                    }
+                });
+
+                if (face_index_offset) {
+                    for (size_t face = start; face < end; ++face) {
+                        mesh.faceIndices[face] =
+                            get_face_index(data + face * record_size, first_count);
+                    }
+                }
+            });
+
+            return data + num_faces * record_size;
+        }
+    }
+
+    // mixed triangles and quads: walk the records one after another
+    mesh.triIndices.reserve(num_faces * 3);
+    mesh.quadIndices.reserve(num_faces * 4);
+    if (face_index_offset) {
+        mesh.faceIndices.reserve(num_faces);
+    }
+
+    size_t ignored_faces = 0;
+    const uint8_t *record = data;
+    for (size_t face = 0; face < num_faces; ++face) {
+        if (size_t(data_end - record) < prefix_size + count_size) {
+            return {};
+        }
+
+        const auto vertex_count = load_integer(vertex_indices->count_type, record + prefix_size);
+        const uint8_t *first_index = record + prefix_size + count_size;
+        if (vertex_count < 0 ||
+            size_t(data_end - first_index) < vertex_count * index_size + suffix_size) {
+            return {};
+        }
+
+        const auto get_index = [&](uint k) {
+            return int(load_integer(vertex_indices->type, first_index + k * index_size));
+        };
+
+        if (vertex_count == 3) {
+            for (uint k = 0; k < 3; ++k) {
+                mesh.triIndices.push_back(get_index(k));
+            }
+        } else if (vertex_count == 4) {
+            // modify order since we're specifying it as a blp
+            for (const uint k : {0, 1, 3, 2}) {
+                mesh.quadIndices.push_back(get_index(k));
+            }
+        } else {
+            ignored_faces += 1;
+        }
+
+        // only for the faces kept, in the order they were read
+        if (face_index_offset && (vertex_count == 3 || vertex_count == 4)) {
+            mesh.faceIndices.push_back(get_face_index(record, vertex_count));
+        }
+
+        record = first_index + vertex_count * index_size + suffix_size;
+    }
+
+    if (ignored_faces > 0) {
+        printf("plymesh: ignoring %zu faces that are neither triangles nor quads\n",
+               ignored_faces);
+    }
+
+    return record;
+}
+} // namespace
+
+std::optional<TriQuadMesh> BinaryPLYReader::read(const std::string &filename,
+                                                  ThreadPool *thread_pool) {
+    if constexpr (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__) {
+        return {};
+    }
+
+    const MappedFile file(filename);
+    if (file.data == nullptr) {
+        return {};
+    }
+
+    std::vector<PLYElement> elements;
+    size_t data_offset = 0;
+    const std::string_view text(reinterpret_cast<const char *>(file.data), file.size);
+    if (!parse_header(text, elements, data_offset)) {
+        return {};
+    }
+
+    const PLYElement *vertex_element = nullptr;
+    const PLYElement *face_element = nullptr;
+    for (const auto &element : elements) {
+        if (element.name == "vertex") {
+            vertex_element = &element;
+        } else if (element.name == "face") {
+            face_element = &element;
+        }
+    }
+
+    if (vertex_element == nullptr || face_element == nullptr || vertex_element->count == 0 ||
+        face_element->count == 0) {
+        return {};
+    }
+
+    if (std::max(vertex_element->count, face_element->count) < PARALLEL_SIZE) {
+        thread_pool = nullptr;
+    }
+
+    TriQuadMesh mesh;
+    const uint8_t *data = file.data + data_offset;
+    const uint8_t *data_end = file.data + file.size;
+    for (const auto &element : elements) {
+        if (&element == face_element) {
+            const auto face_end = read_faces(element, data, data_end, mesh, thread_pool);
+            if (!face_end) {
+                return {};
+            }
+
+            data = *face_end;
+            continue;
+        }
+
+        // other elements are skipped, they can only be when their records have a fixed size
+        const auto record_size = get_record_size(element);
+        if (!record_size || size_t(data_end - data) / std::max<size_t>(*record_size, 1) <
+                                element.count) {
+            return {};
+        }
+
+        if (&element == vertex_element &&
+            !read_vertices(element, data, mesh, thread_pool)) {
+            return {};
+        }
+
+        data += element.count * *record_size;
+    }
+
+    return mesh;
+}
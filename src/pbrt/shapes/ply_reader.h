@@ -0,0 +1,18 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+class ThreadPool;
+struct TriQuadMesh;
+
+class BinaryPLYReader {
+    // decodes binary little-endian PLY files from a memory mapping: the header gives the record
+    // layout, vertex properties are copied column by column and faces with the same vertex count
+    // are decoded as fixed-size records, all without a callback per value
+
+  public:
+    static std::optional<TriQuadMesh> read(const std::string &filename, ThreadPool *thread_pool);
+    // nothing for ASCII or big-endian files and layouts it doesn't handle: those are left to rply
+    // thread_pool: large files are decoded on it, nullptr to stay on the calling thread
+};
@@ -46,6 +46,22 @@ class Sphere {
         return ShapeIntersection{intr, isect->t_hit};
     }
 
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeHit> intersect_hit(const Ray &ray, FloatType t_max) const {
+        auto isect = basic_intersect(ray, t_max);
+        if (!isect) {
+            return {};
+        }
+
+        return ShapeHit{.t_hit = isect->t_hit, .coordinates = isect->p_obj, .phi = isect->phi};
+    }
+
+    PBRT_CPU_GPU
+    SurfaceInteraction compute_surface_interaction(const ShapeHit &hit, const Ray &ray) const {
+        const QuadricIntersection isect{hit.t_hit, hit.coordinates, hit.phi};
+        return interaction_from_intersection(isect, -ray.d);
+    }
+
     PBRT_CPU_GPU
     pbrt::optional<ShapeSample> sample(const Point2f &u) const;
 
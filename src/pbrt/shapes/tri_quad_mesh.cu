@@ -1,3 +1,4 @@
+#include <pbrt/shapes/ply_reader.h>
 #include <pbrt/shapes/tri_quad_mesh.h>
 
 struct FaceCallbackContext {
@@ -73,7 +74,8 @@ int rply_faceindex_callback(p_ply_argument argument) {
     return 1;
 }
 
-TriQuadMesh TriQuadMesh::read_ply(const std::string &filename) {
+static TriQuadMesh read_ply_with_rply(const std::string &filename) {
+    // one callback per value: for ASCII files and layouts BinaryPLYReader leaves out
     TriQuadMesh mesh;
 
     p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
@@ -167,6 +169,13 @@ TriQuadMesh TriQuadMesh::read_ply(const std::string &filename) {
 
     ply_close(ply);
 
+    return mesh;
+}
+
+TriQuadMesh TriQuadMesh::read_ply(const std::string &filename, ThreadPool *thread_pool) {
+    auto binary_mesh = BinaryPLYReader::read(filename, thread_pool);
+    TriQuadMesh mesh = binary_mesh ? std::move(*binary_mesh) : read_ply_with_rply(filename);
+
     for (int idx : mesh.triIndices) {
         if (idx < 0 || idx >= mesh.p.size()) {
             printf("plymesh: Vertex index %d is out of bounds! "
@@ -7,6 +7,8 @@
 #include <pbrt/gpu/macro.h>
 #include <vector>
 
+class ThreadPool;
+
 struct TriQuadMesh {
     std::vector<Point3f> p;
     std::vector<Normal3f> n;
@@ -15,5 +17,6 @@ struct TriQuadMesh {
     std::vector<int> triIndices;
     std::vector<int> quadIndices;
 
-    static TriQuadMesh read_ply(const std::string &filename);
+    static TriQuadMesh read_ply(const std::string &filename, ThreadPool *thread_pool = nullptr);
+    // thread_pool: see BinaryPLYReader::read()
 };
@@ -4,17 +4,41 @@
 
 PBRT_CPU_GPU
 pbrt::optional<ShapeIntersection> Triangle::intersect(const Ray &ray, FloatType t_max) const {
+    auto hit = intersect_hit(ray, RayPrecomputation(ray), t_max);
+    if (!hit) {
+        return {};
+    }
+
+    return ShapeIntersection(compute_surface_interaction(hit.value(), ray), hit->t_hit);
+}
+
+PBRT_CPU_GPU
+pbrt::optional<ShapeHit> Triangle::intersect_hit(const Ray &ray,
+                                                 const RayPrecomputation &ray_precomputation,
+                                                 FloatType t_max) const {
     Point3f points[3];
     get_points(points);
 
-    auto tri_intersection = intersect_triangle(ray, t_max, points[0], points[1], points[2]);
+    auto tri_intersection =
+        intersect_triangle(ray, ray_precomputation, t_max, points[0], points[1], points[2]);
     if (!tri_intersection) {
         return {};
     }
 
-    SurfaceInteraction si = interaction_from_intersection(tri_intersection.value(), -ray.d);
+    return ShapeHit{
+        .t_hit = tri_intersection->t,
+        .coordinates = Point3f(tri_intersection->b0, tri_intersection->b1, tri_intersection->b2),
+        .phi = 0,
+    };
+}
 
-    return ShapeIntersection(si, tri_intersection->t);
+PBRT_CPU_GPU
+SurfaceInteraction Triangle::compute_surface_interaction(const ShapeHit &hit,
+                                                         const Ray &ray) const {
+    const TriangleIntersection tri_intersection(hit.coordinates.x, hit.coordinates.y,
+                                                hit.coordinates.z, hit.t_hit);
+
+    return interaction_from_intersection(tri_intersection, -ray.d);
 }
 
 PBRT_CPU_GPU
@@ -50,7 +74,7 @@ FloatType Triangle::pdf(const ShapeSampleContext &ctx, const Vector3f &wi) const
         const int *v = &mesh->vertexIndices[3 * triIndex];
 
 
-        Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+        Point3f p0 = mesh->get_point(v[0]), p1 = mesh->get_point(v[1]), p2 = mesh->get_point(v[2]);
         */
         Point3f points[3];
         get_points(points);
@@ -78,9 +102,9 @@ FloatType Triangle::pdf(const ShapeSampleContext &ctx, const Vector3f &wi) const
 PBRT_CPU_GPU
 pbrt::optional<ShapeSample> Triangle::sample(Point2f u) const {
     const int *v = &(mesh->vertex_indices[3 * triangle_idx]);
-    const Point3f p0 = mesh->p[v[0]];
-    const Point3f p1 = mesh->p[v[1]];
-    const Point3f p2 = mesh->p[v[2]];
+    const Point3f p0 = mesh->get_point(v[0]);
+    const Point3f p1 = mesh->get_point(v[1]);
+    const Point3f p2 = mesh->get_point(v[2]);
 
     FloatType b[3];
     sample_uniform_triangle(b, u);
@@ -90,9 +114,9 @@ pbrt::optional<ShapeSample> Triangle::sample(Point2f u) const {
     // Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
     Normal3f n = Normal3f((p1 - p0).cross(p2 - p0).normalize());
 
-    if (mesh->n) {
-        Normal3f ns =
-            (b[0] * mesh->n[v[0]] + b[1] * mesh->n[v[1]] + (1 - b[0] - b[1]) * mesh->n[v[2]]);
+    if (mesh->has_normals()) {
+        Normal3f ns = (b[0] * mesh->get_normal(v[0]) + b[1] * mesh->get_normal(v[1]) +
+                       (1 - b[0] - b[1]) * mesh->get_normal(v[2]));
         n = n.face_forward(ns);
     } else if ((mesh->reverse_orientation ^ mesh->transformSwapsHandedness)) {
         // this part not implemented
@@ -100,9 +124,9 @@ pbrt::optional<ShapeSample> Triangle::sample(Point2f u) const {
     }
 
     Point2f uv[3];
-    if (mesh->uv) {
+    if (mesh->has_uv()) {
         for (uint idx = 0; idx < 3; ++idx) {
-            uv[idx] = mesh->uv[v[idx]];
+            uv[idx] = mesh->get_uv(v[idx]);
         }
     } else {
         uv[0] = Point2f(0, 0);
@@ -187,19 +211,19 @@ pbrt::optional<ShapeSample> Triangle::sample(const ShapeSampleContext &ctx, Poin
     // Compute surface normal for sampled point on triangle
     Normal3f n = Normal3f((p1 - p0).cross(p2 - p0).normalize());
 
-    if (mesh->n) {
-        Normal3f ns(b[0] * mesh->n[v[0]] + b[1] * mesh->n[v[1]] +
-                    (1 - b[0] - b[1]) * mesh->n[v[2]]);
+    if (mesh->has_normals()) {
+        Normal3f ns(b[0] * mesh->get_normal(v[0]) + b[1] * mesh->get_normal(v[1]) +
+                    (1 - b[0] - b[1]) * mesh->get_normal(v[2]));
         n = n.face_forward(ns);
     } else if (mesh->reverse_orientation ^ mesh->transformSwapsHandedness) {
         n *= -1;
     }
 
     Point2f uv[3];
-    if (mesh->uv) {
-        uv[0] = mesh->uv[v[0]];
-        uv[1] = mesh->uv[v[1]];
-        uv[2] = mesh->uv[v[2]];
+    if (mesh->has_uv()) {
+        uv[0] = mesh->get_uv(v[0]);
+        uv[1] = mesh->get_uv(v[1]);
+        uv[2] = mesh->get_uv(v[2]);
     } else {
         uv[0] = Point2f(0, 0);
         uv[1] = Point2f(1, 0);
@@ -216,133 +240,45 @@ pbrt::optional<ShapeSample> Triangle::sample(const ShapeSampleContext &ctx, Poin
 
 PBRT_CPU_GPU
 pbrt::optional<Triangle::TriangleIntersection>
-Triangle::intersect_triangle(const Ray &ray, FloatType t_max, const Point3f &p0, const Point3f &p1,
+Triangle::intersect_triangle(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                             FloatType t_max, const Point3f &p0, const Point3f &p1,
                              const Point3f &p2) const {
     // Return no intersection if triangle is degenerate
     if ((p2 - p0).cross(p1 - p0).squared_length() == 0.0) {
         return {};
     }
 
-    // Transform triangle vertices to ray coordinate space
-    // Translate vertices based on ray origin
-    Point3f p0t = p0 - ray.o.to_vector3();
-    Point3f p1t = p1 - ray.o.to_vector3();
-    Point3f p2t = p2 - ray.o.to_vector3();
-
-    // Permute components of triangle vertices and ray direction
-    uint8_t kz = ray.d.abs().max_component_index();
-    uint8_t kx = (kz + 1) % 3;
-    uint8_t ky = (kz + 2) % 3;
-
-    uint8_t permuted_idx[3] = {kx, ky, kz};
-    Vector3f d = ray.d.permute(permuted_idx);
-
-    p0t = p0t.permute(permuted_idx);
-    p1t = p1t.permute(permuted_idx);
-    p2t = p2t.permute(permuted_idx);
-
-    // Apply shear transformation to translated vertex positions
-    FloatType Sx = -d.x / d.z;
-    FloatType Sy = -d.y / d.z;
-    FloatType Sz = 1 / d.z;
-    p0t.x += Sx * p0t.z;
-    p0t.y += Sy * p0t.z;
-    p1t.x += Sx * p1t.z;
-    p1t.y += Sy * p1t.z;
-    p2t.x += Sx * p2t.z;
-    p2t.y += Sy * p2t.z;
-
-    // Compute edge function coefficients _e0_, _e1_, and _e2_
-    FloatType e0 = difference_of_products(p1t.x, p2t.y, p1t.y, p2t.x);
-    FloatType e1 = difference_of_products(p2t.x, p0t.y, p2t.y, p0t.x);
-    FloatType e2 = difference_of_products(p0t.x, p1t.y, p0t.y, p1t.x);
-
-    // Fall back to double-precision test at triangle edges
-    if (sizeof(FloatType) == sizeof(float) && (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)) {
-        double p2txp1ty = (double)p2t.x * (double)p1t.y;
-        double p2typ1tx = (double)p2t.y * (double)p1t.x;
-        e0 = (FloatType)(p2typ1tx - p2txp1ty);
-        double p0txp2ty = (double)p0t.x * (double)p2t.y;
-        double p0typ2tx = (double)p0t.y * (double)p2t.x;
-        e1 = (FloatType)(p0typ2tx - p0txp2ty);
-        double p1txp0ty = (double)p1t.x * (double)p0t.y;
-        double p1typ0tx = (double)p1t.y * (double)p0t.x;
-        e2 = (FloatType)(p1typ0tx - p1txp0ty);
-    }
-
-    // Perform triangle edge and determinant tests
-    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0)) {
-        return {};
-    }
-
-    FloatType det = e0 + e1 + e2;
-    if (det == 0) {
-        return {};
-    }
-
-    // Compute scaled hit distance to triangle and test against ray $t$ range
-    p0t.z *= Sz;
-    p1t.z *= Sz;
-    p2t.z *= Sz;
-    FloatType tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
-    if (det < 0 && (tScaled >= 0 || tScaled < t_max * det)) {
-        return {};
-    }
-
-    if (det > 0 && (tScaled <= 0 || tScaled > t_max * det)) {
-        return {};
-    }
-
-    // Compute barycentric coordinates and $t$ value for triangle intersection
-    FloatType invDet = 1 / det;
-    FloatType b0 = e0 * invDet, b1 = e1 * invDet, b2 = e2 * invDet;
-    FloatType t = tScaled * invDet;
-
-    // Ensure that computed triangle $t$ is conservatively greater than zero
-    // Compute $\delta_z$ term for triangle $t$ error bounds
-    // FloatType maxZt = MaxComponentValue(Abs(Vector3f(p0t.z, p1t.z, p2t.z)));
-
-    FloatType maxZt = Vector3f(p0t.z, p1t.z, p2t.z).abs().max_component_value();
-    FloatType deltaZ = gamma(3) * maxZt;
-
-    // Compute $\delta_x$ and $\delta_y$ terms for triangle $t$ error bounds
-    FloatType maxXt = Vector3f(p0t.x, p1t.x, p2t.x).abs().max_component_value();
-    FloatType maxYt = Vector3f(p0t.y, p1t.y, p2t.y).abs().max_component_value();
-
-    FloatType deltaX = gamma(5) * (maxXt + maxZt);
-    FloatType deltaY = gamma(5) * (maxYt + maxZt);
-
-    // Compute $\delta_e$ term for triangle $t$ error bounds
-    FloatType deltaE = 2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+    const FloatType p[3][3][1] = {
+        {{p0.x}, {p0.y}, {p0.z}},
+        {{p1.x}, {p1.y}, {p1.z}},
+        {{p2.x}, {p2.y}, {p2.z}},
+    };
 
-    // Compute $\delta_t$ term for triangle $t$ error bounds and check _t_
-    FloatType maxE = Vector3f(e0, e1, e2).abs().max_component_value();
-    FloatType deltaT =
-        3 * (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) * std::abs(invDet);
-    if (t <= deltaT) {
+    FloatType t[1];
+    FloatType b[3][1];
+    if (intersect_triangles<1>(ray, ray_precomputation, t_max, p, t, b) == 0) {
         return {};
     }
 
-    // Return _TriangleIntersection_ for intersection
-    return TriangleIntersection(b0, b1, b2, t);
+    return TriangleIntersection(b[0][0], b[1][0], b[2][0], t[0]);
 }
 
 PBRT_CPU_GPU
 SurfaceInteraction Triangle::interaction_from_intersection(const TriangleIntersection &ti,
                                                            const Vector3f &wo) const {
     const int *v = &(mesh->vertex_indices[3 * triangle_idx]);
-    const Point3f p0 = mesh->p[v[0]];
-    const Point3f p1 = mesh->p[v[1]];
-    const Point3f p2 = mesh->p[v[2]];
+    const Point3f p0 = mesh->get_point(v[0]);
+    const Point3f p1 = mesh->get_point(v[1]);
+    const Point3f p2 = mesh->get_point(v[2]);
 
     // Compute triangle partial derivatives
     // Compute deltas and matrix determinant for triangle partial derivatives
     // Get triangle texture coordinates in _uv_ array
 
     Point2f uv[3];
-    if (mesh->uv) {
+    if (mesh->has_uv()) {
         for (uint idx = 0; idx < 3; ++idx) {
-            uv[idx] = mesh->uv[v[idx]];
+            uv[idx] = mesh->get_uv(v[idx]);
         }
     } else {
         uv[0] = Point2f(0, 0);
@@ -395,12 +331,20 @@ SurfaceInteraction Triangle::interaction_from_intersection(const TriangleInterse
         isect.n = isect.shading.n = -isect.n;
     }
 
-    if (mesh->n || mesh->s) {
+    if (mesh->has_normals() || mesh->s) {
+        // decoded once: they may be stored compressed
+        Normal3f n[3];
+        if (mesh->has_normals()) {
+            for (uint idx = 0; idx < 3; ++idx) {
+                n[idx] = mesh->get_normal(v[idx]);
+            }
+        }
+
         // Initialize _Triangle_ shading geometry
         // Compute shading normal _ns_ for triangle
         Normal3f ns;
-        if (mesh->n) {
-            ns = ti.b0 * mesh->n[v[0]] + ti.b1 * mesh->n[v[1]] + ti.b2 * mesh->n[v[2]];
+        if (mesh->has_normals()) {
+            ns = ti.b0 * n[0] + ti.b1 * n[1] + ti.b2 * n[2];
             ns = ns.squared_length() > 0 ? ns.normalize() : isect.n;
         } else {
             ns = isect.n;
@@ -427,12 +371,12 @@ SurfaceInteraction Triangle::interaction_from_intersection(const TriangleInterse
 
         // Compute $\dndu$ and $\dndv$ for triangle shading geometry
         Normal3f dndu, dndv;
-        if (mesh->n) {
+        if (mesh->has_normals()) {
             // Compute deltas for triangle partial derivatives of normal
             Vector2f duv02 = uv[0] - uv[2];
             Vector2f duv12 = uv[1] - uv[2];
-            Normal3f dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-            Normal3f dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+            Normal3f dn1 = n[0] - n[2];
+            Normal3f dn2 = n[1] - n[2];
 
             auto determinant = difference_of_products(duv02[0], duv12[1], duv02[1], duv12[0]);
             bool degenerateUV = std::abs(determinant) < 1e-9;
@@ -444,7 +388,7 @@ SurfaceInteraction Triangle::interaction_from_intersection(const TriangleInterse
                 // rays reflected from triangles with degenerate
                 // parameterizations are still reasonable.
 
-                auto dn = (mesh->n[v[2]] - mesh->n[v[0]]).cross(mesh->n[v[1]] - mesh->n[v[0]]);
+                auto dn = (n[2] - n[0]).cross(n[1] - n[0]);
 
                 if (dn.squared_length() == 0) {
                     dndu = dndv = Normal3f(0, 0, 0);
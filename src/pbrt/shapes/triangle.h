@@ -12,6 +12,8 @@ struct ShapeIntersection;
 
 class Triangle {
   public:
+    using Mesh = TriangleMesh;
+
     struct TriangleIntersection {
         FloatType b0, b1, b2;
         FloatType t;
@@ -26,12 +28,137 @@ class Triangle {
         return std::abs(2.0 * std::atan2(a.dot(b.cross(c)), 1 + a.dot(b) + a.dot(c) + b.dot(c)));
     }
 
+    template <uint WIDTH>
+    PBRT_CPU_GPU static uint intersect_triangles(const Ray &ray,
+                                                 const RayPrecomputation &ray_precomputation,
+                                                 FloatType t_max, const FloatType p[3][3][WIDTH],
+                                                 FloatType t_hit[WIDTH], FloatType b[3][WIDTH]) {
+        // watertight test of WIDTH triangles in SoA layout: p[vertex][axis][lane]
+        // returns a bit mask of the lanes hit, t_hit is infinite for the others
+        // (barycentrics are only meaningful for lanes hit)
+        // every lane goes through the same instructions, results are selected at the end:
+        // a single triangle is tested as WIDTH = 1, so both agree bit for bit
+
+        // components permuted so that z is the largest one of ray direction, sheared along it
+        const uint8_t kx = ray_precomputation.kx;
+        const uint8_t ky = ray_precomputation.ky;
+        const uint8_t kz = ray_precomputation.kz;
+
+        const FloatType Sx = ray_precomputation.shear_x;
+        const FloatType Sy = ray_precomputation.shear_y;
+        const FloatType Sz = ray_precomputation.shear_z;
+
+        // read once: indexing a point by a variable axis is a switch
+        const FloatType ox = ray.o[kx];
+        const FloatType oy = ray.o[ky];
+        const FloatType oz = ray.o[kz];
+
+        // results are kept local until all lanes are done: t_hit and b could alias p otherwise
+        FloatType lane_t[WIDTH];
+        FloatType lane_b[3][WIDTH];
+
+        uint hit_mask = 0;
+        for (uint lane = 0; lane < WIDTH; ++lane) {
+            // transform triangle vertices to ray coordinate space
+            FloatType x[3];
+            FloatType y[3];
+            FloatType z[3];
+            for (uint vertex = 0; vertex < 3; ++vertex) {
+                x[vertex] = p[vertex][kx][lane] - ox;
+                y[vertex] = p[vertex][ky][lane] - oy;
+                z[vertex] = p[vertex][kz][lane] - oz;
+
+                x[vertex] += Sx * z[vertex];
+                y[vertex] += Sy * z[vertex];
+            }
+
+            FloatType e0 = difference_of_products(x[1], y[2], y[1], x[2]);
+            FloatType e1 = difference_of_products(x[2], y[0], y[2], x[0]);
+            FloatType e2 = difference_of_products(x[0], y[1], y[0], x[1]);
+
+            if constexpr (sizeof(FloatType) == sizeof(float)) {
+                // fall back to double-precision test at triangle edges
+                const bool on_edge = (e0 == 0.0f) | (e1 == 0.0f) | (e2 == 0.0f);
+                const auto e0_double =
+                    (FloatType)((double)y[2] * (double)x[1] - (double)x[2] * (double)y[1]);
+                const auto e1_double =
+                    (FloatType)((double)y[0] * (double)x[2] - (double)x[0] * (double)y[2]);
+                const auto e2_double =
+                    (FloatType)((double)y[1] * (double)x[0] - (double)x[1] * (double)y[0]);
+
+                e0 = on_edge ? e0_double : e0;
+                e1 = on_edge ? e1_double : e1;
+                e2 = on_edge ? e2_double : e2;
+            }
+
+            // triangle edge and determinant tests
+            const bool inside =
+                !(((e0 < 0) | (e1 < 0) | (e2 < 0)) & ((e0 > 0) | (e1 > 0) | (e2 > 0)));
+
+            const FloatType det = e0 + e1 + e2;
+
+            // scaled hit distance against ray t range
+            for (uint vertex = 0; vertex < 3; ++vertex) {
+                z[vertex] *= Sz;
+            }
+
+            const FloatType t_scaled = e0 * z[0] + e1 * z[1] + e2 * z[2];
+            const bool in_range = ((det < 0) & (t_scaled < 0) & (t_scaled >= t_max * det)) |
+                                  ((det > 0) & (t_scaled > 0) & (t_scaled <= t_max * det));
+
+            // not finite for a zero determinant, which is never selected
+            const FloatType inv_det = 1 / det;
+            const FloatType t = t_scaled * inv_det;
+
+            // ensure that t is conservatively greater than zero
+            const FloatType max_zt = max_abs(z[0], z[1], z[2]);
+            const FloatType max_xt = max_abs(x[0], x[1], x[2]);
+            const FloatType max_yt = max_abs(y[0], y[1], y[2]);
+
+            const FloatType delta_z = gamma(3) * max_zt;
+            const FloatType delta_x = gamma(5) * (max_xt + max_zt);
+            const FloatType delta_y = gamma(5) * (max_yt + max_zt);
+            const FloatType delta_e =
+                2 * (gamma(2) * max_xt * max_yt + delta_y * max_xt + delta_x * max_yt);
+
+            const FloatType max_e = max_abs(e0, e1, e2);
+            const FloatType delta_t =
+                3 * (gamma(3) * max_e * max_zt + delta_e * max_zt + delta_z * max_e) *
+                std::abs(inv_det);
+
+            const bool hit = inside & in_range & (t > delta_t);
+
+            lane_t[lane] = hit ? t : Infinity;
+            lane_b[0][lane] = e0 * inv_det;
+            lane_b[1][lane] = e1 * inv_det;
+            lane_b[2][lane] = e2 * inv_det;
+            hit_mask |= uint(hit) << lane;
+        }
+
+        for (uint lane = 0; lane < WIDTH; ++lane) {
+            t_hit[lane] = lane_t[lane];
+            b[0][lane] = lane_b[0][lane];
+            b[1][lane] = lane_b[1][lane];
+            b[2][lane] = lane_b[2][lane];
+        }
+
+        return hit_mask;
+    }
+
     PBRT_CPU_GPU
     void init(int idx, const TriangleMesh *_mesh) {
         triangle_idx = idx;
         mesh = _mesh;
     }
 
+    PBRT_CPU_GPU
+    void get_points(Point3f p[3]) const {
+        const int *v = &(mesh->vertex_indices[3 * triangle_idx]);
+        for (uint idx = 0; idx < 3; ++idx) {
+            p[idx] = mesh->get_point(v[idx]);
+        }
+    }
+
     PBRT_CPU_GPU
     Bounds3f bounds() const {
         Point3f points[3];
@@ -40,6 +167,54 @@ class Triangle {
         return Bounds3f(points, 3);
     }
 
+    PBRT_CPU_GPU
+    Bounds3f clip_bounds(const Bounds3f &clip_box) const {
+        // clip the triangle against the 6 planes of clip_box (Sutherland-Hodgman)
+        constexpr uint MAX_VERTICES = 9;
+        Point3f polygon[MAX_VERTICES];
+        get_points(polygon);
+        uint num_vertices = 3;
+
+        for (uint plane = 0; plane < 6 && num_vertices > 0; ++plane) {
+            const uint8_t axis = plane / 2;
+            const bool keep_above = plane % 2 == 0;
+            const FloatType plane_val = keep_above ? clip_box.p_min[axis] : clip_box.p_max[axis];
+
+            const auto inside = [&](const Point3f &p) {
+                return keep_above ? p[axis] >= plane_val : p[axis] <= plane_val;
+            };
+
+            Point3f clipped[MAX_VERTICES];
+            uint num_clipped = 0;
+            for (uint idx = 0; idx < num_vertices; ++idx) {
+                const auto &current = polygon[idx];
+                const auto &next = polygon[(idx + 1) % num_vertices];
+
+                if (inside(current)) {
+                    clipped[num_clipped++] = current;
+                }
+
+                if (inside(current) != inside(next)) {
+                    const FloatType t = (plane_val - current[axis]) / (next[axis] - current[axis]);
+                    auto p = current + (next - current) * t;
+                    p[axis] = plane_val;
+                    clipped[num_clipped++] = p;
+                }
+            }
+
+            num_vertices = num_clipped;
+            for (uint idx = 0; idx < num_vertices; ++idx) {
+                polygon[idx] = clipped[idx];
+            }
+        }
+
+        if (num_vertices == 0) {
+            return Bounds3f::empty();
+        }
+
+        return Bounds3f(polygon, num_vertices).intersection(clip_box);
+    }
+
     PBRT_CPU_GPU
     FloatType area() const {
         Point3f p[3];
@@ -49,16 +224,26 @@ class Triangle {
     }
 
     PBRT_CPU_GPU
-    bool fast_intersect(const Ray &ray, FloatType t_max) const {
+    bool fast_intersect(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                        FloatType t_max) const {
         Point3f points[3];
         get_points(points);
 
-        return intersect_triangle(ray, t_max, points[0], points[1], points[2]).has_value();
+        return intersect_triangle(ray, ray_precomputation, t_max, points[0], points[1], points[2])
+            .has_value();
     }
 
     PBRT_CPU_GPU
     pbrt::optional<ShapeIntersection> intersect(const Ray &ray, FloatType t_max) const;
 
+    PBRT_CPU_GPU
+    pbrt::optional<ShapeHit> intersect_hit(const Ray &ray,
+                                           const RayPrecomputation &ray_precomputation,
+                                           FloatType t_max) const;
+
+    PBRT_CPU_GPU
+    SurfaceInteraction compute_surface_interaction(const ShapeHit &hit, const Ray &ray) const;
+
     PBRT_CPU_GPU
     FloatType pdf(const ShapeSampleContext &ctx, const Vector3f &wi) const;
 
@@ -75,11 +260,14 @@ class Triangle {
     static constexpr FloatType MaxSphericalSampleArea = 6.22;
 
     PBRT_CPU_GPU
-    void get_points(Point3f p[3]) const {
-        const int *v = &(mesh->vertex_indices[3 * triangle_idx]);
-        for (uint idx = 0; idx < 3; ++idx) {
-            p[idx] = mesh->p[v[idx]];
-        }
+    static FloatType max_abs(FloatType a, FloatType b, FloatType c) {
+        // selects values: std::max() returns a reference, which leaves a branch in the lane loop
+        a = std::abs(a);
+        b = std::abs(b);
+        c = std::abs(c);
+
+        const FloatType max_ab = a < b ? b : a;
+        return max_ab < c ? c : max_ab;
     }
 
     PBRT_CPU_GPU
@@ -94,7 +282,8 @@ class Triangle {
 
     PBRT_CPU_GPU
     pbrt::optional<Triangle::TriangleIntersection>
-    intersect_triangle(const Ray &ray, FloatType t_max, const Point3f &p0, const Point3f &p1,
+    intersect_triangle(const Ray &ray, const RayPrecomputation &ray_precomputation,
+                       FloatType t_max, const Point3f &p0, const Point3f &p1,
                        const Point3f &p2) const;
 
     PBRT_CPU_GPU
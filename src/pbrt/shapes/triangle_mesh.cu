@@ -36,11 +36,89 @@ static __global__ void init_shapes(Shape *shapes, const TypeOfShape *concrete_sh
     shapes[worker_idx].init(&concrete_shapes[worker_idx]);
 }
 
-std::pair<const Shape *, uint>
-TriangleMesh::build_triangles(const Transform &render_from_object, bool reverse_orientation,
-                              const std::vector<Point3f> &points, const std::vector<int> &indices,
-                              const std::vector<Normal3f> &normals, const std::vector<Point2f> &uv,
-                              GPUMemoryAllocator &allocator) {
+static void compress_mesh(TriangleMesh *mesh, const Transform &render_from_object,
+                          bool reverse_orientation, const std::vector<Point3f> &points,
+                          const std::vector<Normal3f> &normals, const std::vector<Point2f> &uv,
+                          const TriangleMesh *same_topology, MeshStats *stats,
+                          GPUMemoryAllocator &allocator) {
+    constexpr uint16_t MAX_QUANTIZED = std::numeric_limits<uint16_t>::max();
+
+    std::vector<Point3f> render_points(points.size());
+    auto bounds = Bounds3f::empty();
+    for (size_t idx = 0; idx < points.size(); ++idx) {
+        render_points[idx] = render_from_object(points[idx]);
+        bounds += render_points[idx];
+    }
+
+    mesh->quantized_origin = bounds.p_min;
+    mesh->quantized_scale = (bounds.p_max - bounds.p_min) / MAX_QUANTIZED;
+
+    std::vector<uint16_t> quantized_points(points.size() * 3);
+    for (size_t idx = 0; idx < points.size(); ++idx) {
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            const FloatType scale = mesh->quantized_scale[axis];
+            const FloatType offset = render_points[idx][axis] - mesh->quantized_origin[axis];
+
+            quantized_points[idx * 3 + axis] =
+                scale > 0 ? clamp<FloatType>(std::round(offset / scale), 0, MAX_QUANTIZED) : 0;
+        }
+    }
+    mesh->quantized_p = allocator.copy_to_device(quantized_points);
+
+    if (!normals.empty()) {
+        std::vector<OctahedralVector> octahedral_normals(normals.size());
+        for (size_t idx = 0; idx < normals.size(); ++idx) {
+            const auto n = render_from_object(normals[idx]);
+            octahedral_normals[idx] = OctahedralVector(reverse_orientation ? -n : n);
+        }
+        mesh->octahedral_n = allocator.copy_to_device(octahedral_normals);
+    }
+
+    if (same_topology != nullptr && same_topology->half_uv != nullptr) {
+        mesh->half_uv = same_topology->half_uv;
+    } else if (!uv.empty()) {
+        std::vector<Half> half_uv(uv.size() * 2);
+        for (size_t idx = 0; idx < uv.size(); ++idx) {
+            half_uv[idx * 2] = Half(float(uv[idx].x));
+            half_uv[idx * 2 + 1] = Half(float(uv[idx].y));
+        }
+        mesh->half_uv = allocator.copy_to_device(half_uv);
+    }
+
+    if (stats == nullptr) {
+        return;
+    }
+
+    stats->compressed_meshes += 1;
+    stats->compressed_vertices += points.size();
+    stats->full_vertex_bytes += sizeof(Point3f) * points.size() +
+                                sizeof(Normal3f) * normals.size() + sizeof(Point2f) * uv.size();
+    stats->compressed_vertex_bytes += sizeof(uint16_t) * quantized_points.size() +
+                                      sizeof(OctahedralVector) * normals.size() +
+                                      sizeof(Half) * 2 * uv.size();
+}
+
+const TriangleMesh *TriangleMesh::build_mesh(const Transform &render_from_object,
+                                             bool reverse_orientation,
+                                             const std::vector<Point3f> &points,
+                                             const std::vector<int> &indices,
+                                             const std::vector<Normal3f> &normals,
+                                             const std::vector<Point2f> &uv, bool compressed,
+                                             const TriangleMesh *same_topology,
+                                             MeshStats *stats, GPUMemoryAllocator &allocator) {
+    // indices and uv don't depend on the transform
+    const int *gpu_indices = same_topology != nullptr ? same_topology->vertex_indices
+                                                      : allocator.copy_to_device(indices);
+
+    if (compressed) {
+        auto mesh = allocator.allocate<TriangleMesh>();
+        mesh->init(reverse_orientation, gpu_indices, indices.size(), nullptr, nullptr, nullptr);
+        compress_mesh(mesh, render_from_object, reverse_orientation, points, normals, uv,
+                      same_topology, stats, allocator);
+
+        return mesh;
+    }
+
     auto gpu_points = allocator.allocate<Point3f>(points.size());
     CHECK_CUDA_ERROR(cudaMemcpy(gpu_points, points.data(), sizeof(Point3f) * points.size(),
                                 cudaMemcpyHostToDevice));
@@ -56,10 +134,6 @@ TriangleMesh::build_triangles(const Transform &render_from_object, bool reverse_
         CHECK_CUDA_ERROR(cudaDeviceSynchronize());
     }
 
-    auto gpu_indices = allocator.allocate<int>(indices.size());
-    CHECK_CUDA_ERROR(cudaMemcpy(gpu_indices, indices.data(), sizeof(int) * indices.size(),
-                                cudaMemcpyHostToDevice));
-
     Normal3f *gpu_normals = nullptr;
     if (!normals.empty()) {
         gpu_normals = allocator.allocate<Normal3f>(normals.size());
@@ -75,16 +149,23 @@ TriangleMesh::build_triangles(const Transform &render_from_object, bool reverse_
         }
     }
 
-    Point2f *gpu_uv = nullptr;
-    if (!uv.empty()) {
-        gpu_uv = allocator.allocate<Point2f>(uv.size());
-        CHECK_CUDA_ERROR(
-            cudaMemcpy(gpu_uv, uv.data(), sizeof(Point2f) * uv.size(), cudaMemcpyHostToDevice));
+    const Point2f *gpu_uv = nullptr;
+    if (same_topology != nullptr && same_topology->uv != nullptr) {
+        gpu_uv = same_topology->uv;
+    } else if (!uv.empty()) {
+        gpu_uv = allocator.copy_to_device(uv);
     }
 
     auto mesh = allocator.allocate<TriangleMesh>();
     mesh->init(reverse_orientation, gpu_indices, indices.size(), gpu_points, gpu_normals, gpu_uv);
 
+    return mesh;
+}
+
+std::pair<const Shape *, uint> TriangleMesh::build_triangles(const TriangleMesh *mesh,
+                                                             GPUMemoryAllocator &allocator) {
+    constexpr uint threads = 1024;
+
     uint num_triangles = mesh->triangles_num;
 
     auto triangles = allocator.allocate<Triangle>(num_triangles);
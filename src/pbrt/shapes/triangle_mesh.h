@@ -1,10 +1,13 @@
 #pragma once
 
+#include <pbrt/euclidean_space/octahedral_vector.h>
 #include <pbrt/euclidean_space/transform.h>
+#include <pbrt/util/float.h>
 #include <vector>
 
 class GPUMemoryAllocator;
 class Shape;
+struct MeshStats;
 
 class TriangleMesh {
   public:
@@ -17,14 +20,34 @@ class TriangleMesh {
     const Point2f *uv = nullptr;
     const int *faceIndices = nullptr;
 
+    // compressed storage (replacing p, n and uv when set):
+    // positions quantized to 16 bits per axis within the mesh bounds
+    const uint16_t *quantized_p;
+    // 3 per vertex, decoded as quantized_origin + q * quantized_scale
+    Point3f quantized_origin;
+    Vector3f quantized_scale;
+    const OctahedralVector *octahedral_n;
+    const Half *half_uv;
+    // 2 per vertex
+
     bool reverse_orientation;
     bool transformSwapsHandedness;
 
-    static std::pair<const Shape *, uint>
-    build_triangles(const Transform &render_from_object, bool reverse_orientation,
-                    const std::vector<Point3f> &points, const std::vector<int> &indices,
-                    const std::vector<Normal3f> &normals, const std::vector<Point2f> &uv,
-                    GPUMemoryAllocator &allocator);
+    static const TriangleMesh *build_mesh(const Transform &render_from_object,
+                                          bool reverse_orientation,
+                                          const std::vector<Point3f> &points,
+                                          const std::vector<int> &indices,
+                                          const std::vector<Normal3f> &normals,
+                                          const std::vector<Point2f> &uv, bool compressed,
+                                          const TriangleMesh *same_topology, MeshStats *stats,
+                                          GPUMemoryAllocator &allocator);
+    // same_topology: a mesh built from the same indices and uv (under another transform),
+    // whose device buffers are shared instead of uploaded again (nullptr: upload them)
+    // stats: what compression saved is added to it (nullptr: not counted)
+
+    static std::pair<const Shape *, uint> build_triangles(const TriangleMesh *mesh,
+                                                          GPUMemoryAllocator &allocator);
+    // one Triangle and Shape per triangle: only needed by what samples them (area lights)
 
     PBRT_CPU_GPU
     void init(bool _reverse_orientation, const int *_vertex_indices, uint num_indices,
@@ -40,6 +63,46 @@ class TriangleMesh {
         n = _n;
         s = nullptr;
 
+        quantized_p = nullptr;
+        octahedral_n = nullptr;
+        half_uv = nullptr;
+
         transformSwapsHandedness = false;
     }
+
+    PBRT_CPU_GPU
+    Point3f get_point(const int vertex_idx) const {
+        if (quantized_p == nullptr) {
+            return p[vertex_idx];
+        }
+
+        const uint16_t *q = &quantized_p[3 * vertex_idx];
+        return Point3f(quantized_origin.x + FloatType(q[0]) * quantized_scale.x,
+                       quantized_origin.y + FloatType(q[1]) * quantized_scale.y,
+                       quantized_origin.z + FloatType(q[2]) * quantized_scale.z);
+    }
+
+    PBRT_CPU_GPU
+    bool has_normals() const {
+        return n != nullptr || octahedral_n != nullptr;
+    }
+
+    PBRT_CPU_GPU
+    Normal3f get_normal(const int vertex_idx) const {
+        return octahedral_n == nullptr ? n[vertex_idx] : octahedral_n[vertex_idx].to_normal();
+    }
+
+    PBRT_CPU_GPU
+    bool has_uv() const {
+        return uv != nullptr || half_uv != nullptr;
+    }
+
+    PBRT_CPU_GPU
+    Point2f get_uv(const int vertex_idx) const {
+        if (half_uv == nullptr) {
+            return uv[vertex_idx];
+        }
+
+        return Point2f(float(half_uv[2 * vertex_idx]), float(half_uv[2 * vertex_idx + 1]));
+    }
 };
@@ -64,26 +64,27 @@ Point2i remap_pixel_coord(const Point2i p, const Point2i resolution, WrapMode2D
     return coord;
 }
 
-const GPUImage *GPUImage::create_from_file(const std::string &filename,
-                                           GPUMemoryAllocator &allocator) {
-    auto image = allocator.allocate<GPUImage>();
-
+GPUImage::HostPixels GPUImage::read_file(const std::string &filename) {
     auto path = std::filesystem::path(filename);
     if (path.extension() == ".png") {
-        image->init_png(filename, allocator);
-        return image;
+        return read_png(filename);
     }
 
     if (path.extension() == ".exr") {
-        image->init_exr(filename, allocator);
-        return image;
+        return read_exr(filename);
     }
 
     REPORT_FATAL_ERROR();
-    return nullptr;
+    return {};
 }
 
-void GPUImage::init_png(const std::string &filename, GPUMemoryAllocator &allocator) {
+void GPUImage::init(const HostPixels &host_pixels, GPUMemoryAllocator &allocator) {
+    resolution = host_pixels.resolution;
+    pixels = allocator.copy_to_device(host_pixels.pixels);
+    pixel_format = PixelFormat::U256;
+}
+
+GPUImage::HostPixels GPUImage::read_png(const std::string &filename) {
     std::vector<unsigned char> rgba_pixels;
     uint width;
     uint height;
@@ -96,9 +97,10 @@ void GPUImage::init_png(const std::string &filename, GPUMemoryAllocator &allocat
     // the pixels are now in the vector "image", 4 bytes per pixel, ordered RGBARGBA..., use it as
     // texture,
 
-    resolution = Point2i(width, height);
-
-    auto gpu_pixels = allocator.allocate<RGB>(width * height);
+    HostPixels host_pixels{
+        .resolution = Point2i(width, height),
+        .pixels = std::vector<RGB>(width * height),
+    };
 
     SRGBColorEncoding encoding;
     for (uint x = 0; x < width; ++x) {
@@ -111,16 +113,15 @@ void GPUImage::init_png(const std::string &filename, GPUMemoryAllocator &allocat
             auto blue  = rgba_pixels[index * 4 + 2];
             // clang-format on
 
-            gpu_pixels[index] =
+            host_pixels.pixels[index] =
                 RGB(encoding.to_linear(red), encoding.to_linear(green), encoding.to_linear(blue));
         }
     }
 
-    pixels = gpu_pixels;
-    pixel_format = PixelFormat::U256;
+    return host_pixels;
 }
 
-void GPUImage::init_exr(const std::string &filename, GPUMemoryAllocator &allocator) {
+GPUImage::HostPixels GPUImage::read_exr(const std::string &filename) {
     float *out; // width * height * RGBA
     int width;
     int height;
@@ -132,9 +133,11 @@ void GPUImage::init_exr(const std::string &filename, GPUMemoryAllocator &allocat
         }
         exit(1);
     }
-    resolution = Point2i(width, height);
 
-    auto gpu_pixels = allocator.allocate<RGB>(width * height);
+    HostPixels host_pixels{
+        .resolution = Point2i(width, height),
+        .pixels = std::vector<RGB>(width * height),
+    };
 
     for (uint idx = 0; idx < width * height; ++idx) {
         auto r = out[idx * 4 + 0];
@@ -142,11 +145,11 @@ void GPUImage::init_exr(const std::string &filename, GPUMemoryAllocator &allocat
         auto b = out[idx * 4 + 2];
         // auto alpha = out[idx * 4 + 3];
 
-        gpu_pixels[idx] = RGB(r, g, b);
+        host_pixels.pixels[idx] = RGB(r, g, b);
     }
+    free(out);
 
-    pixels = gpu_pixels;
-    pixel_format = PixelFormat::U256;
+    return host_pixels;
 }
 
 PBRT_CPU_GPU
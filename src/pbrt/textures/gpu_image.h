@@ -3,6 +3,7 @@
 #include <pbrt/euclidean_space/point2.h>
 #include <pbrt/gpu/macro.h>
 #include <string>
+#include <vector>
 
 class GPUMemoryAllocator;
 class RGB;
@@ -74,8 +75,15 @@ inline bool Is32Bit(PixelFormat format) {
 
 class GPUImage {
   public:
-    static const GPUImage *create_from_file(const std::string &filename,
-                                            GPUMemoryAllocator &allocator);
+    struct HostPixels {
+        Point2i resolution;
+        std::vector<RGB> pixels;
+    };
+
+    static HostPixels read_file(const std::string &filename);
+    // decodes into host memory only: several files can be read at once on different threads
+
+    void init(const HostPixels &host_pixels, GPUMemoryAllocator &allocator);
 
     PBRT_CPU_GPU
     Point2i get_resolution() const {
@@ -93,7 +101,7 @@ class GPUImage {
 
     const RGB *pixels;
 
-    void init_png(const std::string &filename, GPUMemoryAllocator &allocator);
+    static HostPixels read_png(const std::string &filename);
 
-    void init_exr(const std::string &filename, GPUMemoryAllocator &allocator);
+    static HostPixels read_exr(const std::string &filename);
 };
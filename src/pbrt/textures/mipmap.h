@@ -1,6 +1,7 @@
 #pragma once
 
 #include <pbrt/gpu/gpu_memory_allocator.h>
+#include <pbrt/scene/loader_cache.h>
 #include <pbrt/scene/parameter_dictionary.h>
 #include <pbrt/spectrum_util/rgb.h>
 #include <pbrt/textures/gpu_image.h>
@@ -77,6 +78,6 @@ class MIPMap {
         wrap_mode = parse_wrap_mode(wrap_string);
 
         auto image_path = parameters.root + "/" + parameters.get_one_string("filename");
-        image = GPUImage::create_from_file(image_path, allocator);
+        image = parameters.loader_cache->read_image(image_path, allocator);
     }
 };
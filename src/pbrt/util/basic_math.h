@@ -129,6 +129,36 @@ PBRT_CPU_GPU auto difference_of_products(Ta a, Tb b, Tc c, Td d) {
     return diff + error;
 }
 
+PBRT_CPU_GPU
+inline bool solve_quadratic(FloatType a, FloatType b, FloatType c, FloatType *t0, FloatType *t1) {
+    // real roots of a t^2 + b t + c = 0 with *t0 <= *t1, false if there are none
+    if (a == 0) {
+        if (b == 0) {
+            return false;
+        }
+
+        *t0 = *t1 = -c / b;
+        return true;
+    }
+
+    const FloatType discrim = difference_of_products(b, b, 4 * a, c);
+    if (discrim < 0) {
+        return false;
+    }
+
+    // avoids the cancellation of -b + sqrt(discrim)
+    const FloatType q = -0.5 * (b + std::copysign(std::sqrt(discrim), b));
+    *t0 = q / a;
+    *t1 = c / q;
+    if (*t0 > *t1) {
+        const FloatType t = *t0;
+        *t0 = *t1;
+        *t1 = t;
+    }
+
+    return true;
+}
+
 template <typename Ta, typename Tb, typename Tc, typename Td>
 PBRT_CPU_GPU auto sum_of_products(Ta a, Tb b, Tc c, Td d) {
     auto cd = c * d;
@@ -164,6 +194,32 @@ PBRT_CPU_GPU constexpr T encode_morton3(T x, T y, T z) {
     return (left_shift3(z) << 2) | (left_shift3(y) << 1) | left_shift3(x);
 }
 
+template <typename T, std::enable_if_t<std::is_same_v<T, uint64_t>, bool> = true>
+PBRT_CPU_GPU constexpr T left_shift3(T x) {
+    if (x == (1 << 21)) {
+        --x;
+    }
+
+    // the same bit spreading for 21 bits: 63-bit morton codes
+
+    // clang-format off
+
+    x = (x | (x << 32)) & 0x001f00000000ffff;
+    x = (x | (x << 16)) & 0x001f0000ff0000ff;
+    x = (x | (x <<  8)) & 0x100f00f00f00f00f;
+    x = (x | (x <<  4)) & 0x10c30c30c30c30c3;
+    x = (x | (x <<  2)) & 0x1249249249249249;
+
+    // clang-format on
+
+    return x;
+}
+
+template <typename T, std::enable_if_t<std::is_same_v<T, uint64_t>, bool> = true>
+PBRT_CPU_GPU constexpr T encode_morton3(T x, T y, T z) {
+    return (left_shift3(z) << 2) | (left_shift3(y) << 1) | left_shift3(x);
+}
+
 PBRT_CPU_GPU
 inline FloatType smooth_step(FloatType x, FloatType a, FloatType b) {
     if (a == b) {
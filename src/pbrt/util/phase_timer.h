@@ -0,0 +1,41 @@
+#pragma once
+
+#include <pbrt/gpu/macro.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+class PhaseTimer {
+  public:
+    PhaseTimer() : last_checkpoint(std::chrono::system_clock::now()) {}
+
+    void record(const std::string &phase) {
+        const auto now = std::chrono::system_clock::now();
+        const std::chrono::duration<FloatType> duration{now - last_checkpoint};
+
+        phases.emplace_back(phase, duration.count());
+        last_checkpoint = now;
+    }
+
+    FloatType total() const {
+        FloatType seconds = 0;
+        for (const auto &phase : phases) {
+            seconds += phase.second;
+        }
+
+        return seconds;
+    }
+
+    void report(const std::string &title) const {
+        printf("%s took %.2f seconds (", title.c_str(), total());
+        for (uint idx = 0; idx < phases.size(); ++idx) {
+            printf("%s%s: %.2f", idx > 0 ? ", " : "", phases[idx].first.c_str(),
+                   phases[idx].second);
+        }
+        printf(")\n");
+    }
+
+  private:
+    std::chrono::system_clock::time_point last_checkpoint;
+    std::vector<std::pair<std::string, FloatType>> phases;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <condition_variable>
 #include <functional>
 #include <mutex>
@@ -30,14 +31,7 @@ class ThreadPool {
                     }
 
                     cv.notify_all();
-                    next_job();
-
-                    {
-                        std::unique_lock<std::mutex> lock(mtx);
-                        num_active_jobs -= 1;
-                    }
-
-                    cv.notify_all();
+                    run_job(next_job);
                 }
             });
         }
@@ -58,22 +52,57 @@ class ThreadPool {
 
     void parallel_execute(const int start, const int end,
                           const std::function<void(int)> &function_ptr) {
+        uint num_remaining_jobs = 0;
         {
             std::unique_lock<std::mutex> lock(mtx);
             for (int i = start; i < end; ++i) {
-                job_queue.emplace(std::move([i, &function_ptr] { function_ptr(i); }));
+                job_queue.emplace([this, i, &function_ptr, &num_remaining_jobs] {
+                    function_ptr(i);
+                    finish_call_job(num_remaining_jobs);
+                });
 
                 num_active_jobs += 1;
+                num_remaining_jobs += 1;
             }
         }
         cv.notify_all();
 
-        while (true) {
+        wait_for(num_remaining_jobs);
+    }
+
+    void parallel_for(const uint start, const uint end,
+                      const std::function<void(uint, uint)> &function_ptr) {
+        // split [start, end) into contiguous chunks: one job per chunk instead of per index
+        if (end <= start) {
+            return;
+        }
+
+        const uint length = end - start;
+        const uint num_chunks = std::min<uint>(length, threads.size() * 4);
+        const uint chunk_size = (length + num_chunks - 1) / num_chunks;
+
+        uint num_remaining_jobs = 0;
+        {
             std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, [this] { return num_active_jobs == 0; });
+            for (uint chunk_start = start; chunk_start < end; chunk_start += chunk_size) {
+                const uint chunk_end = std::min(chunk_start + chunk_size, end);
+                job_queue.emplace([this, chunk_start, chunk_end, &function_ptr,
+                                   &num_remaining_jobs] {
+                    function_ptr(chunk_start, chunk_end);
+                    finish_call_job(num_remaining_jobs);
+                });
 
-            break;
+                num_active_jobs += 1;
+                num_remaining_jobs += 1;
+            }
         }
+        cv.notify_all();
+
+        wait_for(num_remaining_jobs);
+    }
+
+    uint num_threads() const {
+        return threads.size();
     }
 
     void submit(const std::function<void()> &function_ptr) {
@@ -84,6 +113,7 @@ class ThreadPool {
     }
 
     void sync() {
+        // waits for every job of the pool (including submit()): not to be called from a job
         while (true) {
             std::unique_lock lock(mtx);
             cv.wait(lock, [this] { return num_active_jobs == 0; });
@@ -92,6 +122,45 @@ class ThreadPool {
     }
 
   private:
+    void run_job(const std::function<void()> &job) {
+        job();
+
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            num_active_jobs -= 1;
+        }
+
+        cv.notify_all();
+    }
+
+    void finish_call_job(uint &num_remaining_jobs) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            num_remaining_jobs -= 1;
+        }
+
+        cv.notify_all();
+    }
+
+    void wait_for(const uint &num_remaining_jobs) {
+        // waits for the jobs of one call only, running queued jobs meanwhile:
+        // a job of this pool can call parallel_execute()/parallel_for() without deadlocking
+        std::unique_lock<std::mutex> lock(mtx);
+        while (num_remaining_jobs > 0) {
+            if (job_queue.empty()) {
+                cv.wait(lock);
+                continue;
+            }
+
+            auto next_job = std::move(job_queue.front());
+            job_queue.pop();
+
+            lock.unlock();
+            run_job(next_job);
+            lock.lock();
+        }
+    }
+
     std::vector<std::thread> threads;
     std::queue<std::function<void()>> job_queue;
     uint num_active_jobs;